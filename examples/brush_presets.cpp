@@ -3,6 +3,7 @@
 
 #include "../include/BrushEngine.h"
 #include "../include/BrushMapping.h"
+#include "../include/BrushPresets.h"
 
 namespace Acute {
 namespace BrushPresets {
@@ -261,6 +262,70 @@ BrushSettings createWatercolor() {
     return settings;
 }
 
+// Smudge: drags the canvas color along the stroke, no paint of its own
+BrushSettings createSmudge() {
+    BrushSettings settings;
+    settings.baseSize = 40.0f;
+    settings.baseOpacity = 1.0f;
+    settings.baseHardness = 0.4f;
+    settings.baseFlow = 0.8f;
+    settings.baseSpacing = 0.1f;
+    settings.smudge = 1.0f;
+    settings.smudgeLength = 0.9f;
+    
+    // Pressure to strength
+    InputMapping pressureFlow;
+    pressureFlow.source = InputSource::Pressure;
+    pressureFlow.target = BrushProperty::Flow;
+    pressureFlow.minOutput = 0.2f;
+    pressureFlow.maxOutput = 1.0f;
+    pressureFlow.strength = 1.0f;
+    pressureFlow.curve = CurveType::Linear;
+    settings.mappings.push_back(pressureFlow);
+    
+    return settings;
+}
+
+// Blender: softens edges by mixing neighbouring colors over a short reach
+BrushSettings createBlender() {
+    BrushSettings settings;
+    settings.baseSize = 30.0f;
+    settings.baseOpacity = 0.6f;
+    settings.baseHardness = 0.2f;
+    settings.baseFlow = 0.5f;
+    settings.baseSpacing = 0.1f;
+    settings.smudge = 1.0f;
+    settings.smudgeLength = 0.5f;
+    return settings;
+}
+
+// Wet mix: the brush color mixes with the wet paint it passes over
+BrushSettings createWetMix() {
+    BrushSettings settings;
+    settings.baseSize = 35.0f;
+    settings.baseOpacity = 0.9f;
+    settings.baseHardness = 0.5f;
+    settings.baseFlow = 0.7f;
+    settings.baseSpacing = 0.1f;
+    settings.smudge = 0.6f;
+    settings.smudgeLength = 0.7f;
+    settings.colorR = 0.8f;
+    settings.colorG = 0.3f;
+    settings.colorB = 0.2f;
+    
+    // Pressure to size
+    InputMapping pressureSize;
+    pressureSize.source = InputSource::Pressure;
+    pressureSize.target = BrushProperty::Size;
+    pressureSize.minOutput = 0.5f;
+    pressureSize.maxOutput = 1.2f;
+    pressureSize.strength = 1.0f;
+    pressureSize.curve = CurveType::Linear;
+    settings.mappings.push_back(pressureSize);
+    
+    return settings;
+}
+
 } // namespace BrushPresets
 } // namespace Acute
 
@@ -0,0 +1,257 @@
+// Sample consumer of Acute's live canvas export (AcuteDrawing --export-frames NAME).
+// Follows the shared memory ring as a capture tool would: for every new frame
+// it copies only the regions that changed into its own copy of the canvas,
+// and reports them. A recorder could encode straight from the slot instead.
+//
+// Usage: acute-frame-consumer [--name NAME] [--frames N] [--png PATH]
+
+#include "FrameExport.h"
+#include "ImageWriter.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef PLATFORM_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace Acute;
+
+namespace {
+
+volatile std::sig_atomic_t g_stop = 0;
+
+void onSignal(int) {
+    g_stop = 1;
+}
+
+// Read-only view of the producer's segment
+struct Segment {
+    const uint8_t* base = nullptr;
+    size_t size = 0;
+#ifdef PLATFORM_WINDOWS
+    HANDLE mapping = nullptr;
+#endif
+
+    const FrameExportHeader* header() const { return reinterpret_cast<const FrameExportHeader*>(base); }
+    
+    const uint8_t* slotPixels(uint64_t sequence) const {
+        const FrameExportHeader* h = header();
+        return base + h->pixelOffset + h->slotBytes * (sequence % h->slotCount);
+    }
+    
+    // False until the producer has created and filled in the segment
+    bool open(const std::string& name) {
+#ifdef PLATFORM_WINDOWS
+        mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+        if (!mapping) {
+            return false;
+        }
+        base = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (!base) {
+            close();
+            return false;
+        }
+        MEMORY_BASIC_INFORMATION info;
+        VirtualQuery(base, &info, sizeof(info));
+        size = info.RegionSize;
+#else
+        std::string path = name.empty() || name[0] != '/' ? "/" + name : name;
+        int fd = shm_open(path.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(FrameExportHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void* address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED) {
+            return false;
+        }
+        base = static_cast<const uint8_t*>(address);
+        size = static_cast<size_t>(info.st_size);
+#endif
+        const FrameExportHeader* h = header();
+        if (h->magic.load(std::memory_order_acquire) != kFrameExportMagic || h->version != kFrameExportVersion
+            || h->pixelOffset + h->slotBytes * h->slotCount > size) {
+            close();
+            return false;
+        }
+        return true;
+    }
+    
+    void close() {
+#ifdef PLATFORM_WINDOWS
+        if (base) {
+            UnmapViewOfFile(base);
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        mapping = nullptr;
+#else
+        if (base) {
+            munmap(const_cast<uint8_t*>(base), size);
+        }
+#endif
+        base = nullptr;
+        size = 0;
+    }
+};
+
+// Regions changed between frame `seen` and `latest`; false if some frame in
+// between has already left the ring
+bool collectRegions(const FrameExportHeader& header, uint64_t seen, uint64_t latest,
+                    std::vector<FrameExportRect>& regions) {
+    regions.clear();
+    if (seen == 0 || latest - seen > header.slotCount) {
+        return false;
+    }
+    for (uint64_t sequence = seen + 1; sequence <= latest; sequence++) {
+        const FrameExportSlot& slot = header.slots[sequence % header.slotCount];
+        if (slot.sequence.load(std::memory_order_acquire) != sequence) {
+            return false;
+        }
+        uint32_t count = std::min(slot.rectCount, static_cast<uint32_t>(kFrameExportMaxRects));
+        regions.insert(regions.end(), slot.rects, slot.rects + count);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Premultiplied to straight alpha, for the PNG
+void writeImage(const std::string& path, const std::vector<uint8_t>& canvas, int width, int height) {
+    std::vector<uint8_t> rgba(canvas.size());
+    for (size_t i = 0; i < canvas.size(); i += 4) {
+        uint8_t alpha = canvas[i + 3];
+        for (int c = 0; c < 3; c++) {
+            rgba[i + c] = alpha ? static_cast<uint8_t>(std::min(255, (canvas[i + c] * 255 + alpha / 2) / alpha)) : 0;
+        }
+        rgba[i + 3] = alpha;
+    }
+    if (writePng(path, rgba.data(), width, height)) {
+        std::cout << "Wrote " << path << std::endl;
+    } else {
+        std::cerr << "Failed to write " << path << std::endl;
+    }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string name = "acute-canvas";
+    std::string pngPath;
+    uint64_t frameLimit = 0;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--name") == 0 && i + 1 < argc) {
+            name = argv[++i];
+        } else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frameLimit = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--png") == 0 && i + 1 < argc) {
+            pngPath = argv[++i];
+        } else {
+            std::cout << "Usage: acute-frame-consumer [--name NAME] [--frames N] [--png PATH]" << std::endl;
+            return 1;
+        }
+    }
+    std::signal(SIGINT, onSignal);
+    
+    Segment segment;
+    std::vector<uint8_t> canvas;
+    std::vector<FrameExportRect> regions;
+    int width = 0, height = 0;
+    uint64_t seen = 0, framesRead = 0, bytesCopied = 0, fullCopies = 0;
+    bool waiting = false;
+    while (!g_stop && (frameLimit == 0 || framesRead < frameLimit)) {
+        if (!segment.base) {
+            if (!segment.open(name)) {
+                if (!waiting) {
+                    std::cout << "Waiting for " << name << "..." << std::endl;
+                    waiting = true;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            waiting = false;
+            width = segment.header()->width;
+            height = segment.header()->height;
+            canvas.assign(static_cast<size_t>(width) * height * 4, 0);
+            seen = 0;
+            std::cout << "Opened " << name << ": " << width << "x" << height << std::endl;
+        }
+        
+        const FrameExportHeader& header = *segment.header();
+        if (header.closed.load(std::memory_order_acquire)) {
+            // Closed for good, or reopened at a new canvas size
+            segment.close();
+            continue;
+        }
+        uint64_t latest = header.latest.load(std::memory_order_acquire);
+        if (latest == seen) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            continue;
+        }
+        
+        bool full = !collectRegions(header, seen, latest, regions);
+        if (full) {
+            regions.assign(1, FrameExportRect{ 0, 0, width, height });
+        }
+        
+        // Copy out of the newest slot, then make sure it was not rewritten
+        // meanwhile; if it was, the next pass starts over from the newer frame
+        const FrameExportSlot& slot = header.slots[latest % header.slotCount];
+        if (slot.sequence.load(std::memory_order_acquire) != latest) {
+            continue;
+        }
+        const uint8_t* pixels = segment.slotPixels(latest);
+        uint64_t bytes = 0;
+        for (const auto& region : regions) {
+            const size_t rowBytes = static_cast<size_t>(region.x1 - region.x0) * 4;
+            for (int y = region.y0; y < region.y1; y++) {
+                const size_t offset = static_cast<size_t>(y) * header.stride + static_cast<size_t>(region.x0) * 4;
+                std::memcpy(canvas.data() + static_cast<size_t>(y) * width * 4 + region.x0 * 4, pixels + offset,
+                            rowBytes);
+            }
+            bytes += rowBytes * (region.y1 - region.y0);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.sequence.load(std::memory_order_relaxed) != latest) {
+            seen = 0;
+            continue;
+        }
+        
+        std::cout << "Frame " << latest << ": " << (full ? "whole canvas" : std::to_string(regions.size()) + " regions")
+                  << ", " << (bytes >> 10) << " KiB" << (latest - seen > 1 && seen ? " (skipped frames)" : "")
+                  << std::endl;
+        seen = latest;
+        framesRead++;
+        bytesCopied += bytes;
+        fullCopies += full ? 1 : 0;
+    }
+    
+    std::cout << framesRead << " frames read, " << fullCopies << " whole, " << (bytesCopied >> 20) << " MiB copied"
+              << std::endl;
+    if (!pngPath.empty() && !canvas.empty()) {
+        writeImage(pngPath, canvas, width, height);
+    }
+    segment.close();
+    return 0;
+}
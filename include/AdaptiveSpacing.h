@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cmath>
+
+namespace Acute {
+
+// Adaptive dab spacing.
+//
+// Overlapping dabs leave a ripple in the coverage along a stroke, one period
+// per dab. Soft tips ripple little, and a faint dab (low opacity and flow)
+// turns even a large ripple into a small change in alpha. Such dabs can be
+// spaced k times wider if each one's alpha is raised to 1 - (1 - a)^k: the
+// accumulated coverage stays the same, with k times fewer dabs.
+//
+// The ripple of each round tip hardness at each spacing is tabulated once
+// from the tip profile. Spacing is widened while the alpha ripple stays
+// within what the brush already had at its own spacing, or within one 8-bit
+// step.
+
+// Factor (>= 1) to widen the spacing (a fraction of the size) of a round dab
+// with this hardness and alpha by. The compensated alpha stays <= maxAlpha.
+float adaptiveSpacingFactor(float hardness, float alpha, float maxAlpha, float spacing);
+
+// Alpha that keeps the accumulated coverage when spacing widens by factor
+inline float compensateAlpha(float alpha, float factor) {
+    return 1.0f - std::pow(1.0f - alpha, factor);
+}
+
+} // namespace Acute
@@ -1,7 +1,13 @@
 #pragma once
 
+#include "FloodFill.h"
+#include "InputTypes.h"
+#include "Timelapse.h"
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace Acute {
 
@@ -9,15 +15,39 @@ class Window;
 class Canvas;
 class InputManager;
 class BrushEngine;
+class StrokeHistory;
 class Renderer;
+class BrushPresetLibrary;
+class DabScheduler;
 
 class Application {
 public:
     Application();
     ~Application();
     
-    // Initialize the application
-    bool initialize(const std::string& title, int width, int height);
+    // Initialize the application. A canvas size of 0 makes the canvas follow
+    // the window size; otherwise the document keeps its size and the window
+    // shows a zoomable view of it. A video memory budget (bytes) streams the
+    // document's tiles in and out around the view; its size is then rounded
+    // up to whole tiles. Compute raster draws dabs with the tile-binned
+    // compute shader rasterizer where the driver has OpenGL 4.3.
+    bool initialize(const std::string& title, int width, int height,
+                    int canvasWidth = 0, int canvasHeight = 0, size_t residencyBudget = 0,
+                    bool computeRaster = false);
+    
+    // Tolerance and gap closing of the fill tool
+    void setFillOptions(const FillOptions& options) { m_fillOptions = options; }
+    
+    // Publish the canvas to the named shared memory ring for capture tools;
+    // false if it could not be created
+    bool setFrameExport(const std::string& name);
+    
+    // Record a time-lapse of the session to a file; false if it could not
+    // be created
+    bool startTimelapse(const std::string& path, const TimelapseOptions& options);
+    
+    // Play a time-lapse on the canvas at a number of snapshots per second
+    bool playTimelapse(const std::string& path, float rate);
     
     // Run the main loop
     void run();
@@ -31,9 +61,41 @@ private:
     std::unique_ptr<InputManager> m_inputManager;
     std::unique_ptr<BrushEngine> m_brushEngine;
     std::unique_ptr<Renderer> m_renderer;
+    std::unique_ptr<BrushPresetLibrary> m_presets;
+    
+    // Strokes wait here and are drawn within a share of each frame
+    std::unique_ptr<DabScheduler> m_dabScheduler;
+    static constexpr float kDabBudgetShare = 0.5f;
+    float m_frameInterval;    // Seconds per display refresh
+    
+    // Every finished stroke as input, brush and seed; cleared with the canvas
+    std::unique_ptr<StrokeHistory> m_history;
+    std::vector<InputPoint> m_strokePoints;
+    uint32_t m_nextStrokeSeed;
     
     bool m_running;
     bool m_strokeActive;  // Track if a stroke is currently active
+    bool m_strokeOnGpu;   // The active stroke's dabs are generated on the GPU
+    bool m_canvasFollowsWindow;
+    
+    // Middle mouse drag pans the view
+    bool m_panning;
+    int m_panLastX, m_panLastY;
+    
+    // Shift + left drag selects a rectangle, Alt + left drag a lasso
+    enum class SelectionDrag { None, Rectangle, Lasso };
+    SelectionDrag m_selectionDrag;
+    std::vector<float> m_selectionPoints;    // Canvas pixels, x,y pairs
+    
+    // G toggles the fill tool: a left click fills with the brush color
+    bool m_fillTool;
+    FillOptions m_fillOptions;
+    
+    // Time-lapse playback (null when not playing) and the fraction of a
+    // snapshot due
+    std::unique_ptr<TimelapseReader> m_playback;
+    float m_playbackRate;
+    float m_playbackDue;
     
     // Handle events
     void handleEvents();
@@ -46,6 +108,32 @@ private:
     
     // Setup default brush
     void setupDefaultBrush();
+    
+    // View navigation: zoom around a window point, fit the canvas in the window
+    void zoomView(float factor, float screenX, float screenY);
+    void resetView();
+    
+    // Report the recorded strokes under a window point
+    void pickStrokes(int x, int y);
+    
+    // Cycle the canvas symmetry mode
+    void cycleSymmetry();
+    
+    // Fill tool: toggle it, fill from a window point
+    void toggleFillTool();
+    void fillAt(int x, int y);
+    
+    // Show the next time-lapse snapshot; false at the end
+    bool stepPlayback();
+    
+    // Selection drags in window pixels
+    void beginSelection(SelectionDrag drag, int x, int y);
+    void extendSelection(int x, int y);
+    void finishSelection();
+    
+    // Load the preset library (if present) and switch to a preset by index
+    void loadPresetLibrary(const std::string& path);
+    void selectPreset(size_t index);
 };
 
 } // namespace Acute
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Acute {
+
+// Minimal dependency-free BC7 (BPTC) encoder for RGBA8 texels. Every block
+// uses mode 6: one subset, 7-bit endpoints with a shared bit each and 4-bit
+// indices over all four channels. That is the mode that suits smooth, soft
+// painted content best, and a principal axis fit with two least squares
+// refinements gets close to what exhaustive encoders reach for it. Flat
+// blocks take a fast path.
+
+constexpr size_t kBc7BlockBytes = 16;
+
+// Bytes for a width x height image (both multiples of 4)
+size_t bc7EncodedSize(int width, int height);
+
+// Encode one 4x4 block of RGBA8 texels (row by row, 64 bytes)
+void bc7EncodeBlock(const uint8_t* texels, uint8_t* block);
+
+// Encode a width x height RGBA8 image (both multiples of 4) into
+// bc7EncodedSize() bytes, blocks in row order as glCompressedTexImage expects
+void bc7EncodeImage(const uint8_t* pixels, int width, int height, uint8_t* dst);
+
+} // namespace Acute
@@ -2,6 +2,15 @@
 
 namespace Acute {
 
+// How a dab combines with the canvas (premultiplied alpha)
+enum class BlendMode {
+    Normal,     // Source over
+    Erase,      // Destination out: removes coverage
+    Multiply,
+    Screen,
+    Add
+};
+
 // Represents a single brush dab (stamp) to be rendered
 struct BrushDab {
     float x;              // Position X
@@ -12,6 +21,11 @@ struct BrushDab {
     float hardness;       // Edge hardness 0.0 to 1.0
     float flow;           // Flow/strength 0.0 to 1.0
     float scatter;        // Random scatter amount
+    float spacing;        // Distance to the next dab, as a fraction of size
+    int tip;              // Brush tip index (-1 = round tip from hardness)
+    BlendMode blend;      // Blend mode
+    float smudge;         // Share of the paint taken from the pickup (0 = brush color only)
+    float smudgeLength;   // Share of the pickup kept from the previous dab (0 = fresh from the canvas)
     
     // Color (RGB)
     float r, g, b;
@@ -19,9 +33,16 @@ struct BrushDab {
     BrushDab()
         : x(0.0f), y(0.0f), size(10.0f)
         , opacity(1.0f), rotation(0.0f)
-        , hardness(0.5f), flow(1.0f), scatter(0.0f)
+        , hardness(0.5f), flow(1.0f), scatter(0.0f), spacing(0.15f), tip(-1)
+        , blend(BlendMode::Normal)
+        , smudge(0.0f), smudgeLength(0.0f)
         , r(0.0f), g(0.0f), b(0.0f)
     {}
+    
+    // Smudging dabs first pick up the canvas under their footprint into a
+    // running pickup color, then move the canvas towards their color mixed
+    // with it. Only Normal blending smudges.
+    bool isSmudging() const { return smudge > 0.0f && blend == BlendMode::Normal; }
 };
 
 } // namespace Acute
@@ -2,10 +2,15 @@
 
 #include "InputTypes.h"
 #include "BrushMapping.h"
+#include "BrushPipeline.h"
 #include "BrushDab.h"
+#include "ColorDynamics.h"
+#include "DabSegment.h"
+#include "RibbonSegment.h"
 #include <vector>
 #include <map>
 #include <memory>
+#include <random>
 
 namespace Acute {
 
@@ -17,6 +22,15 @@ struct BrushSettings {
     float baseFlow;          // Base flow
     float baseSpacing;       // Spacing between dabs (as fraction of size)
     float baseRotation;      // Base rotation
+    int tipIndex;            // Image tip index (-1 = round tip from hardness)
+    bool strokeBuffer;       // Accumulate each stroke separately, capped at baseOpacity
+    BlendMode blendMode;     // How dabs combine with the canvas
+    
+    // Smudging (see BrushDab::isSmudging): smudge 1 only drags canvas color
+    // (smudge, blend), in between it mixes into the brush color (wet mix).
+    // Smudging strokes paint the canvas directly, without a stroke buffer.
+    float smudge;            // Share of the paint picked up from the canvas
+    float smudgeLength;      // Share of the pickup carried from dab to dab
     
     // Color
     float colorR, colorG, colorB;
@@ -31,23 +45,89 @@ struct BrushSettings {
         , baseFlow(1.0f)
         , baseSpacing(0.15f)
         , baseRotation(0.0f)
+        , tipIndex(-1)
+        , strokeBuffer(false)
+        , blendMode(BlendMode::Normal)
+        , smudge(0.0f)
+        , smudgeLength(0.0f)
         , colorR(0.0f), colorG(0.0f), colorB(0.0f)
     {}
 };
 
+// Settings are shared immutably so presets can be swapped without copying
+typedef std::shared_ptr<const BrushSettings> BrushSettingsPtr;
+
+// How a stroke is represented for rendering
+enum class StrokeMode {
+    Dabs,    // Stamp a dab every spacing * size pixels
+    Ribbon   // Variable-width ribbon tessellated from the input points
+};
+
 // The brush engine processes input and generates dabs
 class BrushEngine {
 public:
     BrushEngine();
     ~BrushEngine();
     
-    // Set the current brush settings
+    // Set the current brush settings. The pointer overload only swaps a
+    // reference, so switching presets is cheap; a change requested during a
+    // stroke takes effect at the next beginStroke.
     void setBrushSettings(const BrushSettings& settings);
-    const BrushSettings& getBrushSettings() const { return m_settings; }
+    void setBrushSettings(BrushSettingsPtr settings);
+    const BrushSettings& getBrushSettings() const { return *m_settings; }
+    BrushSettingsPtr getBrushSettingsPtr() const { return m_settings; }
     
     // Process input and generate dabs for a stroke
     std::vector<BrushDab> processInput(const InputPoint& input);
     
+    // Process input and generate ribbon segments (StrokeMode::Ribbon only)
+    std::vector<RibbonSegment> processRibbonInput(const InputPoint& input);
+    
+    // Process input into a segment for GPU dab generation: spacing and dab
+    // count here, placement and mappings on the GPU. Only for settings that
+    // pass canGenerateOnGpu. processInput stays the reference (headless
+    // rendering and history replay use it); both space a stroke identically.
+    std::vector<DabSegment> processSegmentInput(const InputPoint& input);
+    
+    // Whether the settings can be generated on the GPU: no random sources
+    // (other than color jitter), scatter or smudging, and at most
+    // DabSegmentBrush::kMaxMappings mappings
+    static bool canGenerateOnGpu(const BrushSettings& settings);
+    
+    // Base values and tabulated mappings of the current settings, for the GPU
+    DabSegmentBrush getSegmentBrush() const;
+    
+    // Stroke representation chosen for the current settings
+    StrokeMode getStrokeMode() const { return m_strokeMode; }
+    
+    // Whether the settings can be drawn as a ribbon: hard round tip, a fixed
+    // function blend mode without smudging and only smooth size/opacity/flow
+    // mappings
+    static bool canUseRibbon(const BrushSettings& settings);
+    
+    // Use specialized mapping pipelines when the mapping shape has one (default
+    // on). Turning this off forces the generic path, for verification.
+    void setSpecializedPipelines(bool enabled);
+    bool isPipelineSpecialized() const { return m_pipeline != nullptr; }
+    
+    // Space faint, soft round dabs wider where the extra dabs would not be
+    // visible, raising their flow to keep the coverage (default on; see
+    // AdaptiveSpacing.h). Turning this off emits every dab, for comparison.
+    void setAdaptiveSpacing(bool enabled);
+    bool isAdaptiveSpacing() const { return m_adaptiveSpacing; }
+    
+    // Blend mode for a stroke: the eraser end of a stylus always erases,
+    // whatever the preset says
+    BlendMode getBlendMode(const InputPoint& input) const;
+    
+    // Seed the random input source and scatter. Replaying a stroke's input
+    // with the seed it was drawn with reproduces its dabs exactly.
+    void setRandomSeed(uint32_t seed);
+    
+    // Upper bound on how far a dab's pixels reach from its input point, over
+    // every mapped size and scatter the settings can produce
+    static float getMaxDabRadius(const BrushSettings& settings);
+    
     // Reset the engine state (call at start of new stroke)
     void beginStroke();
     void endStroke();
@@ -57,17 +137,33 @@ public:
     void clearMappings();
     
 private:
-    BrushSettings m_settings;
+    BrushSettingsPtr m_settings;
+    BrushSettingsPtr m_pendingSettings;  // Swapped in at the next beginStroke
+    StrokeMode m_strokeMode;
+    MappingPipeline m_pipeline;          // Null = generic mapping loop
+    bool m_specializedPipelines;
+    std::vector<InputMapping> m_shapeMappings;  // All but the color mappings
+    ColorDynamics m_colorDynamics;
+    bool m_adaptiveSpacing;
+    bool m_spacingAdaptable;             // The settings allow widening the spacing
+    std::mt19937 m_random;
     
     // Stroke state
     bool m_strokeActive;
     InputPoint m_lastInput;
+    bool m_hasLastInput;                 // False until the stroke's first point
     float m_distanceSinceLastDab;
+    float m_strokeLength;
+    float m_spacingFactor;               // Adaptive widening for the current input
+    bool m_pickupEmpty;                  // No dab has picked up paint yet this stroke
+    std::vector<InputPoint> m_dabInputs; // Per dab of a batch, for color dynamics
+    uint32_t m_colorSeed;                // Color jitter of this stroke
+    uint32_t m_strokeDabs;               // Dabs colored so far this stroke
     
     // Generate a single dab from input
     BrushDab generateDab(const InputPoint& input);
     
-    // Apply all mappings to modify dab properties
+    // Apply the shape mappings to modify dab properties
     void applyMappings(const InputPoint& input, BrushDab& dab);
     
     // Get value from input source
@@ -76,8 +172,34 @@ private:
     // Calculate spacing based on current settings
     float calculateSpacing(const BrushDab& dab);
     
+    // Advance the stroke by a move to input: the spacing for it (adaptively
+    // widened), with the mapped dab at the end of the move
+    float advance(const InputPoint& input, float distance, BrushDab& endDab);
+    
+    // Adaptive spacing factor for a dab (1 if it can't be widened), and the
+    // flow that keeps a dab's coverage at the current factor
+    float getSpacingFactor(const BrushDab& dab) const;
+    void compensateFlow(BrushDab& dab) const;
+    
+    // What dab alpha is relative to as it accumulates: the stroke opacity
+    // with a stroke buffer, 1 otherwise
+    float getAccumulationScale() const;
+    
     // Apply random scatter to dab position
     void applyScatter(BrushDab& dab);
+    
+    // Mappings, flow compensation, scatter and the input kept for color
+    // dynamics, then append
+    void addDab(const InputPoint& input, std::vector<BrushDab>& dabs);
+    
+    // Color dynamics over the whole batch of dabs at once
+    void colorDabs(std::vector<BrushDab>& dabs);
+    
+    // Pick the stroke mode and mapping pipeline after the settings changed
+    void updateStrokeMode();
+    
+    // Ribbon endpoint (center, radius, opacity) for an input point
+    void evaluateRibbonPoint(const InputPoint& input, float& radius, float& opacity);
 };
 
 } // namespace Acute
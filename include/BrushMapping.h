@@ -62,25 +62,32 @@ struct InputMapping {
     
     // Apply the mapping curve to transform input [0,1] to output [minOutput, maxOutput]
     float apply(float inputValue) const {
-        if (inverted) {
-            inputValue = 1.0f - inputValue;
-        }
-        
-        float curvedValue = inputValue;
         switch (curve) {
-            case CurveType::Linear:
-                curvedValue = inputValue;
-                break;
             case CurveType::Quadratic:
-                curvedValue = inputValue * inputValue;
-                break;
+                return applyCurve<CurveType::Quadratic>(inputValue);
             case CurveType::Cubic:
-                curvedValue = inputValue * inputValue * inputValue;
-                break;
+                return applyCurve<CurveType::Cubic>(inputValue);
             case CurveType::Custom:
                 // TODO: Implement custom curve evaluation
-                curvedValue = inputValue;
-                break;
+                return applyCurve<CurveType::Linear>(inputValue);
+            case CurveType::Linear:
+            default:
+                return applyCurve<CurveType::Linear>(inputValue);
+        }
+    }
+    
+    // apply() with the curve fixed at compile time (used by specialized pipelines)
+    template <CurveType Curve>
+    float applyCurve(float inputValue) const {
+        if (inverted) {
+            inputValue = 1.0f - inputValue;
+        }
+        
+        float curvedValue = inputValue;
+        if (Curve == CurveType::Quadratic) {
+            curvedValue = inputValue * inputValue;
+        } else if (Curve == CurveType::Cubic) {
+            curvedValue = inputValue * inputValue * inputValue;
         }
         
         // Interpolate between min and max
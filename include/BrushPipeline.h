@@ -0,0 +1,107 @@
+#pragma once
+
+#include "InputTypes.h"
+#include "BrushMapping.h"
+#include "BrushDab.h"
+#include <algorithm>
+#include <vector>
+
+namespace Acute {
+
+// Per-dab mapping evaluation.
+//
+// The generic path in BrushEngine loops over the mappings and switches on
+// source, curve and target for every dab. Common mapping shapes (pressure to
+// size, pressure to size + opacity, the example presets) get dedicated
+// template instantiations instead, picked once when the settings change.
+// Both paths share the helpers below, so they produce bit-identical dabs.
+// Color mappings are not part of either: ColorDynamics evaluates them for a
+// whole batch of dabs afterwards.
+
+// Evaluate all mappings of a known shape and clamp the dab
+typedef void (*MappingPipeline)(const std::vector<InputMapping>& mappings,
+                                const InputPoint& input, BrushDab& dab);
+
+// Specialized pipeline for the mappings, or nullptr to use the generic path
+MappingPipeline findMappingPipeline(const std::vector<InputMapping>& mappings);
+
+// Normalized input value for a deterministic source ([0,1])
+template <InputSource Source>
+inline float readInputSource(const InputPoint& input) {
+    if (Source == InputSource::Pressure) {
+        return input.pressure;
+    } else if (Source == InputSource::TiltX) {
+        return (input.tiltX + 1.0f) * 0.5f; // Convert from [-1,1] to [0,1]
+    } else if (Source == InputSource::TiltY) {
+        return (input.tiltY + 1.0f) * 0.5f;
+    } else if (Source == InputSource::TiltMagnitude) {
+        return std::min(1.0f, input.getTiltMagnitude());
+    } else if (Source == InputSource::Speed) {
+        return std::min(1.0f, input.getSpeed() / 1000.0f); // Normalize speed
+    } else if (Source == InputSource::Rotation) {
+        return input.rotation / 360.0f;
+    }
+    return 1.0f;
+}
+
+// Apply a mapped value to its dab property
+template <BrushProperty Target>
+inline void applyMappedValue(float value, BrushDab& dab) {
+    if (Target == BrushProperty::Size) {
+        dab.size *= value;
+    } else if (Target == BrushProperty::Opacity) {
+        dab.opacity *= value;
+    } else if (Target == BrushProperty::Hardness) {
+        dab.hardness = std::max(0.0f, std::min(1.0f, value));
+    } else if (Target == BrushProperty::Flow) {
+        dab.flow *= value;
+    } else if (Target == BrushProperty::Rotation) {
+        dab.rotation += value;
+    } else if (Target == BrushProperty::Scatter) {
+        dab.scatter = value;
+    } else if (Target == BrushProperty::Spacing) {
+        dab.spacing = value;
+    }
+    // Color properties are evaluated by ColorDynamics
+}
+
+inline void applyMappedValue(BrushProperty target, float value, BrushDab& dab) {
+    switch (target) {
+        case BrushProperty::Size:
+            applyMappedValue<BrushProperty::Size>(value, dab);
+            break;
+        case BrushProperty::Opacity:
+            applyMappedValue<BrushProperty::Opacity>(value, dab);
+            break;
+        case BrushProperty::Hardness:
+            applyMappedValue<BrushProperty::Hardness>(value, dab);
+            break;
+        case BrushProperty::Flow:
+            applyMappedValue<BrushProperty::Flow>(value, dab);
+            break;
+        case BrushProperty::Rotation:
+            applyMappedValue<BrushProperty::Rotation>(value, dab);
+            break;
+        case BrushProperty::Scatter:
+            applyMappedValue<BrushProperty::Scatter>(value, dab);
+            break;
+        case BrushProperty::Spacing:
+            applyMappedValue<BrushProperty::Spacing>(value, dab);
+            break;
+        default:
+            break;
+    }
+}
+
+// Closest dabs may be, as a fraction of size
+constexpr float kMinDabSpacing = 0.01f;
+
+// Final clamp after all mappings
+inline void clampMappedDab(BrushDab& dab) {
+    dab.size = std::max(0.1f, dab.size);
+    dab.opacity = std::max(0.0f, std::min(1.0f, dab.opacity));
+    dab.flow = std::max(0.0f, std::min(1.0f, dab.flow));
+    dab.spacing = std::max(kMinDabSpacing, dab.spacing);
+}
+
+} // namespace Acute
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "BrushEngine.h"
+#include <istream>
+#include <ostream>
+#include <string>
+
+namespace Acute {
+
+// Readable text form of a single brush preset:
+//
+//   # comment
+//   name = Pencil
+//   size = 3
+//   opacity = 0.6
+//   hardness = 0.9
+//   flow = 0.7
+//   spacing = 0.05
+//   rotation = 0
+//   color = 0.1 0.1 0.1
+//   tip = -1
+//   strokeBuffer = 0
+//   blend = Normal
+//   smudge = 0
+//   smudgeLength = 0
+//   mapping = Pressure Size 0.2 2.0 1.0 Cubic [inverted]
+//
+// Keys that are missing keep their BrushSettings defaults.
+
+// Enum names used in the text form
+const char* toString(InputSource source);
+const char* toString(BrushProperty property);
+const char* toString(CurveType curve);
+const char* toString(BlendMode mode);
+bool parseInputSource(const std::string& text, InputSource& source);
+bool parseBrushProperty(const std::string& text, BrushProperty& property);
+bool parseCurveType(const std::string& text, CurveType& curve);
+bool parseBlendMode(const std::string& text, BlendMode& mode);
+
+// Read one "key = value" line into the settings. Returns false on an unknown
+// key or malformed value; error describes the problem.
+bool parsePresetLine(const std::string& line, BrushSettings& settings, std::string& name,
+                     std::string& error);
+
+// Read/write a whole preset
+bool readBrushPreset(std::istream& in, BrushSettings& settings, std::string& name);
+void writeBrushPreset(std::ostream& out, const BrushSettings& settings, const std::string& name);
+
+// File helpers
+bool loadBrushPreset(const std::string& path, BrushSettings& settings, std::string& name);
+bool saveBrushPreset(const std::string& path, const BrushSettings& settings, const std::string& name);
+
+} // namespace Acute
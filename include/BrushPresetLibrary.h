@@ -0,0 +1,77 @@
+#pragma once
+
+#include "BrushEngine.h"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Acute {
+
+// A named collection of brush presets.
+//
+// Two on-disk forms:
+// - Text: presets in the BrushPresetFile format, one after another. Each
+//   "name = ..." line starts a new preset.
+// - Binary (.acbl): fixed-size little-endian records plus a string table.
+//   openBinary() memory-maps the file and only reads the header and names;
+//   a preset's settings are decoded the first time getPreset() asks for it.
+//
+// getPreset() hands out shared immutable settings, so passing them to
+// BrushEngine::setBrushSettings switches brushes without copying.
+class BrushPresetLibrary {
+public:
+    BrushPresetLibrary();
+    ~BrushPresetLibrary();
+    
+    BrushPresetLibrary(const BrushPresetLibrary&) = delete;
+    BrushPresetLibrary& operator=(const BrushPresetLibrary&) = delete;
+    
+    // Replace the contents with a library file
+    bool openBinary(const std::string& path);
+    bool loadText(const std::string& path);
+    
+    // Open either form, picking binary for the .acbl extension
+    bool open(const std::string& path);
+    
+    bool saveBinary(const std::string& path) const;
+    bool saveText(const std::string& path) const;
+    
+    // Append a preset (replaces one with the same name)
+    void addPreset(const std::string& name, const BrushSettings& settings);
+    
+    // Drop all presets and unmap the file
+    void clear();
+    
+    size_t getPresetCount() const { return m_entries.size(); }
+    const std::string& getPresetName(size_t index) const { return m_entries[index].name; }
+    
+    // Index of the named preset, or -1
+    int findPreset(const std::string& name) const;
+    
+    // Settings for a preset (decoded and cached on first use), null if out of range
+    BrushSettingsPtr getPreset(size_t index) const;
+    
+private:
+    struct MappedFile;
+    struct PresetRecord;
+    
+    struct Entry {
+        std::string name;
+        mutable BrushSettingsPtr settings;    // Null until decoded
+        const unsigned char* record;          // Source record in the mapped file
+    };
+    
+    std::vector<Entry> m_entries;
+    std::unique_ptr<MappedFile> m_file;
+    const unsigned char* m_mappings;          // Mapping records in the mapped file
+    uint32_t m_version;                       // Format version of the mapped file
+    
+    // Size of a preset record in a file of this version
+    static size_t getRecordBytes(uint32_t version);
+    
+    // Build settings from a binary record
+    BrushSettingsPtr decode(const unsigned char* data) const;
+};
+
+} // namespace Acute
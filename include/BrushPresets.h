@@ -0,0 +1,21 @@
+#pragma once
+
+#include "BrushEngine.h"
+
+namespace Acute {
+namespace BrushPresets {
+
+// Built-in example presets (defined in examples/brush_presets.cpp)
+BrushSettings createPencil();
+BrushSettings createAirbrush();
+BrushSettings createPen();
+BrushSettings createMarker();
+BrushSettings createSplatter();
+BrushSettings createCalligraphy();
+BrushSettings createWatercolor();
+BrushSettings createSmudge();
+BrushSettings createBlender();
+BrushSettings createWetMix();
+
+} // namespace BrushPresets
+} // namespace Acute
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Acute {
+
+// A single brush tip: square 8-bit coverage image with a full mip chain
+struct BrushTipImage {
+    int size;                                 // Edge length of level 0 in pixels
+    std::vector<std::vector<uint8_t>> levels; // levels[0] is size x size, each level halves
+    
+    BrushTipImage() : size(0) {}
+};
+
+// The set of brush tips uploaded together as one texture array.
+// Layers [0, kRoundTipCount) hold procedural round tips at quantized hardness,
+// imported image tips are appended after them.
+class BrushTipSet {
+public:
+    static constexpr int kTipSize = 256;
+    static constexpr int kRoundTipCount = 32;
+    static constexpr int kMaxLayers = 64;
+    
+    BrushTipSet();
+    
+    // Number of tip layers (round tips + image tips)
+    int getLayerCount() const { return static_cast<int>(m_layers.size()); }
+    const BrushTipImage& getLayer(int layer) const { return m_layers[layer]; }
+    
+    // Number of mip levels per layer
+    static int getLevelCount();
+    
+    // Add an image tip from 8-bit grayscale coverage (255 = full paint).
+    // The image is fitted into the tip square keeping its aspect ratio.
+    // Returns the tip index to use in BrushSettings::tipIndex, or -1 if the set is full.
+    int addImageTip(const uint8_t* pixels, int width, int height);
+    
+    // Load a binary PGM (P5) file as an image tip, returns tip index or -1
+    int loadImageTip(const std::string& path);
+    
+    int getImageTipCount() const { return getLayerCount() - kRoundTipCount; }
+    
+    // Texture layer for a dab: tip >= 0 selects an image tip, otherwise the
+    // round tip closest to the given hardness
+    int layerForDab(int tip, float hardness) const;
+    static int roundTipLayer(float hardness);
+    
+    // Bilinear sample of a layer at the given mip level, u/v in [0,1] (for CPU paths)
+    float sample(int layer, float u, float v, int level = 0) const;
+    
+private:
+    std::vector<BrushTipImage> m_layers;
+    
+    // Generate the round tip for a hardness value
+    static BrushTipImage createRoundTip(float hardness);
+    
+    // Fill levels[1..] by 2x2 box filtering levels[0]
+    static void buildMipChain(BrushTipImage& tip);
+};
+
+} // namespace Acute
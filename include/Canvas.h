@@ -1,24 +1,40 @@
 #pragma once
 
 #include "BrushDab.h"
+#include "BrushTip.h"
+#include "ComputeRasterizer.h"
+#include "DabSegment.h"
+#include "FloodFill.h"
+#include "RTree.h"
+#include "RibbonSegment.h"
+#include "Symmetry.h"
+#include "Timelapse.h"
 #include <GL/glew.h>
 #include <vector>
 #include <memory>
+#include <string>
 
 namespace Acute {
 
 class Shader;
+class GLStateCache;
+class TileResidency;
+class DabGenerator;
+class FrameExport;
+class ReadbackCache;
 
-// Canvas manages the drawing surface and compositing
+// Canvas manages the drawing surface and compositing. All GL state changes
+// go through the renderer's state cache, so draws set what they need and
+// leave it bound instead of restoring defaults.
 class Canvas {
 public:
-    Canvas(int width, int height);
+    Canvas(int width, int height, GLStateCache& state);
     ~Canvas();
     
     // Initialize OpenGL resources
     bool initialize();
     
-    // Clear the canvas
+    // Clear the canvas (colors are stored premultiplied by alpha)
     void clear(float r = 1.0f, float g = 1.0f, float b = 1.0f, float a = 1.0f);
     
     // Draw a single dab onto the canvas
@@ -26,36 +42,265 @@ public:
     
     // Draw multiple dabs
     void drawDabs(const std::vector<BrushDab>& dabs);
+    void drawDabs(const BrushDab* dabs, size_t count);
     
-    // Render the canvas to the screen
+    // Draw ribbon stroke segments in a single pass
+    void drawRibbon(const std::vector<RibbonSegment>& segments);
+    void drawRibbon(const RibbonSegment* segments, size_t count);
+    
+    // GPU dab generation (with the compute rasterizer only): the segments'
+    // dabs are placed, mapped and drawn without leaving the GPU. Set the
+    // brush before a stroke's segments; not for mask painting.
+    bool canGenerateDabs() const { return m_dabGenerator != nullptr; }
+    void setSegmentBrush(const DabSegmentBrush& brush);
+    void drawDabSegments(const DabSegment* segments, size_t count);
+    
+    // Stroke buffer mode: while a buffered stroke is active, dabs accumulate
+    // into a scratch surface covering only the stroke's bounding box, with
+    // flow building up to the stroke opacity. endStroke() composites it once
+    // with the stroke's blend mode.
+    void beginStroke(bool useStrokeBuffer, float opacity, BlendMode blend = BlendMode::Normal);
+    void endStroke();
+    
+    // Render the canvas to the screen through the view. Zoomed out, the
+    // display samples the mip level matching the zoom; levels are brought up
+    // to date first by re-downsampling only what was drawn since the last frame.
     void render();
     
-    // Resize the canvas
+    // Dabs queued but not drawn yet, shown by render() over the canvas as
+    // plain round discs at a fraction of the screen resolution. Replaces the
+    // previous set; erase dabs, smudging dabs and mask strokes have no proxy.
+    void setProxyDabs(const std::vector<BrushDab>& dabs);
+    
+    // Bucket fill from a canvas pixel: the region of similar color around it
+    // (see FloodFill) is painted with a color at an opacity in a blend mode,
+    // clipped by the selection. Fills the canvas, also while mask painting.
+    // Colors come from the readback cache, which the first fill enables.
+    // Returns false if the pixel is outside the canvas.
+    bool fill(float x, float y, const FillOptions& options, float r, float g, float b, float opacity,
+              BlendMode blend = BlendMode::Normal);
+    
+    // Keep a system memory copy of the canvas up to date in the background,
+    // a few tiles per frame, so fills need not wait for it
+    void setReadbackCache(bool enabled);
+    const ReadbackCache* getReadbackCache() const { return m_readbackCache.get(); }
+    
+    // Publish the canvas to a named shared memory ring for capture tools
+    // (see FrameExport), copying the tiles the readback cache refreshes each
+    // frame. An empty name stops. Returns false if the segment could not be
+    // created.
+    bool setFrameExport(const std::string& name);
+    const FrameExport* getFrameExport() const { return m_frameExport.get(); }
+    
+    // Record a time-lapse of the canvas (see TimelapseRecorder) from the
+    // tiles the readback cache refreshes. Finishing waits for the cache to
+    // catch up and records the last changes; the recorder and its counters
+    // stay until the next start.
+    bool startTimelapse(const std::string& path, const TimelapseOptions& options);
+    void finishTimelapse();
+    const TimelapseRecorder* getTimelapse() const { return m_timelapse.get(); }
+    
+    // Replace a region with premultiplied RGBA8 pixels (canvas pixels, rows
+    // top to bottom, stride bytes apart), as time-lapse playback does
+    void writePixels(int x0, int y0, int x1, int y1, const uint8_t* pixels, size_t stride);
+    
+    // Resize the canvas (clears it)
     void resize(int width, int height);
     
+    // View: window size in pixels, screen pixels per canvas pixel, and the
+    // canvas pixel shown at the window's top-left corner
+    void setViewSize(int width, int height);
+    void setView(float zoom, float originX, float originY);
+    float getZoom() const { return m_zoom; }
+    float getViewOriginX() const { return m_viewOriginX; }
+    float getViewOriginY() const { return m_viewOriginY; }
+    int getViewWidth() const { return m_viewWidth; }
+    int getViewHeight() const { return m_viewHeight; }
+    
+    // Window pixel to canvas pixel
+    void screenToCanvas(float& x, float& y) const;
+    
+    int getMipLevelCount() const { return m_mipLevels; }
+    
+    // Symmetry: every dab and ribbon is drawn once per symmetry transform as
+    // instances of the same draw call
+    void setSymmetry(const Symmetry& symmetry);
+    const Symmetry& getSymmetry() const { return m_symmetry; }
+    int getSymmetryCopies() const { return static_cast<int>(m_symmetryTransforms.size()); }
+    
+    // Selection (canvas pixels). Rectangle and lasso selections are hard
+    // edged and clip drawing with the stencil test; a lasso is a list of x,y
+    // pairs filled even-odd. Replaces any previous selection.
+    void selectRectangle(float x0, float y0, float x1, float y1);
+    void selectLasso(const std::vector<float>& points);
+    void clearSelection();
+    bool hasSelection() const { return m_selection != Selection::None; }
+    
+    // Mask painting: strokes paint into the selection mask instead of the
+    // canvas (erase removes from it). The painted mask is soft and scales
+    // dab coverage when painting the canvas.
+    void setMaskPainting(bool enabled);
+    bool isMaskPainting() const { return m_maskPainting; }
+    
+    // Add an image brush tip (8-bit grayscale coverage), returns tip index or -1
+    int addBrushTip(const uint8_t* pixels, int width, int height);
+    
+    // Load a PGM image brush tip from disk, returns tip index or -1
+    int loadBrushTip(const std::string& path);
+    
+    const BrushTipSet& getBrushTips() const { return m_brushTips; }
+    
+    // Documents larger than video memory: with a budget (bytes, set before
+    // initialize) and sparse texture support, only the tiles near the view
+    // are kept in video memory and the rest is stored compressed
+    void setResidencyBudget(size_t bytes) { m_residencyBudget = bytes; }
+    const TileResidency* getResidency() const { return m_residency.get(); }
+    
+    // Draw dab batches with the tile-binned compute rasterizer instead of one
+    // quad per dab (set before initialize; needs GL 4.3, otherwise quads are
+    // kept). Mask painting always uses quads.
+    void setComputeRaster(bool enabled) { m_computeRasterRequested = enabled; }
+    bool isComputeRaster() const { return m_computeRaster != nullptr; }
+    
     int getWidth() const { return m_width; }
     int getHeight() const { return m_height; }
     
 private:
     int m_width;
     int m_height;
+    GLStateCache& m_state;
     
-    // Framebuffer for canvas rendering
+    // Framebuffer for canvas rendering (level 0 of the canvas texture)
     GLuint m_framebuffer;
     GLuint m_canvasTexture;
     
+    // Mip pyramid of the canvas texture, rebuilt over the dirty regions:
+    // x0, y0, x1, y1 in canvas pixels drawn since the last update. Touching
+    // regions merge; past kMaxDirtyRegions they collapse into one.
+    static constexpr size_t kMaxDirtyRegions = 16;
+    int m_mipLevels;
+    GLuint m_mipFramebuffer;
+    std::unique_ptr<Shader> m_mipShader;
+    std::vector<int> m_dirtyRegions;
+    
+    // View transform
+    int m_viewWidth, m_viewHeight;
+    float m_zoom;
+    float m_viewOriginX, m_viewOriginY;
+    
+    // Symmetry transforms, uploaded to the dab and ribbon shaders on change
+    Symmetry m_symmetry;
+    std::vector<SymmetryTransform> m_symmetryTransforms;
+    std::vector<float> m_symmetryMatrices;
+    
+    // Bounds of each copy from the last getSymmetryBounds, and their running
+    // union over a compute batch; copies off the canvas have empty boxes.
+    // Dirty regions and destination copies follow these, not the union of
+    // the copies, which can span most of the canvas.
+    std::vector<Box> m_copyBounds;
+    std::vector<Box> m_batchCopyBounds;
+    
     // Brush rendering resources
     GLuint m_dabVAO;
     GLuint m_dabVBO;
     std::unique_ptr<Shader> m_dabShader;
     
+    // Ribbon rendering resources (streamed per batch)
+    GLuint m_ribbonVAO;
+    GLuint m_ribbonVBO;
+    std::unique_ptr<Shader> m_ribbonShader;
+    std::vector<float> m_ribbonVertices;
+    
     // Screen quad for displaying canvas
     GLuint m_screenVAO;
     GLuint m_screenVBO;
     std::unique_ptr<Shader> m_screenShader;
     
-    // Brush texture (circular gradient)
-    GLuint m_brushTexture;
+    // Proxy for queued dabs: instanced discs into a low resolution target
+    // covering the view, composited over the screen
+    static constexpr int kProxyScale = 4;
+    GLuint m_proxyVAO;
+    GLuint m_proxyVBO;
+    GLsizei m_proxyCount;
+    std::vector<float> m_proxyInstances;
+    GLuint m_proxyTexture;
+    GLuint m_proxyFramebuffer;
+    int m_proxyWidth, m_proxyHeight;
+    std::unique_ptr<Shader> m_proxyShader;
+    std::unique_ptr<Shader> m_proxyCompositeShader;
+    
+    // Brush tips (texture array with mip chains, one layer per tip)
+    BrushTipSet m_brushTips;
+    GLuint m_tipTexture;
+    
+    // Per-stroke scratch surface (stroke buffer mode)
+    static constexpr int kScratchChunkSize = 128;
+    bool m_strokeBufferActive;
+    bool m_strokeHasContent;
+    float m_strokeOpacity;
+    int m_strokeMinX, m_strokeMinY;    // Running stroke bounds in canvas pixels
+    int m_strokeMaxX, m_strokeMaxY;
+    std::vector<Box> m_strokeCopyBounds; // The same per symmetry copy
+    GLuint m_scratchFramebuffer;
+    GLuint m_scratchTexture;
+    int m_scratchX, m_scratchY;        // Allocated region in canvas pixels
+    int m_scratchWidth, m_scratchHeight;
+    BlendMode m_strokeBlend;
+    std::unique_ptr<Shader> m_compositeShader;
+    
+    // Copy of the canvas under the current draw, for blend modes that fixed
+    // function blending cannot express (allocated on first use)
+    GLuint m_destinationTexture;
+    
+    // Paint picked up by smudging dabs: one premultiplied color per symmetry
+    // copy, ping-ponged between two tiny targets (allocated on first use)
+    GLuint m_pickupTextures[2];
+    GLuint m_pickupFramebuffers[2];
+    int m_pickupCurrent;               // Holds the latest pickup
+    std::unique_ptr<Shader> m_pickupShader;
+    
+    // Selection mask (R8, 1 = selected) and the stencil shared by the canvas
+    // and mask framebuffers (allocated on first selection)
+    enum class Selection { None, Hard, Soft };
+    Selection m_selection;
+    bool m_maskPainting;
+    GLuint m_maskTexture;
+    GLuint m_maskFramebuffer;
+    GLuint m_stencilRenderbuffer;
+    GLuint m_selectionVAO;
+    GLuint m_selectionVBO;
+    std::unique_ptr<Shader> m_selectionShader;
+    
+    // Tile residency (null when the whole canvas is in video memory); mips
+    // are then tracked and rebuilt per tile
+    size_t m_residencyBudget;
+    std::unique_ptr<TileResidency> m_residency;
+    std::vector<int> m_dirtyTiles;
+    
+    // Compute rasterizer (null when dabs are drawn as quads)
+    bool m_computeRasterRequested;
+    std::unique_ptr<ComputeRasterizer> m_computeRaster;
+    std::vector<ComputeRasterizer::Dab> m_computeDabs;
+    std::unique_ptr<DabGenerator> m_dabGenerator;
+    
+    // System memory copy of the canvas (null until enabled), the fill over
+    // it and the filled mask (R8 read as all four channels, allocated on
+    // first use)
+    std::unique_ptr<ReadbackCache> m_readbackCache;
+    bool m_readbackRequested;
+    FloodFill m_floodFill;
+    GLuint m_fillTexture;
+    
+    // Shared memory export of the canvas (null when off), fed by the cache
+    std::unique_ptr<FrameExport> m_frameExport;
+    std::vector<int> m_refreshedTiles;
+    
+    // Time-lapse recording (open while recording), fed by the cache too
+    std::unique_ptr<TimelapseRecorder> m_timelapse;
+    std::vector<uint8_t> m_uploadRows;
+    
+    // Create or drop the readback cache for the fill tool and frame export
+    void updateReadbackCache();
     
     // Initialize shaders
     bool initializeShaders();
@@ -63,11 +308,91 @@ private:
     // Initialize geometry
     bool initializeGeometry();
     
-    // Create brush texture
-    void createBrushTexture();
+    // Create brush tip texture array and upload all tips
+    void createTipTexture();
+    
+    // Upload every mip level of one tip layer
+    void uploadTipLayer(int layer);
     
-    // Create framebuffer
+    // Create framebuffer and the canvas texture with its full mip chain
     bool createFramebuffer();
+    
+    // Rebuild the symmetry transforms for the canvas size and upload them
+    void updateSymmetry();
+    
+    // Grow a canvas region to the union of its copies that touch the canvas,
+    // keeping each copy's box in m_copyBounds. Returns false if none does.
+    bool getSymmetryBounds(float& minX, float& minY, float& maxX, float& maxY);
+    
+    // Union each copy's box into the running per-copy bounds (replacing them
+    // when first)
+    static void growCopyBounds(std::vector<Box>& bounds, const std::vector<Box>& copies, bool first);
+    
+    // Add a region (canvas pixels), or each of a list, to the dirty regions,
+    // or mark the whole canvas
+    void markDirty(float minX, float minY, float maxX, float maxY);
+    void markDirty(const std::vector<Box>& regions);
+    void markAllDirty();
+    
+    // Downsample the dirty region (framebuffer texels) into each mip level in turn
+    void updateMips();
+    void updateMipRegion(int x0, int y0, int x1, int y1);
+    
+    // Bring the tiles under a canvas region into video memory before drawing
+    // on it, for each symmetry copy or just the region itself
+    void makeResident(float minX, float minY, float maxX, float maxY, bool eachCopy);
+    
+    // Bind the canvas, the stroke scratch or the mask for drawing, fill the
+    // projection. Returns true if the shader must multiply by the soft mask.
+    bool setDrawTarget(float* projection);
+    
+    // Orthographic projection from a canvas region, y down
+    static void makeProjection(float* projection, float originX, float originY, float width, float height);
+    
+    // Draw the proxy dabs over the screen (default framebuffer bound)
+    void drawProxy();
+    
+    // Draw a batch into the canvas or the stroke scratch in one compute pass
+    void drawDabsCompute(const BrushDab* dabs, size_t count);
+    
+    // Compute target for a batch with these canvas bounds (after symmetry):
+    // the stroke scratch or the canvas, whose mips are marked dirty under
+    // each copy of the batch (m_batchCopyBounds)
+    ComputeRasterizer::Target getComputeTarget(float minX, float minY, float maxX, float maxY);
+    
+    // Set the stencil test for the selection; soft masks are bound to texture
+    // unit 2 and true is returned. Only canvas targets are clipped.
+    bool applySelection(bool canvasTarget);
+    
+    // Create or free the mask texture, its framebuffer and the stencil
+    bool ensureSelectionTargets();
+    void releaseSelectionTargets();
+    
+    // Grow the scratch so it covers the running stroke bounds plus this region
+    // (also adding m_copyBounds to the stroke's per-copy bounds). Returns false
+    // if the region lies outside the canvas.
+    bool ensureScratchCovers(float minX, float minY, float maxX, float maxY);
+    void releaseScratch();
+    
+    // Composite the scratch into the canvas framebuffer with the stroke blend mode
+    void drawScratch();
+    
+    // Blend modes expressible as glBlendFunc on premultiplied color
+    static bool isFixedFunctionBlend(BlendMode mode);
+    void setFixedFunctionBlend(BlendMode mode);
+    
+    // Mix the canvas under a smudging dab's footprint into the pickup, for
+    // every copy in one tiny pass; leaves the new pickup on texture unit 3.
+    // Nothing is copied: the dab's samples are read from the canvas itself.
+    void pickUpPaint(const BrushDab& dab);
+    
+    // Copy the canvas region under [minX, maxX) x [minY, maxY) into the
+    // destination texture (bound to texture unit 1). The canvas framebuffer
+    // must be bound. Returns false if the region lies outside the canvas.
+    bool copyDestination(float minX, float minY, float maxX, float maxY);
+    
+    // The same for each of a list of regions; false if none is on the canvas
+    bool copyDestination(const std::vector<Box>& regions);
 };
 
 } // namespace Acute
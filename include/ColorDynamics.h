@@ -0,0 +1,71 @@
+#pragma once
+
+#include "InputTypes.h"
+#include "BrushMapping.h"
+#include "BrushDab.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Acute {
+
+// Hue in turns [0, 1), saturation and value in [0, 1]
+struct HsvColor {
+    float h, s, v;
+};
+
+HsvColor rgbToHsv(float r, float g, float b);
+
+// Convert arrays of HSV colors to RGB. Hue wraps to turns; saturation and
+// value are clamped to [0, 1]. No branches per element, so it vectorizes;
+// the arrays must not overlap.
+void hsvToRgb(const float* __restrict h, const float* __restrict s, const float* __restrict v,
+              float* __restrict r, float* __restrict g, float* __restrict b, size_t count);
+
+inline bool isColorProperty(BrushProperty property) {
+    return property == BrushProperty::ColorH || property == BrushProperty::ColorS
+        || property == BrushProperty::ColorV;
+}
+
+// Per-dab hue, saturation and value from the ColorH/S/V mappings.
+//
+// Works on a batch of dabs at a time, in structure-of-arrays form: each
+// mapping switches on its source, curve and target once per batch and then
+// runs a plain loop over the dabs, and the HSV to RGB conversion runs over
+// the arrays the same way. The brush color is converted to HSV only when the
+// brush changes. ColorH adds to the hue (in turns), ColorS and ColorV
+// multiply saturation and value; Random sources give jitter, hashed from a
+// per-stroke seed and the dab's index in the stroke so DabGenerator can
+// compute the same values on the GPU.
+//
+// On the CPU path color mappings cost up to half the dab rate of a solid
+// brush (the inputs are kept per dab and converted as a batch); strokes that
+// pass BrushEngine::canGenerateOnGpu evaluate them in the dab generation
+// shader instead, at no cost to the CPU (acute-render --bench-color).
+class ColorDynamics {
+public:
+    ColorDynamics();
+    
+    // Take the brush color and its color mappings; other mappings are ignored
+    void setBrush(float r, float g, float b, const std::vector<InputMapping>& mappings);
+    
+    // False when the brush has no color mappings (dabs keep the brush color)
+    bool isActive() const { return !m_mappings.empty(); }
+    
+    // Color each dab from the input point it was generated at; firstDab is
+    // the first one's index in the stroke
+    void apply(const InputPoint* inputs, BrushDab* dabs, size_t count, uint32_t seed, uint32_t firstDab) const;
+    
+private:
+    // Dabs per pass; the arrays live on the stack
+    static constexpr size_t kBatchSize = 64;
+    
+    HsvColor m_base;
+    std::vector<InputMapping> m_mappings;
+    
+    // Mapped values of mapping `index` for a pass
+    void evaluate(size_t index, const InputPoint* inputs, size_t count, uint32_t seed, uint32_t firstDab,
+                  float* values) const;
+};
+
+} // namespace Acute
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace Acute {
+
+class Shader;
+class GLStateCache;
+
+// Tile-binned dab rasterizer in compute shaders (GL 4.3), an alternative to
+// drawing one blended quad per dab.
+//
+// A batch of dabs is uploaded once. The binning pass expands every dab into
+// its symmetry copies, works out each copy's texel bounds and inverse quad
+// mapping, and counts the copies overlapping each 16x16 texel tile. A prefix
+// sum turns the counts into offsets, and a scatter pass writes each copy's
+// index into the lists of the tiles it overlaps. Then one workgroup per tile
+// loads its pixels into registers, sorts its own list back into batch order
+// and blends those dabs in float before writing the tile back once. Only
+// tiles with dabs get a workgroup (an indirect dispatch sized on the GPU),
+// and a tile costs the dabs that touch it, not the whole batch. Dense strokes with
+// hundreds of overlapping dabs per pixel cost shader arithmetic instead of a
+// framebuffer read-modify-write per dab.
+//
+// Every blend mode runs in the shader, so Multiply needs no destination copy.
+// Blending at float precision between dabs rounds once per batch rather than
+// once per dab, so results differ from the quad path by a few 8-bit steps in
+// heavy overlaps.
+class ComputeRasterizer {
+public:
+    static constexpr int kTileSize = 16;
+    
+    // One dab as uploaded (std430 layout)
+    struct Dab {
+        float x, y, size, rotation;
+        float r, g, b, opacity;     // Opacity already includes flow
+        float tipLayer;
+        float blend;                // BlendMode
+        float lod;                  // Tip mip level for the dab's size
+        float padding;
+    };
+    
+    // The image being drawn into: an RGBA8 texture whose top-left texel shows
+    // canvas pixel (originX, originY), rows bottom up, and the texel rect
+    // [x0, x1) x [y0, y1) the batch may touch
+    struct Target {
+        GLuint texture;
+        int height;
+        float originX, originY;
+        int x0, y0, x1, y1;
+        GLuint mask;                // R8 coverage scale per texel, or 0
+    };
+    
+    explicit ComputeRasterizer(GLStateCache& state);
+    ~ComputeRasterizer();
+    
+    // True if the context has compute shaders and image load/store
+    static bool isSupported();
+    
+    bool initialize();
+    
+    // Symmetry transforms (column-major mat3x2 each), set on change
+    void setSymmetry(const std::vector<float>& matrices, int count);
+    
+    // Draw a batch in order. The tip array is bound to texture unit 0 and the
+    // mask to unit 2.
+    void draw(const std::vector<Dab>& dabs, const Target& target, GLuint tipTexture);
+    
+    // The dab storage buffer, grown to hold `count` dabs, for filling on the
+    // GPU (DabGenerator); then draw them with drawReserved. maxTiles bounds
+    // the tile list: the sum of tilesPerCopy over the dabs.
+    GLuint reserveDabs(size_t count);
+    void drawReserved(size_t count, size_t maxTiles, const Target& target, GLuint tipTexture);
+    
+    // Most tiles one copy of a dab can overlap, for a dab whose pixels reach
+    // `extent` from its center
+    static size_t tilesPerCopy(float extent);
+    
+private:
+    GLStateCache& m_state;
+    std::unique_ptr<Shader> m_binShader;
+    std::unique_ptr<Shader> m_scanShader;
+    std::unique_ptr<Shader> m_scatterShader;
+    std::unique_ptr<Shader> m_rasterShader;
+    int m_copies;
+    
+    // Storage buffers, grown as needed
+    GLuint m_dabBuffer;
+    GLuint m_instanceBuffer;
+    GLuint m_tileCountBuffer;
+    GLuint m_tileOffsetBuffer;        // Tile count + 1 entries
+    GLuint m_tileListBuffer;          // Copy indices, tile by tile
+    GLuint m_activeTileBuffer;        // Raster dispatch size, non-empty tiles
+    size_t m_dabCapacity;
+    size_t m_instanceCapacity;
+    size_t m_tileCapacity;
+    size_t m_tileOffsetCapacity;
+    size_t m_tileListCapacity;
+    size_t m_activeTileCapacity;
+    
+    // Make a buffer hold at least `bytes`; contents are not kept
+    void reserve(GLuint buffer, size_t& capacity, size_t bytes);
+};
+
+} // namespace Acute
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "BrushDab.h"
+#include "BrushTip.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Acute {
+
+// Software drawing surface for offline/batch compositing.
+// Mirrors the GPU Canvas dab pipeline (same tips, premultiplied alpha, same
+// blend modes, smudging) on the CPU, so it needs no OpenGL context or window.
+class CpuCanvas {
+public:
+    CpuCanvas(int width, int height);
+    ~CpuCanvas();
+    
+    // Clear the canvas
+    void clear(float r = 1.0f, float g = 1.0f, float b = 1.0f, float a = 1.0f);
+    
+    // Clear only [x0, x1) x [y0, y1) (clamped to the canvas)
+    void clearRect(int x0, int y0, int x1, int y1,
+                   float r = 1.0f, float g = 1.0f, float b = 1.0f, float a = 1.0f);
+    
+    // Resize the canvas (contents are cleared)
+    void resize(int width, int height);
+    
+    // Draw a single dab onto the canvas. Smudging dabs use the pickup of
+    // their symmetry copy.
+    void drawDab(const BrushDab& dab, int copy = 0);
+    
+    // Draw multiple dabs in order. With symmetry each dab is followed by its
+    // copies, as in the GPU canvas's instance order; copies is their number.
+    void drawDabs(const std::vector<BrushDab>& dabs, int copies = 1);
+    
+    // Draw the part of a dab that falls inside [x0, x1) x [y0, y1).
+    // Regions that do not overlap can be drawn from different threads,
+    // except for smudging dabs: they sample their whole footprint into the
+    // pickup, so they must be drawn in order, once each.
+    void drawDabClipped(const BrushDab& dab, int x0, int y0, int x1, int y1, int copy = 0);
+    
+    // Pixel bounds touched by a dab, as [x0, x1) x [y0, y1) clamped to the canvas.
+    // Returns false if the dab lies outside the canvas.
+    bool getDabBounds(const BrushDab& dab, int& x0, int& y0, int& x1, int& y1) const;
+    
+    // Add an image brush tip (8-bit grayscale coverage), returns tip index or -1
+    int addBrushTip(const uint8_t* pixels, int width, int height);
+    int loadBrushTip(const std::string& path);
+    const BrushTipSet& getBrushTips() const { return m_brushTips; }
+    
+    // Convert to 8-bit straight-alpha RGBA, rows top to bottom
+    void readPixels(std::vector<uint8_t>& rgba) const;
+    
+    // Raw premultiplied float RGBA pixels, rows top to bottom
+    const float* getPixels() const { return m_pixels.data(); }
+    
+    int getWidth() const { return m_width; }
+    int getHeight() const { return m_height; }
+    
+private:
+    int m_width;
+    int m_height;
+    std::vector<float> m_pixels;
+    BrushTipSet m_brushTips;
+    
+    // Smudge pickup, one premultiplied color per symmetry copy
+    std::vector<float> m_pickup;
+    
+    // Mix the canvas under a smudging dab into its copy's pickup
+    void pickUpPaint(const BrushDab& dab, int copy);
+    
+    // Bilinear premultiplied color at a canvas position, clamped to the edges
+    void sampleBilinear(float x, float y, float* color) const;
+};
+
+} // namespace Acute
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "DabSegment.h"
+#include <GL/glew.h>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace Acute {
+
+class Shader;
+class GLStateCache;
+
+// Dab placement and mapping in compute shaders, from the raw input moves.
+//
+// The CPU path uploads every dab; here only the DabSegment of each input
+// sample is uploaded. A prefix sum over the segments' dab counts gives each
+// segment its first dab. Then one invocation per dab finds its segment,
+// interpolates the input along the move, evaluates the mappings from a
+// texture of tabulated curves (color dynamics included, with the jitter
+// hashed from the dab's index in the stroke as ColorDynamics does) and writes
+// the dab in the ComputeRasterizer layout, ready for binning.
+//
+// BrushEngine::processInput remains the reference. The dabs agree with it up
+// to float rounding in placement and the curve tables.
+class DabGenerator {
+public:
+    explicit DabGenerator(GLStateCache& state);
+    ~DabGenerator();
+    
+    bool initialize();
+    
+    // Base values and mapping curves for the following segments, which start
+    // a stroke. imageLayer is the tip array layer of an image tip, or -1 for
+    // round tips.
+    void setBrush(const DabSegmentBrush& brush, int imageLayer);
+    
+    // Write the dabs of the segments (dabCount in total) to the start of
+    // dabBuffer. With a stroke buffer, dab alpha is relative to the stroke
+    // opacity and dabs blend Normal into the scratch.
+    void generate(const DabSegment* segments, size_t count, size_t dabCount, GLuint dabBuffer,
+                  bool strokeBuffer, float strokeOpacity);
+    
+    // Count dabs of the stroke that are not drawn, so later dabs keep their
+    // index (and their color jitter)
+    void skip(size_t dabCount) { m_strokeDabs += dabCount; }
+
+private:
+    GLStateCache& m_state;
+    std::unique_ptr<Shader> m_scanShader;
+    std::unique_ptr<Shader> m_generateShader;
+    
+    GLuint m_segmentBuffer;
+    GLuint m_firstDabBuffer;
+    size_t m_segmentCapacity;
+    size_t m_firstDabCapacity;
+    size_t m_strokeDabs;             // Generated or skipped since setBrush
+    
+    // R32F, DabSegmentBrush::kCurveSamples wide, one row per mapping
+    GLuint m_curveTexture;
+    
+    void reserve(GLuint buffer, size_t& capacity, size_t bytes);
+};
+
+} // namespace Acute
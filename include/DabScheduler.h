@@ -0,0 +1,136 @@
+#pragma once
+
+#include "BrushDab.h"
+#include "DabSegment.h"
+#include "RibbonSegment.h"
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace Acute {
+
+class Canvas;
+
+// Frame budget for stroke rendering, between the brush engine and the canvas.
+//
+// A fast stroke with a huge soft brush can produce thousands of dabs in one
+// input burst, far more than the GPU fills in a frame. Strokes are queued
+// here instead of drawn as they arrive; each frame draws, in order, as many
+// dabs as a cost model predicts will fit in the time budget and leaves the
+// rest for later frames. The canvas shows the waiting tail as a low
+// resolution proxy until the real dabs catch up.
+//
+// The cost model is fitted to measurements: CPU submission time per dab, and
+// GPU time (timer queries, read back a few frames later) per dab and per
+// covered pixel. Ribbon segments are priced and split the same way, as one
+// instance covering their quad. At least one dab is drawn per frame, so even
+// a single dab larger than the budget makes progress.
+//
+// "Dabs" in the counts below include ribbon segments.
+class DabScheduler {
+public:
+    struct Stats {
+        uint64_t dabsDrawn;
+        uint64_t dabsDeferred;     // Drawn in a later frame than they arrived in
+        uint64_t framesBehind;     // Frames that ended with dabs still waiting
+        size_t longestBacklog;     // Most dabs waiting at the end of a frame
+    };
+    
+    DabScheduler();
+    ~DabScheduler();
+    
+    // Create the timer queries (needs a GL context)
+    bool initialize();
+    
+    // Stroke boundaries and content, in input order. The canvas stroke is
+    // begun and ended when drawing reaches these points. Strokes generated on
+    // the GPU pass their brush and submit segments instead of dabs.
+    void beginStroke(bool useStrokeBuffer, float opacity, BlendMode blend,
+                     std::shared_ptr<const DabSegmentBrush> segmentBrush = nullptr);
+    void submit(const std::vector<BrushDab>& dabs);
+    void submitRibbon(const std::vector<RibbonSegment>& segments);
+    void submitSegments(const std::vector<DabSegment>& segments);
+    void endStroke();
+    
+    // Once per frame before the canvas renders: draw what fits in the budget
+    // (seconds) and hand the rest to the canvas proxy
+    void drain(Canvas& canvas, float budget);
+    
+    // Draw everything still queued, whatever it costs. Call before changing
+    // canvas state the queued dabs depend on (clear, selection, symmetry...).
+    void finish(Canvas& canvas);
+    
+    // True if nothing is waiting to be drawn
+    bool isIdle() const;
+    size_t getPendingDabs() const { return m_pendingDabs; }
+    
+    const Stats& getStats() const { return m_stats; }
+    
+private:
+    struct PendingStroke {
+        bool useStrokeBuffer;
+        float opacity;
+        BlendMode blend;
+        bool begun;                        // Begun on the canvas
+        bool ended;                        // No more input will arrive
+        std::vector<BrushDab> dabs;
+        size_t next;                       // First dab not yet drawn
+        std::vector<RibbonSegment> segments;
+        size_t nextRibbon;                 // First ribbon segment not yet drawn
+        std::shared_ptr<const DabSegmentBrush> segmentBrush;
+        std::vector<DabSegment> dabSegments;
+        size_t nextSegment;                // First segment not yet drawn
+    };
+    
+    // One drain's GPU time, with what it drew (dab instances and pixels
+    // over all symmetry copies)
+    struct TimerQuery {
+        GLuint query;
+        bool pending;
+        double dabs;
+        double pixels;
+    };
+    
+    static constexpr int kQuerySlots = 4;
+    
+    // Proxy dabs handed to the canvas; longer tails are thinned out
+    static constexpr size_t kMaxProxyDabs = 4096;
+    
+    std::deque<PendingStroke> m_strokes;
+    size_t m_pendingDabs;
+    
+    // Dabs queued before the current frame began drawing
+    size_t m_carriedDabs;
+    
+    TimerQuery m_queries[kQuerySlots];
+    int m_nextQuery;
+    
+    // Cost model in seconds. The GPU fit is a least squares fit of
+    // time = perDab * dabs + perPixel * pixels over exponentially decaying
+    // sums of the measured batches.
+    double m_cpuPerDab;
+    double m_gpuPerDab;
+    double m_gpuPerPixel;
+    double m_sumDD, m_sumDP, m_sumPP, m_sumDT, m_sumPT;
+    
+    std::vector<BrushDab> m_proxyDabs;
+    Stats m_stats;
+    
+    // Draw queued work up to a budget (negative: no limit)
+    void drawQueued(Canvas& canvas, double budget);
+    
+    // Fold finished timer queries into the GPU fit
+    void collectQueries();
+    void addGpuSample(double dabs, double pixels, double seconds);
+    
+    // Cost of one instance covering pixels (per symmetry copy)
+    double predictCost(double pixels, int copies) const;
+    
+    // Gather the waiting dabs for the canvas proxy
+    void updateProxy(Canvas& canvas);
+};
+
+} // namespace Acute
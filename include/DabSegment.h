@@ -0,0 +1,49 @@
+#pragma once
+
+#include "BrushDab.h"
+#include <cstdint>
+#include <vector>
+
+namespace Acute {
+
+// The dabs of one input move, to be placed and mapped on the GPU.
+//
+// BrushEngine works out the spacing and how many dabs the move gets (the
+// same arithmetic as its CPU path, so the stroke keeps its phase); the dabs
+// themselves are interpolated along the move and mapped by DabGenerator.
+// Laid out as six vec4s for upload (std430).
+struct DabSegment {
+    float x0, y0, x1, y1;                   // From the previous input point to this one
+    float pressure0, pressure1, tiltX0, tiltX1;
+    float tiltY0, tiltY1, rotation0, rotation1;
+    float velocityX0, velocityY0, velocityX1, velocityY1;
+    float length;                           // Of the move, in pixels
+    float distance;                         // Travelled since the last dab, at the end of the move
+    float spacing;                          // Between dabs, in pixels
+    float spacingFactor;                    // Adaptive widening (see AdaptiveSpacing.h)
+    float count;                            // Dabs in this move
+    float blend;                            // BlendMode
+    float size;                             // Mapped dab size at the end, for cost estimates
+    float radius;                           // Farthest any dab's pixels reach from the path
+};
+
+// What the GPU needs to turn segments into dabs: the brush's base values and
+// its mappings, each tabulated over its input range.
+struct DabSegmentBrush {
+    static constexpr int kCurveSamples = 256;
+    static constexpr int kMaxMappings = 16;
+    
+    float size, opacity, hardness, flow, rotation;
+    int tip;                          // Image tip index (-1 = round tip from hardness)
+    float r, g, b;
+    float accumulationScale;          // Stroke opacity with a stroke buffer, 1 otherwise
+    uint32_t colorSeed;               // Color jitter of the stroke (see ColorDynamics)
+    
+    // Per mapping, in order; curves holds kCurveSamples outputs per mapping
+    // for inputs 0 to 1
+    std::vector<int> sources;
+    std::vector<int> targets;
+    std::vector<float> curves;
+};
+
+} // namespace Acute
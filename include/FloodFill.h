@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace Acute {
+
+struct FillOptions {
+    int tolerance = 0;     // Largest per-channel difference from the seed color that still fills (0-255)
+    int gap = 0;           // Close gaps in the outline up to this many pixels wide
+};
+
+// Bucket fill over premultiplied RGBA8 pixels (rows top to bottom, no
+// padding). A scanline span fill: each span is grown left and right 16
+// pixels per SSE2 compare, and the rows above and below are searched for
+// the next spans the same way.
+//
+// With a gap, everything outside the tolerance is a barrier. Barriers are
+// grown by the gap so the fill cannot leak through openings narrower than
+// it; the result is then grown back by the gap, staying off the barriers,
+// so it still reaches the outline.
+//
+// The mask is canvas sized and kept between fills: only the previous
+// fill's bounds are cleared, so a small fill costs little on a large canvas.
+class FloodFill {
+public:
+    FloodFill();
+    
+    // Fill from (x, y). Returns false if the seed lies outside the image.
+    bool fill(const uint8_t* pixels, int width, int height, int x, int y, const FillOptions& options);
+    
+    // One byte per pixel, 255 where filled, 0 elsewhere; the same size and
+    // layout as the pixels
+    const uint8_t* getMask() const { return m_mask.data(); }
+    
+    // Filled region [x0, x1) x [y0, y1) of the last fill (empty if none)
+    int getMinX() const { return m_minX; }
+    int getMinY() const { return m_minY; }
+    int getMaxX() const { return m_maxX; }
+    int getMaxY() const { return m_maxY; }
+    
+private:
+    // A fillable run [x, end) found scanning the row next to a filled span;
+    // the run need not be tested again, nor that span's row and extent
+    struct Seed {
+        int x, end, y;
+        int direction;                 // Row step away from the parent span
+        int parentLeft, parentRight;
+    };
+    
+    int m_width, m_height;
+    int m_minX, m_minY, m_maxX, m_maxY;
+    std::vector<uint8_t> m_mask;
+    std::vector<uint8_t> m_barrier;    // Gap closing: pixels outside the tolerance
+    std::vector<uint8_t> m_blocked;    // The barriers grown by the gap
+    std::vector<uint8_t> m_row;        // Growing a map: one row, padded
+    std::vector<uint8_t> m_above;      // Growing a map: the rows above as they were, a ring
+    std::vector<Seed> m_stack;
+    
+    // Scanline fill from the seed over pixels that pass the test
+    template <typename Test>
+    void fillSpans(const Test& test, int x, int y);
+    
+    // Push a seed for every fillable run of a row within [left, right)
+    template <typename Test>
+    void pushRuns(const Test& test, int y, int left, int right, int direction, int parentLeft, int parentRight);
+    
+    // Grow the set pixels of a map by the radius (square window) within
+    // [x0, x1) x [y0, y1)
+    void grow(uint8_t* map, int x0, int y0, int x1, int y1, int radius);
+};
+
+} // namespace Acute
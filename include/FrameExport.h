@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Acute {
+
+class ReadbackCache;
+
+// Shared memory layout of the live canvas export, for capture tools on the
+// same machine. The segment starts with a FrameExportHeader; the pixels of
+// slot i start at pixelOffset + i * slotBytes. Pixels are premultiplied
+// RGBA8 in canvas pixels, rows top to bottom, stride bytes apart.
+//
+// Frames are numbered from 1 and frame n is written to slot n % slotCount.
+// To read the newest frame, load latest, check the slot's sequence equals
+// it, read the pixels and check the sequence again: it is 0 while the slot
+// is being rewritten. A reader has slotCount - 1 frames to finish.
+//
+// Each slot lists the regions that changed since the frame before it. A
+// reader that skipped frames takes the union of their lists; if one of
+// them is gone from the ring, it reads the whole canvas instead.
+constexpr uint32_t kFrameExportMagic = 0x58464341;    // "ACFX"
+constexpr uint32_t kFrameExportVersion = 1;
+constexpr int kFrameExportSlots = 3;
+constexpr int kFrameExportMaxRects = 64;
+
+struct FrameExportRect {
+    int32_t x0, y0, x1, y1;        // Canvas pixels, y down, exclusive max
+};
+
+struct FrameExportSlot {
+    std::atomic<uint64_t> sequence;
+    uint32_t rectCount;
+    uint32_t reserved;
+    FrameExportRect rects[kFrameExportMaxRects];
+};
+
+struct FrameExportHeader {
+    std::atomic<uint32_t> magic;   // Set last, once the header is filled in
+    uint32_t version;
+    std::atomic<uint32_t> closed;  // The producer stopped or the canvas was resized: open again
+    uint32_t slotCount;
+    int32_t width;
+    int32_t height;
+    uint64_t stride;
+    uint64_t pixelOffset;
+    uint64_t slotBytes;
+    std::atomic<uint64_t> latest;  // Newest complete frame, 0 before the first
+    FrameExportSlot slots[kFrameExportSlots];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free && std::atomic<uint64_t>::is_always_lock_free,
+              "Frame export atomics are shared between processes");
+
+// Publishes the readback cache's canvas mirror into a named shared memory
+// segment (POSIX shm_open, or a named file mapping on Windows). Only tiles
+// refreshed since a slot was last written are copied into it, so an idle
+// canvas costs nothing and a stroke costs the tiles it touches, once per
+// slot.
+class FrameExport {
+public:
+    FrameExport();
+    ~FrameExport();
+    
+    FrameExport(const FrameExport&) = delete;
+    FrameExport& operator=(const FrameExport&) = delete;
+    
+    // Create the segment for a canvas of this size, replacing any segment of
+    // the same name. Prints an error and returns false on failure.
+    bool open(const std::string& name, int width, int height);
+    
+    // Mark the segment closed for readers and remove it
+    void close();
+    
+    bool isOpen() const { return m_header != nullptr; }
+    const std::string& getName() const { return m_name; }
+    uint64_t getSequence() const { return m_sequence; }
+    uint64_t getBytesCopied() const { return m_bytesCopied; }
+    
+    // Publish a frame from the cache's mirror; tiles are the cache tiles
+    // refreshed since the last frame
+    void publish(const ReadbackCache& cache, const std::vector<int>& tiles);
+    
+private:
+    std::string m_name;
+    FrameExportHeader* m_header;
+    uint8_t* m_base;
+    size_t m_size;
+#ifdef PLATFORM_WINDOWS
+    void* m_mapping;
+#endif
+    int m_width, m_height;
+    uint64_t m_sequence;
+    uint64_t m_bytesCopied;
+    
+    // Per slot, per cache tile: refreshed since the slot was last written
+    std::vector<uint8_t> m_pending[kFrameExportSlots];
+    std::vector<FrameExportRect> m_rects;
+    
+    // Map a new segment of m_size bytes; false on failure
+    bool createMapping();
+    void releaseMapping();
+    
+    // Merge the refreshed tiles into row runs, and runs with the same
+    // columns on consecutive rows, into m_rects
+    void buildRects(const ReadbackCache& cache, const std::vector<int>& tiles);
+};
+
+} // namespace Acute
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstdint>
+
+namespace Acute {
+
+// Shadow copy of the GL state the renderer touches.
+//
+// Every bind and state change in Canvas, Renderer and Shader goes through
+// here. A call that would set the value the context already has is skipped
+// and counted as elided, so draw paths can simply set what they need instead
+// of restoring defaults after every draw.
+//
+// Code that changes GL state behind the cache's back must call invalidate().
+// Debug builds can check the shadow copy against glGet queries with validate().
+class GLStateCache {
+public:
+    // State groups with separate counters
+    enum Counter {
+        Framebuffer,
+        Viewport,
+        Program,
+        VertexArray,
+        ArrayBuffer,
+        ActiveTexture,
+        Texture,
+        BlendEnable,
+        BlendFunc,
+        BlendEquation,
+        ClearColor,
+        StencilTest,
+        StencilFunc,
+        StencilOp,
+        CounterCount
+    };
+    
+    struct Stats {
+        uint64_t issued[CounterCount];    // Calls forwarded to GL
+        uint64_t elided[CounterCount];    // Calls skipped as no-ops
+        
+        uint64_t totalIssued() const;
+        uint64_t totalElided() const;
+    };
+    
+    // Texture units and targets tracked per unit; binds outside these pass through
+    static constexpr int kTextureUnits = 6;
+    
+    GLStateCache();
+    
+    // Forget everything; the next call of each kind is always issued
+    void invalidate();
+    
+    // GL_FRAMEBUFFER binds both the draw and read framebuffer
+    void bindFramebuffer(GLenum target, GLuint framebuffer);
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+    
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vertexArray);
+    void bindBuffer(GLenum target, GLuint buffer);
+    
+    // Select a texture unit (0-based, not GL_TEXTURE0)
+    void activeTexture(int unit);
+    
+    // Bind on a unit, switching the active unit if needed. Later glTex* calls
+    // apply to this texture.
+    void bindTexture(int unit, GLenum target, GLuint texture);
+    
+    void setBlend(bool enabled);
+    void blendFunc(GLenum source, GLenum destination);
+    void blendFuncSeparate(GLenum sourceColor, GLenum destinationColor,
+                           GLenum sourceAlpha, GLenum destinationAlpha);
+    void blendEquation(GLenum mode);
+    
+    void clearColor(float r, float g, float b, float a);
+    
+    // Stencil state for both faces; the stencil write mask stays at all ones
+    void setStencilTest(bool enabled);
+    void stencilFunc(GLenum func, GLint ref, GLuint mask);
+    void stencilOp(GLenum stencilFail, GLenum depthFail, GLenum pass);
+    
+    // Delete objects and drop them from the shadow state (GL unbinds deleted
+    // objects, and their names can be reused). Zero the handle.
+    void deleteTexture(GLuint& texture);
+    void deleteFramebuffer(GLuint& framebuffer);
+    void deleteVertexArray(GLuint& vertexArray);
+    void deleteBuffer(GLuint& buffer);
+    
+    // Compare the shadow state with glGet queries and report mismatches.
+    // Stalls the pipeline; meant for debug builds.
+    bool validate() const;
+    
+    const Stats& getStats() const { return m_stats; }
+    void resetStats();
+    
+    static const char* getCounterName(Counter counter);
+    
+private:
+    // Texture targets with a slot per unit
+    enum TextureSlot {
+        Texture2D,
+        Texture2DArray,
+        TextureSlotCount
+    };
+    
+    // Unknown state compares unequal to any real value
+    static constexpr GLuint kUnknownName = 0xFFFFFFFFu;
+    static constexpr GLenum kUnknownEnum = 0xFFFFFFFFu;
+    
+    GLuint m_drawFramebuffer;
+    GLuint m_readFramebuffer;
+    GLint m_viewport[4];
+    bool m_viewportKnown;
+    GLuint m_program;
+    GLuint m_vertexArray;
+    GLuint m_arrayBuffer;
+    int m_activeUnit;
+    GLuint m_textures[kTextureUnits][TextureSlotCount];
+    int m_blendEnabled;                    // -1 unknown
+    GLenum m_blendFunc[4];                 // src rgb, dst rgb, src alpha, dst alpha
+    GLenum m_blendEquation;
+    float m_clearColor[4];
+    bool m_clearColorKnown;
+    int m_stencilEnabled;                  // -1 unknown
+    GLenum m_stencilFunc;
+    GLint m_stencilRef;
+    GLuint m_stencilMask;
+    GLenum m_stencilOp[3];
+    
+    Stats m_stats;
+    
+    // Count a call; returns true if it must be issued
+    bool track(Counter counter, bool changed);
+    
+    static int textureSlot(GLenum target);
+};
+
+} // namespace Acute
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace Acute {
+
+// Minimal dependency-free PNG writer (8-bit RGBA, rows top to bottom).
+// Uses uncompressed deflate blocks, trading file size for speed.
+bool writePng(const std::string& path, const uint8_t* rgba, int width, int height);
+
+} // namespace Acute
@@ -5,6 +5,14 @@
 
 namespace Acute {
 
+// Input device type
+enum class DeviceType {
+    Mouse,
+    StylusPen,
+    StylusEraser,
+    Touch
+};
+
 // Input data structure from stylus/mouse
 struct InputPoint {
     float x;              // X coordinate in pixels
@@ -16,11 +24,13 @@ struct InputPoint {
     float velocityX;      // Speed in X direction
     float velocityY;      // Speed in Y direction
     uint64_t timestamp;   // Timestamp in milliseconds
+    DeviceType device;    // Which tool produced the point (eraser end erases)
     
     InputPoint()
         : x(0.0f), y(0.0f), pressure(1.0f)
         , tiltX(0.0f), tiltY(0.0f), rotation(0.0f)
         , velocityX(0.0f), velocityY(0.0f), timestamp(0)
+        , device(DeviceType::Mouse)
     {}
     
     float getSpeed() const {
@@ -32,14 +42,6 @@ struct InputPoint {
     }
 };
 
-// Input device type
-enum class DeviceType {
-    Mouse,
-    StylusPen,
-    StylusEraser,
-    Touch
-};
-
 } // namespace Acute
 
 
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Acute {
+
+// Minimal dependency-free LZ4 block codec (the raw block format, no frame
+// header or checksum). Greedy single-probe matching: much faster than
+// deflate and good at the flat and repetitive areas canvas tiles are made of.
+
+// Largest compressed size of `size` input bytes
+size_t lz4CompressBound(size_t size);
+
+// Compress into dst; returns the compressed size, or 0 if it does not fit
+size_t lz4Compress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity);
+
+// Decompress a block that must expand to exactly outputSize bytes. Returns
+// false on malformed input; never reads or writes out of bounds.
+bool lz4Decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t outputSize);
+
+} // namespace Acute
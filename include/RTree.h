@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Acute {
+
+// Axis-aligned box in canvas pixels
+struct Box {
+    float minX, minY, maxX, maxY;
+    
+    bool intersects(const Box& other) const {
+        return minX <= other.maxX && other.minX <= maxX && minY <= other.maxY && other.minY <= maxY;
+    }
+    bool contains(float x, float y) const {
+        return x >= minX && x <= maxX && y >= minY && y <= maxY;
+    }
+    float area() const { return (maxX - minX) * (maxY - minY); }
+    Box merged(const Box& other) const;
+};
+
+// Dynamic R-tree mapping boxes to 32-bit values (Guttman, quadratic split).
+// Nodes live in one array and refer to each other by index, so queries walk
+// contiguous memory and the tree copies cheaply.
+class RTree {
+public:
+    RTree();
+    
+    void insert(const Box& box, uint32_t value);
+    
+    // Remove an entry inserted with this exact box. Underfull nodes are kept
+    // (only empty ones are dropped), which slightly loosens later queries.
+    bool remove(const Box& box, uint32_t value);
+    
+    void clear();
+    size_t size() const { return m_size; }
+    
+    // Append the values whose boxes intersect the query box (unordered)
+    void query(const Box& box, std::vector<uint32_t>& values) const;
+    
+    // Append the values whose boxes contain the point (unordered)
+    void queryPoint(float x, float y, std::vector<uint32_t>& values) const;
+    
+    // Bounds of everything in the tree (meaningless when empty)
+    Box getBounds() const;
+    
+private:
+    static constexpr int kMaxEntries = 16;
+    static constexpr int kMinEntries = 6;
+    
+    // One extra slot holds the overflowing entry until the node is split
+    struct Node {
+        bool leaf;
+        int count;
+        Box boxes[kMaxEntries + 1];
+        uint32_t items[kMaxEntries + 1];    // Values in leaves, node indices otherwise
+    };
+    
+    std::vector<Node> m_nodes;
+    std::vector<uint32_t> m_freeNodes;
+    uint32_t m_root;
+    size_t m_size;
+    
+    uint32_t allocateNode(bool leaf);
+    Box nodeBounds(uint32_t node) const;
+    
+    // Insert below a node; returns the index of a new sibling if the node split
+    int64_t insertInto(uint32_t node, const Box& box, uint32_t value);
+    uint32_t split(uint32_t node);
+    
+    // Returns true if found; the node's boxes are tightened on the way back
+    bool removeFrom(uint32_t node, const Box& box, uint32_t value);
+};
+
+} // namespace Acute
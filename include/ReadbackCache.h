@@ -0,0 +1,139 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Acute {
+
+class GLStateCache;
+class TileResidency;
+
+// System memory mirror of the canvas for tools that read pixels on the CPU
+// (the fill tool), kept fresh without ever reading the whole framebuffer at
+// once.
+//
+// The mirror is split into tiles that go stale when drawing marks them
+// dirty. Once per frame a few stale tiles are copied into pixel buffers
+// behind a fence and picked up on a later frame, when the copy has landed,
+// within a byte budget. Tiles still being drawn on wait until the stroke
+// moves on. Tiles that are not resident under tile residency are read from
+// their stored copy instead, never paged in. A tool that needs the mirror
+// now calls finish(), which only waits for the tiles that are still stale.
+//
+// Tiles refreshed since the last takeRefreshed() are remembered for
+// consumers that follow the mirror as it changes (frame export).
+//
+// Pixels are premultiplied RGBA8 in canvas pixels: rows top to bottom,
+// width * 4 bytes each.
+class ReadbackCache {
+public:
+    static constexpr int kTileSize = 256;
+    
+    struct Stats {
+        uint64_t tilesReadBack;    // Copied from the framebuffer
+        uint64_t tilesFromStore;   // Copied from residency's stored tiles
+        uint64_t bytesReadBack;
+        size_t staleTiles;
+    };
+    
+    explicit ReadbackCache(GLStateCache& state);
+    ~ReadbackCache();
+    
+    ReadbackCache(const ReadbackCache&) = delete;
+    ReadbackCache& operator=(const ReadbackCache&) = delete;
+    
+    // Mirror the canvas framebuffer (level 0 attached) of this size, through
+    // residency if it is not null. Every tile starts stale.
+    void initialize(GLuint framebuffer, int width, int height, const TileResidency* residency);
+    
+    // Bytes read back per frame (default 4 MiB)
+    void setFrameBudget(size_t bytes) { m_frameBudget = bytes; }
+    
+    // Read back a tile drawn on every frame once it has been stale this many
+    // frames, instead of waiting for the stroke to move on (default: never)
+    void setMaxDeferral(uint64_t frames) { m_maxDeferral = frames; }
+    
+    // The canvas changed under a region (canvas pixels, y down)
+    void markDirty(int x0, int y0, int x1, int y1);
+    void markAllDirty();
+    
+    // Once per frame: take in landed copies and start copying stale tiles
+    // that were not drawn on this frame, within the budget
+    void update();
+    
+    // Bring every tile up to date now, waiting only for the stale ones
+    void finish();
+    
+    // Indices of the tiles whose pixels changed since the last call (row
+    // major, kTileSize tiles). Returns false if there are none.
+    bool takeRefreshed(std::vector<int>& tiles);
+    
+    // Tile rectangle in canvas pixels, y down
+    void getTileRect(int index, int& x0, int& y0, int& x1, int& y1) const;
+    int getTilesX() const { return m_tilesX; }
+    int getTilesY() const { return m_tilesY; }
+    
+    const uint8_t* getPixels() const { return m_pixels.data(); }
+    int getWidth() const { return m_width; }
+    int getHeight() const { return m_height; }
+    
+    const Stats& getStats() const { return m_stats; }
+    
+private:
+    enum class TileState : uint8_t { Stale, Pending, Fresh };
+    
+    struct Tile {
+        TileState state;
+        uint32_t generation;           // Bumped when drawing makes the tile stale
+        uint32_t landed;               // Generation of the copy in the mirror
+        uint64_t lastDirty;            // Frame the tile was last drawn on
+        uint64_t staleSince;           // Frame the tile last went stale
+    };
+    
+    struct Readback {
+        GLuint buffer;
+        GLsync fence;
+        int tile;                      // -1 when free
+        uint32_t generation;
+    };
+    
+    static constexpr int kReadbackSlots = 16;
+    
+    GLStateCache& m_state;
+    GLuint m_framebuffer;
+    const TileResidency* m_residency;
+    int m_width, m_height;
+    int m_tilesX, m_tilesY;
+    size_t m_frameBudget;
+    uint64_t m_maxDeferral;
+    uint64_t m_frame;
+    
+    std::vector<uint8_t> m_pixels;
+    std::vector<Tile> m_tiles;
+    size_t m_nextStale;                // Where the search for stale tiles resumes
+    std::vector<uint8_t> m_refreshed;  // Per tile: changed since takeRefreshed()
+    size_t m_refreshedCount;
+    Readback m_readbacks[kReadbackSlots];
+    
+    // The residency tile last read from its store, by its first texel
+    std::vector<uint8_t> m_stored;
+    int m_storedX, m_storedY;
+    
+    Stats m_stats;
+    
+    // Start copying a stale tile, or copy it from the store at once. Returns
+    // false if no slot is free.
+    bool beginReadback(int index);
+    
+    // Take in landed copies; with wait, block until at least one lands
+    void finishReadbacks(bool wait);
+    
+    // Copy a tile from residency's store; false if it is resident
+    bool readStored(int index);
+    
+    void markRefreshed(int index);
+};
+
+} // namespace Acute
@@ -1,7 +1,10 @@
 #pragma once
 
+#include "GLStateCache.h"
+
 namespace Acute {
 
+// Owns the GL state cache shared by everything that draws
 class Renderer {
 public:
     Renderer();
@@ -16,8 +19,11 @@ public:
     // Clear the screen
     void clear();
     
+    GLStateCache& getState() { return m_state; }
+    
 private:
     float m_clearColor[4];
+    GLStateCache m_state;
 };
 
 } // namespace Acute
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "BrushDab.h"
+
+namespace Acute {
+
+// One piece of a ribbon stroke: a tapered capsule from (x0, y0) with radius r0
+// to (x1, y1) with radius r1. A stroke is a chain of segments whose round ends
+// form the caps and joins.
+struct RibbonSegment {
+    float x0, y0, r0;     // Start point and radius in pixels
+    float x1, y1, r1;     // End point and radius in pixels
+    float opacity;        // Combined opacity * flow, 0.0 to 1.0
+    float hardness;       // Edge hardness 0.0 to 1.0
+    bool joinsPrevious;   // Start disc is shared with the previous segment's end cap
+    BlendMode blend;      // Blend mode (the same for a whole stroke)
+    
+    // Color (RGB)
+    float r, g, b;
+    
+    RibbonSegment()
+        : x0(0.0f), y0(0.0f), r0(0.0f)
+        , x1(0.0f), y1(0.0f), r1(0.0f)
+        , opacity(1.0f), hardness(1.0f), joinsPrevious(false)
+        , blend(BlendMode::Normal)
+        , r(0.0f), g(0.0f), b(0.0f)
+    {}
+};
+
+} // namespace Acute
@@ -1,10 +1,18 @@
 #pragma once
 
+#include <initializer_list>
 #include <string>
 #include <GL/glew.h>
 
 namespace Acute {
 
+class GLStateCache;
+
+// GLSL blendPremultiplied(src, dst, mode): premultiplied blend of src into
+// dst, mode values match BlendMode. Used by the shader fallback path, the
+// stroke preview on screen and the compute rasterizer.
+extern const char* const kBlendFunctionSource;
+
 class Shader {
 public:
     Shader();
@@ -13,11 +21,14 @@ public:
     // Load and compile shaders from source code
     bool loadFromSource(const std::string& vertexSource, const std::string& fragmentSource);
     
+    // Load a compute program (GL 4.3)
+    bool loadComputeFromSource(const std::string& computeSource);
+    
     // Load shaders from files
     bool loadFromFile(const std::string& vertexPath, const std::string& fragmentPath);
     
-    // Use this shader program
-    void use() const;
+    // Use this shader program (skipped if it is already current)
+    void use(GLStateCache& state) const;
     
     // Utility functions for setting uniforms
     void setInt(const std::string& name, int value) const;
@@ -27,6 +38,11 @@ public:
     void setVec4(const std::string& name, float x, float y, float z, float w) const;
     void setMat4(const std::string& name, const float* value) const;
     
+    // Array of column-major mat3x2 (6 floats each)
+    void setMat3x2Array(const std::string& name, const float* values, int count) const;
+    
+    void setIntArray(const std::string& name, const int* values, int count) const;
+    
     GLuint getProgram() const { return m_program; }
     
 private:
@@ -36,7 +52,7 @@ private:
     GLuint compileShader(GLenum type, const std::string& source);
     
     // Link the program
-    bool linkProgram(GLuint vertexShader, GLuint fragmentShader);
+    bool linkProgram(std::initializer_list<GLuint> shaders);
 };
 
 } // namespace Acute
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "BrushEngine.h"
+#include "InputTypes.h"
+#include "RTree.h"
+#include <cstdint>
+#include <vector>
+
+namespace Acute {
+
+class CpuCanvas;
+
+// A stroke as it was drawn: the input, the brush and the random seed, which
+// together reproduce its dabs exactly
+struct StrokeRecord {
+    std::vector<InputPoint> points;
+    BrushSettingsPtr settings;
+    uint32_t seed;
+    Box bounds;          // Every pixel the stroke can touch
+    bool removed;
+};
+
+// Non-destructive record of every stroke on a canvas, indexed by bounding
+// box. Strokes are drawn in id order; ids are never reused.
+//
+// Pixels can be rebuilt from the history at any time: a region after some
+// strokes changed, or any region at any resolution for export.
+class StrokeHistory {
+public:
+    StrokeHistory();
+    
+    // Record a finished stroke; returns its id
+    uint32_t addStroke(std::vector<InputPoint> points, BrushSettingsPtr settings, uint32_t seed);
+    
+    // Change a stroke's brush or drop it. Returns the canvas region that must
+    // be redrawn (the old and new bounds).
+    Box setStrokeSettings(uint32_t id, BrushSettingsPtr settings);
+    Box removeStroke(uint32_t id);
+    
+    void clear();
+    
+    size_t getStrokeCount() const { return m_strokes.size(); }
+    const StrokeRecord& getStroke(uint32_t id) const { return m_strokes[id]; }
+    
+    // Strokes whose bounds intersect a region, in drawing order
+    void queryRegion(const Box& region, std::vector<uint32_t>& ids) const;
+    
+    // Strokes whose path passes within `radius` of a point plus their own
+    // brush radius, in drawing order (topmost last)
+    void hitTest(float x, float y, float radius, std::vector<uint32_t>& ids) const;
+    
+    // Clear [region] of the canvas and draw every stroke touching it again,
+    // clipped to the region. Canvas and history share coordinates.
+    void redrawRegion(BrushEngine& engine, CpuCanvas& canvas, const Box& region) const;
+    
+    // Draw the strokes touching a region into a canvas whose origin is the
+    // region's top-left corner, scaled by `scale` (canvas sized by the caller)
+    void rasterize(BrushEngine& engine, CpuCanvas& canvas, const Box& region, float scale) const;
+    
+    // The dabs rasterize() would draw, in order (for parallel compositing)
+    void collectDabs(BrushEngine& engine, const Box& region, float scale, std::vector<BrushDab>& dabs) const;
+    
+    // Bounds of a stroke's input path grown by the brush radius
+    static Box computeBounds(const std::vector<InputPoint>& points, const BrushSettings& settings);
+    
+private:
+    std::vector<StrokeRecord> m_strokes;
+    RTree m_index;
+    mutable std::vector<uint32_t> m_candidates;
+    
+    // Run a stroke through the engine with its seed, offset and scale
+    void replay(BrushEngine& engine, const StrokeRecord& stroke, float originX, float originY,
+                float scale, std::vector<BrushDab>& dabs) const;
+};
+
+} // namespace Acute
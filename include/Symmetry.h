@@ -0,0 +1,57 @@
+#pragma once
+
+#include "BrushDab.h"
+#include <string>
+#include <vector>
+
+namespace Acute {
+
+// Symmetry modes
+enum class SymmetryMode {
+    None,
+    MirrorX,    // Reflect across the vertical axis through the center
+    MirrorY,    // Reflect across the horizontal axis through the center
+    Radial,     // N copies rotated about the center
+    Tiled       // Wrap around the canvas edges
+};
+
+// Rigid transform of canvas pixels, column-major 2x3 (the layout of a GLSL
+// mat3x2): x' = m[0] * x + m[2] * y + m[4], y' = m[1] * x + m[3] * y + m[5]
+struct SymmetryTransform {
+    float m[6];
+    float rotation;    // Degrees, in the dab rotation convention
+    bool mirrored;     // Reflection: the tip is flipped and rotation runs backwards
+    
+    void apply(float& x, float& y) const {
+        float tx = m[0] * x + m[2] * y + m[4];
+        y = m[1] * x + m[3] * y + m[5];
+        x = tx;
+    }
+};
+
+// Symmetry settings for a canvas. Dabs are generated once; the canvas draws
+// one copy per transform.
+struct Symmetry {
+    static constexpr int kMaxTransforms = 32;
+    
+    SymmetryMode mode = SymmetryMode::None;
+    int segments = 8;          // Radial copies (2 to kMaxTransforms)
+    float centerX = -1.0f;     // Mirror axes and radial center in canvas
+    float centerY = -1.0f;     // pixels (negative = canvas center)
+    
+    // Transforms replicating a dab, identity first. Tiled mode repeats with
+    // the canvas size as period, so a dab crossing an edge reappears on the
+    // opposite side.
+    std::vector<SymmetryTransform> buildTransforms(int canvasWidth, int canvasHeight) const;
+};
+
+// Copy of a dab moved by a transform. BrushDab has no flip, so a mirrored
+// copy of an asymmetric image tip is rotated rather than reflected; the GPU
+// canvas applies the full transform instead.
+BrushDab transformDab(const BrushDab& dab, const SymmetryTransform& transform);
+
+// Parse "none", "mirror-x", "mirror-y", "radial[:N]" or "tiled"
+bool parseSymmetry(const std::string& text, Symmetry& symmetry);
+std::string toString(const Symmetry& symmetry);
+
+} // namespace Acute
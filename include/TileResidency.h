@@ -0,0 +1,250 @@
+#pragma once
+
+#include "TileStore.h"
+#include <GL/glew.h>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Acute {
+
+class GLStateCache;
+
+// Video memory residency for a canvas texture larger than the card can hold.
+//
+// The texture is sparse (ARB_sparse_texture): level 0 and the finer mip
+// levels are split into square tiles whose pages are committed only while the
+// tile is resident. Everything else lives LZ4-compressed in system memory, in
+// a TileStore that keeps one copy of identical tiles. The coarse levels stay
+// committed, so any part of the canvas can always be shown blurred while its
+// tile streams in; the screen shader clamps its level of detail per tile
+// through a small lookup texture.
+//
+// Residency follows the view: visible tiles first, then a ring around them
+// and the tiles the pan is heading for. Least recently used tiles are evicted
+// once the budget is full. Uploads and readbacks go through pixel buffers and
+// are limited to a byte budget per frame, so streaming never stalls a frame;
+// only drawing onto a tile that is not resident waits for it.
+//
+// Tiles that have not been drawn on for a while are re-encoded to BC7 on a
+// worker thread and their RGBA8 pages released: they stay on screen from a
+// compressed texture array at a quarter of the video memory, keeping a
+// lossless LZ4 copy in system memory. Drawing on such a tile restores RGBA8
+// from that copy, so compression never loses paint, only display precision.
+// Identical tiles share their layer as they share their stored copy.
+//
+// Tiles are addressed in texels (rows bottom up, as in the framebuffer).
+class TileResidency {
+public:
+    static constexpr int kTileSize = 512;
+    
+    struct Stats {
+        uint64_t hits;             // Tiles needed (visible or drawn on) and resident
+        uint64_t misses;           // Tiles needed but not resident
+        uint64_t evictions;
+        uint64_t bytesUploaded;
+        uint64_t bytesReadBack;
+        uint64_t compressions;     // Cold tiles moved to BC7
+        uint64_t deduplicated;     // Tiles stored as a reference to identical contents
+        size_t residentTiles;
+        size_t compressedTiles;    // Shown from BC7
+        size_t compressedLayers;   // Distinct BC7 tiles in video memory
+        size_t storedBytes;        // LZ4 size of the distinct stored tiles
+    };
+    
+    explicit TileResidency(GLStateCache& state);
+    ~TileResidency();
+    
+    // True if the driver supports sparse textures and the size is whole tiles
+    static bool isSupported(int width, int height);
+    
+    // Allocate sparse storage for the (bound, not yet allocated) texture on
+    // unit 0 and commit the coarse levels. `framebuffer` has level 0 attached
+    // and is used for readbacks. Returns false if sparse storage fails.
+    bool initialize(GLuint texture, GLuint framebuffer, int width, int height, int levels,
+                    size_t budgetBytes);
+                    
+    // Bytes uploaded or read back per frame while streaming (default 4 MiB)
+    void setFrameBudget(size_t bytes) { m_frameBudget = bytes; }
+    
+    // Frames without drawing before a tile is compressed (default 300); 0
+    // keeps every tile RGBA8
+    void setColdFrames(uint64_t frames) { m_coldFrames = frames; }
+    
+    // The whole canvas was cleared to a color (premultiplied RGBA8): evicted
+    // tiles become solid, pending readbacks are dropped
+    void clear(const uint8_t color[4]);
+    
+    // Make the tiles under a texel region resident now, ignoring the frame
+    // budget. Call before drawing on or reading from the region.
+    void require(int x0, int y0, int x1, int y1);
+    
+    // Level 0 texels (kTileSize squared RGBA8, rows bottom up) of the tile
+    // under texel (x, y) if it is not resident: its stored copy, or the clear
+    // color. Returns false if the tile is resident and the texture holds it.
+    bool readStored(int x, int y, uint8_t* texels) const;
+    
+    // Flag the resident tiles under a texel region for mip regeneration
+    void markDirty(int x0, int y0, int x1, int y1);
+    
+    // Texel rects (x0, y0, x1, y1) of the tiles whose mips must be rebuilt;
+    // clears the flags
+    void takeDirtyTiles(std::vector<int>& rects);
+    
+    // Once per frame: stream towards the visible texel region at a display
+    // level of detail, finish readbacks and evict over budget
+    void update(float x0, float y0, float x1, float y1, float lod);
+    
+    // Per tile (R8, NEAREST): the finest level that is committed, divided by 255
+    GLuint getLodTexture() const { return m_lodTexture; }
+    
+    // Per tile (R16UI, NEAREST): 1 + its layer in the compressed array, or 0
+    GLuint getSlotTexture() const { return m_slotTexture; }
+    
+    // BC7 array of the compressed tiles (0 if unsupported); its levels match
+    // the tiled levels
+    GLuint getCompressedTexture() const { return m_compressedTexture; }
+    
+    // Levels below this are split into tiles; from it on they stay committed
+    int getTiledLevels() const { return m_tiledLevels; }
+    
+    const Stats& getStats() const { return m_stats; }
+    
+private:
+    struct Tile {
+        bool resident;
+        bool dirty;                    // Mips need rebuilding
+        bool encoding;                 // Queued for BC7
+        int readback;                  // Pending readback slot, or -1
+        int slot;                      // Layer in the compressed array, or -1
+        uint32_t generation;           // Bumped when drawing invalidates an encode
+        uint64_t lastUsed;             // Frame the tile was last needed
+        uint64_t lastDrawn;            // Frame the tile was last drawn on or uploaded
+        std::shared_ptr<TileStore::Entry> data;    // Level 0 texels; null means solid
+    };
+    
+    struct Readback {
+        GLuint buffer;
+        GLsync fence;
+        int tile;                      // -1 when free
+        bool compress;                 // For BC7 rather than eviction
+    };
+    
+    // Level 0 texels in, every tiled level of BC7 out
+    struct EncodeJob {
+        int tile;
+        uint32_t generation;
+        std::vector<uint8_t> pixels;
+        std::vector<uint8_t> blocks;
+    };
+    
+    static constexpr int kReadbackSlots = 8;
+    static constexpr int kUploadSlots = 4;
+    static constexpr float kLookaheadFrames = 12.0f;
+    static constexpr size_t kMaxEncodes = 2;
+    
+    GLStateCache& m_state;
+    GLuint m_texture;
+    GLuint m_framebuffer;
+    int m_tilesX, m_tilesY;
+    int m_tiledLevels;
+    size_t m_maxResident;
+    size_t m_frameBudget;
+    uint64_t m_coldFrames;
+    uint64_t m_frame;
+    
+    // Declared before the tiles, which hold references into it
+    TileStore m_store;
+    std::vector<Tile> m_tiles;
+    uint8_t m_solidColor[4];
+    
+    // Pixel buffers: uploads cycle through theirs, readbacks hold one each
+    // until the copy has landed
+    GLuint m_uploadBuffers[kUploadSlots];
+    int m_nextUpload;
+    Readback m_readbacks[kReadbackSlots];
+    
+    // Pan velocity in texels per frame, smoothed
+    bool m_viewKnown;
+    float m_lastCenterX, m_lastCenterY;
+    float m_velocityX, m_velocityY;
+    
+    GLuint m_lodTexture;
+    std::vector<uint8_t> m_lodValues;
+    bool m_lodChanged;
+    
+    std::vector<int> m_wanted;
+    
+    // Compressed array, grown by doubling, its free layers and the tiles
+    // showing each layer
+    GLuint m_compressedTexture;
+    int m_compressedLayers;
+    int m_maxCompressedLayers;
+    std::vector<int> m_freeSlots;
+    std::vector<int> m_layerUsers;
+    
+    GLuint m_slotTexture;
+    std::vector<uint16_t> m_slotValues;
+    bool m_slotsChanged;
+    
+    // BC7 worker: jobs in, finished jobs out
+    std::thread m_encoder;
+    std::mutex m_encodeMutex;
+    std::condition_variable m_encodeWake;
+    std::deque<EncodeJob> m_encodeJobs;
+    std::vector<EncodeJob> m_encoded;
+    size_t m_encodesPending;           // Queued or running, main thread's count
+    bool m_encoderStopping;
+    
+    Stats m_stats;
+    
+    size_t tileBytes() const { return static_cast<size_t>(kTileSize) * kTileSize * 4; }
+    
+    // Commit or release a tile's pages in every tiled level
+    void commit(int index, bool commit);
+    
+    // Commit a tile and fill level 0 from its stored data
+    void upload(int index);
+    
+    // Start copying a resident tile to a pixel buffer, to evict it or to
+    // compress it; false if no slot is free
+    bool beginReadback(int index, bool compress);
+    
+    // Compress landed readbacks and release their pages (evictions) or queue
+    // them for BC7, within the budget
+    void finishReadbacks(size_t& budget);
+    
+    // Keep a tile resident as it is: drop its pending readback
+    void cancelReadback(int index);
+    
+    void setResident(int index, bool resident);
+    
+    // Start encoding tiles that have not been drawn on for a while
+    void compressColdTiles();
+    
+    // Show finished encodes from the compressed array and release their pages
+    void takeEncoded();
+    
+    // Show a resident tile from a layer of the compressed array and release
+    // its pages
+    void showCompressed(int index, int slot);
+    
+    // A free layer in the compressed array, growing it if needed; -1 if full
+    int allocateSlot();
+    
+    // Stop showing a tile from the compressed array; true if that freed its
+    // layer
+    bool releaseSlot(int index);
+    
+    // Drop a queued encode: the tile has changed
+    void cancelEncode(int index);
+    
+    void encoderLoop();
+};
+
+} // namespace Acute
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "BrushDab.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Acute {
+
+class CpuCanvas;
+
+// Multi-core dab compositing for CpuCanvas.
+// Dabs are binned into screen tiles by bounding box, keeping submission order
+// within each tile, and the tiles are processed by a work-stealing thread pool.
+// Every pixel belongs to exactly one tile and each tile replays its dabs in
+// order, so the output is identical to serial compositing.
+class TileScheduler {
+public:
+    static constexpr int kTileSize = 64;
+    
+    // threadCount <= 0 uses every hardware thread
+    explicit TileScheduler(int threadCount = 0);
+    ~TileScheduler();
+    
+    TileScheduler(const TileScheduler&) = delete;
+    TileScheduler& operator=(const TileScheduler&) = delete;
+    
+    // Composite dabs onto the canvas in parallel (blocks until done). Dabs
+    // are grouped by symmetry copies as for CpuCanvas::drawDabs. Smudging
+    // dabs read pixels beyond their tile, so a batch with any is drawn in
+    // order on the calling thread.
+    void composite(CpuCanvas& canvas, const std::vector<BrushDab>& dabs, int copies = 1);
+    
+    // Run task(index) for every index in [0, count) on the pool (blocks until done).
+    // The calling thread takes part as worker 0.
+    void parallelFor(size_t count, const std::function<void(size_t)>& task);
+    
+    int getThreadCount() const { return static_cast<int>(m_queues.size()); }
+    
+    // Counters since construction
+    uint64_t getTasksRun() const { return m_tasksRun.load(); }
+    uint64_t getTasksStolen() const { return m_tasksStolen.load(); }
+    
+private:
+    // Per-worker task deque: the owner pops from the back, thieves take the front
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+    
+    std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+    std::vector<std::thread> m_threads;
+    
+    // Job hand-off
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const std::function<void(size_t)>* m_task;
+    uint64_t m_generation;
+    std::atomic<size_t> m_remaining;
+    bool m_stopping;
+    
+    std::atomic<uint64_t> m_tasksRun;
+    std::atomic<uint64_t> m_tasksStolen;
+    
+    // Tile bins (dab indices in submission order), reused between calls
+    std::vector<std::vector<uint32_t>> m_bins;
+    std::vector<uint32_t> m_activeTiles;
+    
+    // Worker thread body (index >= 1)
+    void workerLoop(int index);
+    
+    // Run tasks until none are left anywhere
+    void drainTasks(int index);
+    
+    // Take a task from the worker's own queue, or steal one
+    bool takeTask(int index, size_t& task);
+};
+
+} // namespace Acute
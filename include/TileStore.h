@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace Acute {
+
+// Content-addressed store for tile texels in system memory.
+//
+// Tiles are hashed when they are stored. Identical contents (blank and solid
+// tiles, repeats from tiled symmetry, a tile stored again unchanged) share
+// one LZ4 copy by reference count, so memory grows with the distinct tiles
+// only. Entries are immutable: a tile that changes is stored anew and drops
+// its reference, which frees the old copy once nothing else uses it.
+//
+// Not thread-safe; references must not outlive the store (their deleter
+// unregisters the entry).
+class TileStore {
+public:
+    struct Entry {
+        uint64_t hash;
+        std::vector<uint8_t> data;     // LZ4 texels
+        int layer;                     // Owner's GPU copy (e.g. a BC7 layer), or -1
+    };
+    
+    struct Stats {
+        uint64_t hits;                 // Stores that found their contents already there
+        uint64_t misses;
+        size_t entries;
+        size_t storedBytes;            // LZ4 bytes of the distinct entries
+    };
+    
+    explicit TileStore(size_t tileBytes);
+    
+    TileStore(const TileStore&) = delete;
+    TileStore& operator=(const TileStore&) = delete;
+    
+    // The entry for tileBytes of texels, shared if they are stored already;
+    // null if they do not compress
+    std::shared_ptr<Entry> store(const uint8_t* texels);
+    
+    // Expand an entry into tileBytes of texels; false if it is corrupt
+    bool load(const Entry& entry, uint8_t* texels) const;
+    
+    const Stats& getStats() const { return m_stats; }
+    
+private:
+    size_t m_tileBytes;
+    
+    struct Live {
+        Entry* entry;
+        std::weak_ptr<Entry> reference;
+    };
+    
+    // Live entries by hash; colliding contents share a bucket
+    std::unordered_multimap<uint64_t, Live> m_entries;
+    std::vector<uint8_t> m_compressScratch;
+    std::vector<uint8_t> m_loadScratch;
+    
+    Stats m_stats;
+    
+    // Called when the last reference to an entry goes
+    void release(Entry* entry);
+};
+
+} // namespace Acute
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Acute {
+
+// Time-lapse recording of the canvas as tile deltas (.actl files).
+//
+// A snapshot stores only the tiles that changed since the one before, each
+// as the XOR with its previous contents: unchanged pixels become zero bytes.
+// The delta is split into byte planes (all reds, then greens, ...) so a
+// stroke of one color becomes long runs, and LZ4 compressed. A keyframe
+// stores every tile outright, so playback can start from it. An idle canvas
+// writes nothing.
+//
+// Tiles are ReadbackCache tiles, and pixels are premultiplied RGBA8 in
+// canvas pixels, rows top to bottom.
+struct TimelapseOptions {
+    float interval = 5.0f;              // Seconds between snapshots
+    float keyframeInterval = 600.0f;    // Seconds between keyframes
+};
+
+// Records from the readback cache's canvas mirror. The main thread only
+// copies the changed tiles out of the mirror, a few per frame; deltas are
+// computed, compressed and written on a worker thread. The worker keeps
+// every tile's last contents compressed, so its memory follows the
+// compressed canvas size and keyframes need no compression.
+class TimelapseRecorder {
+public:
+    static constexpr int kTileSize = 256;
+    
+    struct Stats {
+        uint64_t snapshots;
+        uint64_t keyframes;
+        uint64_t tilesWritten;
+        uint64_t bytesWritten;
+    };
+    
+    TimelapseRecorder();
+    ~TimelapseRecorder();
+    
+    TimelapseRecorder(const TimelapseRecorder&) = delete;
+    TimelapseRecorder& operator=(const TimelapseRecorder&) = delete;
+    
+    // Start a new file for a canvas of this size. Prints an error and
+    // returns false on failure.
+    bool open(const std::string& path, int width, int height, const TimelapseOptions& options);
+    
+    // Write what is still queued and close the file
+    void close();
+    
+    bool isOpen() const { return m_file != nullptr; }
+    const std::string& getPath() const { return m_path; }
+    
+    // Once per frame, with the mirror and the tiles refreshed in it this
+    // frame (row major, kTileSize tiles)
+    void update(const uint8_t* pixels, const std::vector<int>& refreshed);
+    
+    // Record every tile still pending as a last snapshot, then close
+    void finish(const uint8_t* pixels, const std::vector<int>& refreshed);
+    
+    // The canvas was resized (and cleared); the next snapshot is a keyframe
+    void resize(int width, int height);
+    
+    // Copied under the worker's lock
+    Stats getStats() const;
+    
+private:
+    struct Snapshot {
+        uint64_t time = 0;              // Milliseconds since recording started
+        int width = 0, height = 0;
+        bool reset = false;             // First snapshot at this size
+        std::vector<int> tiles;
+        std::vector<uint8_t> texels;    // Whole tiles, zero padded at the edges
+    };
+    
+    std::string m_path;
+    FILE* m_file;
+    TimelapseOptions m_options;
+    int m_width, m_height;
+    int m_tilesX, m_tilesY;
+    uint64_t m_startTime;
+    uint64_t m_lastSnapshot;
+    bool m_reset;
+    
+    // Main thread: tiles changed since they were last copied, and the
+    // snapshot being copied, a byte budget per frame
+    std::vector<uint8_t> m_pending;
+    size_t m_pendingCount;
+    bool m_collecting;
+    size_t m_cursor;
+    Snapshot m_collected;
+    
+    // Worker: one snapshot at a time; the main thread waits for it to finish
+    // before it starts copying the next
+    std::thread m_worker;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    Snapshot m_queued;
+    bool m_hasQueued;
+    bool m_working;
+    bool m_stopping;
+    Stats m_stats;
+    
+    // Worker state: each tile's last contents, compressed byte planes
+    // (empty: transparent), and the time of the last keyframe
+    std::vector<std::vector<uint8_t>> m_stored;
+    uint64_t m_lastKeyframe;
+    bool m_wroteKeyframe;
+    
+    uint64_t now() const;
+    
+    void markPending(const std::vector<int>& refreshed);
+    
+    // Start a snapshot if the worker is free (with wait, once it is)
+    bool beginSnapshot(bool wait);
+    
+    // Copy pending tiles into the snapshot within a byte budget; true once
+    // every tile has been looked at
+    bool copyTiles(const uint8_t* pixels, size_t budget);
+    
+    void queueSnapshot();
+    
+    void workerLoop();
+    
+    // Delta or keyframe record for a snapshot; false on a write error
+    bool writeSnapshot(const Snapshot& snapshot);
+};
+
+// Reads a time-lapse back, one record at a time, into a whole canvas image
+class TimelapseReader {
+public:
+    static constexpr int kTileSize = TimelapseRecorder::kTileSize;
+    
+    TimelapseReader();
+    ~TimelapseReader();
+    
+    TimelapseReader(const TimelapseReader&) = delete;
+    TimelapseReader& operator=(const TimelapseReader&) = delete;
+    
+    // Prints an error and returns false if the file is not a time-lapse
+    bool open(const std::string& path);
+    
+    // Apply the next record. Returns false at the end of the file, or at a
+    // damaged or truncated record (the recording was cut short).
+    bool next();
+    
+    // Time of the record next() would apply; false at the end
+    bool peekTime(uint64_t& time);
+    
+    // Skip to the last keyframe at or before a time (milliseconds) and
+    // apply it; the first record is always a keyframe
+    bool seek(uint64_t time);
+    
+    // After next(): the record's time, size and the tiles it changed
+    uint64_t getTime() const { return m_time; }
+    bool isKeyframe() const { return m_keyframe; }
+    int getWidth() const { return m_width; }
+    int getHeight() const { return m_height; }
+    const std::vector<int>& getChangedTiles() const { return m_changed; }
+    int getTilesX() const { return m_tilesX; }
+    
+    // Tile rectangle in canvas pixels, y down
+    void getTileRect(int index, int& x0, int& y0, int& x1, int& y1) const;
+    
+    // The canvas as of the last record
+    const uint8_t* getPixels() const { return m_pixels.data(); }
+    
+private:
+    FILE* m_file;
+    uint64_t m_time;
+    bool m_keyframe;
+    int m_width, m_height;
+    int m_tilesX, m_tilesY;
+    std::vector<int> m_changed;
+    std::vector<uint8_t> m_pixels;
+    std::vector<uint8_t> m_compressed;
+    std::vector<uint8_t> m_planes;
+    std::vector<uint8_t> m_tile;
+};
+
+} // namespace Acute
@@ -0,0 +1,132 @@
+#include "AdaptiveSpacing.h"
+#include "BrushTip.h"
+#include <algorithm>
+#include <mutex>
+
+namespace Acute {
+
+namespace {
+
+// Tabulated spacings: kSpacingStep, 2 * kSpacingStep, ... (fractions of the size)
+constexpr float kSpacingStep = 0.01f;
+constexpr int kSpacingSteps = 60;
+
+// Sample grid: rows across the stroke, positions within one dab period, and
+// the samples of the coverage integral along a row
+constexpr int kRows = 12;
+constexpr int kPhases = 9;
+constexpr int kIntegralSamples = 64;
+
+// One 8-bit alpha step
+constexpr float kInvisibleRipple = 1.0f / 255.0f;
+
+// Where a stroke starts or ends the overlap is one-sided, and a wide step
+// changes the alpha there by about this fraction of the alpha it adds
+// (measured with acute-render --bench-spacing)
+constexpr float kEndRipple = 0.25f;
+
+// The profile BrushTipSet::createRoundTip bakes, for a dab of size 1
+float roundTipProfile(float inner, float dist) {
+    const float outer = 0.5f;
+    float t = std::max(0.0f, std::min(1.0f, (dist - inner) / (outer - inner)));
+    return 1.0f - t * t * (3.0f - 2.0f * t);
+}
+
+// Largest deviation of the summed tip coverage from its mean along the
+// stroke, per round tip layer and spacing. Rows are made non-decreasing in
+// spacing, so they also bound the spacings between the samples. Each row is
+// built the first time its hardness is drawn with.
+class RippleTable {
+public:
+    const float* getRow(int layer) {
+        std::call_once(m_built[layer], [this, layer]() { buildRow(layer); });
+        return m_ripple[layer];
+    }
+    
+private:
+    float m_ripple[BrushTipSet::kRoundTipCount][kSpacingSteps];
+    std::once_flag m_built[BrushTipSet::kRoundTipCount];
+    
+    void buildRow(int layer) {
+        float hardness = static_cast<float>(layer) / (BrushTipSet::kRoundTipCount - 1);
+        float inner = std::min(hardness * 0.5f, 0.5f - 1.0f / BrushTipSet::kTipSize);
+        
+        // Coverage of one dab integrated along each row
+        float integrals[kRows];
+        for (int row = 0; row < kRows; row++) {
+            float y = (row + 0.5f) * 0.5f / kRows;
+            float halfWidth = std::sqrt(0.25f - y * y);
+            float sum = 0.0f;
+            for (int i = 0; i < kIntegralSamples; i++) {
+                float x = ((i + 0.5f) / kIntegralSamples * 2.0f - 1.0f) * halfWidth;
+                sum += roundTipProfile(inner, std::sqrt(x * x + y * y));
+            }
+            integrals[row] = sum * 2.0f * halfWidth / kIntegralSamples;
+        }
+        
+        float worst = 0.0f;
+        for (int step = 0; step < kSpacingSteps; step++) {
+            float spacing = (step + 1) * kSpacingStep;
+            for (int row = 0; row < kRows; row++) {
+                float y = (row + 0.5f) * 0.5f / kRows;
+                float halfWidth = std::sqrt(0.25f - y * y);
+                float mean = integrals[row] / spacing;
+                
+                // The sum is symmetric about a dab and about the midpoint
+                int reach = static_cast<int>(halfWidth / spacing) + 1;
+                for (int phase = 0; phase < kPhases; phase++) {
+                    float x = phase * 0.5f * spacing / (kPhases - 1);
+                    float sum = 0.0f;
+                    for (int i = -reach; i <= reach; i++) {
+                        float dx = x - i * spacing;
+                        sum += roundTipProfile(inner, std::sqrt(dx * dx + y * y));
+                    }
+                    worst = std::max(worst, std::abs(sum - mean));
+                }
+            }
+            m_ripple[layer][step] = worst;
+        }
+    }
+};
+
+RippleTable& rippleTable() {
+    static RippleTable table;
+    return table;
+}
+
+} // namespace
+
+float adaptiveSpacingFactor(float hardness, float alpha, float maxAlpha, float spacing) {
+    if (alpha <= 0.0f || alpha >= maxAlpha || spacing <= 0.0f) {
+        return 1.0f;
+    }
+    const float* ripple = rippleTable().getRow(BrushTipSet::roundTipLayer(hardness));
+    
+    // The brush's own ripple, from the tabulated spacing at or below its own
+    int own = static_cast<int>(spacing / kSpacingStep) - 1;
+    if (own >= kSpacingSteps) {
+        return 1.0f;
+    }
+    float budget = std::max(kInvisibleRipple, own >= 0 ? alpha * ripple[own] : 0.0f);
+    
+    // Compensated alpha and ripple both grow with the spacing, so the steps
+    // that fit come first: binary search for the last one. The stroke ends
+    // bound the added alpha.
+    auto fits = [&](int step) {
+        float compensated = compensateAlpha(alpha, (step + 1) * kSpacingStep / spacing);
+        return compensated <= maxAlpha && compensated * ripple[step] <= budget
+            && (compensated - alpha) * kEndRipple <= budget;
+    };
+    int low = own, high = kSpacingSteps - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (fits(mid)) {
+            low = mid;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return low > own ? (low + 1) * kSpacingStep / spacing : 1.0f;
+}
+
+} // namespace Acute
@@ -1,10 +1,19 @@
 #include "Application.h"
 #include "Window.h"
 #include "Canvas.h"
+#include "DabScheduler.h"
+#include "FrameExport.h"
 #include "InputManager.h"
 #include "BrushEngine.h"
+#include "BrushPresetLibrary.h"
 #include "Renderer.h"
+#include "StrokeHistory.h"
+#include "TileResidency.h"
 #include <SDL2/SDL.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
 #include <iostream>
 
 #ifdef PLATFORM_WINDOWS
@@ -15,8 +24,19 @@
 namespace Acute {
 
 Application::Application()
-    : m_running(false)
+    : m_frameInterval(1.0f / 60.0f)
+    , m_nextStrokeSeed(1)
+    , m_running(false)
     , m_strokeActive(false)
+    , m_strokeOnGpu(false)
+    , m_canvasFollowsWindow(true)
+    , m_panning(false)
+    , m_panLastX(0)
+    , m_panLastY(0)
+    , m_selectionDrag(SelectionDrag::None)
+    , m_fillTool(false)
+    , m_playbackRate(10.0f)
+    , m_playbackDue(0.0f)
 {
 }
 
@@ -24,7 +44,9 @@ Application::~Application() {
     shutdown();
 }
 
-bool Application::initialize(const std::string& title, int width, int height) {
+bool Application::initialize(const std::string& title, int width, int height,
+                             int canvasWidth, int canvasHeight, size_t residencyBudget,
+                             bool computeRaster) {
     // Initialize SDL
     if (SDL_Init(SDL_INIT_VIDEO) < 0) {
         std::cerr << "Failed to initialize SDL: " << SDL_GetError() << std::endl;
@@ -44,10 +66,35 @@ bool Application::initialize(const std::string& title, int width, int height) {
     }
     
     // Create canvas
-    m_canvas = std::make_unique<Canvas>(width, height);
+    m_canvasFollowsWindow = canvasWidth <= 0 || canvasHeight <= 0;
+    if (m_canvasFollowsWindow) {
+        canvasWidth = width;
+        canvasHeight = height;
+    } else if (residencyBudget > 0) {
+        const int tile = TileResidency::kTileSize;
+        canvasWidth = (canvasWidth + tile - 1) / tile * tile;
+        canvasHeight = (canvasHeight + tile - 1) / tile * tile;
+    }
+    m_canvas = std::make_unique<Canvas>(canvasWidth, canvasHeight, m_renderer->getState());
+    if (!m_canvasFollowsWindow) {
+        m_canvas->setResidencyBudget(residencyBudget);
+    }
+    m_canvas->setComputeRaster(computeRaster);
     if (!m_canvas->initialize()) {
         return false;
     }
+    m_canvas->setViewSize(width, height);
+    resetView();
+    
+    // Strokes are drawn within a share of each frame, paced by the display
+    m_dabScheduler = std::make_unique<DabScheduler>();
+    if (!m_dabScheduler->initialize()) {
+        std::cerr << "Warning: No GPU timer queries; dab budget uses CPU time only" << std::endl;
+    }
+    SDL_DisplayMode mode;
+    if (SDL_GetWindowDisplayMode(m_window->getSDLWindow(), &mode) == 0 && mode.refresh_rate > 0) {
+        m_frameInterval = 1.0f / static_cast<float>(mode.refresh_rate);
+    }
     
     // Create input manager
     m_inputManager = std::make_unique<InputManager>();
@@ -67,30 +114,81 @@ bool Application::initialize(const std::string& title, int width, int height) {
     
     // Create brush engine
     m_brushEngine = std::make_unique<BrushEngine>();
+    m_history = std::make_unique<StrokeHistory>();
     setupDefaultBrush();
+    loadPresetLibrary("brushes.acbl");
     
     // Set up input callback
-    m_inputManager->setInputCallback([this](const InputPoint& input, bool isPressed) {
+    m_inputManager->setInputCallback([this](const InputPoint& screenInput, bool isPressed) {
         if (!m_brushEngine) return;
         
+        // Input arrives in window pixels; brushes work in canvas pixels
+        InputPoint input = screenInput;
+        if (m_canvas) {
+            m_canvas->screenToCanvas(input.x, input.y);
+            input.velocityX /= m_canvas->getZoom();
+            input.velocityY /= m_canvas->getZoom();
+        }
+        
         if (isPressed) {
             // Begin stroke if not already active
             if (!m_strokeActive) {
+                // Seeded so the history can replay the stroke exactly
+                m_brushEngine->setRandomSeed(m_nextStrokeSeed);
+                m_strokePoints.clear();
                 m_brushEngine->beginStroke();
+                const BrushSettings& settings = m_brushEngine->getBrushSettings();
+                
+                // Only the input samples go to the GPU when it can place and
+                // map this brush's dabs itself
+                m_strokeOnGpu = m_canvas && m_canvas->canGenerateDabs() && !m_canvas->isMaskPainting()
+                    && m_brushEngine->getStrokeMode() == StrokeMode::Dabs
+                    && BrushEngine::canGenerateOnGpu(settings);
+                std::shared_ptr<const DabSegmentBrush> segmentBrush;
+                if (m_strokeOnGpu) {
+                    segmentBrush = std::make_shared<DabSegmentBrush>(m_brushEngine->getSegmentBrush());
+                }
+                
+                // Smudging picks up what the stroke itself laid down, so it
+                // paints the canvas directly
+                bool strokeBuffer = settings.strokeBuffer && settings.smudge <= 0.0f;
+                m_dabScheduler->beginStroke(strokeBuffer, settings.baseOpacity,
+                                            m_brushEngine->getBlendMode(input), std::move(segmentBrush));
                 m_strokeActive = true;
             }
+            m_strokePoints.push_back(input);
             
             // Process input through brush engine
-            auto dabs = m_brushEngine->processInput(input);
-            
-            // Draw dabs on canvas
-            if (!dabs.empty() && m_canvas) {
-                m_canvas->drawDabs(dabs);
+            if (m_brushEngine->getStrokeMode() == StrokeMode::Ribbon) {
+                // Hard round brushes: one antialiased ribbon pass instead of dabs
+                auto segments = m_brushEngine->processRibbonInput(input);
+                if (!segments.empty()) {
+                    m_dabScheduler->submitRibbon(segments);
+                }
+            } else if (m_strokeOnGpu) {
+                auto segments = m_brushEngine->processSegmentInput(input);
+                if (!segments.empty()) {
+                    m_dabScheduler->submitSegments(segments);
+                }
+            } else {
+                auto dabs = m_brushEngine->processInput(input);
+                
+                // Queued; drawn on the canvas within the frame budget
+                if (!dabs.empty()) {
+                    m_dabScheduler->submit(dabs);
+                }
             }
         } else {
             // End stroke when pressure is released
             if (m_strokeActive) {
+                // Mask strokes change the selection, not the picture
+                if (!m_canvas || !m_canvas->isMaskPainting()) {
+                    m_history->addStroke(std::move(m_strokePoints), m_brushEngine->getBrushSettingsPtr(),
+                                         m_nextStrokeSeed++);
+                }
+                m_strokePoints.clear();
                 m_brushEngine->endStroke();
+                m_dabScheduler->endStroke();
                 m_strokeActive = false;
             }
         }
@@ -109,6 +207,7 @@ void Application::setupDefaultBrush() {
     settings.baseHardness = 0.7f;
     settings.baseFlow = 0.9f;
     settings.baseSpacing = 0.15f;
+    settings.strokeBuffer = true;
     settings.colorR = 0.0f;
     settings.colorG = 0.0f;
     settings.colorB = 0.0f;
@@ -146,6 +245,33 @@ void Application::setupDefaultBrush() {
     m_brushEngine->setBrushSettings(settings);
 }
 
+void Application::loadPresetLibrary(const std::string& path) {
+    m_presets = std::make_unique<BrushPresetLibrary>();
+    
+    // The library is optional; without it the default brush stays active
+    std::ifstream probe(path);
+    if (!probe.good()) {
+        return;
+    }
+    if (m_presets->open(path)) {
+        std::cout << "Loaded " << m_presets->getPresetCount() << " brush presets from " << path
+                  << " (keys 1-9 select)" << std::endl;
+    }
+}
+
+void Application::selectPreset(size_t index) {
+    if (!m_presets || !m_brushEngine) {
+        return;
+    }
+    
+    // Shared settings: the engine only swaps a pointer
+    BrushSettingsPtr settings = m_presets->getPreset(index);
+    if (settings) {
+        m_brushEngine->setBrushSettings(settings);
+        std::cout << "Brush: " << m_presets->getPresetName(index) << std::endl;
+    }
+}
+
 void Application::run() {
     Uint64 lastTime = SDL_GetPerformanceCounter();
     const double frequency = static_cast<double>(SDL_GetPerformanceFrequency());
@@ -174,8 +300,16 @@ void Application::handleEvents() {
                 if (event.window.event == SDL_WINDOWEVENT_RESIZED) {
                     int width = event.window.data1;
                     int height = event.window.data2;
-                    m_canvas->resize(width, height);
-                    glViewport(0, 0, width, height);
+                    // Canvas::render sets the viewport to the new size
+                    if (m_canvasFollowsWindow) {
+                        m_dabScheduler->finish(*m_canvas);
+                        m_canvas->resize(width, height);
+                        m_history->clear();
+                    }
+                    m_canvas->setViewSize(width, height);
+                    if (m_canvasFollowsWindow) {
+                        resetView();
+                    }
                 }
                 break;
                 
@@ -184,49 +318,333 @@ void Application::handleEvents() {
                     m_running = false;
                 } else if (event.key.keysym.sym == SDLK_c && (event.key.keysym.mod & KMOD_CTRL)) {
                     // Clear canvas
+                    m_dabScheduler->finish(*m_canvas);
                     m_canvas->clear();
+                    m_history->clear();
+                } else if ((event.key.keysym.sym == SDLK_d || event.key.keysym.sym == SDLK_a) &&
+                           (event.key.keysym.mod & KMOD_CTRL)) {
+                    // Deselect (select all)
+                    m_dabScheduler->finish(*m_canvas);
+                    m_canvas->clearSelection();
+                } else if (event.key.keysym.sym == SDLK_q && !m_strokeActive) {
+                    // Toggle painting the selection mask
+                    m_dabScheduler->finish(*m_canvas);
+                    m_canvas->setMaskPainting(!m_canvas->isMaskPainting());
+                    std::cout << (m_canvas->isMaskPainting() ? "Painting selection mask" : "Painting canvas")
+                              << std::endl;
+                } else if (event.key.keysym.sym == SDLK_m && !m_strokeActive) {
+                    cycleSymmetry();
+                } else if (event.key.keysym.sym == SDLK_g && !m_strokeActive) {
+                    toggleFillTool();
+                } else if (event.key.keysym.sym == SDLK_HOME) {
+                    resetView();
+                } else if (event.key.keysym.sym >= SDLK_1 && event.key.keysym.sym <= SDLK_9) {
+                    // Number keys pick presets from the library
+                    selectPreset(static_cast<size_t>(event.key.keysym.sym - SDLK_1));
                 }
                 break;
                 
             case SDL_MOUSEBUTTONDOWN:
-                if (event.button.button == SDL_BUTTON_LEFT) {
+                if (event.button.button == SDL_BUTTON_LEFT && (SDL_GetModState() & KMOD_SHIFT)) {
+                    beginSelection(SelectionDrag::Rectangle, event.button.x, event.button.y);
+                } else if (event.button.button == SDL_BUTTON_LEFT && (SDL_GetModState() & KMOD_ALT)) {
+                    beginSelection(SelectionDrag::Lasso, event.button.x, event.button.y);
+                } else if (event.button.button == SDL_BUTTON_LEFT && m_fillTool) {
+                    fillAt(event.button.x, event.button.y);
+                } else if (event.button.button == SDL_BUTTON_LEFT) {
                     // Process mouse input - callback will handle beginStroke
                     m_inputManager->processEvent(event);
+                } else if (event.button.button == SDL_BUTTON_RIGHT) {
+                    pickStrokes(event.button.x, event.button.y);
+                } else if (event.button.button == SDL_BUTTON_MIDDLE) {
+                    m_panning = true;
+                    m_panLastX = event.button.x;
+                    m_panLastY = event.button.y;
                 }
                 break;
                 
             case SDL_MOUSEBUTTONUP:
-                if (event.button.button == SDL_BUTTON_LEFT) {
+                if (event.button.button == SDL_BUTTON_LEFT && m_selectionDrag != SelectionDrag::None) {
+                    finishSelection();
+                } else if (event.button.button == SDL_BUTTON_LEFT) {
                     // Process mouse input - callback will handle endStroke
                     m_inputManager->processEvent(event);
+                } else if (event.button.button == SDL_BUTTON_MIDDLE) {
+                    m_panning = false;
                 }
                 break;
                 
             case SDL_MOUSEMOTION:
+                if (m_panning) {
+                    float zoom = m_canvas->getZoom();
+                    m_canvas->setView(zoom,
+                                      m_canvas->getViewOriginX() - (event.motion.x - m_panLastX) / zoom,
+                                      m_canvas->getViewOriginY() - (event.motion.y - m_panLastY) / zoom);
+                    m_panLastX = event.motion.x;
+                    m_panLastY = event.motion.y;
+                }
+                
+                if (m_selectionDrag != SelectionDrag::None) {
+                    extendSelection(event.motion.x, event.motion.y);
+                    break;
+                }
+                
                 // Process mouse input
                 m_inputManager->processEvent(event);
                 break;
                 
+            case SDL_MOUSEWHEEL: {
+                // Zoom around the cursor, 25% per notch
+                int mouseX = 0, mouseY = 0;
+                SDL_GetMouseState(&mouseX, &mouseY);
+                zoomView(std::pow(1.25f, static_cast<float>(event.wheel.y)),
+                         static_cast<float>(mouseX), static_cast<float>(mouseY));
+                break;
+            }
+                
             default:
                 break;
         }
     }
 }
 
+void Application::zoomView(float factor, float screenX, float screenY) {
+    const float minZoom = 1.0f / 64.0f;
+    const float maxZoom = 32.0f;
+    float zoom = std::max(minZoom, std::min(maxZoom, m_canvas->getZoom() * factor));
+    
+    // Keep the canvas point under the cursor in place
+    float canvasX = screenX, canvasY = screenY;
+    m_canvas->screenToCanvas(canvasX, canvasY);
+    m_canvas->setView(zoom, canvasX - screenX / zoom, canvasY - screenY / zoom);
+}
+
+void Application::resetView() {
+    // Whole canvas centered in the window, never magnified
+    float viewWidth = static_cast<float>(m_canvas->getViewWidth());
+    float viewHeight = static_cast<float>(m_canvas->getViewHeight());
+    float zoom = std::min(1.0f, std::min(viewWidth / m_canvas->getWidth(), viewHeight / m_canvas->getHeight()));
+    m_canvas->setView(zoom,
+                      (m_canvas->getWidth() - viewWidth / zoom) * 0.5f,
+                      (m_canvas->getHeight() - viewHeight / zoom) * 0.5f);
+}
+
+void Application::pickStrokes(int x, int y) {
+    float canvasX = static_cast<float>(x);
+    float canvasY = static_cast<float>(y);
+    m_canvas->screenToCanvas(canvasX, canvasY);
+    
+    // A few screen pixels of slack, whatever the zoom
+    std::vector<uint32_t> ids;
+    m_history->hitTest(canvasX, canvasY, 3.0f / m_canvas->getZoom(), ids);
+    std::cout << ids.size() << " of " << m_history->getStrokeCount() << " strokes under the cursor";
+    if (!ids.empty()) {
+        std::cout << ", topmost #" << ids.back();
+    }
+    std::cout << std::endl;
+}
+
+void Application::toggleFillTool() {
+    // The canvas copy the fill reads is kept fresh only while the tool is on
+    m_fillTool = !m_fillTool;
+    m_canvas->setReadbackCache(m_fillTool);
+    if (m_fillTool) {
+        std::cout << "Fill tool (tolerance " << m_fillOptions.tolerance << ", gap " << m_fillOptions.gap << ")"
+                  << std::endl;
+    } else {
+        std::cout << "Brush" << std::endl;
+    }
+}
+
+void Application::fillAt(int x, int y) {
+    float canvasX = static_cast<float>(x);
+    float canvasY = static_cast<float>(y);
+    m_canvas->screenToCanvas(canvasX, canvasY);
+    
+    // Fill what has been painted so far
+    m_dabScheduler->finish(*m_canvas);
+    const BrushSettings& settings = m_brushEngine->getBrushSettings();
+    auto start = std::chrono::steady_clock::now();
+    if (!m_canvas->fill(canvasX, canvasY, m_fillOptions, settings.colorR, settings.colorG, settings.colorB,
+                        settings.baseOpacity, settings.blendMode)) {
+        return;
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "Filled in " << elapsed.count() << " ms" << std::endl;
+}
+
+void Application::cycleSymmetry() {
+    static const char* const kModes[] = {"none", "mirror-x", "mirror-y", "radial:6", "radial:16", "tiled"};
+    const size_t count = sizeof(kModes) / sizeof(kModes[0]);
+    
+    std::string current = toString(m_canvas->getSymmetry());
+    size_t next = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (current == kModes[i]) {
+            next = (i + 1) % count;
+            break;
+        }
+    }
+    
+    Symmetry symmetry;
+    parseSymmetry(kModes[next], symmetry);
+    m_dabScheduler->finish(*m_canvas);
+    m_canvas->setSymmetry(symmetry);
+    std::cout << "Symmetry: " << kModes[next] << std::endl;
+}
+
+void Application::beginSelection(SelectionDrag drag, int x, int y) {
+    m_selectionDrag = drag;
+    m_selectionPoints.clear();
+    extendSelection(x, y);
+}
+
+void Application::extendSelection(int x, int y) {
+    float canvasX = static_cast<float>(x);
+    float canvasY = static_cast<float>(y);
+    m_canvas->screenToCanvas(canvasX, canvasY);
+    
+    // A rectangle keeps its start corner and the latest position
+    if (m_selectionDrag == SelectionDrag::Rectangle && m_selectionPoints.size() >= 4) {
+        m_selectionPoints.resize(2);
+    }
+    m_selectionPoints.push_back(canvasX);
+    m_selectionPoints.push_back(canvasY);
+}
+
+void Application::finishSelection() {
+    // Strokes still queued were made under the old selection
+    m_dabScheduler->finish(*m_canvas);
+    if (m_selectionDrag == SelectionDrag::Rectangle) {
+        if (m_selectionPoints.size() >= 4) {
+            m_canvas->selectRectangle(m_selectionPoints[0], m_selectionPoints[1],
+                                      m_selectionPoints[2], m_selectionPoints[3]);
+        }
+    } else {
+        m_canvas->selectLasso(m_selectionPoints);
+    }
+    m_selectionDrag = SelectionDrag::None;
+    m_selectionPoints.clear();
+}
+
 void Application::update(float deltaTime) {
-    // Update logic here if needed
-    (void)deltaTime; // Unused for now
+    // At most one time-lapse snapshot per frame
+    if (m_playback) {
+        m_playbackDue = std::min(m_playbackDue + deltaTime * m_playbackRate, 2.0f);
+        if (m_playbackDue >= 1.0f) {
+            m_playbackDue -= 1.0f;
+            if (!stepPlayback()) {
+                std::cout << "Time-lapse finished" << std::endl;
+                m_playback.reset();
+            }
+        }
+    }
+}
+
+bool Application::stepPlayback() {
+    if (!m_playback->next()) {
+        return false;
+    }
+    int width = m_playback->getWidth(), height = m_playback->getHeight();
+    if (m_canvas->getWidth() != width || m_canvas->getHeight() != height) {
+        m_dabScheduler->finish(*m_canvas);
+        m_canvas->resize(width, height);
+        m_history->clear();
+        m_canvasFollowsWindow = false;
+        resetView();
+    }
+    const uint8_t* pixels = m_playback->getPixels();
+    const size_t stride = static_cast<size_t>(width) * 4;
+    for (int index : m_playback->getChangedTiles()) {
+        int x0, y0, x1, y1;
+        m_playback->getTileRect(index, x0, y0, x1, y1);
+        m_canvas->writePixels(x0, y0, x1, y1, pixels + y0 * stride + static_cast<size_t>(x0) * 4, stride);
+    }
+    return true;
 }
 
 void Application::render() {
-    // Render canvas to screen
+    // Draw queued strokes within the frame budget, then the canvas to the screen
+    m_dabScheduler->drain(*m_canvas, kDabBudgetShare * m_frameInterval);
     m_canvas->render();
     
+#ifndef NDEBUG
+    // Catch GL calls that bypass the state cache
+    m_renderer->getState().validate();
+#endif
+
     // Swap buffers
     m_window->swapBuffers();
 }
 
+bool Application::setFrameExport(const std::string& name) {
+    if (!m_canvas->setFrameExport(name)) {
+        return false;
+    }
+    std::cout << "Exporting frames to shared memory " << m_canvas->getFrameExport()->getName() << std::endl;
+    return true;
+}
+
+bool Application::startTimelapse(const std::string& path, const TimelapseOptions& options) {
+    if (!m_canvas->startTimelapse(path, options)) {
+        return false;
+    }
+    std::cout << "Recording a time-lapse to " << path << " every " << options.interval << " s" << std::endl;
+    return true;
+}
+
+bool Application::playTimelapse(const std::string& path, float rate) {
+    auto playback = std::make_unique<TimelapseReader>();
+    if (!playback->open(path)) {
+        return false;
+    }
+    m_playback = std::move(playback);
+    m_playbackRate = rate;
+    m_playbackDue = 1.0f;
+    return true;
+}
+
 void Application::shutdown() {
+    if (m_renderer) {
+        const GLStateCache::Stats& stats = m_renderer->getState().getStats();
+        std::cout << "GL state changes: " << stats.totalIssued() << " issued, "
+                  << stats.totalElided() << " elided" << std::endl;
+        for (int i = 0; i < GLStateCache::CounterCount; i++) {
+            if (stats.elided[i] > 0) {
+                std::cout << "  " << GLStateCache::getCounterName(static_cast<GLStateCache::Counter>(i)) << ": "
+                          << stats.issued[i] << " issued, " << stats.elided[i] << " elided" << std::endl;
+            }
+        }
+    }
+    if (m_canvas && m_canvas->getResidency()) {
+        const TileResidency::Stats& stats = m_canvas->getResidency()->getStats();
+        std::cout << "Tile residency: " << stats.hits << " hits, " << stats.misses << " misses, "
+                  << stats.evictions << " evictions, " << (stats.bytesUploaded >> 20) << " MiB uploaded, "
+                  << (stats.bytesReadBack >> 20) << " MiB read back, " << stats.residentTiles << " tiles resident, "
+                  << stats.compressedTiles << " in BC7 (" << stats.compressedLayers << " distinct, "
+                  << stats.compressions << " compressions), " << (stats.storedBytes >> 20)
+                  << " MiB stored compressed, " << stats.deduplicated << " tiles deduplicated" << std::endl;
+    }
+    if (m_dabScheduler) {
+        const DabScheduler::Stats& stats = m_dabScheduler->getStats();
+        std::cout << "Dab scheduler: " << stats.dabsDrawn << " dabs drawn, " << stats.dabsDeferred
+                  << " deferred to later frames, " << stats.framesBehind << " frames behind, longest backlog "
+                  << stats.longestBacklog << " dabs" << std::endl;
+    }
+    if (m_canvas && m_canvas->getTimelapse()) {
+        // The last changes go in before the canvas goes away
+        m_canvas->finishTimelapse();
+        const TimelapseRecorder::Stats stats = m_canvas->getTimelapse()->getStats();
+        std::cout << "Time-lapse: " << stats.snapshots << " snapshots (" << stats.keyframes << " keyframes), "
+                  << stats.tilesWritten << " tiles, " << (stats.bytesWritten >> 10) << " KiB written to "
+                  << m_canvas->getTimelapse()->getPath() << std::endl;
+    }
+    if (m_canvas && m_canvas->getFrameExport()) {
+        std::cout << "Frame export: " << m_canvas->getFrameExport()->getSequence() << " frames published, "
+                  << (m_canvas->getFrameExport()->getBytesCopied() >> 20) << " MiB copied" << std::endl;
+    }
+    
+    m_dabScheduler.reset();
     m_brushEngine.reset();
     m_inputManager.reset();
     m_canvas.reset();
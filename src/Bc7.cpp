@@ -0,0 +1,265 @@
+#include "Bc7.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace Acute {
+
+namespace {
+
+// Interpolation weights of 4-bit indices, out of 64
+constexpr int kWeights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// A mode 6 endpoint: 7 bits per channel and the shared low bit
+struct Endpoint {
+    int q[4];
+    int p;
+    
+    int value(int c) const { return (q[c] << 1) | p; }
+};
+
+Endpoint quantize(const float* color, int p) {
+    Endpoint e;
+    e.p = p;
+    for (int c = 0; c < 4; c++) {
+        int q = static_cast<int>(std::lround((color[c] - p) * 0.5f));
+        e.q[c] = std::min(127, std::max(0, q));
+    }
+    return e;
+}
+
+// The shared bit that reproduces the color best
+Endpoint quantizeBest(const float* color) {
+    Endpoint best = quantize(color, 0);
+    float bestError = 0.0f;
+    for (int p = 0; p < 2; p++) {
+        Endpoint e = quantize(color, p);
+        float error = 0.0f;
+        for (int c = 0; c < 4; c++) {
+            float d = static_cast<float>(e.value(c)) - color[c];
+            error += d * d;
+        }
+        if (p == 0 || error < bestError) {
+            best = e;
+            bestError = error;
+        }
+    }
+    return best;
+}
+
+// Choose the nearest palette entry per texel; returns the squared error
+int assignIndices(const uint8_t* texels, const Endpoint& e0, const Endpoint& e1, int* indices) {
+    int palette[16][4];
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 4; c++) {
+            palette[i][c] = ((64 - kWeights[i]) * e0.value(c) + kWeights[i] * e1.value(c) + 32) >> 6;
+        }
+    }
+    int total = 0;
+    for (int t = 0; t < 16; t++) {
+        const uint8_t* texel = texels + t * 4;
+        int bestError = 0x7fffffff;
+        for (int i = 0; i < 16; i++) {
+            int error = 0;
+            for (int c = 0; c < 4; c++) {
+                int d = palette[i][c] - texel[c];
+                error += d * d;
+            }
+            if (error < bestError) {
+                bestError = error;
+                indices[t] = i;
+            }
+        }
+        total += bestError;
+    }
+    return total;
+}
+
+// Endpoints that minimise the squared error for fixed indices; false if the
+// indices do not pin both down
+bool fitEndpoints(const uint8_t* texels, const int* indices, float* color0, float* color1) {
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[4] = {}, bx[4] = {};
+    for (int t = 0; t < 16; t++) {
+        float w = kWeights[indices[t]] / 64.0f;
+        float a = 1.0f - w;
+        aa += a * a;
+        ab += a * w;
+        bb += w * w;
+        for (int c = 0; c < 4; c++) {
+            ax[c] += a * texels[t * 4 + c];
+            bx[c] += w * texels[t * 4 + c];
+        }
+    }
+    float det = aa * bb - ab * ab;
+    if (std::fabs(det) < 1e-6f) {
+        return false;
+    }
+    for (int c = 0; c < 4; c++) {
+        color0[c] = std::min(255.0f, std::max(0.0f, (bb * ax[c] - ab * bx[c]) / det));
+        color1[c] = std::min(255.0f, std::max(0.0f, (aa * bx[c] - ab * ax[c]) / det));
+    }
+    return true;
+}
+
+// Little-endian bit writer over the 128-bit block
+struct BitWriter {
+    uint8_t* block;
+    int position;
+    
+    void write(int value, int bits) {
+        for (int i = 0; i < bits; i++, position++) {
+            if (value & (1 << i)) {
+                block[position >> 3] |= static_cast<uint8_t>(1 << (position & 7));
+            }
+        }
+    }
+};
+
+void pack(Endpoint e0, Endpoint e1, int* indices, uint8_t* block) {
+    // The first texel's index is stored without its top bit, which must be 0
+    if (indices[0] >= 8) {
+        std::swap(e0, e1);
+        for (int t = 0; t < 16; t++) {
+            indices[t] = 15 - indices[t];
+        }
+    }
+    
+    std::memset(block, 0, kBc7BlockBytes);
+    BitWriter writer = { block, 0 };
+    writer.write(1 << 6, 7);
+    for (int c = 0; c < 4; c++) {
+        writer.write(e0.q[c], 7);
+        writer.write(e1.q[c], 7);
+    }
+    writer.write(e0.p, 1);
+    writer.write(e1.p, 1);
+    writer.write(indices[0], 3);
+    for (int t = 1; t < 16; t++) {
+        writer.write(indices[t], 4);
+    }
+}
+
+} // namespace
+
+size_t bc7EncodedSize(int width, int height) {
+    return static_cast<size_t>(width / 4) * (height / 4) * kBc7BlockBytes;
+}
+
+void bc7EncodeBlock(const uint8_t* texels, uint8_t* block) {
+    int indices[16] = {};
+    
+    // Flat blocks (empty canvas, solid fills) are common: one endpoint does
+    bool flat = true;
+    for (int t = 1; t < 16 && flat; t++) {
+        flat = std::memcmp(texels, texels + t * 4, 4) == 0;
+    }
+    if (flat) {
+        float color[4];
+        for (int c = 0; c < 4; c++) {
+            color[c] = texels[c];
+        }
+        Endpoint e = quantizeBest(color);
+        pack(e, e, indices, block);
+        return;
+    }
+    
+    // Principal axis of the texels through their mean
+    float mean[4] = {};
+    for (int t = 0; t < 16; t++) {
+        for (int c = 0; c < 4; c++) {
+            mean[c] += texels[t * 4 + c] / 16.0f;
+        }
+    }
+    float covariance[4][4] = {};
+    for (int t = 0; t < 16; t++) {
+        float d[4];
+        for (int c = 0; c < 4; c++) {
+            d[c] = texels[t * 4 + c] - mean[c];
+        }
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) {
+                covariance[i][j] += d[i] * d[j];
+            }
+        }
+    }
+    float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[4] = {};
+        float length = 0.0f;
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) {
+                next[i] += covariance[i][j] * axis[j];
+            }
+            length = std::max(length, std::fabs(next[i]));
+        }
+        if (length < 1e-6f) {
+            break;
+        }
+        for (int i = 0; i < 4; i++) {
+            axis[i] = next[i] / length;
+        }
+    }
+    
+    // Endpoints at the extremes of the texels along the axis
+    float minT = 0.0f, maxT = 0.0f;
+    for (int t = 0; t < 16; t++) {
+        float projection = 0.0f;
+        for (int c = 0; c < 4; c++) {
+            projection += (texels[t * 4 + c] - mean[c]) * axis[c];
+        }
+        minT = t == 0 ? projection : std::min(minT, projection);
+        maxT = t == 0 ? projection : std::max(maxT, projection);
+    }
+    float axisLength = 0.0f;
+    for (int c = 0; c < 4; c++) {
+        axisLength += axis[c] * axis[c];
+    }
+    float color0[4], color1[4];
+    for (int c = 0; c < 4; c++) {
+        color0[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * minT / axisLength));
+        color1[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * maxT / axisLength));
+    }
+    
+    Endpoint best0 = quantizeBest(color0), best1 = quantizeBest(color1);
+    int bestIndices[16];
+    int bestError = assignIndices(texels, best0, best1, bestIndices);
+    
+    // Refit the endpoints to the chosen indices, then try every pair of
+    // shared bits on the result
+    int candidate[16];
+    std::memcpy(candidate, bestIndices, sizeof(candidate));
+    for (int pass = 0; pass < 2 && bestError > 0; pass++) {
+        if (!fitEndpoints(texels, candidate, color0, color1)) {
+            break;
+        }
+        for (int p = 0; p < 4; p++) {
+            Endpoint e0 = quantize(color0, p & 1), e1 = quantize(color1, p >> 1);
+            int error = assignIndices(texels, e0, e1, candidate);
+            if (error < bestError) {
+                best0 = e0;
+                best1 = e1;
+                bestError = error;
+                std::memcpy(bestIndices, candidate, sizeof(candidate));
+            }
+        }
+        std::memcpy(candidate, bestIndices, sizeof(candidate));
+    }
+    
+    pack(best0, best1, bestIndices, block);
+}
+
+void bc7EncodeImage(const uint8_t* pixels, int width, int height, uint8_t* dst) {
+    uint8_t texels[64];
+    for (int by = 0; by < height; by += 4) {
+        for (int bx = 0; bx < width; bx += 4) {
+            for (int row = 0; row < 4; row++) {
+                std::memcpy(texels + row * 16, pixels + (static_cast<size_t>(by + row) * width + bx) * 4, 16);
+            }
+            bc7EncodeBlock(texels, dst);
+            dst += kBc7BlockBytes;
+        }
+    }
+}
+
+} // namespace Acute
@@ -1,27 +1,121 @@
 #include "BrushEngine.h"
+#include "AdaptiveSpacing.h"
 #include <cmath>
 #include <random>
 #include <algorithm>
-#include <iostream>
 
 namespace Acute {
 
+namespace {
+
+// Minimum hardness for a brush to be drawn as a ribbon
+constexpr float kRibbonMinHardness = 0.85f;
+
+// Ribbon pieces are at most this many radii long so mapped width changes stay smooth
+constexpr float kRibbonMaxPieceRadii = 1.0f;
+constexpr float kRibbonMinPieceLength = 2.0f;
+
+// Input a fraction f of the way along a move; the rest (timestamp, device)
+// is the end point's. Barrel rotation turns the short way round.
+InputPoint interpolateInput(const InputPoint& from, const InputPoint& to, float f) {
+    InputPoint point = to;
+    point.x = from.x + (to.x - from.x) * f;
+    point.y = from.y + (to.y - from.y) * f;
+    point.pressure = from.pressure + (to.pressure - from.pressure) * f;
+    point.tiltX = from.tiltX + (to.tiltX - from.tiltX) * f;
+    point.tiltY = from.tiltY + (to.tiltY - from.tiltY) * f;
+    point.velocityX = from.velocityX + (to.velocityX - from.velocityX) * f;
+    point.velocityY = from.velocityY + (to.velocityY - from.velocityY) * f;
+    float turn = to.rotation - from.rotation;
+    turn -= 360.0f * std::round(turn / 360.0f);
+    point.rotation = from.rotation + turn * f;
+    if (point.rotation < 0.0f) {
+        point.rotation += 360.0f;
+    } else if (point.rotation >= 360.0f) {
+        point.rotation -= 360.0f;
+    }
+    return point;
+}
+
+} // namespace
+
 BrushEngine::BrushEngine()
-    : m_strokeActive(false)
+    : m_settings(std::make_shared<BrushSettings>())
+    , m_strokeMode(StrokeMode::Dabs)
+    , m_pipeline(nullptr)
+    , m_specializedPipelines(true)
+    , m_adaptiveSpacing(true)
+    , m_spacingAdaptable(false)
+    , m_random(std::random_device{}())
+    , m_strokeActive(false)
+    , m_hasLastInput(false)
     , m_distanceSinceLastDab(0.0f)
+    , m_strokeLength(0.0f)
+    , m_spacingFactor(1.0f)
+    , m_pickupEmpty(true)
+    , m_colorSeed(0)
+    , m_strokeDabs(0)
 {
 }
 
 BrushEngine::~BrushEngine() = default;
 
 void BrushEngine::setBrushSettings(const BrushSettings& settings) {
-    m_settings = settings;
+    setBrushSettings(std::make_shared<BrushSettings>(settings));
+}
+
+void BrushEngine::setBrushSettings(BrushSettingsPtr settings) {
+    if (!settings) {
+        return;
+    }
+    
+    // Keep the stroke consistent; the canvas was set up for the old settings
+    if (m_strokeActive) {
+        m_pendingSettings = std::move(settings);
+        return;
+    }
+    m_settings = std::move(settings);
+    m_pendingSettings.reset();
+    updateStrokeMode();
+}
+
+void BrushEngine::setRandomSeed(uint32_t seed) {
+    m_random.seed(seed);
+}
+
+float BrushEngine::getMaxDabRadius(const BrushSettings& settings) {
+    // Mapping inputs are in [0, 1], so outputs stay within [minOutput, maxOutput]
+    float size = settings.baseSize;
+    float scatter = 0.0f;
+    for (const auto& mapping : settings.mappings) {
+        float largest = std::max(std::abs(mapping.minOutput), std::abs(mapping.maxOutput));
+        if (mapping.target == BrushProperty::Size) {
+            size *= std::max(1.0f, largest);
+        } else if (mapping.target == BrushProperty::Scatter) {
+            scatter = std::max(scatter, largest);
+        }
+    }
+    
+    // Half-diagonal of the rotated dab, scatter offset and a pixel of filtering
+    return size * 0.7072f + scatter * size * 0.5f + 1.0f;
 }
 
 void BrushEngine::beginStroke() {
+    if (m_pendingSettings) {
+        m_settings = std::move(m_pendingSettings);
+        m_pendingSettings.reset();
+        updateStrokeMode();
+    }
     m_strokeActive = true;
     m_distanceSinceLastDab = 0.0f;
+    m_strokeLength = 0.0f;
     m_lastInput = InputPoint();
+    m_hasLastInput = false;
+    m_pickupEmpty = true;
+    m_strokeDabs = 0;
+    if (m_colorDynamics.isActive()) {
+        m_colorSeed = static_cast<uint32_t>(m_random());
+    }
 }
 
 void BrushEngine::endStroke() {
@@ -29,11 +123,90 @@ void BrushEngine::endStroke() {
 }
 
 void BrushEngine::addMapping(const InputMapping& mapping) {
-    m_settings.mappings.push_back(mapping);
+    // Copy on write: the old settings may be shared with a preset library
+    auto settings = std::make_shared<BrushSettings>(*m_settings);
+    settings->mappings.push_back(mapping);
+    m_settings = std::move(settings);
+    updateStrokeMode();
 }
 
 void BrushEngine::clearMappings() {
-    m_settings.mappings.clear();
+    auto settings = std::make_shared<BrushSettings>(*m_settings);
+    settings->mappings.clear();
+    m_settings = std::move(settings);
+    updateStrokeMode();
+}
+
+bool BrushEngine::canUseRibbon(const BrushSettings& settings) {
+    // Image tips are not round
+    if (settings.tipIndex >= 0 || settings.baseHardness < kRibbonMinHardness) {
+        return false;
+    }
+    
+    // Multiply reads the destination per dab, smudging the pickup
+    if (settings.blendMode == BlendMode::Multiply || settings.smudge > 0.0f) {
+        return false;
+    }
+    
+    for (const auto& mapping : settings.mappings) {
+        // Per-dab noise cannot be represented by a continuous ribbon
+        if (mapping.source == InputSource::Random) {
+            return false;
+        }
+        switch (mapping.target) {
+            case BrushProperty::Size:
+            case BrushProperty::Opacity:
+            case BrushProperty::Flow:
+            case BrushProperty::Spacing:   // No dabs to space
+            case BrushProperty::Rotation:  // Round tips are rotation invariant
+                break;
+            default:
+                return false;
+        }
+    }
+    return true;
+}
+
+BlendMode BrushEngine::getBlendMode(const InputPoint& input) const {
+    if (input.device == DeviceType::StylusEraser) {
+        return BlendMode::Erase;
+    }
+    return m_settings->blendMode;
+}
+
+void BrushEngine::updateStrokeMode() {
+    m_strokeMode = canUseRibbon(*m_settings) ? StrokeMode::Ribbon : StrokeMode::Dabs;
+    
+    // Color mappings are evaluated per batch, so they don't multiply the shapes
+    m_shapeMappings.clear();
+    for (const auto& mapping : m_settings->mappings) {
+        if (!isColorProperty(mapping.target)) {
+            m_shapeMappings.push_back(mapping);
+        }
+    }
+    m_pipeline = m_specializedPipelines ? findMappingPipeline(m_shapeMappings) : nullptr;
+    m_colorDynamics.setBrush(m_settings->colorR, m_settings->colorG, m_settings->colorB,
+                             m_settings->mappings);
+                             
+    // Widening assumes the round tip profile and dabs that only vary smoothly;
+    // smudging dabs carry their pickup over a fixed spacing
+    m_spacingAdaptable = m_adaptiveSpacing && m_settings->tipIndex < 0 && !m_colorDynamics.isActive()
+        && m_settings->smudge <= 0.0f;
+    for (const auto& mapping : m_settings->mappings) {
+        if (mapping.source == InputSource::Random || mapping.target == BrushProperty::Scatter) {
+            m_spacingAdaptable = false;
+        }
+    }
+}
+
+void BrushEngine::setSpecializedPipelines(bool enabled) {
+    m_specializedPipelines = enabled;
+    updateStrokeMode();
+}
+
+void BrushEngine::setAdaptiveSpacing(bool enabled) {
+    m_adaptiveSpacing = enabled;
+    updateStrokeMode();
 }
 
 std::vector<BrushDab> BrushEngine::processInput(const InputPoint& input) {
@@ -42,14 +215,15 @@ std::vector<BrushDab> BrushEngine::processInput(const InputPoint& input) {
     if (!m_strokeActive) {
         return dabs;
     }
+    m_dabInputs.clear();
     
     // For the first point in a stroke
-    if (m_lastInput.timestamp == 0) {
-        BrushDab dab = generateDab(input);
-        applyMappings(input, dab);
-        applyScatter(dab);
-        dabs.push_back(dab);
+    if (!m_hasLastInput) {
+        m_spacingFactor = 1.0f;
+        addDab(input, dabs);
+        colorDabs(dabs);
         m_lastInput = input;
+        m_hasLastInput = true;
         return dabs;
     }
     
@@ -58,12 +232,8 @@ std::vector<BrushDab> BrushEngine::processInput(const InputPoint& input) {
     float dy = input.y - m_lastInput.y;
     float distance = std::sqrt(dx * dx + dy * dy);
     
-    // Generate a temporary dab to calculate spacing
-    BrushDab tempDab = generateDab(input);
-    applyMappings(input, tempDab);
-    float spacing = calculateSpacing(tempDab);
-    
-    m_distanceSinceLastDab += distance;
+    BrushDab endDab;
+    float spacing = advance(input, distance, endDab);
     
     // Generate dabs along the path
     while (m_distanceSinceLastDab >= spacing && spacing > 0.0f) {
@@ -71,25 +241,236 @@ std::vector<BrushDab> BrushEngine::processInput(const InputPoint& input) {
         float t = (m_distanceSinceLastDab - spacing) / distance;
         t = std::max(0.0f, std::min(1.0f, t));
         
-        InputPoint interpInput = input;
-        interpInput.x = m_lastInput.x + dx * (1.0f - t);
-        interpInput.y = m_lastInput.y + dy * (1.0f - t);
+        InputPoint interpInput = interpolateInput(m_lastInput, input, 1.0f - t);
+        addDab(interpInput, dabs);
+        m_distanceSinceLastDab -= spacing;
+    }
+    
+    colorDabs(dabs);
+    m_lastInput = input;
+    return dabs;
+}
+
+float BrushEngine::advance(const InputPoint& input, float distance, BrushDab& endDab) {
+    // Generate a temporary dab to calculate spacing
+    endDab = generateDab(input);
+    applyMappings(input, endDab);
+    float spacing = calculateSpacing(endDab);
+    m_strokeLength += distance;
+    m_spacingFactor = 1.0f;
+    if (m_spacingAdaptable) {
+        // Widen gradually over the first dab diameter: near the stroke start
+        // the overlap is one-sided and a wide step would show
+        float ramp = 1.0f + m_strokeLength / std::max(1.0f, endDab.size);
+        m_spacingFactor = std::min(ramp, getSpacingFactor(endDab));
+    }
+    spacing *= m_spacingFactor;
+    
+    m_distanceSinceLastDab += distance;
+    return spacing;
+}
+
+std::vector<DabSegment> BrushEngine::processSegmentInput(const InputPoint& input) {
+    std::vector<DabSegment> segments;
+    
+    if (!m_strokeActive) {
+        return segments;
+    }
+    
+    DabSegment segment;
+    segment.radius = getMaxDabRadius(*m_settings);
+    segment.blend = static_cast<float>(static_cast<int>(getBlendMode(input)));
+    segment.rotation1 = input.rotation;
+    segment.velocityX1 = input.velocityX;
+    segment.velocityY1 = input.velocityY;
+    segment.x1 = input.x;
+    segment.y1 = input.y;
+    segment.pressure1 = input.pressure;
+    segment.tiltX1 = input.tiltX;
+    segment.tiltY1 = input.tiltY;
+    
+    // The first point of a stroke is one dab on the point itself
+    if (!m_hasLastInput) {
+        BrushDab dab = generateDab(input);
+        applyMappings(input, dab);
+        segment.x0 = input.x;
+        segment.y0 = input.y;
+        segment.pressure0 = input.pressure;
+        segment.tiltX0 = input.tiltX;
+        segment.tiltY0 = input.tiltY;
+        segment.rotation0 = input.rotation;
+        segment.velocityX0 = input.velocityX;
+        segment.velocityY0 = input.velocityY;
+        segment.length = 0.0f;
+        segment.distance = 0.0f;
+        segment.spacing = 0.0f;
+        segment.spacingFactor = 1.0f;
+        segment.count = 1.0f;
+        segment.size = dab.size;
+        m_spacingFactor = 1.0f;
+        segments.push_back(segment);
+        m_lastInput = input;
+        m_hasLastInput = true;
+        return segments;
+    }
+    
+    float dx = input.x - m_lastInput.x;
+    float dy = input.y - m_lastInput.y;
+    float distance = std::sqrt(dx * dx + dy * dy);
+    BrushDab endDab;
+    float spacing = advance(input, distance, endDab);
+    
+    segment.x0 = m_lastInput.x;
+    segment.y0 = m_lastInput.y;
+    segment.pressure0 = m_lastInput.pressure;
+    segment.tiltX0 = m_lastInput.tiltX;
+    segment.tiltY0 = m_lastInput.tiltY;
+    segment.rotation0 = m_lastInput.rotation;
+    segment.velocityX0 = m_lastInput.velocityX;
+    segment.velocityY0 = m_lastInput.velocityY;
+    segment.length = distance;
+    segment.distance = m_distanceSinceLastDab;
+    segment.spacing = spacing;
+    segment.spacingFactor = m_spacingFactor;
+    segment.size = endDab.size;
+    
+    // Count with the same subtractions as processInput, so the distance
+    // carried into the next move is bit-identical
+    int count = 0;
+    while (m_distanceSinceLastDab >= spacing && spacing > 0.0f) {
+        m_distanceSinceLastDab -= spacing;
+        count++;
+    }
+    segment.count = static_cast<float>(count);
+    if (count > 0) {
+        segments.push_back(segment);
+    }
+    
+    m_lastInput = input;
+    return segments;
+}
+
+bool BrushEngine::canGenerateOnGpu(const BrushSettings& settings) {
+    // Smudging dabs are drawn one at a time after a pickup pass each
+    if (settings.smudge > 0.0f) {
+        return false;
+    }
+    int mappings = 0;
+    for (const auto& mapping : settings.mappings) {
+        // The random generator stays on the CPU; color jitter is hashed per
+        // dab, so the shader computes it too
+        if ((mapping.source == InputSource::Random && !isColorProperty(mapping.target))
+            || mapping.target == BrushProperty::Scatter) {
+            return false;
+        }
+        mappings++;
+    }
+    return mappings <= DabSegmentBrush::kMaxMappings;
+}
+
+DabSegmentBrush BrushEngine::getSegmentBrush() const {
+    DabSegmentBrush brush;
+    brush.size = m_settings->baseSize;
+    brush.opacity = m_settings->baseOpacity;
+    brush.hardness = m_settings->baseHardness;
+    brush.flow = m_settings->baseFlow;
+    brush.rotation = m_settings->baseRotation;
+    brush.tip = m_settings->tipIndex;
+    brush.r = m_settings->colorR;
+    brush.g = m_settings->colorG;
+    brush.b = m_settings->colorB;
+    brush.accumulationScale = getAccumulationScale();
+    brush.colorSeed = m_colorSeed;
+    
+    // Sources are read in [0, 1]; interpolating the samples is exact for
+    // linear curves and within 1e-5 for the others. The color mappings go
+    // last, in the order ColorDynamics keys their jitter by.
+    const int samples = DabSegmentBrush::kCurveSamples;
+    for (int pass = 0; pass < 2; pass++) {
+        for (const auto& mapping : m_settings->mappings) {
+            if (isColorProperty(mapping.target) != (pass == 1)) {
+                continue;
+            }
+            brush.sources.push_back(static_cast<int>(mapping.source));
+            brush.targets.push_back(static_cast<int>(mapping.target));
+            for (int i = 0; i < samples; i++) {
+                brush.curves.push_back(mapping.apply(static_cast<float>(i) / (samples - 1)));
+            }
+        }
+    }
+    return brush;
+}
+
+std::vector<RibbonSegment> BrushEngine::processRibbonInput(const InputPoint& input) {
+    std::vector<RibbonSegment> segments;
+    
+    if (!m_strokeActive) {
+        return segments;
+    }
+    
+    RibbonSegment segment;
+    segment.hardness = m_settings->baseHardness;
+    segment.r = m_settings->colorR;
+    segment.g = m_settings->colorG;
+    segment.b = m_settings->colorB;
+    segment.blend = getBlendMode(input);
+    
+    // The first point of a stroke is a round dot (zero-length segment)
+    if (!m_hasLastInput) {
+        float radius, opacity;
+        evaluateRibbonPoint(input, radius, opacity);
+        segment.x0 = segment.x1 = input.x;
+        segment.y0 = segment.y1 = input.y;
+        segment.r0 = segment.r1 = radius;
+        segment.opacity = opacity;
+        segments.push_back(segment);
+        m_lastInput = input;
+        m_hasLastInput = true;
+        return segments;
+    }
+    
+    float dx = input.x - m_lastInput.x;
+    float dy = input.y - m_lastInput.y;
+    float distance = std::sqrt(dx * dx + dy * dy);
+    
+    // Split long moves so width follows the mapped pressure smoothly
+    float startRadius, startOpacity;
+    evaluateRibbonPoint(m_lastInput, startRadius, startOpacity);
+    float pieceLength = std::max(kRibbonMinPieceLength, startRadius * kRibbonMaxPieceRadii);
+    int pieces = std::max(1, static_cast<int>(std::ceil(distance / pieceLength)));
+    
+    InputPoint previous = m_lastInput;
+    float previousRadius = startRadius;
+    for (int i = 1; i <= pieces; i++) {
+        float t = static_cast<float>(i) / pieces;
         
-        // Interpolate other properties
-        interpInput.pressure = m_lastInput.pressure + (input.pressure - m_lastInput.pressure) * (1.0f - t);
-        interpInput.tiltX = m_lastInput.tiltX + (input.tiltX - m_lastInput.tiltX) * (1.0f - t);
-        interpInput.tiltY = m_lastInput.tiltY + (input.tiltY - m_lastInput.tiltY) * (1.0f - t);
+        InputPoint interpInput = interpolateInput(m_lastInput, input, t);
+        float radius, opacity;
+        evaluateRibbonPoint(interpInput, radius, opacity);
         
-        BrushDab dab = generateDab(interpInput);
-        applyMappings(interpInput, dab);
-        applyScatter(dab);
-        dabs.push_back(dab);
+        segment.x0 = previous.x;
+        segment.y0 = previous.y;
+        segment.r0 = previousRadius;
+        segment.x1 = interpInput.x;
+        segment.y1 = interpInput.y;
+        segment.r1 = radius;
+        segment.opacity = opacity;
+        segment.joinsPrevious = true;
+        segments.push_back(segment);
         
-        m_distanceSinceLastDab -= spacing;
+        previous = interpInput;
+        previousRadius = radius;
     }
     
     m_lastInput = input;
-    return dabs;
+    return segments;
+}
+
+void BrushEngine::evaluateRibbonPoint(const InputPoint& input, float& radius, float& opacity) {
+    BrushDab dab = generateDab(input);
+    applyMappings(input, dab);
+    radius = dab.size * 0.5f;
+    opacity = dab.opacity * dab.flow;
 }
 
 BrushDab BrushEngine::generateDab(const InputPoint& input) {
@@ -100,94 +481,61 @@ BrushDab BrushEngine::generateDab(const InputPoint& input) {
     dab.y = input.y;
     
     // Set base properties from settings
-    dab.size = m_settings.baseSize;
-    dab.opacity = m_settings.baseOpacity;
-    dab.hardness = m_settings.baseHardness;
-    dab.flow = m_settings.baseFlow;
-    dab.rotation = m_settings.baseRotation;
+    dab.size = m_settings->baseSize;
+    dab.opacity = m_settings->baseOpacity;
+    dab.hardness = m_settings->baseHardness;
+    dab.flow = m_settings->baseFlow;
+    dab.rotation = m_settings->baseRotation;
+    dab.spacing = m_settings->baseSpacing;
+    dab.tip = m_settings->tipIndex;
+    dab.blend = getBlendMode(input);
+    dab.smudge = m_settings->smudge;
+    dab.smudgeLength = m_settings->smudgeLength;
     
     // Set color
-    dab.r = m_settings.colorR;
-    dab.g = m_settings.colorG;
-    dab.b = m_settings.colorB;
+    dab.r = m_settings->colorR;
+    dab.g = m_settings->colorG;
+    dab.b = m_settings->colorB;
     
     return dab;
 }
 
 void BrushEngine::applyMappings(const InputPoint& input, BrushDab& dab) {
-    float originalSize = dab.size;
+    // Specialized instantiation for this mapping shape
+    if (m_pipeline) {
+        m_pipeline(m_shapeMappings, input, dab);
+        return;
+    }
     
     // Apply each mapping
-    for (const auto& mapping : m_settings.mappings) {
+    for (const auto& mapping : m_shapeMappings) {
         float inputValue = getInputValue(input, mapping.source);
         float outputValue = mapping.apply(inputValue);
         
         // Apply to the appropriate property
-        switch (mapping.target) {
-            case BrushProperty::Size:
-                dab.size *= outputValue;
-                {
-                    static int sizeDebugCount = 0;
-                    if (sizeDebugCount++ % 50 == 0 && mapping.source == InputSource::Pressure) {
-                        std::cout << "[Brush Engine] Size mapping - Input: " << inputValue 
-                                  << ", Output: " << outputValue 
-                                  << ", Original size: " << originalSize 
-                                  << ", Final size: " << dab.size << std::endl;
-                    }
-                }
-                break;
-            case BrushProperty::Opacity:
-                dab.opacity *= outputValue;
-                break;
-            case BrushProperty::Hardness:
-                dab.hardness = std::max(0.0f, std::min(1.0f, outputValue));
-                break;
-            case BrushProperty::Flow:
-                dab.flow *= outputValue;
-                break;
-            case BrushProperty::Rotation:
-                dab.rotation += outputValue;
-                break;
-            case BrushProperty::Scatter:
-                dab.scatter = outputValue;
-                break;
-            // Color properties would modify HSV and convert back to RGB
-            default:
-                break;
-        }
+        applyMappedValue(mapping.target, outputValue, dab);
     }
     
     // Clamp values
-    dab.size = std::max(0.1f, dab.size);
-    dab.opacity = std::max(0.0f, std::min(1.0f, dab.opacity));
-    dab.flow = std::max(0.0f, std::min(1.0f, dab.flow));
+    clampMappedDab(dab);
 }
 
 float BrushEngine::getInputValue(const InputPoint& input, InputSource source) {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_real_distribution<float> dis(0.0f, 1.0f);
-    
     switch (source) {
-        case InputSource::Pressure: {
-            static int pressureDebugCount = 0;
-            if (pressureDebugCount++ % 50 == 0) { // Print every 50th sample
-                std::cout << "[Brush Engine] Using pressure: " << input.pressure << std::endl;
-            }
-            return input.pressure;
-        }
+        case InputSource::Pressure:
+            return readInputSource<InputSource::Pressure>(input);
         case InputSource::TiltX:
-            return (input.tiltX + 1.0f) * 0.5f; // Convert from [-1,1] to [0,1]
+            return readInputSource<InputSource::TiltX>(input);
         case InputSource::TiltY:
-            return (input.tiltY + 1.0f) * 0.5f;
+            return readInputSource<InputSource::TiltY>(input);
         case InputSource::TiltMagnitude:
-            return std::min(1.0f, input.getTiltMagnitude());
+            return readInputSource<InputSource::TiltMagnitude>(input);
         case InputSource::Speed:
-            return std::min(1.0f, input.getSpeed() / 1000.0f); // Normalize speed
+            return readInputSource<InputSource::Speed>(input);
         case InputSource::Rotation:
-            return input.rotation / 360.0f;
+            return readInputSource<InputSource::Rotation>(input);
         case InputSource::Random:
-            return dis(gen);
+            return std::uniform_real_distribution<float>(0.0f, 1.0f)(m_random);
         case InputSource::Constant:
         default:
             return 1.0f;
@@ -195,18 +543,64 @@ float BrushEngine::getInputValue(const InputPoint& input, InputSource source) {
 }
 
 float BrushEngine::calculateSpacing(const BrushDab& dab) {
-    return dab.size * m_settings.baseSpacing;
+    return dab.size * dab.spacing;
+}
+
+float BrushEngine::getSpacingFactor(const BrushDab& dab) const {
+    // Coverage must accumulate as source over; a stroke buffer always does
+    if (!m_settings->strokeBuffer && dab.blend != BlendMode::Normal && dab.blend != BlendMode::Erase) {
+        return 1.0f;
+    }
+    float scale = getAccumulationScale();
+    float alpha = std::min(1.0f, dab.opacity * dab.flow / scale);
+    float maxAlpha = std::min(1.0f, dab.opacity / scale);
+    return adaptiveSpacingFactor(dab.hardness, alpha, maxAlpha, dab.spacing);
+}
+
+float BrushEngine::getAccumulationScale() const {
+    bool buffered = m_settings->strokeBuffer && m_settings->baseOpacity > 0.0f;
+    return buffered ? m_settings->baseOpacity : 1.0f;
+}
+
+void BrushEngine::compensateFlow(BrushDab& dab) const {
+    if (m_spacingFactor <= 1.0f || dab.opacity <= 0.0f) {
+        return;
+    }
+    float scale = getAccumulationScale();
+    float alpha = std::min(1.0f, dab.opacity * dab.flow / scale);
+    dab.flow = std::min(1.0f, compensateAlpha(alpha, m_spacingFactor) * scale / dab.opacity);
+}
+
+void BrushEngine::addDab(const InputPoint& input, std::vector<BrushDab>& dabs) {
+    BrushDab dab = generateDab(input);
+    applyMappings(input, dab);
+    compensateFlow(dab);
+    applyScatter(dab);
+    
+    // The first dab of a stroke starts the pickup afresh from the canvas
+    if (m_pickupEmpty) {
+        dab.smudgeLength = 0.0f;
+        m_pickupEmpty = false;
+    }
+    dabs.push_back(dab);
+    if (m_colorDynamics.isActive()) {
+        m_dabInputs.push_back(input);
+    }
+}
+
+void BrushEngine::colorDabs(std::vector<BrushDab>& dabs) {
+    if (m_colorDynamics.isActive()) {
+        m_colorDynamics.apply(m_dabInputs.data(), dabs.data(), dabs.size(), m_colorSeed, m_strokeDabs);
+        m_strokeDabs += static_cast<uint32_t>(dabs.size());
+    }
 }
 
 void BrushEngine::applyScatter(BrushDab& dab) {
     if (dab.scatter > 0.0f) {
-        static std::random_device rd;
-        static std::mt19937 gen(rd());
-        static std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
-        
+        std::uniform_real_distribution<float> dis(-1.0f, 1.0f);
         float scatterAmount = dab.scatter * dab.size * 0.5f;
-        dab.x += dis(gen) * scatterAmount;
-        dab.y += dis(gen) * scatterAmount;
+        dab.x += dis(m_random) * scatterAmount;
+        dab.y += dis(m_random) * scatterAmount;
     }
 }
 
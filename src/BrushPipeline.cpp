@@ -0,0 +1,97 @@
+#include "BrushPipeline.h"
+
+namespace Acute {
+
+namespace {
+
+// One mapping with source, target and curve known at compile time
+template <InputSource Source, BrushProperty Target, CurveType Curve>
+struct MappingStage {
+    static bool matches(const InputMapping& mapping) {
+        return mapping.source == Source && mapping.target == Target && mapping.curve == Curve;
+    }
+    
+    static void apply(const InputMapping& mapping, const InputPoint& input, BrushDab& dab) {
+        applyMappedValue<Target>(mapping.applyCurve<Curve>(readInputSource<Source>(input)), dab);
+    }
+};
+
+// A mapping shape: the stages in mapping order
+template <typename... Stages>
+struct Pipeline {
+    static bool matches(const std::vector<InputMapping>& mappings) {
+        if (mappings.size() != sizeof...(Stages)) {
+            return false;
+        }
+        size_t index = 0;
+        return (Stages::matches(mappings[index++]) && ...);
+    }
+    
+    static void run(const std::vector<InputMapping>& mappings, const InputPoint& input, BrushDab& dab) {
+        const InputMapping* mapping = mappings.data();
+        (Stages::apply(*mapping++, input, dab), ...);
+        clampMappedDab(dab);
+    }
+};
+
+template <BrushProperty Target, CurveType Curve>
+using PressureTo = MappingStage<InputSource::Pressure, Target, Curve>;
+
+constexpr CurveType Linear = CurveType::Linear;
+constexpr CurveType Quadratic = CurveType::Quadratic;
+constexpr CurveType Cubic = CurveType::Cubic;
+
+struct PipelineEntry {
+    bool (*matches)(const std::vector<InputMapping>&);
+    MappingPipeline run;
+};
+
+template <typename P>
+constexpr PipelineEntry entry() {
+    return { &P::matches, &P::run };
+}
+
+// Shapes with a dedicated instantiation. Brushes with Random sources stay on
+// the generic path, which owns the random generator.
+const PipelineEntry kPipelines[] = {
+    // No mappings
+    entry<Pipeline<>>(),
+    
+    // Pressure -> size (Pen)
+    entry<Pipeline<PressureTo<BrushProperty::Size, Linear>>>(),
+    entry<Pipeline<PressureTo<BrushProperty::Size, Quadratic>>>(),
+    entry<Pipeline<PressureTo<BrushProperty::Size, Cubic>>>(),
+    
+    // Pressure -> size + pressure -> opacity (Pencil)
+    entry<Pipeline<PressureTo<BrushProperty::Size, Linear>, PressureTo<BrushProperty::Opacity, Linear>>>(),
+    entry<Pipeline<PressureTo<BrushProperty::Size, Quadratic>, PressureTo<BrushProperty::Opacity, Linear>>>(),
+    entry<Pipeline<PressureTo<BrushProperty::Size, Cubic>, PressureTo<BrushProperty::Opacity, Linear>>>(),
+    
+    // Pressure -> size + pressure -> flow (Airbrush)
+    entry<Pipeline<PressureTo<BrushProperty::Size, Linear>, PressureTo<BrushProperty::Flow, Quadratic>>>(),
+    
+    // Pressure -> size + tilt -> opacity (Marker)
+    entry<Pipeline<PressureTo<BrushProperty::Size, Linear>,
+                   MappingStage<InputSource::TiltMagnitude, BrushProperty::Opacity, Linear>>>(),
+                   
+    // Pressure -> size + tilt -> rotation (Calligraphy)
+    entry<Pipeline<PressureTo<BrushProperty::Size, Quadratic>,
+                   MappingStage<InputSource::TiltX, BrushProperty::Rotation, Linear>>>(),
+                   
+    // Pressure -> size + opacity, speed -> spacing (application default brush)
+    entry<Pipeline<PressureTo<BrushProperty::Size, Quadratic>, PressureTo<BrushProperty::Opacity, Linear>,
+                   MappingStage<InputSource::Speed, BrushProperty::Spacing, Linear>>>()
+};
+
+} // namespace
+
+MappingPipeline findMappingPipeline(const std::vector<InputMapping>& mappings) {
+    for (const auto& pipeline : kPipelines) {
+        if (pipeline.matches(mappings)) {
+            return pipeline.run;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace Acute
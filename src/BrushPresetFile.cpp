@@ -0,0 +1,206 @@
+#include "BrushPresetFile.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace Acute {
+
+namespace {
+
+const char* const kInputSourceNames[] = {
+    "Pressure", "TiltX", "TiltY", "TiltMagnitude", "Speed", "Rotation", "Random", "Constant"
+};
+
+const char* const kBrushPropertyNames[] = {
+    "Size", "Opacity", "Spacing", "Hardness", "Flow", "Scatter", "Rotation",
+    "ColorH", "ColorS", "ColorV"
+};
+
+const char* const kCurveTypeNames[] = {
+    "Linear", "Quadratic", "Cubic", "Custom"
+};
+
+const char* const kBlendModeNames[] = {
+    "Normal", "Erase", "Multiply", "Screen", "Add"
+};
+
+template <typename Enum, size_t N>
+bool parseEnum(const std::string& text, const char* const (&names)[N], Enum& value) {
+    for (size_t i = 0; i < N; i++) {
+        if (text == names[i]) {
+            value = static_cast<Enum>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::string trim(const std::string& text) {
+    size_t begin = text.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+        return std::string();
+    }
+    size_t end = text.find_last_not_of(" \t\r\n");
+    return text.substr(begin, end - begin + 1);
+}
+
+} // namespace
+
+const char* toString(InputSource source) {
+    return kInputSourceNames[static_cast<int>(source)];
+}
+
+const char* toString(BrushProperty property) {
+    return kBrushPropertyNames[static_cast<int>(property)];
+}
+
+const char* toString(CurveType curve) {
+    return kCurveTypeNames[static_cast<int>(curve)];
+}
+
+const char* toString(BlendMode mode) {
+    return kBlendModeNames[static_cast<int>(mode)];
+}
+
+bool parseInputSource(const std::string& text, InputSource& source) {
+    return parseEnum(text, kInputSourceNames, source);
+}
+
+bool parseBrushProperty(const std::string& text, BrushProperty& property) {
+    return parseEnum(text, kBrushPropertyNames, property);
+}
+
+bool parseCurveType(const std::string& text, CurveType& curve) {
+    return parseEnum(text, kCurveTypeNames, curve);
+}
+
+bool parseBlendMode(const std::string& text, BlendMode& mode) {
+    return parseEnum(text, kBlendModeNames, mode);
+}
+
+bool parsePresetLine(const std::string& line, BrushSettings& settings, std::string& name,
+                     std::string& error) {
+    std::string content = trim(line.substr(0, line.find('#')));
+    if (content.empty()) {
+        return true;
+    }
+    
+    size_t equals = content.find('=');
+    if (equals == std::string::npos) {
+        error = "expected 'key = value': " + content;
+        return false;
+    }
+    std::string key = trim(content.substr(0, equals));
+    std::string value = trim(content.substr(equals + 1));
+    std::istringstream stream(value);
+    
+    bool ok = true;
+    if (key == "name") {
+        name = value;
+    } else if (key == "size") {
+        ok = static_cast<bool>(stream >> settings.baseSize);
+    } else if (key == "opacity") {
+        ok = static_cast<bool>(stream >> settings.baseOpacity);
+    } else if (key == "hardness") {
+        ok = static_cast<bool>(stream >> settings.baseHardness);
+    } else if (key == "flow") {
+        ok = static_cast<bool>(stream >> settings.baseFlow);
+    } else if (key == "spacing") {
+        ok = static_cast<bool>(stream >> settings.baseSpacing);
+    } else if (key == "rotation") {
+        ok = static_cast<bool>(stream >> settings.baseRotation);
+    } else if (key == "color") {
+        ok = static_cast<bool>(stream >> settings.colorR >> settings.colorG >> settings.colorB);
+    } else if (key == "tip") {
+        ok = static_cast<bool>(stream >> settings.tipIndex);
+    } else if (key == "strokeBuffer") {
+        ok = static_cast<bool>(stream >> settings.strokeBuffer);
+    } else if (key == "blend") {
+        std::string mode;
+        ok = (stream >> mode) && parseBlendMode(mode, settings.blendMode);
+    } else if (key == "smudge") {
+        ok = static_cast<bool>(stream >> settings.smudge);
+    } else if (key == "smudgeLength") {
+        ok = static_cast<bool>(stream >> settings.smudgeLength);
+    } else if (key == "mapping") {
+        InputMapping mapping;
+        std::string source, target, curve, flag;
+        ok = static_cast<bool>(stream >> source >> target >> mapping.minOutput
+                               >> mapping.maxOutput >> mapping.strength >> curve)
+            && parseInputSource(source, mapping.source)
+            && parseBrushProperty(target, mapping.target)
+            && parseCurveType(curve, mapping.curve);
+        if (ok && stream >> flag) {
+            ok = (flag == "inverted");
+            mapping.inverted = ok;
+        }
+        if (ok) {
+            settings.mappings.push_back(mapping);
+        }
+    } else {
+        error = "unknown key '" + key + "'";
+        return false;
+    }
+    
+    if (!ok) {
+        error = "malformed value for '" + key + "': " + value;
+    }
+    return ok;
+}
+
+bool readBrushPreset(std::istream& in, BrushSettings& settings, std::string& name) {
+    settings = BrushSettings();
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        std::string error;
+        if (!parsePresetLine(line, settings, name, error)) {
+            std::cerr << "Brush preset line " << lineNumber << ": " << error << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+void writeBrushPreset(std::ostream& out, const BrushSettings& settings, const std::string& name) {
+    out << "name = " << name << "\n";
+    out << "size = " << settings.baseSize << "\n";
+    out << "opacity = " << settings.baseOpacity << "\n";
+    out << "hardness = " << settings.baseHardness << "\n";
+    out << "flow = " << settings.baseFlow << "\n";
+    out << "spacing = " << settings.baseSpacing << "\n";
+    out << "rotation = " << settings.baseRotation << "\n";
+    out << "color = " << settings.colorR << " " << settings.colorG << " " << settings.colorB << "\n";
+    out << "tip = " << settings.tipIndex << "\n";
+    out << "strokeBuffer = " << (settings.strokeBuffer ? 1 : 0) << "\n";
+    out << "blend = " << toString(settings.blendMode) << "\n";
+    out << "smudge = " << settings.smudge << "\n";
+    out << "smudgeLength = " << settings.smudgeLength << "\n";
+    for (const auto& mapping : settings.mappings) {
+        out << "mapping = " << toString(mapping.source) << " " << toString(mapping.target) << " "
+            << mapping.minOutput << " " << mapping.maxOutput << " " << mapping.strength << " "
+            << toString(mapping.curve) << (mapping.inverted ? " inverted" : "") << "\n";
+    }
+}
+
+bool loadBrushPreset(const std::string& path, BrushSettings& settings, std::string& name) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open brush preset: " << path << std::endl;
+        return false;
+    }
+    return readBrushPreset(file, settings, name);
+}
+
+bool saveBrushPreset(const std::string& path, const BrushSettings& settings, const std::string& name) {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Failed to write brush preset: " << path << std::endl;
+        return false;
+    }
+    writeBrushPreset(file, settings, name);
+    return static_cast<bool>(file);
+}
+
+} // namespace Acute
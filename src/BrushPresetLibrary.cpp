@@ -0,0 +1,448 @@
+#include "BrushPresetLibrary.h"
+#include "BrushPresetFile.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#ifdef PLATFORM_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Acute {
+
+namespace {
+
+const char kLibraryMagic[4] = { 'A', 'C', 'B', 'L' };
+constexpr uint32_t kLibraryVersion = 2;      // 2: smudge settings in the preset record
+
+// Record flags
+constexpr uint32_t kPresetStrokeBuffer = 1u << 0;
+constexpr uint32_t kPresetBlendShift = 8;          // Bits 8-15: BlendMode
+constexpr uint32_t kPresetBlendMask = 0xFFu;
+constexpr uint8_t kMappingInverted = 1u << 0;
+
+struct LibraryHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t presetCount;
+    uint32_t mappingCount;
+    uint32_t stringBytes;
+    uint32_t reserved;
+};
+
+struct MappingRecord {
+    uint8_t source;
+    uint8_t target;
+    uint8_t curve;
+    uint8_t flags;
+    float minOutput;
+    float maxOutput;
+    float strength;
+};
+
+static_assert(sizeof(LibraryHeader) == 24, "LibraryHeader layout");
+static_assert(sizeof(MappingRecord) == 16, "MappingRecord layout");
+
+bool hasExtension(const std::string& path, const char* extension) {
+    size_t length = strlen(extension);
+    return path.size() >= length && path.compare(path.size() - length, length, extension) == 0;
+}
+
+} // namespace
+
+struct BrushPresetLibrary::PresetRecord {
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t firstMapping;
+    uint32_t mappingCount;
+    float size;
+    float opacity;
+    float hardness;
+    float flow;
+    float spacing;
+    float rotation;
+    float color[3];
+    int32_t tipIndex;
+    uint32_t flags;
+    float smudge;                 // Version 2
+    float smudgeLength;
+};
+
+static_assert(sizeof(float) == 4, "Binary presets store 32-bit floats");
+
+// Read-only view of a whole file
+struct BrushPresetLibrary::MappedFile {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef PLATFORM_WINDOWS
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    bool open(const std::string& path) {
+#ifdef PLATFORM_WINDOWS
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            return false;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) {
+            return false;
+        }
+        data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        size = static_cast<size_t>(fileSize.QuadPart);
+        return data != nullptr;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* address = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED) {
+            return false;
+        }
+        data = static_cast<const unsigned char*>(address);
+        size = static_cast<size_t>(info.st_size);
+        return true;
+#endif
+    }
+    
+    ~MappedFile() {
+#ifdef PLATFORM_WINDOWS
+        if (data) {
+            UnmapViewOfFile(data);
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+            CloseHandle(file);
+        }
+#else
+        if (data) {
+            munmap(const_cast<unsigned char*>(data), size);
+        }
+#endif
+    }
+};
+
+BrushPresetLibrary::BrushPresetLibrary()
+    : m_mappings(nullptr)
+    , m_version(0)
+{
+}
+
+BrushPresetLibrary::~BrushPresetLibrary() = default;
+
+void BrushPresetLibrary::clear() {
+    m_entries.clear();
+    m_file.reset();
+    m_mappings = nullptr;
+    m_version = 0;
+}
+
+bool BrushPresetLibrary::open(const std::string& path) {
+    return hasExtension(path, ".acbl") ? openBinary(path) : loadText(path);
+}
+
+bool BrushPresetLibrary::openBinary(const std::string& path) {
+    clear();
+    
+    auto file = std::make_unique<MappedFile>();
+    if (!file->open(path)) {
+        std::cerr << "Failed to open preset library: " << path << std::endl;
+        return false;
+    }
+    
+    LibraryHeader header;
+    if (file->size < sizeof(header)) {
+        std::cerr << "Preset library is truncated: " << path << std::endl;
+        return false;
+    }
+    memcpy(&header, file->data, sizeof(header));
+    if (memcmp(header.magic, kLibraryMagic, sizeof(kLibraryMagic)) != 0
+        || header.version == 0 || header.version > kLibraryVersion) {
+        std::cerr << "Not a version 1-" << kLibraryVersion << " preset library: " << path << std::endl;
+        return false;
+    }
+    
+    const size_t recordBytes = getRecordBytes(header.version);
+    const uint64_t presetBytes = uint64_t(header.presetCount) * recordBytes;
+    const uint64_t mappingBytes = uint64_t(header.mappingCount) * sizeof(MappingRecord);
+    if (sizeof(header) + presetBytes + mappingBytes + header.stringBytes > file->size) {
+        std::cerr << "Preset library is truncated: " << path << std::endl;
+        return false;
+    }
+    
+    const unsigned char* records = file->data + sizeof(header);
+    const unsigned char* mappings = file->data + sizeof(header) + presetBytes;
+    const char* strings = reinterpret_cast<const char*>(mappings + mappingBytes);
+    
+    m_entries.reserve(header.presetCount);
+    for (uint32_t i = 0; i < header.presetCount; i++) {
+        const unsigned char* data = records + i * recordBytes;
+        PresetRecord record = {};
+        memcpy(&record, data, recordBytes);
+        if (uint64_t(record.nameOffset) + record.nameLength > header.stringBytes
+            || uint64_t(record.firstMapping) + record.mappingCount > header.mappingCount) {
+            std::cerr << "Preset library record " << i << " is out of range: " << path << std::endl;
+            m_entries.clear();
+            return false;
+        }
+        Entry entry;
+        entry.name.assign(strings + record.nameOffset, record.nameLength);
+        entry.record = data;
+        m_entries.push_back(std::move(entry));
+    }
+    
+    m_mappings = mappings;
+    m_version = header.version;
+    m_file = std::move(file);
+    return true;
+}
+
+bool BrushPresetLibrary::loadText(const std::string& path) {
+    clear();
+    
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open preset library: " << path << std::endl;
+        return false;
+    }
+    
+    BrushSettings settings;
+    std::string name;
+    bool hasPreset = false;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        
+        // A name line starts the next preset
+        std::istringstream stream(line);
+        std::string key;
+        if (stream >> key && (key == "name" || key == "name=")) {
+            if (hasPreset) {
+                addPreset(name, settings);
+            }
+            settings = BrushSettings();
+            hasPreset = true;
+        }
+        
+        std::string error;
+        if (!parsePresetLine(line, settings, name, error)) {
+            std::cerr << path << ":" << lineNumber << ": " << error << std::endl;
+            clear();
+            return false;
+        }
+    }
+    if (hasPreset) {
+        addPreset(name, settings);
+    }
+    return true;
+}
+
+bool BrushPresetLibrary::saveText(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Failed to write preset library: " << path << std::endl;
+        return false;
+    }
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        if (i > 0) {
+            file << "\n";
+        }
+        writeBrushPreset(file, *getPreset(i), m_entries[i].name);
+    }
+    return static_cast<bool>(file);
+}
+
+bool BrushPresetLibrary::saveBinary(const std::string& path) const {
+    std::vector<PresetRecord> records;
+    std::vector<MappingRecord> mappings;
+    std::string strings;
+    records.reserve(m_entries.size());
+    
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        const BrushSettings& settings = *getPreset(i);
+        PresetRecord record = {};
+        record.nameOffset = static_cast<uint32_t>(strings.size());
+        record.nameLength = static_cast<uint32_t>(m_entries[i].name.size());
+        record.firstMapping = static_cast<uint32_t>(mappings.size());
+        record.mappingCount = static_cast<uint32_t>(settings.mappings.size());
+        record.size = settings.baseSize;
+        record.opacity = settings.baseOpacity;
+        record.hardness = settings.baseHardness;
+        record.flow = settings.baseFlow;
+        record.spacing = settings.baseSpacing;
+        record.rotation = settings.baseRotation;
+        record.color[0] = settings.colorR;
+        record.color[1] = settings.colorG;
+        record.color[2] = settings.colorB;
+        record.tipIndex = settings.tipIndex;
+        record.flags = settings.strokeBuffer ? kPresetStrokeBuffer : 0;
+        record.flags |= static_cast<uint32_t>(settings.blendMode) << kPresetBlendShift;
+        record.smudge = settings.smudge;
+        record.smudgeLength = settings.smudgeLength;
+        records.push_back(record);
+        strings += m_entries[i].name;
+        
+        for (const auto& mapping : settings.mappings) {
+            MappingRecord packed;
+            packed.source = static_cast<uint8_t>(mapping.source);
+            packed.target = static_cast<uint8_t>(mapping.target);
+            packed.curve = static_cast<uint8_t>(mapping.curve);
+            packed.flags = mapping.inverted ? kMappingInverted : 0;
+            packed.minOutput = mapping.minOutput;
+            packed.maxOutput = mapping.maxOutput;
+            packed.strength = mapping.strength;
+            mappings.push_back(packed);
+        }
+    }
+    
+    // Pad the string table so a following section would stay aligned
+    strings.resize((strings.size() + 3) & ~size_t(3), '\0');
+    
+    LibraryHeader header;
+    memcpy(header.magic, kLibraryMagic, sizeof(kLibraryMagic));
+    header.version = kLibraryVersion;
+    header.presetCount = static_cast<uint32_t>(records.size());
+    header.mappingCount = static_cast<uint32_t>(mappings.size());
+    header.stringBytes = static_cast<uint32_t>(strings.size());
+    header.reserved = 0;
+    
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Failed to write preset library: " << path << std::endl;
+        return false;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(records.data(), sizeof(PresetRecord), records.size(), file);
+    fwrite(mappings.data(), sizeof(MappingRecord), mappings.size(), file);
+    fwrite(strings.data(), 1, strings.size(), file);
+    bool ok = (ferror(file) == 0);
+    fclose(file);
+    if (!ok) {
+        std::cerr << "Failed to write preset library: " << path << std::endl;
+    }
+    return ok;
+}
+
+void BrushPresetLibrary::addPreset(const std::string& name, const BrushSettings& settings) {
+    auto shared = std::make_shared<const BrushSettings>(settings);
+    int existing = findPreset(name);
+    if (existing >= 0) {
+        m_entries[existing].settings = shared;
+        m_entries[existing].record = nullptr;
+        return;
+    }
+    
+    Entry entry;
+    entry.name = name;
+    entry.settings = shared;
+    entry.record = nullptr;
+    m_entries.push_back(std::move(entry));
+}
+
+int BrushPresetLibrary::findPreset(const std::string& name) const {
+    for (size_t i = 0; i < m_entries.size(); i++) {
+        if (m_entries[i].name == name) {
+            return static_cast<int>(i);
+        }
+    }
+    return -1;
+}
+
+BrushSettingsPtr BrushPresetLibrary::getPreset(size_t index) const {
+    if (index >= m_entries.size()) {
+        return nullptr;
+    }
+    const Entry& entry = m_entries[index];
+    if (!entry.settings) {
+        entry.settings = decode(entry.record);
+    }
+    return entry.settings;
+}
+
+size_t BrushPresetLibrary::getRecordBytes(uint32_t version) {
+    // Version 1 records end before the smudge settings
+    static_assert(offsetof(PresetRecord, smudge) == 60, "Version 1 PresetRecord layout");
+    return version >= 2 ? sizeof(PresetRecord) : offsetof(PresetRecord, smudge);
+}
+
+BrushSettingsPtr BrushPresetLibrary::decode(const unsigned char* data) const {
+    // Copied out: version 1 records are shorter than PresetRecord
+    PresetRecord record = {};
+    memcpy(&record, data, getRecordBytes(m_version));
+    
+    auto settings = std::make_shared<BrushSettings>();
+    settings->baseSize = record.size;
+    settings->baseOpacity = record.opacity;
+    settings->baseHardness = record.hardness;
+    settings->baseFlow = record.flow;
+    settings->baseSpacing = record.spacing;
+    settings->baseRotation = record.rotation;
+    settings->colorR = record.color[0];
+    settings->colorG = record.color[1];
+    settings->colorB = record.color[2];
+    settings->tipIndex = record.tipIndex;
+    settings->strokeBuffer = (record.flags & kPresetStrokeBuffer) != 0;
+    
+    // Version 1 files written before blend modes have zero here (Normal)
+    uint32_t blend = (record.flags >> kPresetBlendShift) & kPresetBlendMask;
+    if (blend <= static_cast<uint32_t>(BlendMode::Add)) {
+        settings->blendMode = static_cast<BlendMode>(blend);
+    }
+    
+    // Version 1 records have no smudge settings (no smudge)
+    if (m_version >= 2) {
+        settings->smudge = record.smudge;
+        settings->smudgeLength = record.smudgeLength;
+    }
+    
+    settings->mappings.reserve(record.mappingCount);
+    for (uint32_t i = 0; i < record.mappingCount; i++) {
+        MappingRecord packed;
+        memcpy(&packed, m_mappings + (record.firstMapping + i) * sizeof(MappingRecord), sizeof(packed));
+        
+        // Skip enums written by a newer version
+        if (packed.source > static_cast<uint8_t>(InputSource::Constant)
+            || packed.target > static_cast<uint8_t>(BrushProperty::ColorV)
+            || packed.curve > static_cast<uint8_t>(CurveType::Custom)) {
+            continue;
+        }
+        
+        InputMapping mapping;
+        mapping.source = static_cast<InputSource>(packed.source);
+        mapping.target = static_cast<BrushProperty>(packed.target);
+        mapping.curve = static_cast<CurveType>(packed.curve);
+        mapping.inverted = (packed.flags & kMappingInverted) != 0;
+        mapping.minOutput = packed.minOutput;
+        mapping.maxOutput = packed.maxOutput;
+        mapping.strength = packed.strength;
+        settings->mappings.push_back(mapping);
+    }
+    return settings;
+}
+
+} // namespace Acute
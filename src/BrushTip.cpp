@@ -0,0 +1,201 @@
+#include "BrushTip.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+namespace Acute {
+
+BrushTipSet::BrushTipSet() {
+    m_layers.reserve(kMaxLayers);
+    for (int i = 0; i < kRoundTipCount; i++) {
+        float hardness = static_cast<float>(i) / (kRoundTipCount - 1);
+        m_layers.push_back(createRoundTip(hardness));
+    }
+}
+
+int BrushTipSet::getLevelCount() {
+    int levels = 1;
+    for (int size = kTipSize; size > 1; size /= 2) {
+        levels++;
+    }
+    return levels;
+}
+
+BrushTipImage BrushTipSet::createRoundTip(float hardness) {
+    BrushTipImage tip;
+    tip.size = kTipSize;
+    tip.levels.resize(1);
+    tip.levels[0].resize(kTipSize * kTipSize);
+    
+    // Falloff starts at hardness * radius; keep at least one texel of edge
+    // so fully hard tips still antialias
+    const float outer = 0.5f;
+    const float inner = std::min(hardness * outer, outer - 1.0f / kTipSize);
+    
+    for (int y = 0; y < kTipSize; y++) {
+        for (int x = 0; x < kTipSize; x++) {
+            float u = (x + 0.5f) / kTipSize - 0.5f;
+            float v = (y + 0.5f) / kTipSize - 0.5f;
+            float dist = std::sqrt(u * u + v * v);
+            
+            // 1 - smoothstep(inner, outer, dist)
+            float t = std::max(0.0f, std::min(1.0f, (dist - inner) / (outer - inner)));
+            float value = 1.0f - t * t * (3.0f - 2.0f * t);
+            tip.levels[0][y * kTipSize + x] = static_cast<uint8_t>(value * 255.0f + 0.5f);
+        }
+    }
+    
+    buildMipChain(tip);
+    return tip;
+}
+
+void BrushTipSet::buildMipChain(BrushTipImage& tip) {
+    tip.levels.resize(1);
+    int size = tip.size;
+    while (size > 1) {
+        const std::vector<uint8_t>& src = tip.levels.back();
+        int half = size / 2;
+        std::vector<uint8_t> dst(half * half);
+        for (int y = 0; y < half; y++) {
+            for (int x = 0; x < half; x++) {
+                int sum = src[(2 * y) * size + 2 * x] + src[(2 * y) * size + 2 * x + 1]
+                        + src[(2 * y + 1) * size + 2 * x] + src[(2 * y + 1) * size + 2 * x + 1];
+                dst[y * half + x] = static_cast<uint8_t>((sum + 2) / 4);
+            }
+        }
+        tip.levels.push_back(std::move(dst));
+        size = half;
+    }
+}
+
+int BrushTipSet::addImageTip(const uint8_t* pixels, int width, int height) {
+    if (!pixels || width <= 0 || height <= 0) {
+        return -1;
+    }
+    if (getLayerCount() >= kMaxLayers) {
+        std::cerr << "Brush tip set is full (" << kMaxLayers << " layers)" << std::endl;
+        return -1;
+    }
+    
+    BrushTipImage tip;
+    tip.size = kTipSize;
+    tip.levels.resize(1);
+    tip.levels[0].assign(kTipSize * kTipSize, 0);
+    
+    // Fit the image into the square, centered, keeping aspect ratio
+    float scale = static_cast<float>(kTipSize) / std::max(width, height);
+    float offsetX = (kTipSize - width * scale) * 0.5f;
+    float offsetY = (kTipSize - height * scale) * 0.5f;
+    
+    for (int y = 0; y < kTipSize; y++) {
+        for (int x = 0; x < kTipSize; x++) {
+            // Bilinear resample from the source image
+            float sx = (x + 0.5f - offsetX) / scale - 0.5f;
+            float sy = (y + 0.5f - offsetY) / scale - 0.5f;
+            if (sx < -0.5f || sy < -0.5f || sx > width - 0.5f || sy > height - 0.5f) {
+                continue;
+            }
+            int x0 = static_cast<int>(std::floor(sx));
+            int y0 = static_cast<int>(std::floor(sy));
+            float fx = sx - x0;
+            float fy = sy - y0;
+            auto texel = [&](int tx, int ty) {
+                tx = std::max(0, std::min(width - 1, tx));
+                ty = std::max(0, std::min(height - 1, ty));
+                return static_cast<float>(pixels[ty * width + tx]);
+            };
+            float top = texel(x0, y0) + (texel(x0 + 1, y0) - texel(x0, y0)) * fx;
+            float bottom = texel(x0, y0 + 1) + (texel(x0 + 1, y0 + 1) - texel(x0, y0 + 1)) * fx;
+            float value = top + (bottom - top) * fy;
+            tip.levels[0][y * kTipSize + x] = static_cast<uint8_t>(value + 0.5f);
+        }
+    }
+    
+    buildMipChain(tip);
+    m_layers.push_back(std::move(tip));
+    return getImageTipCount() - 1;
+}
+
+int BrushTipSet::loadImageTip(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open brush tip: " << path << std::endl;
+        return -1;
+    }
+    
+    // Binary PGM header: "P5" width height maxval, separated by whitespace/comments
+    std::string magic;
+    file >> magic;
+    auto readValue = [&file]() {
+        int value = -1;
+        while (file >> std::ws && file.peek() == '#') {
+            std::string comment;
+            std::getline(file, comment);
+        }
+        file >> value;
+        return value;
+    };
+    int width = readValue();
+    int height = readValue();
+    int maxValue = readValue();
+    file.get(); // Single whitespace before the raster
+    
+    if (magic != "P5" || width <= 0 || height <= 0 || maxValue <= 0 || maxValue > 255) {
+        std::cerr << "Unsupported brush tip format (expected 8-bit P5 PGM): " << path << std::endl;
+        return -1;
+    }
+    
+    std::vector<uint8_t> pixels(width * height);
+    file.read(reinterpret_cast<char*>(pixels.data()), pixels.size());
+    if (file.gcount() != static_cast<std::streamsize>(pixels.size())) {
+        std::cerr << "Truncated brush tip image: " << path << std::endl;
+        return -1;
+    }
+    
+    // Samples above maxValue (malformed files) saturate
+    if (maxValue != 255) {
+        for (auto& p : pixels) {
+            p = static_cast<uint8_t>(std::min(255, p * 255 / maxValue));
+        }
+    }
+    
+    return addImageTip(pixels.data(), width, height);
+}
+
+int BrushTipSet::roundTipLayer(float hardness) {
+    hardness = std::max(0.0f, std::min(1.0f, hardness));
+    return static_cast<int>(hardness * (kRoundTipCount - 1) + 0.5f);
+}
+
+int BrushTipSet::layerForDab(int tip, float hardness) const {
+    if (tip >= 0 && tip < getImageTipCount()) {
+        return kRoundTipCount + tip;
+    }
+    return roundTipLayer(hardness);
+}
+
+float BrushTipSet::sample(int layer, float u, float v, int level) const {
+    const BrushTipImage& tip = m_layers[layer];
+    level = std::max(0, std::min(static_cast<int>(tip.levels.size()) - 1, level));
+    const std::vector<uint8_t>& data = tip.levels[level];
+    int size = std::max(1, tip.size >> level);
+    
+    // Texel-center bilinear filtering with clamp-to-edge, matching GL_LINEAR
+    float sx = u * size - 0.5f;
+    float sy = v * size - 0.5f;
+    int x0 = static_cast<int>(std::floor(sx));
+    int y0 = static_cast<int>(std::floor(sy));
+    float fx = sx - x0;
+    float fy = sy - y0;
+    auto texel = [&](int tx, int ty) {
+        tx = std::max(0, std::min(size - 1, tx));
+        ty = std::max(0, std::min(size - 1, ty));
+        return data[ty * size + tx] * (1.0f / 255.0f);
+    };
+    float top = texel(x0, y0) + (texel(x0 + 1, y0) - texel(x0, y0)) * fx;
+    float bottom = texel(x0, y0 + 1) + (texel(x0 + 1, y0 + 1) - texel(x0, y0 + 1)) * fx;
+    return top + (bottom - top) * fy;
+}
+
+} // namespace Acute
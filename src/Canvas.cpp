@@ -1,31 +1,118 @@
 #include "Canvas.h"
+#include "DabGenerator.h"
+#include "FrameExport.h"
 #include "Shader.h"
+#include "GLStateCache.h"
+#include "RTree.h"
+#include "ReadbackCache.h"
+#include "TileResidency.h"
 #include <iostream>
 #include <cmath>
+#include <cstring>
+#include <algorithm>
 
 namespace Acute {
 
-Canvas::Canvas(int width, int height)
+static_assert(TimelapseRecorder::kTileSize == ReadbackCache::kTileSize, "The time-lapse records cache tiles");
+
+namespace {
+
+// Bounding box of a box under a symmetry transform
+Box transformBounds(const Box& box, const SymmetryTransform& transform) {
+    float x = (box.minX + box.maxX) * 0.5f, y = (box.minY + box.maxY) * 0.5f;
+    const float halfWidth = (box.maxX - box.minX) * 0.5f, halfHeight = (box.maxY - box.minY) * 0.5f;
+    transform.apply(x, y);
+    float hx = std::abs(transform.m[0]) * halfWidth + std::abs(transform.m[2]) * halfHeight;
+    float hy = std::abs(transform.m[1]) * halfWidth + std::abs(transform.m[3]) * halfHeight;
+    return { x - hx, y - hy, x + hx, y + hy };
+}
+
+} // namespace
+
+Canvas::Canvas(int width, int height, GLStateCache& state)
     : m_width(width)
     , m_height(height)
+    , m_state(state)
     , m_framebuffer(0)
     , m_canvasTexture(0)
+    , m_mipLevels(1)
+    , m_mipFramebuffer(0)
+    , m_viewWidth(width)
+    , m_viewHeight(height)
+    , m_zoom(1.0f)
+    , m_viewOriginX(0.0f)
+    , m_viewOriginY(0.0f)
     , m_dabVAO(0)
     , m_dabVBO(0)
+    , m_ribbonVAO(0)
+    , m_ribbonVBO(0)
     , m_screenVAO(0)
     , m_screenVBO(0)
-    , m_brushTexture(0)
+    , m_proxyVAO(0)
+    , m_proxyVBO(0)
+    , m_proxyCount(0)
+    , m_proxyTexture(0)
+    , m_proxyFramebuffer(0)
+    , m_proxyWidth(0)
+    , m_proxyHeight(0)
+    , m_tipTexture(0)
+    , m_strokeBufferActive(false)
+    , m_strokeHasContent(false)
+    , m_strokeOpacity(1.0f)
+    , m_strokeMinX(0)
+    , m_strokeMinY(0)
+    , m_strokeMaxX(0)
+    , m_strokeMaxY(0)
+    , m_scratchFramebuffer(0)
+    , m_scratchTexture(0)
+    , m_scratchX(0)
+    , m_scratchY(0)
+    , m_scratchWidth(0)
+    , m_scratchHeight(0)
+    , m_strokeBlend(BlendMode::Normal)
+    , m_destinationTexture(0)
+    , m_pickupTextures{ 0, 0 }
+    , m_pickupFramebuffers{ 0, 0 }
+    , m_pickupCurrent(0)
+    , m_selection(Selection::None)
+    , m_maskPainting(false)
+    , m_maskTexture(0)
+    , m_maskFramebuffer(0)
+    , m_stencilRenderbuffer(0)
+    , m_selectionVAO(0)
+    , m_selectionVBO(0)
+    , m_residencyBudget(0)
+    , m_computeRasterRequested(false)
+    , m_readbackRequested(false)
+    , m_fillTexture(0)
 {
 }
 
 Canvas::~Canvas() {
-    if (m_dabVAO) glDeleteVertexArrays(1, &m_dabVAO);
-    if (m_dabVBO) glDeleteBuffers(1, &m_dabVBO);
-    if (m_screenVAO) glDeleteVertexArrays(1, &m_screenVAO);
-    if (m_screenVBO) glDeleteBuffers(1, &m_screenVBO);
-    if (m_framebuffer) glDeleteFramebuffers(1, &m_framebuffer);
-    if (m_canvasTexture) glDeleteTextures(1, &m_canvasTexture);
-    if (m_brushTexture) glDeleteTextures(1, &m_brushTexture);
+    m_state.deleteVertexArray(m_dabVAO);
+    m_state.deleteBuffer(m_dabVBO);
+    m_state.deleteVertexArray(m_ribbonVAO);
+    m_state.deleteBuffer(m_ribbonVBO);
+    m_state.deleteVertexArray(m_screenVAO);
+    m_state.deleteBuffer(m_screenVBO);
+    m_state.deleteVertexArray(m_proxyVAO);
+    m_state.deleteBuffer(m_proxyVBO);
+    m_state.deleteFramebuffer(m_proxyFramebuffer);
+    m_state.deleteTexture(m_proxyTexture);
+    m_state.deleteVertexArray(m_selectionVAO);
+    m_state.deleteBuffer(m_selectionVBO);
+    releaseSelectionTargets();
+    m_state.deleteFramebuffer(m_framebuffer);
+    m_state.deleteFramebuffer(m_mipFramebuffer);
+    m_state.deleteTexture(m_canvasTexture);
+    m_state.deleteTexture(m_tipTexture);
+    m_state.deleteTexture(m_destinationTexture);
+    m_state.deleteTexture(m_fillTexture);
+    for (int i = 0; i < 2; i++) {
+        m_state.deleteFramebuffer(m_pickupFramebuffers[i]);
+        m_state.deleteTexture(m_pickupTextures[i]);
+    }
+    releaseScratch();
 }
 
 bool Canvas::initialize() {
@@ -37,12 +124,30 @@ bool Canvas::initialize() {
         return false;
     }
     
-    createBrushTexture();
+    createTipTexture();
     
     if (!createFramebuffer()) {
         return false;
     }
     
+    if (m_computeRasterRequested && ComputeRasterizer::isSupported()) {
+        m_computeRaster = std::make_unique<ComputeRasterizer>(m_state);
+        if (!m_computeRaster->initialize()) {
+            m_computeRaster.reset();
+        }
+    }
+    if (m_computeRasterRequested && !m_computeRaster) {
+        std::cerr << "Compute rasterizer needs OpenGL 4.3; drawing dabs as quads" << std::endl;
+    }
+    if (m_computeRaster) {
+        m_dabGenerator = std::make_unique<DabGenerator>(m_state);
+        if (!m_dabGenerator->initialize()) {
+            std::cerr << "Warning: No GPU dab generation; dabs are generated on the CPU" << std::endl;
+            m_dabGenerator.reset();
+        }
+    }
+    
+    updateSymmetry();
     clear();
     
     return true;
@@ -57,11 +162,13 @@ bool Canvas::initializeShaders() {
         layout (location = 1) in vec2 aTexCoord;
         
         out vec2 TexCoord;
+        flat out int Copy;
         
         uniform mat4 projection;
         uniform vec2 position;
         uniform float size;
         uniform float rotation;
+        uniform mat3x2 symmetry[32];    // Symmetry::kMaxTransforms, one per instance
         
         void main() {
             // Rotate and scale
@@ -70,29 +177,54 @@ bool Canvas::initializeShaders() {
             mat2 rot = mat2(c, -s, s, c);
             vec2 scaled = aPos * size;
             vec2 rotated = rot * scaled;
-            vec2 finalPos = position + rotated;
+            vec2 finalPos = symmetry[gl_InstanceID] * vec3(position + rotated, 1.0);
             
             gl_Position = projection * vec4(finalPos, 0.0, 1.0);
             TexCoord = aTexCoord;
+            Copy = gl_InstanceID;
         }
     )";
     
-    std::string dabFragmentSource = R"(
+    std::string dabFragmentSource = std::string(R"(
         #version 330 core
         in vec2 TexCoord;
-        out vec4 FragColor;
+        flat in int Copy;
+        layout (location = 0, index = 0) out vec4 FragColor;
+        layout (location = 0, index = 1) out vec4 Coverage;    // Smudging: share of the canvas replaced
         
-        uniform sampler2D brushTexture;
+        uniform sampler2DArray brushTips;
+        uniform float tipLayer;
         uniform vec3 color;
         uniform float opacity;
-        uniform float hardness;
-        
+        uniform int blendMode;
+        uniform int readDestination;    // Blend in the shader against a canvas copy
+        uniform sampler2D destination;
+        uniform int useMask;            // Soft selection: scale coverage by the mask
+        uniform sampler2D mask;
+        uniform int smudge;             // Move the canvas towards the paint mixed with the pickup
+        uniform float smudgeAmount;
+        uniform sampler2D pickup;       // One premultiplied color per copy
+    )") + kBlendFunctionSource + R"(
         void main() {
-            float dist = length(TexCoord - vec2(0.5));
-            float alpha = 1.0 - smoothstep(0.5 - hardness * 0.5, 0.5, dist);
-            alpha *= texture(brushTexture, TexCoord).r;
+            // Hardness is baked into the tip layer; one trilinear fetch
+            float alpha = texture(brushTips, vec3(TexCoord, tipLayer)).r;
             alpha *= opacity;
-            FragColor = vec4(color, alpha);
+            if (useMask != 0) {
+                alpha *= texelFetch(mask, ivec2(gl_FragCoord.xy), 0).r;
+            }
+            Coverage = vec4(alpha);
+            vec4 src = vec4(color * alpha, alpha);
+            if (smudge != 0) {
+                // The paint may be partly transparent, so this is a lerp
+                // rather than source over (see drawDab)
+                vec4 paint = mix(vec4(color, 1.0), texelFetch(pickup, ivec2(Copy, 0), 0), smudgeAmount);
+                FragColor = paint * alpha;
+            } else if (readDestination != 0) {
+                vec4 dst = texelFetch(destination, ivec2(gl_FragCoord.xy), 0);
+                FragColor = blendPremultiplied(src, dst, blendMode);
+            } else {
+                FragColor = src;
+            }
         }
     )";
     
@@ -101,6 +233,160 @@ bool Canvas::initializeShaders() {
         return false;
     }
     
+    // Ribbon shader: each segment is a bounding quad, coverage comes from the
+    // analytic distance to the tapered capsule
+    m_ribbonShader = std::make_unique<Shader>();
+    std::string ribbonVertexSource = R"(
+        #version 330 core
+        layout (location = 0) in vec2 aPos;
+        layout (location = 1) in vec3 aStart;   // x0, y0, r0
+        layout (location = 2) in vec3 aEnd;     // x1, y1, r1
+        layout (location = 3) in vec4 aColor;   // rgb, opacity
+        layout (location = 4) in vec2 aParams;  // hardness, joinsPrevious
+        
+        out vec2 FragPos;
+        flat out vec3 Start;
+        flat out vec3 End;
+        flat out vec4 Color;
+        flat out vec2 Params;
+        
+        uniform mat4 projection;
+        uniform mat3x2 symmetry[32];
+        
+        void main() {
+            // Rigid transforms keep the capsule radii
+            mat3x2 transform = symmetry[gl_InstanceID];
+            vec2 pos = transform * vec3(aPos, 1.0);
+            gl_Position = projection * vec4(pos, 0.0, 1.0);
+            FragPos = pos;
+            Start = vec3(transform * vec3(aStart.xy, 1.0), aStart.z);
+            End = vec3(transform * vec3(aEnd.xy, 1.0), aEnd.z);
+            Color = aColor;
+            Params = aParams;
+        }
+    )";
+    
+    std::string ribbonFragmentSource = R"(
+        #version 330 core
+        in vec2 FragPos;
+        flat in vec3 Start;
+        flat in vec3 End;
+        flat in vec4 Color;
+        flat in vec2 Params;
+        out vec4 FragColor;
+        
+        uniform int strokeBuffer;     // Drawing into the stroke scratch (max blending)
+        uniform float opacityScale;
+        uniform int useMask;          // Soft selection: scale coverage by the mask
+        uniform sampler2D mask;
+        
+        // Signed distance to the convex hull of two circles
+        float taperedCapsule(vec2 p, vec2 a, vec2 b, float ra, float rb) {
+            vec2 ba = b - a;
+            float h = dot(ba, ba);
+            float dr = ra - rb;
+            if (h <= dr * dr + 1e-4) {
+                // One end contains the other (or zero length)
+                return min(length(p - a) - ra, length(p - b) - rb);
+            }
+            vec2 pa = p - a;
+            vec2 q = vec2(abs(dot(pa, vec2(ba.y, -ba.x))), dot(pa, ba)) / h;
+            vec2 c = vec2(sqrt(h - dr * dr), dr);
+            float k = c.x * q.y - c.y * q.x;
+            float m = dot(c, q);
+            float n = dot(q, q);
+            if (k < 0.0) return sqrt(h * n) - ra;
+            if (k > c.x) return sqrt(h * (n + 1.0 - 2.0 * q.y)) - rb;
+            return m - ra;
+        }
+        
+        float coverage(float dist, float band) {
+            return 1.0 - smoothstep(0.5 - band, 0.5, dist);
+        }
+        
+        void main() {
+            float radius = 0.5 * (Start.z + End.z);
+            float band = max(1.0, (1.0 - Params.x) * radius);
+            float d = taperedCapsule(FragPos, Start.xy, End.xy, Start.z, End.z);
+            float alpha = coverage(d, band);
+            
+            // The join disc was already drawn by the previous segment's end cap
+            if (Params.y > 0.5 && strokeBuffer == 0) {
+                float joint = coverage(length(FragPos - Start.xy) - Start.z, band);
+                alpha = max(0.0, alpha - joint);
+            }
+            
+            if (alpha <= 0.0) discard;
+            alpha = min(1.0, alpha * Color.a * opacityScale);
+            if (useMask != 0) {
+                alpha *= texelFetch(mask, ivec2(gl_FragCoord.xy), 0).r;
+            }
+            FragColor = vec4(Color.rgb * alpha, alpha);
+        }
+    )";
+    
+    if (!m_ribbonShader->loadFromSource(ribbonVertexSource, ribbonFragmentSource)) {
+        std::cerr << "Failed to load ribbon shader" << std::endl;
+        return false;
+    }
+    
+    // Composite shader: draws the premultiplied stroke scratch, or a fill
+    // mask tinted with the fill color, over a target
+    m_compositeShader = std::make_unique<Shader>();
+    std::string compositeVertexSource = R"(
+        #version 330 core
+        layout (location = 0) in vec2 aPos;
+        layout (location = 1) in vec2 aTexCoord;
+        
+        out vec2 TexCoord;
+        
+        uniform mat4 projection;
+        uniform vec4 rect;  // x, y, width, height in canvas pixels
+        
+        void main() {
+            vec2 pos = rect.xy + (aPos + 0.5) * rect.zw;
+            gl_Position = projection * vec4(pos, 0.0, 1.0);
+            // Scratch rows are stored y down like the canvas
+            TexCoord = vec2(aTexCoord.x, 1.0 - aTexCoord.y);
+        }
+    )";
+    
+    std::string compositeFragmentSource = std::string(R"(
+        #version 330 core
+        in vec2 TexCoord;
+        out vec4 FragColor;
+        
+        uniform sampler2D scratchTexture;
+        uniform vec3 tint;
+        uniform float opacity;
+        uniform int blendMode;
+        uniform int readDestination;
+        uniform sampler2D destination;
+        uniform int useMask;
+        uniform sampler2D mask;
+    )") + kBlendFunctionSource + R"(
+        void main() {
+            vec4 src = texture(scratchTexture, TexCoord) * vec4(tint, 1.0) * opacity;
+            if (useMask != 0) {
+                src *= texelFetch(mask, ivec2(gl_FragCoord.xy), 0).r;
+            }
+            
+            // Nothing to blend; the destination may not have been copied here
+            if (src.a <= 0.0) discard;
+            if (readDestination != 0) {
+                vec4 dst = texelFetch(destination, ivec2(gl_FragCoord.xy), 0);
+                FragColor = blendPremultiplied(src, dst, blendMode);
+            } else {
+                FragColor = src;
+            }
+        }
+    )";
+    
+    if (!m_compositeShader->loadFromSource(compositeVertexSource, compositeFragmentSource)) {
+        std::cerr << "Failed to load composite shader" << std::endl;
+        return false;
+    }
+    
     // Screen shader for displaying the canvas
     m_screenShader = std::make_unique<Shader>();
     std::string screenVertexSource = R"(
@@ -116,15 +402,81 @@ bool Canvas::initializeShaders() {
         }
     )";
     
-    std::string screenFragmentSource = R"(
+    std::string screenFragmentSource = std::string(R"(
         #version 330 core
         in vec2 TexCoord;
         out vec4 FragColor;
         
         uniform sampler2D screenTexture;
+        uniform vec2 canvasSize;
+        uniform vec2 viewSize;
+        uniform vec2 viewOrigin;        // Canvas pixel at the top-left corner
+        uniform float zoom;
+        uniform float lod;              // Mip level matching the zoom
+        
+        // In-progress buffered stroke, previewed without touching the canvas
+        uniform int strokeActive;
+        uniform sampler2D strokeTexture;
+        uniform vec4 strokeRect;        // x, y, width, height in canvas pixels
+        uniform float strokeOpacity;
+        uniform int strokeMode;
+        
+        // 0: no selection, 1: selection, 2: painting the selection mask
+        uniform int selectionMode;
+        uniform sampler2D selectionMask;
         
+        // Tile residency: per tile, the finest mip level in video memory / 255,
+        // and 1 + its layer among the compressed tiles (0 if not compressed)
+        uniform int residencyActive;
+        uniform sampler2D residencyLod;
+        uniform usampler2D residencySlot;
+        uniform sampler2DArray compressedTiles;
+        uniform float tiledLevels;
+        uniform float tileSize;
+    )") + kBlendFunctionSource + R"(
         void main() {
-            FragColor = texture(screenTexture, TexCoord);
+            // Window pixel (y down) to canvas pixel
+            vec2 pixel = viewOrigin + vec2(TexCoord.x, 1.0 - TexCoord.y) * viewSize / zoom;
+            if (any(lessThan(pixel, vec2(0.0))) || any(greaterThanEqual(pixel, canvasSize))) {
+                FragColor = vec4(0.2, 0.2, 0.2, 1.0);
+                return;
+            }
+            
+            // Canvas rows are flipped in the texture
+            vec2 canvasUV = vec2(pixel.x, canvasSize.y - pixel.y) / canvasSize;
+            float sampleLod = lod;
+            uint slot = 0u;
+            vec2 tilePosition = canvasUV * canvasSize / tileSize;
+            if (residencyActive != 0) {
+                // Tiles still streaming in show their coarse levels meanwhile
+                ivec2 tile = ivec2(tilePosition);
+                sampleLod = max(lod, texelFetch(residencyLod, tile, 0).r * 255.0);
+                slot = lod < tiledLevels ? texelFetch(residencySlot, tile, 0).r : 0u;
+            }
+            vec4 color = slot > 0u
+                ? textureLod(compressedTiles, vec3(fract(tilePosition), float(slot - 1u)), lod)
+                : textureLod(screenTexture, canvasUV, sampleLod);
+            float selected = selectionMode != 0 ? texture(selectionMask, canvasUV).r : 1.0;
+            if (strokeActive != 0) {
+                vec2 uv = (pixel - strokeRect.xy) / strokeRect.zw;
+                if (all(greaterThanEqual(uv, vec2(0.0))) && all(lessThan(uv, vec2(1.0)))) {
+                    vec4 stroke = texture(strokeTexture, vec2(uv.x, 1.0 - uv.y)) * strokeOpacity * selected;
+                    color = blendPremultiplied(stroke, color, strokeMode);
+                }
+            }
+            
+            // Premultiplied canvas over a checkerboard so erased areas show
+            vec2 cell = floor(gl_FragCoord.xy / 8.0);
+            float checker = mod(cell.x + cell.y, 2.0) < 1.0 ? 1.0 : 0.8;
+            vec3 shown = color.rgb + vec3(checker) * (1.0 - color.a);
+            
+            // Dim what lies outside the selection; tint it red while painting the mask
+            if (selectionMode == 2) {
+                shown = mix(shown, vec3(1.0, 0.2, 0.2), 0.5 * (1.0 - selected));
+            } else if (selectionMode == 1) {
+                shown *= 1.0 - 0.35 * (1.0 - selected);
+            }
+            FragColor = vec4(shown, 1.0);
         }
     )";
     
@@ -133,6 +485,177 @@ bool Canvas::initializeShaders() {
         return false;
     }
     
+    // 2x2 box filter from the level above into the bound level. The viewport
+    // covers the dirty region, so gl_FragCoord is the destination texel.
+    m_mipShader = std::make_unique<Shader>();
+    std::string mipFragmentSource = R"(
+        #version 330 core
+        out vec4 FragColor;
+        
+        uniform sampler2D source;       // Base level set to the source level
+        
+        void main() {
+            ivec2 size = textureSize(source, 0);
+            ivec2 p = ivec2(gl_FragCoord.xy) * 2;
+            ivec2 q = min(p + 1, size - 1);
+            
+            // Premultiplied color averages correctly
+            FragColor = 0.25 * (texelFetch(source, p, 0) + texelFetch(source, ivec2(q.x, p.y), 0)
+                              + texelFetch(source, ivec2(p.x, q.y), 0) + texelFetch(source, q, 0));
+        }
+    )";
+    
+    if (!m_mipShader->loadFromSource(screenVertexSource, mipFragmentSource)) {
+        std::cerr << "Failed to load mip shader" << std::endl;
+        return false;
+    }
+    
+    // Smudge pickup: one texel per symmetry copy. The canvas under the dab is
+    // averaged over a grid weighted by the tip, then mixed into the previous
+    // pickup, which is read from the other texture of the pair.
+    m_pickupShader = std::make_unique<Shader>();
+    std::string pickupFragmentSource = R"(
+        #version 330 core
+        out vec4 FragColor;
+        
+        uniform sampler2D canvas;
+        uniform vec2 canvasSize;
+        uniform sampler2D previous;
+        uniform sampler2DArray brushTips;
+        uniform float tipLayer;
+        uniform float tipLod;
+        uniform vec2 position;
+        uniform float size;
+        uniform float rotation;
+        uniform float smudgeLength;
+        uniform mat3x2 symmetry[32];
+        
+        const int kSamples = 8;         // Per side, as in CpuCanvas
+        
+        void main() {
+            int copy = int(gl_FragCoord.x);
+            float c = cos(radians(rotation));
+            float s = sin(radians(rotation));
+            mat2 rot = mat2(c, -s, s, c);
+            
+            vec4 sum = vec4(0.0);
+            float weight = 0.0;
+            for (int j = 0; j < kSamples; j++) {
+                for (int i = 0; i < kSamples; i++) {
+                    vec2 uv = (vec2(i, j) + 0.5) / float(kSamples);
+                    float w = textureLod(brushTips, vec3(uv, tipLayer), tipLod).r;
+                    vec2 p = symmetry[copy] * vec3(position + rot * ((uv - 0.5) * size), 1.0);
+                    // Canvas rows are flipped in the texture
+                    p = clamp(vec2(p.x, canvasSize.y - p.y), vec2(0.5), canvasSize - 0.5);
+                    sum += w * textureLod(canvas, p / canvasSize, 0.0);
+                    weight += w;
+                }
+            }
+            
+            vec4 last = texelFetch(previous, ivec2(copy, 0), 0);
+            vec4 picked = weight > 0.0 ? sum / weight : last;
+            FragColor = smudgeLength > 0.0 ? mix(picked, last, smudgeLength) : picked;
+        }
+    )";
+    
+    if (!m_pickupShader->loadFromSource(screenVertexSource, pickupFragmentSource)) {
+        std::cerr << "Failed to load pickup shader" << std::endl;
+        return false;
+    }
+    
+    // Selection shapes (canvas pixels), written through the stencil test
+    m_selectionShader = std::make_unique<Shader>();
+    std::string selectionVertexSource = R"(
+        #version 330 core
+        layout (location = 0) in vec2 aPos;
+        
+        uniform mat4 projection;
+        
+        void main() {
+            gl_Position = projection * vec4(aPos, 0.0, 1.0);
+        }
+    )";
+    
+    std::string selectionFragmentSource = R"(
+        #version 330 core
+        out vec4 FragColor;
+        
+        void main() {
+            FragColor = vec4(1.0);
+        }
+    )";
+    
+    if (!m_selectionShader->loadFromSource(selectionVertexSource, selectionFragmentSource)) {
+        std::cerr << "Failed to load selection shader" << std::endl;
+        return false;
+    }
+    
+    // Proxy for queued dabs: a soft disc per dab and symmetry copy. The
+    // instance attributes advance once per `copies` instances.
+    m_proxyShader = std::make_unique<Shader>();
+    std::string proxyVertexSource = R"(
+        #version 330 core
+        layout (location = 0) in vec2 aPos;
+        layout (location = 2) in vec4 aDab;     // x, y, size, hardness
+        layout (location = 3) in vec4 aColor;   // rgb, opacity
+        
+        out vec2 Offset;
+        flat out float Hardness;
+        flat out vec4 Color;
+        
+        uniform mat4 projection;
+        uniform mat3x2 symmetry[32];
+        uniform int copies;
+        
+        void main() {
+            vec2 pos = symmetry[gl_InstanceID % copies] * vec3(aDab.xy + aPos * aDab.z, 1.0);
+            gl_Position = projection * vec4(pos, 0.0, 1.0);
+            Offset = aPos * 2.0;
+            Hardness = aDab.w;
+            Color = aColor;
+        }
+    )";
+    
+    std::string proxyFragmentSource = R"(
+        #version 330 core
+        in vec2 Offset;
+        flat in float Hardness;
+        flat in vec4 Color;
+        out vec4 FragColor;
+        
+        void main() {
+            float falloff = clamp((1.0 - length(Offset)) / max(1.0 - Hardness, 0.05), 0.0, 1.0);
+            float alpha = Color.a * falloff;
+            FragColor = vec4(Color.rgb * alpha, alpha);
+        }
+    )";
+    
+    if (!m_proxyShader->loadFromSource(proxyVertexSource, proxyFragmentSource)) {
+        std::cerr << "Failed to load proxy shader" << std::endl;
+        return false;
+    }
+    
+    // The proxy target is a little larger than the view; scale picks the part shown
+    m_proxyCompositeShader = std::make_unique<Shader>();
+    std::string proxyCompositeFragmentSource = R"(
+        #version 330 core
+        in vec2 TexCoord;
+        out vec4 FragColor;
+        
+        uniform sampler2D proxyTexture;
+        uniform vec2 scale;
+        
+        void main() {
+            // Rows run y down from the top of the texture, like the canvas
+            FragColor = texture(proxyTexture, vec2(TexCoord.x * scale.x, 1.0 - (1.0 - TexCoord.y) * scale.y));
+        }
+    )";
+    
+    if (!m_proxyCompositeShader->loadFromSource(screenVertexSource, proxyCompositeFragmentSource)) {
+        std::cerr << "Failed to load proxy composite shader" << std::endl;
+        return false;
+    }
+    
     return true;
 }
 
@@ -151,8 +674,8 @@ bool Canvas::initializeGeometry() {
     glGenVertexArrays(1, &m_dabVAO);
     glGenBuffers(1, &m_dabVBO);
     
-    glBindVertexArray(m_dabVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, m_dabVBO);
+    m_state.bindVertexArray(m_dabVAO);
+    m_state.bindBuffer(GL_ARRAY_BUFFER, m_dabVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(dabVertices), dabVertices, GL_STATIC_DRAW);
     
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
@@ -160,6 +683,25 @@ bool Canvas::initializeGeometry() {
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
     glEnableVertexAttribArray(1);
     
+    // Ribbon vertices are streamed per batch
+    glGenVertexArrays(1, &m_ribbonVAO);
+    glGenBuffers(1, &m_ribbonVBO);
+    
+    m_state.bindVertexArray(m_ribbonVAO);
+    m_state.bindBuffer(GL_ARRAY_BUFFER, m_ribbonVBO);
+    
+    const GLsizei ribbonStride = 14 * sizeof(float);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, ribbonStride, (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, ribbonStride, (void*)(2 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, ribbonStride, (void*)(5 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, ribbonStride, (void*)(8 * sizeof(float)));
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(4, 2, GL_FLOAT, GL_FALSE, ribbonStride, (void*)(12 * sizeof(float)));
+    glEnableVertexAttribArray(4);
+    
     // Screen quad (-1 to 1)
     float screenVertices[] = {
         // positions    // texcoords
@@ -174,8 +716,8 @@ bool Canvas::initializeGeometry() {
     glGenVertexArrays(1, &m_screenVAO);
     glGenBuffers(1, &m_screenVBO);
     
-    glBindVertexArray(m_screenVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, m_screenVBO);
+    m_state.bindVertexArray(m_screenVAO);
+    m_state.bindBuffer(GL_ARRAY_BUFFER, m_screenVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(screenVertices), screenVertices, GL_STATIC_DRAW);
     
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
@@ -183,46 +725,137 @@ bool Canvas::initializeGeometry() {
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)(2 * sizeof(float)));
     glEnableVertexAttribArray(1);
     
-    glBindVertexArray(0);
+    // Selection outlines in canvas pixels (streamed per selection)
+    glGenVertexArrays(1, &m_selectionVAO);
+    glGenBuffers(1, &m_selectionVBO);
+    
+    m_state.bindVertexArray(m_selectionVAO);
+    m_state.bindBuffer(GL_ARRAY_BUFFER, m_selectionVBO);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    
+    // Proxy discs: the dab quad plus streamed per-dab attributes
+    glGenVertexArrays(1, &m_proxyVAO);
+    glGenBuffers(1, &m_proxyVBO);
+    
+    m_state.bindVertexArray(m_proxyVAO);
+    m_state.bindBuffer(GL_ARRAY_BUFFER, m_dabVBO);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    m_state.bindBuffer(GL_ARRAY_BUFFER, m_proxyVBO);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(4 * sizeof(float)));
+    glEnableVertexAttribArray(3);
     
     return true;
 }
 
-void Canvas::createBrushTexture() {
-    const int size = 256;
-    std::vector<unsigned char> data(size * size);
+void Canvas::createTipTexture() {
+    const int size = BrushTipSet::kTipSize;
+    const int levels = BrushTipSet::getLevelCount();
     
-    // Create a radial gradient
-    for (int y = 0; y < size; y++) {
-        for (int x = 0; x < size; x++) {
-            float dx = (x - size * 0.5f) / (size * 0.5f);
-            float dy = (y - size * 0.5f) / (size * 0.5f);
-            float dist = std::sqrt(dx * dx + dy * dy);
-            float value = std::max(0.0f, 1.0f - dist);
-            data[y * size + x] = static_cast<unsigned char>(value * 255);
-        }
+    glGenTextures(1, &m_tipTexture);
+    m_state.bindTexture(0, GL_TEXTURE_2D_ARRAY, m_tipTexture);
+    
+    // Allocate every level for the full layer capacity so image tips can be
+    // added later without reallocating
+    for (int level = 0; level < levels; level++) {
+        int levelSize = std::max(1, size >> level);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_R8, levelSize, levelSize,
+                     BrushTipSet::kMaxLayers, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
     }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     
-    glGenTextures(1, &m_brushTexture);
-    glBindTexture(GL_TEXTURE_2D, m_brushTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, size, size, 0, GL_RED, GL_UNSIGNED_BYTE, data.data());
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    for (int layer = 0; layer < m_brushTips.getLayerCount(); layer++) {
+        uploadTipLayer(layer);
+    }
+}
+
+void Canvas::uploadTipLayer(int layer) {
+    const BrushTipImage& tip = m_brushTips.getLayer(layer);
+    
+    // Small mip levels have rows narrower than 4 bytes
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (size_t level = 0; level < tip.levels.size(); level++) {
+        int levelSize = std::max(1, tip.size >> level);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, static_cast<GLint>(level), 0, 0, layer,
+                        levelSize, levelSize, 1, GL_RED, GL_UNSIGNED_BYTE, tip.levels[level].data());
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+int Canvas::addBrushTip(const uint8_t* pixels, int width, int height) {
+    int tip = m_brushTips.addImageTip(pixels, width, height);
+    if (tip >= 0 && m_tipTexture) {
+        m_state.bindTexture(0, GL_TEXTURE_2D_ARRAY, m_tipTexture);
+        uploadTipLayer(m_brushTips.layerForDab(tip, 0.0f));
+    }
+    return tip;
+}
+
+int Canvas::loadBrushTip(const std::string& path) {
+    int tip = m_brushTips.loadImageTip(path);
+    if (tip >= 0 && m_tipTexture) {
+        m_state.bindTexture(0, GL_TEXTURE_2D_ARRAY, m_tipTexture);
+        uploadTipLayer(m_brushTips.layerForDab(tip, 0.0f));
+    }
+    return tip;
 }
 
 bool Canvas::createFramebuffer() {
     // Create framebuffer
     glGenFramebuffers(1, &m_framebuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    m_state.bindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
     
-    // Create texture for canvas
+    // Create texture for canvas, with every mip level down to 1x1
+    m_mipLevels = 1;
+    while ((std::max(m_width, m_height) >> m_mipLevels) > 0) {
+        m_mipLevels++;
+    }
     glGenTextures(1, &m_canvasTexture);
-    glBindTexture(GL_TEXTURE_2D, m_canvasTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_width, m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    m_state.bindTexture(0, GL_TEXTURE_2D, m_canvasTexture);
+    
+    // With a residency budget the texture is sparse and only tiles near the
+    // view are backed by video memory
+    m_residency.reset();
+    if (m_residencyBudget > 0 && TileResidency::isSupported(m_width, m_height)) {
+        m_residency = std::make_unique<TileResidency>(m_state);
+        if (!m_residency->initialize(m_canvasTexture, m_framebuffer, m_width, m_height, m_mipLevels,
+                                     m_residencyBudget)) {
+            // The storage may already be immutable; start over with a plain texture
+            m_residency.reset();
+            m_state.deleteTexture(m_canvasTexture);
+            glGenTextures(1, &m_canvasTexture);
+            m_state.bindTexture(0, GL_TEXTURE_2D, m_canvasTexture);
+        }
+    } else if (m_residencyBudget > 0) {
+        std::cerr << "Tile residency needs ARB_sparse_texture and a canvas of whole "
+                  << TileResidency::kTileSize << " px tiles; keeping the whole canvas in video memory" << std::endl;
+    }
+    if (!m_residency) {
+        for (int level = 0; level < m_mipLevels; level++) {
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, std::max(1, m_width >> level),
+                         std::max(1, m_height >> level), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, m_mipLevels - 1);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    
+    // Target for the mip updates; the level is attached per pass
+    if (!m_mipFramebuffer) {
+        glGenFramebuffers(1, &m_mipFramebuffer);
+    }
+    markAllDirty();
     
     // Attach texture to framebuffer
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_canvasTexture, 0);
@@ -230,98 +863,1485 @@ bool Canvas::createFramebuffer() {
     // Check framebuffer status
     if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
         std::cerr << "Framebuffer is not complete!" << std::endl;
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
         return false;
     }
     
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
     return true;
 }
 
 void Canvas::clear(float r, float g, float b, float a) {
-    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
-    glClearColor(r, g, b, a);
+    m_state.bindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    m_state.clearColor(r * a, g * a, b * a, a);
     glClear(GL_COLOR_BUFFER_BIT);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (!m_residency) {
+        markAllDirty();
+        return;
+    }
+    if (m_readbackCache) {
+        m_readbackCache->markAllDirty();
+    }
+    
+    // Evicted tiles become solid. Clearing every level directly keeps the
+    // coarse levels right without downsampling the whole canvas.
+    const uint8_t color[4] = {
+        static_cast<uint8_t>(std::lround(r * a * 255.0f)), static_cast<uint8_t>(std::lround(g * a * 255.0f)),
+        static_cast<uint8_t>(std::lround(b * a * 255.0f)), static_cast<uint8_t>(std::lround(a * 255.0f))
+    };
+    m_residency->clear(color);
+    m_state.bindFramebuffer(GL_FRAMEBUFFER, m_mipFramebuffer);
+    for (int level = 1; level < m_mipLevels; level++) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_canvasTexture, level);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+}
+
+bool Canvas::setDrawTarget(float* projection) {
+    // Orthographic projection from canvas pixels, y down. In stroke buffer
+    // mode the target is the scratch surface, offset to its canvas origin.
+    float originX = 0.0f, originY = 0.0f;
+    int width = m_width, height = m_height;
+    if (m_strokeBufferActive) {
+        m_state.bindFramebuffer(GL_FRAMEBUFFER, m_scratchFramebuffer);
+        originX = static_cast<float>(m_scratchX);
+        originY = static_cast<float>(m_scratchY);
+        width = m_scratchWidth;
+        height = m_scratchHeight;
+    } else if (m_maskPainting) {
+        m_state.bindFramebuffer(GL_FRAMEBUFFER, m_maskFramebuffer);
+    } else {
+        m_state.bindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    }
+    m_state.viewport(0, 0, width, height);
+    makeProjection(projection, originX, originY, width, height);
+    
+    // Only draws into the canvas itself are restricted by the selection
+    return applySelection(!m_strokeBufferActive && !m_maskPainting);
+}
+
+void Canvas::makeProjection(float* projection, float originX, float originY, float width, float height) {
+    const float ortho[16] = {
+        2.0f / width, 0.0f, 0.0f, 0.0f,
+        0.0f, -2.0f / height, 0.0f, 0.0f,
+        0.0f, 0.0f, -1.0f, 0.0f,
+        -1.0f - 2.0f * originX / width, 1.0f + 2.0f * originY / height, 0.0f, 1.0f
+    };
+    std::copy(ortho, ortho + 16, projection);
 }
 
 void Canvas::drawDab(const BrushDab& dab) {
-    glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    float opacity = dab.opacity * dab.flow;
+    
+    // Half-diagonal of the rotated quad plus a pixel of filtering, over every copy
+    float extent = dab.size * 0.7072f + 1.0f;
+    float minX = dab.x - extent, minY = dab.y - extent;
+    float maxX = dab.x + extent, maxY = dab.y + extent;
+    if (!m_strokeBufferActive && !m_maskPainting) {
+        makeResident(minX, minY, maxX, maxY, true);
+    }
+    if (!getSymmetryBounds(minX, minY, maxX, maxY)) {
+        return;
+    }
+    if (m_strokeBufferActive) {
+        if (!ensureScratchCovers(minX, minY, maxX, maxY)) {
+            return;
+        }
+        // Flow builds up towards 1 in the scratch; the stroke opacity is applied once on composite
+        opacity = std::min(1.0f, opacity / m_strokeOpacity);
+    }
     
-    // Enable blending for alpha compositing
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    // Only dabs on the canvas itself have paint to pick up
+    bool smudging = dab.isSmudging() && !m_strokeBufferActive && !m_maskPainting;
+    if (smudging) {
+        pickUpPaint(dab);
+    }
     
-    // Use dab shader
-    m_dabShader->use();
+    float projection[16];
+    bool useMask = setDrawTarget(projection);
     
-    // Set up orthographic projection
-    float projection[16] = {
-        2.0f / m_width, 0.0f, 0.0f, 0.0f,
-        0.0f, -2.0f / m_height, 0.0f, 0.0f,
-        0.0f, 0.0f, -1.0f, 0.0f,
-        -1.0f, 1.0f, 0.0f, 1.0f
-    };
+    // The selection mask only takes adding and erasing coverage
+    BlendMode blend = dab.blend;
+    if (m_maskPainting && blend != BlendMode::Erase) {
+        blend = BlendMode::Normal;
+    }
+    
+    // The shader outputs premultiplied color
+    bool readDestination = false;
+    if (m_strokeBufferActive) {
+        // The scratch accumulates plain coverage; the stroke blend mode is
+        // applied when it is composited
+        m_state.setBlend(true);
+        setFixedFunctionBlend(BlendMode::Normal);
+    } else if (smudging) {
+        // dst * (1 - coverage) + paint * coverage: the second output is the
+        // coverage, so paint with any alpha needs no destination copy
+        m_state.setBlend(true);
+        m_state.blendEquation(GL_FUNC_ADD);
+        m_state.blendFunc(GL_ONE, GL_ONE_MINUS_SRC1_COLOR);
+    } else if (isFixedFunctionBlend(blend)) {
+        m_state.setBlend(true);
+        setFixedFunctionBlend(blend);
+    } else {
+        // Shader blend against a copy of just the pixels under each copy
+        if (!copyDestination(m_copyBounds)) {
+            return;
+        }
+        readDestination = true;
+    }
+    if (!m_strokeBufferActive && !m_maskPainting) {
+        markDirty(m_copyBounds);
+    }
+    
+    // Use dab shader
+    m_dabShader->use(m_state);
     m_dabShader->setMat4("projection", projection);
     
     // Set uniforms
     m_dabShader->setVec2("position", dab.x, dab.y);
     m_dabShader->setFloat("size", dab.size);
     m_dabShader->setFloat("rotation", dab.rotation);
-    m_dabShader->setVec3("color", dab.r, dab.g, dab.b);
-    m_dabShader->setFloat("opacity", dab.opacity * dab.flow);
-    m_dabShader->setFloat("hardness", dab.hardness);
-    
-    // Bind brush texture
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, m_brushTexture);
-    m_dabShader->setInt("brushTexture", 0);
+    if (m_maskPainting) {
+        m_dabShader->setVec3("color", 1.0f, 1.0f, 1.0f);
+    } else {
+        m_dabShader->setVec3("color", dab.r, dab.g, dab.b);
+    }
+    m_dabShader->setFloat("opacity", opacity);
+    m_dabShader->setFloat("tipLayer", static_cast<float>(m_brushTips.layerForDab(dab.tip, dab.hardness)));
+    m_dabShader->setInt("blendMode", static_cast<int>(blend));
+    m_dabShader->setInt("readDestination", readDestination ? 1 : 0);
+    m_dabShader->setInt("destination", 1);
+    m_dabShader->setInt("useMask", useMask ? 1 : 0);
+    m_dabShader->setInt("mask", 2);
+    m_dabShader->setInt("smudge", smudging ? 1 : 0);
+    m_dabShader->setFloat("smudgeAmount", dab.smudge);
+    m_dabShader->setInt("pickup", 3);
     
-    // Draw quad
-    glBindVertexArray(m_dabVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
+    // Bind brush tip array
+    m_state.bindTexture(0, GL_TEXTURE_2D_ARRAY, m_tipTexture);
+    m_dabShader->setInt("brushTips", 0);
     
-    glDisable(GL_BLEND);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // Draw the quad once per symmetry copy
+    m_state.bindVertexArray(m_dabVAO);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, static_cast<GLsizei>(m_symmetryTransforms.size()));
 }
 
 void Canvas::drawDabs(const std::vector<BrushDab>& dabs) {
-    for (const auto& dab : dabs) {
-        drawDab(dab);
-    }
+    drawDabs(dabs.data(), dabs.size());
 }
 
-void Canvas::render() {
-    // Render canvas texture to screen
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glClearColor(0.2f, 0.2f, 0.2f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
-    
-    m_screenShader->use();
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, m_canvasTexture);
-    m_screenShader->setInt("screenTexture", 0);
-    
-    glBindVertexArray(m_screenVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
+void Canvas::drawDabs(const BrushDab* dabs, size_t count) {
+    if (m_computeRaster && !m_maskPainting) {
+        // A smudging dab reads what the dabs before it drew, so it ends the
+        // compute batch and is drawn on its own
+        size_t start = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (!dabs[i].isSmudging() || m_strokeBufferActive) {
+                continue;
+            }
+            if (i > start) {
+                drawDabsCompute(dabs + start, i - start);
+            }
+            drawDab(dabs[i]);
+            start = i + 1;
+        }
+        if (start < count) {
+            drawDabsCompute(dabs + start, count - start);
+        }
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        drawDab(dabs[i]);
+    }
 }
 
-void Canvas::resize(int width, int height) {
-    m_width = width;
-    m_height = height;
-    
-    // Recreate framebuffer with new size
-    if (m_framebuffer) {
-        glDeleteFramebuffers(1, &m_framebuffer);
-        glDeleteTextures(1, &m_canvasTexture);
+void Canvas::drawDabsCompute(const BrushDab* dabs, size_t count) {
+    // Same per-dab preparation as drawDab, gathering the batch bounds
+    m_computeDabs.clear();
+    float batchMinX = 0.0f, batchMinY = 0.0f, batchMaxX = 0.0f, batchMaxY = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+        const BrushDab& dab = dabs[i];
+        float opacity = dab.opacity * dab.flow;
+        float extent = dab.size * 0.7072f + 1.0f;
+        float minX = dab.x - extent, minY = dab.y - extent;
+        float maxX = dab.x + extent, maxY = dab.y + extent;
+        if (!m_strokeBufferActive) {
+            makeResident(minX, minY, maxX, maxY, true);
+        }
+        if (!getSymmetryBounds(minX, minY, maxX, maxY)) {
+            continue;
+        }
+        if (m_strokeBufferActive) {
+            if (!ensureScratchCovers(minX, minY, maxX, maxY)) {
+                continue;
+            }
+            opacity = std::min(1.0f, opacity / m_strokeOpacity);
+        }
+        
+        growCopyBounds(m_batchCopyBounds, m_copyBounds, m_computeDabs.empty());
+        if (m_computeDabs.empty()) {
+            batchMinX = minX;
+            batchMinY = minY;
+            batchMaxX = maxX;
+            batchMaxY = maxY;
+        } else {
+            batchMinX = std::min(batchMinX, minX);
+            batchMinY = std::min(batchMinY, minY);
+            batchMaxX = std::max(batchMaxX, maxX);
+            batchMaxY = std::max(batchMaxY, maxY);
+        }
+        
+        // The scratch accumulates plain coverage, as with quads
+        BlendMode blend = m_strokeBufferActive ? BlendMode::Normal : dab.blend;
+        float layer = static_cast<float>(m_brushTips.layerForDab(dab.tip, dab.hardness));
+        float lod = std::log2(static_cast<float>(BrushTipSet::kTipSize) / std::max(dab.size, 1.0f));
+        m_computeDabs.push_back({ dab.x, dab.y, dab.size, dab.rotation, dab.r, dab.g, dab.b, opacity,
+                                  layer, static_cast<float>(static_cast<int>(blend)), lod, 0.0f });
     }
-    
-    createFramebuffer();
-    clear();
+    if (m_computeDabs.empty()) {
+        return;
+    }
+    m_computeRaster->draw(m_computeDabs, getComputeTarget(batchMinX, batchMinY, batchMaxX, batchMaxY),
+                          m_tipTexture);
 }
 
-} // namespace Acute
+void Canvas::setSegmentBrush(const DabSegmentBrush& brush) {
+    if (!m_dabGenerator) {
+        return;
+    }
+    int layer = brush.tip >= 0 && brush.tip < m_brushTips.getImageTipCount()
+        ? m_brushTips.layerForDab(brush.tip, brush.hardness) : -1;
+    m_dabGenerator->setBrush(brush, layer);
+}
+
+void Canvas::drawDabSegments(const DabSegment* segments, size_t count) {
+    if (!m_dabGenerator) {
+        return;
+    }
+    
+    // Per segment, the preparation drawDabsCompute does per dab, on the
+    // move's bounds grown by the largest dab
+    size_t dabCount = 0;
+    size_t maxTiles = 0;
+    bool any = false;
+    float batchMinX = 0.0f, batchMinY = 0.0f, batchMaxX = 0.0f, batchMaxY = 0.0f;
+    for (size_t i = 0; i < count; i++) {
+        const DabSegment& segment = segments[i];
+        dabCount += static_cast<size_t>(segment.count);
+        maxTiles += static_cast<size_t>(segment.count) * ComputeRasterizer::tilesPerCopy(segment.radius);
+        float minX = std::min(segment.x0, segment.x1) - segment.radius;
+        float minY = std::min(segment.y0, segment.y1) - segment.radius;
+        float maxX = std::max(segment.x0, segment.x1) + segment.radius;
+        float maxY = std::max(segment.y0, segment.y1) + segment.radius;
+        if (!m_strokeBufferActive) {
+            makeResident(minX, minY, maxX, maxY, true);
+        }
+        if (!getSymmetryBounds(minX, minY, maxX, maxY)) {
+            continue;
+        }
+        if (m_strokeBufferActive && !ensureScratchCovers(minX, minY, maxX, maxY)) {
+            continue;
+        }
+        growCopyBounds(m_batchCopyBounds, m_copyBounds, !any);
+        if (!any) {
+            batchMinX = minX;
+            batchMinY = minY;
+            batchMaxX = maxX;
+            batchMaxY = maxY;
+            any = true;
+        } else {
+            batchMinX = std::min(batchMinX, minX);
+            batchMinY = std::min(batchMinY, minY);
+            batchMaxX = std::max(batchMaxX, maxX);
+            batchMaxY = std::max(batchMaxY, maxY);
+        }
+    }
+    if (!any) {
+        m_dabGenerator->skip(dabCount);
+        return;
+    }
+    if (dabCount == 0) {
+        return;
+    }
+    
+    // Off-canvas segments are generated too and clipped by the target rect
+    ComputeRasterizer::Target target = getComputeTarget(batchMinX, batchMinY, batchMaxX, batchMaxY);
+    m_dabGenerator->generate(segments, count, dabCount, m_computeRaster->reserveDabs(dabCount),
+                             m_strokeBufferActive, m_strokeOpacity);
+    m_computeRaster->drawReserved(dabCount, maxTiles, target, m_tipTexture);
+}
+
+ComputeRasterizer::Target Canvas::getComputeTarget(float minX, float minY, float maxX, float maxY) {
+    ComputeRasterizer::Target target;
+    int width = m_width;
+    if (m_strokeBufferActive) {
+        target.texture = m_scratchTexture;
+        target.height = m_scratchHeight;
+        target.originX = static_cast<float>(m_scratchX);
+        target.originY = static_cast<float>(m_scratchY);
+        target.mask = 0;
+        width = m_scratchWidth;
+    } else {
+        target.texture = m_canvasTexture;
+        target.height = m_height;
+        target.originX = 0.0f;
+        target.originY = 0.0f;
+        target.mask = m_selection != Selection::None ? m_maskTexture : 0;
+        markDirty(m_batchCopyBounds);
+    }
+    
+    // Batch bounds in texels, rows bottom up
+    target.x0 = std::max(0, static_cast<int>(std::floor(minX - target.originX)));
+    target.x1 = std::min(width, static_cast<int>(std::ceil(maxX - target.originX)));
+    target.y0 = std::max(0, target.height - static_cast<int>(std::ceil(maxY - target.originY)));
+    target.y1 = std::min(target.height, target.height - static_cast<int>(std::floor(minY - target.originY)));
+    return target;
+}
+
+void Canvas::drawRibbon(const std::vector<RibbonSegment>& segments) {
+    drawRibbon(segments.data(), segments.size());
+}
+
+void Canvas::drawRibbon(const RibbonSegment* segments, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    
+    float minX = segments[0].x0, minY = segments[0].y0;
+    float maxX = minX, maxY = minY;
+    for (size_t i = 0; i < count; i++) {
+        const RibbonSegment& seg = segments[i];
+        float extent = std::max(seg.r0, seg.r1) + 2.0f;
+        minX = std::min(minX, std::min(seg.x0, seg.x1) - extent);
+        minY = std::min(minY, std::min(seg.y0, seg.y1) - extent);
+        maxX = std::max(maxX, std::max(seg.x0, seg.x1) + extent);
+        maxY = std::max(maxY, std::max(seg.y0, seg.y1) + extent);
+    }
+    if (!m_strokeBufferActive && !m_maskPainting) {
+        makeResident(minX, minY, maxX, maxY, true);
+    }
+    if (!getSymmetryBounds(minX, minY, maxX, maxY)) {
+        return;
+    }
+    if (m_strokeBufferActive) {
+        if (!ensureScratchCovers(minX, minY, maxX, maxY)) {
+            return;
+        }
+    } else if (!m_maskPainting) {
+        markDirty(m_copyBounds);
+    }
+    
+    // Tessellate every segment into an oriented bounding quad (two triangles)
+    const float margin = 1.5f;
+    const bool maskColor = m_maskPainting;
+    m_ribbonVertices.clear();
+    m_ribbonVertices.reserve(count * 6 * 14);
+    for (size_t i = 0; i < count; i++) {
+        const RibbonSegment& seg = segments[i];
+        float dx = seg.x1 - seg.x0;
+        float dy = seg.y1 - seg.y0;
+        float length = std::sqrt(dx * dx + dy * dy);
+        float ux = 1.0f, uy = 0.0f;
+        if (length > 1e-4f) {
+            ux = dx / length;
+            uy = dy / length;
+        }
+        float nx = -uy, ny = ux;
+        float extent = std::max(seg.r0, seg.r1) + margin;
+        
+        float ax = seg.x0 - ux * extent, ay = seg.y0 - uy * extent;
+        float bx = seg.x1 + ux * extent, by = seg.y1 + uy * extent;
+        float corners[4][2] = {
+            {ax - nx * extent, ay - ny * extent},
+            {bx - nx * extent, by - ny * extent},
+            {bx + nx * extent, by + ny * extent},
+            {ax + nx * extent, ay + ny * extent}
+        };
+        const int order[6] = {0, 1, 2, 0, 2, 3};
+        for (int corner : order) {
+            const float vertex[14] = {
+                corners[corner][0], corners[corner][1],
+                seg.x0, seg.y0, seg.r0,
+                seg.x1, seg.y1, seg.r1,
+                maskColor ? 1.0f : seg.r, maskColor ? 1.0f : seg.g, maskColor ? 1.0f : seg.b, seg.opacity,
+                seg.hardness, seg.joinsPrevious ? 1.0f : 0.0f
+            };
+            m_ribbonVertices.insert(m_ribbonVertices.end(), vertex, vertex + 14);
+        }
+    }
+    
+    float projection[16];
+    bool useMask = setDrawTarget(projection);
+    m_state.setBlend(true);
+    
+    m_ribbonShader->use(m_state);
+    m_ribbonShader->setMat4("projection", projection);
+    m_ribbonShader->setInt("useMask", useMask ? 1 : 0);
+    m_ribbonShader->setInt("mask", 2);
+    if (m_strokeBufferActive) {
+        // Coverage is a union in the scratch: max blending of premultiplied
+        // color blends every pixel exactly once, so joins need no correction
+        m_state.blendEquation(GL_MAX);
+        m_ribbonShader->setInt("strokeBuffer", 1);
+        m_ribbonShader->setFloat("opacityScale", 1.0f / m_strokeOpacity);
+    } else {
+        // Ribbons are only used with fixed function modes (see BrushEngine::canUseRibbon)
+        BlendMode blend = segments[0].blend;
+        if (m_maskPainting && blend != BlendMode::Erase) {
+            blend = BlendMode::Normal;
+        }
+        setFixedFunctionBlend(blend);
+        m_ribbonShader->setInt("strokeBuffer", 0);
+        m_ribbonShader->setFloat("opacityScale", 1.0f);
+    }
+    
+    m_state.bindVertexArray(m_ribbonVAO);
+    m_state.bindBuffer(GL_ARRAY_BUFFER, m_ribbonVBO);
+    glBufferData(GL_ARRAY_BUFFER, m_ribbonVertices.size() * sizeof(float),
+                 m_ribbonVertices.data(), GL_STREAM_DRAW);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, static_cast<GLsizei>(count * 6),
+                          static_cast<GLsizei>(m_symmetryTransforms.size()));
+}
+
+void Canvas::setSymmetry(const Symmetry& symmetry) {
+    m_symmetry = symmetry;
+    updateSymmetry();
+}
+
+void Canvas::updateSymmetry() {
+    m_symmetryTransforms = m_symmetry.buildTransforms(m_width, m_height);
+    m_symmetryMatrices.clear();
+    for (const auto& transform : m_symmetryTransforms) {
+        m_symmetryMatrices.insert(m_symmetryMatrices.end(), transform.m, transform.m + 6);
+    }
+    
+    // Uniforms live in the program, so they are set once per change
+    GLsizei count = static_cast<GLsizei>(m_symmetryTransforms.size());
+    m_dabShader->use(m_state);
+    m_dabShader->setMat3x2Array("symmetry", m_symmetryMatrices.data(), count);
+    m_ribbonShader->use(m_state);
+    m_ribbonShader->setMat3x2Array("symmetry", m_symmetryMatrices.data(), count);
+    m_proxyShader->use(m_state);
+    m_proxyShader->setMat3x2Array("symmetry", m_symmetryMatrices.data(), count);
+    m_pickupShader->use(m_state);
+    m_pickupShader->setMat3x2Array("symmetry", m_symmetryMatrices.data(), count);
+    if (m_computeRaster) {
+        m_computeRaster->setSymmetry(m_symmetryMatrices, count);
+    }
+}
+
+bool Canvas::getSymmetryBounds(float& minX, float& minY, float& maxX, float& maxY) {
+    const Box box = { minX, minY, maxX, maxY };
+    bool any = false;
+    m_copyBounds.clear();
+    for (const auto& transform : m_symmetryTransforms) {
+        Box copy = transformBounds(box, transform);
+        if (copy.maxX <= 0.0f || copy.maxY <= 0.0f || copy.minX >= m_width || copy.minY >= m_height) {
+            // Off-canvas copies (tiled mode) are clipped by the viewport
+            m_copyBounds.push_back(Box{ 0.0f, 0.0f, 0.0f, 0.0f });
+            continue;
+        }
+        m_copyBounds.push_back(copy);
+        if (!any) {
+            minX = copy.minX;
+            minY = copy.minY;
+            maxX = copy.maxX;
+            maxY = copy.maxY;
+            any = true;
+        } else {
+            minX = std::min(minX, copy.minX);
+            minY = std::min(minY, copy.minY);
+            maxX = std::max(maxX, copy.maxX);
+            maxY = std::max(maxY, copy.maxY);
+        }
+    }
+    return any;
+}
+
+void Canvas::growCopyBounds(std::vector<Box>& bounds, const std::vector<Box>& copies, bool first) {
+    if (first || bounds.size() != copies.size()) {
+        bounds = copies;
+        return;
+    }
+    for (size_t i = 0; i < copies.size(); i++) {
+        const Box& copy = copies[i];
+        Box& box = bounds[i];
+        if (copy.minX >= copy.maxX) {
+            continue;
+        }
+        if (box.minX >= box.maxX) {
+            box = copy;
+        } else {
+            box.minX = std::min(box.minX, copy.minX);
+            box.minY = std::min(box.minY, copy.minY);
+            box.maxX = std::max(box.maxX, copy.maxX);
+            box.maxY = std::max(box.maxY, copy.maxY);
+        }
+    }
+}
+
+void Canvas::makeResident(float minX, float minY, float maxX, float maxY, bool eachCopy) {
+    if (!m_residency) {
+        return;
+    }
+    
+    // Each symmetry copy on its own: their union can span far more tiles
+    const Box box = { minX, minY, maxX, maxY };
+    size_t copies = eachCopy ? m_symmetryTransforms.size() : 1;
+    for (size_t i = 0; i < copies; i++) {
+        Box copy = eachCopy ? transformBounds(box, m_symmetryTransforms[i]) : box;
+        
+        // Canvas rows are flipped in the texture
+        m_residency->require(static_cast<int>(std::floor(copy.minX)), m_height - static_cast<int>(std::ceil(copy.maxY)),
+                             static_cast<int>(std::ceil(copy.maxX)), m_height - static_cast<int>(std::floor(copy.minY)));
+    }
+}
+
+void Canvas::beginStroke(bool useStrokeBuffer, float opacity, BlendMode blend) {
+    // Mask strokes paint the mask directly
+    m_strokeBufferActive = useStrokeBuffer && opacity > 0.0f && !m_maskPainting;
+    m_strokeOpacity = std::min(1.0f, opacity);
+    m_strokeBlend = blend;
+    m_strokeHasContent = false;
+}
+
+void Canvas::endStroke() {
+    if (!m_strokeBufferActive) {
+        return;
+    }
+    
+    // Composite the finished stroke into the canvas once
+    if (m_strokeHasContent) {
+        drawScratch();
+    }
+    
+    m_strokeBufferActive = false;
+    m_strokeHasContent = false;
+}
+
+bool Canvas::ensureScratchCovers(float minX, float minY, float maxX, float maxY) {
+    // Clamp the requested region to the canvas
+    int x0 = std::max(0, static_cast<int>(std::floor(minX)));
+    int y0 = std::max(0, static_cast<int>(std::floor(minY)));
+    int x1 = std::min(m_width, static_cast<int>(std::ceil(maxX)));
+    int y1 = std::min(m_height, static_cast<int>(std::ceil(maxY)));
+    if (x0 >= x1 || y0 >= y1) {
+        return false;
+    }
+    
+    growCopyBounds(m_strokeCopyBounds, m_copyBounds, !m_strokeHasContent);
+    if (!m_strokeHasContent) {
+        // First content of the stroke: start a fresh region around it
+        m_strokeMinX = x0;
+        m_strokeMinY = y0;
+        m_strokeMaxX = x1;
+        m_strokeMaxY = y1;
+    } else {
+        m_strokeMinX = std::min(m_strokeMinX, x0);
+        m_strokeMinY = std::min(m_strokeMinY, y0);
+        m_strokeMaxX = std::max(m_strokeMaxX, x1);
+        m_strokeMaxY = std::max(m_strokeMaxY, y1);
+    }
+    
+    bool covered = m_strokeHasContent && m_scratchTexture
+        && m_strokeMinX >= m_scratchX && m_strokeMinY >= m_scratchY
+        && m_strokeMaxX <= m_scratchX + m_scratchWidth
+        && m_strokeMaxY <= m_scratchY + m_scratchHeight;
+    if (covered) {
+        return true;
+    }
+    
+    // Grow to the running bounding box, snapped outwards to whole chunks
+    const int chunk = kScratchChunkSize;
+    int newX = std::max(0, (m_strokeMinX / chunk) * chunk);
+    int newY = std::max(0, (m_strokeMinY / chunk) * chunk);
+    int newRight = std::min(m_width, ((m_strokeMaxX + chunk - 1) / chunk) * chunk);
+    int newBottom = std::min(m_height, ((m_strokeMaxY + chunk - 1) / chunk) * chunk);
+    
+    // Reuse the previous stroke's surface when the new region fits in it
+    if (!m_strokeHasContent && m_scratchTexture
+        && newRight - newX <= m_scratchWidth && newBottom - newY <= m_scratchHeight) {
+        m_scratchX = std::min(newX, m_width - m_scratchWidth);
+        m_scratchY = std::min(newY, m_height - m_scratchHeight);
+        m_state.bindFramebuffer(GL_FRAMEBUFFER, m_scratchFramebuffer);
+        m_state.clearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        m_strokeHasContent = true;
+        return true;
+    }
+    
+    GLuint texture = 0;
+    GLuint framebuffer = 0;
+    glGenTextures(1, &texture);
+    m_state.bindTexture(0, GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, newRight - newX, newBottom - newY, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    
+    glGenFramebuffers(1, &framebuffer);
+    m_state.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Stroke scratch framebuffer is not complete!" << std::endl;
+        m_state.deleteFramebuffer(framebuffer);
+        m_state.deleteTexture(texture);
+        return false;
+    }
+    m_state.clearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    
+    // Carry over what the stroke has drawn so far. Rows are flipped in the
+    // scratch (y down), so the old region's top edge maps from the new top.
+    if (m_strokeHasContent && m_scratchTexture) {
+        int newHeight = newBottom - newY;
+        int dstX = m_scratchX - newX;
+        int dstY = newHeight - (m_scratchY - newY) - m_scratchHeight;
+        m_state.bindFramebuffer(GL_READ_FRAMEBUFFER, m_scratchFramebuffer);
+        m_state.bindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+        glBlitFramebuffer(0, 0, m_scratchWidth, m_scratchHeight,
+                          dstX, dstY, dstX + m_scratchWidth, dstY + m_scratchHeight,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+    
+    releaseScratch();
+    m_scratchTexture = texture;
+    m_scratchFramebuffer = framebuffer;
+    m_scratchX = newX;
+    m_scratchY = newY;
+    m_scratchWidth = newRight - newX;
+    m_scratchHeight = newBottom - newY;
+    m_strokeHasContent = true;
+    return true;
+}
+
+void Canvas::releaseScratch() {
+    m_state.deleteFramebuffer(m_scratchFramebuffer);
+    m_state.deleteTexture(m_scratchTexture);
+    m_scratchWidth = 0;
+    m_scratchHeight = 0;
+}
+
+void Canvas::drawScratch() {
+    makeResident(static_cast<float>(m_scratchX), static_cast<float>(m_scratchY),
+                 static_cast<float>(m_scratchX + m_scratchWidth), static_cast<float>(m_scratchY + m_scratchHeight),
+                 false);
+    m_state.bindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    m_state.viewport(0, 0, m_width, m_height);
+    
+    // Premultiplied scratch scaled by the stroke opacity, in the stroke's mode
+    bool readDestination = false;
+    if (isFixedFunctionBlend(m_strokeBlend)) {
+        m_state.setBlend(true);
+        setFixedFunctionBlend(m_strokeBlend);
+    } else {
+        // The scratch is empty between the stroke's copies; the composite
+        // discards those pixels, so only the copies are read
+        readDestination = copyDestination(m_strokeCopyBounds);
+        if (!readDestination) {
+            return;
+        }
+    }
+    
+    markDirty(m_strokeCopyBounds);
+              
+    m_compositeShader->use(m_state);
+    const float projection[16] = {
+        2.0f / m_width, 0.0f, 0.0f, 0.0f,
+        0.0f, -2.0f / m_height, 0.0f, 0.0f,
+        0.0f, 0.0f, -1.0f, 0.0f,
+        -1.0f, 1.0f, 0.0f, 1.0f
+    };
+    m_compositeShader->setMat4("projection", projection);
+    m_compositeShader->setVec4("rect", static_cast<float>(m_scratchX), static_cast<float>(m_scratchY),
+                               static_cast<float>(m_scratchWidth), static_cast<float>(m_scratchHeight));
+    m_compositeShader->setVec3("tint", 1.0f, 1.0f, 1.0f);
+    m_compositeShader->setFloat("opacity", m_strokeOpacity);
+    m_state.bindTexture(0, GL_TEXTURE_2D, m_scratchTexture);
+    m_compositeShader->setInt("scratchTexture", 0);
+    m_compositeShader->setInt("blendMode", static_cast<int>(m_strokeBlend));
+    m_compositeShader->setInt("readDestination", readDestination ? 1 : 0);
+    m_compositeShader->setInt("destination", 1);
+    m_compositeShader->setInt("useMask", applySelection(true) ? 1 : 0);
+    m_compositeShader->setInt("mask", 2);
+    
+    m_state.bindVertexArray(m_dabVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
+void Canvas::setReadbackCache(bool enabled) {
+    m_readbackRequested = enabled;
+    updateReadbackCache();
+}
+
+bool Canvas::setFrameExport(const std::string& name) {
+    m_frameExport.reset();
+    if (!name.empty()) {
+        auto frameExport = std::make_unique<FrameExport>();
+        if (!frameExport->open(name, m_width, m_height)) {
+            updateReadbackCache();
+            return false;
+        }
+        m_frameExport = std::move(frameExport);
+    }
+    updateReadbackCache();
+    if (m_frameExport) {
+        // Every tile goes out once, as the cache first reads it
+        m_readbackCache->markAllDirty();
+    }
+    return true;
+}
+
+bool Canvas::startTimelapse(const std::string& path, const TimelapseOptions& options) {
+    finishTimelapse();
+    m_timelapse = std::make_unique<TimelapseRecorder>();
+    if (!m_timelapse->open(path, m_width, m_height, options)) {
+        m_timelapse.reset();
+        return false;
+    }
+    updateReadbackCache();
+    // The first snapshot is a keyframe of the whole canvas
+    m_readbackCache->markAllDirty();
+    return true;
+}
+
+void Canvas::finishTimelapse() {
+    if (!m_timelapse || !m_timelapse->isOpen()) {
+        return;
+    }
+    m_readbackCache->finish();
+    m_readbackCache->takeRefreshed(m_refreshedTiles);
+    if (m_frameExport && !m_refreshedTiles.empty()) {
+        m_frameExport->publish(*m_readbackCache, m_refreshedTiles);
+    }
+    m_timelapse->finish(m_readbackCache->getPixels(), m_refreshedTiles);
+    updateReadbackCache();
+}
+
+void Canvas::writePixels(int x0, int y0, int x1, int y1, const uint8_t* pixels, size_t stride) {
+    x0 = std::max(0, x0);
+    y0 = std::max(0, y0);
+    x1 = std::min(m_width, x1);
+    y1 = std::min(m_height, y1);
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    makeResident(static_cast<float>(x0), static_cast<float>(y0), static_cast<float>(x1), static_cast<float>(y1),
+                 false);
+    
+    // Rows are flipped in the texture
+    const size_t rowBytes = static_cast<size_t>(x1 - x0) * 4;
+    m_uploadRows.resize(rowBytes * (y1 - y0));
+    for (int y = y0; y < y1; y++) {
+        std::memcpy(m_uploadRows.data() + static_cast<size_t>(y1 - 1 - y) * rowBytes, pixels + (y - y0) * stride,
+                    rowBytes);
+    }
+    m_state.bindTexture(0, GL_TEXTURE_2D, m_canvasTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, x0, m_height - y1, x1 - x0, y1 - y0, GL_RGBA, GL_UNSIGNED_BYTE,
+                    m_uploadRows.data());
+    markDirty(static_cast<float>(x0), static_cast<float>(y0), static_cast<float>(x1), static_cast<float>(y1));
+}
+
+void Canvas::updateReadbackCache() {
+    bool recording = m_timelapse && m_timelapse->isOpen();
+    if (!m_readbackRequested && !m_frameExport && !recording) {
+        m_readbackCache.reset();
+        return;
+    }
+    if (!m_readbackCache) {
+        m_readbackCache = std::make_unique<ReadbackCache>(m_state);
+        m_readbackCache->initialize(m_framebuffer, m_width, m_height, m_residency.get());
+    }
+    // A live export cannot wait for the pen to leave a tile; a few frames
+    // behind is enough to show strokes as they are drawn. A time-lapse can
+    // wait longer, but not through a long scribble over the same tiles.
+    m_readbackCache->setMaxDeferral(m_frameExport ? 3 : recording ? 60 : UINT64_MAX);
+}
+
+bool Canvas::fill(float x, float y, const FillOptions& options, float r, float g, float b, float opacity,
+                  BlendMode blend) {
+    // Only the tiles drawn on since the cache last caught up are waited for
+    setReadbackCache(true);
+    m_readbackCache->finish();
+    if (!m_floodFill.fill(m_readbackCache->getPixels(), m_width, m_height, static_cast<int>(std::floor(x)),
+                          static_cast<int>(std::floor(y)), options)) {
+        return false;
+    }
+    int x0 = m_floodFill.getMinX(), y0 = m_floodFill.getMinY();
+    int x1 = m_floodFill.getMaxX(), y1 = m_floodFill.getMaxY();
+    
+    // Upload the mask under the fill's bounds, rows y down like the scratch
+    if (!m_fillTexture) {
+        glGenTextures(1, &m_fillTexture);
+        m_state.bindTexture(0, GL_TEXTURE_2D, m_fillTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        const GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, GL_RED };
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    } else {
+        m_state.bindTexture(0, GL_TEXTURE_2D, m_fillTexture);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, m_width);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, x1 - x0, y1 - y0, 0, GL_RED, GL_UNSIGNED_BYTE,
+                 m_floodFill.getMask() + static_cast<size_t>(y0) * m_width + x0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    
+    float minX = static_cast<float>(x0), minY = static_cast<float>(y0);
+    float maxX = static_cast<float>(x1), maxY = static_cast<float>(y1);
+    makeResident(minX, minY, maxX, maxY, false);
+    m_state.bindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    m_state.viewport(0, 0, m_width, m_height);
+    
+    // Composited like a stroke scratch: premultiplied color times the mask
+    bool readDestination = false;
+    if (isFixedFunctionBlend(blend)) {
+        m_state.setBlend(true);
+        setFixedFunctionBlend(blend);
+    } else {
+        readDestination = copyDestination(minX, minY, maxX, maxY);
+        if (!readDestination) {
+            return false;
+        }
+    }
+    markDirty(minX, minY, maxX, maxY);
+    
+    m_compositeShader->use(m_state);
+    float projection[16];
+    makeProjection(projection, 0.0f, 0.0f, static_cast<float>(m_width), static_cast<float>(m_height));
+    m_compositeShader->setMat4("projection", projection);
+    m_compositeShader->setVec4("rect", minX, minY, maxX - minX, maxY - minY);
+    m_compositeShader->setVec3("tint", r, g, b);
+    m_compositeShader->setFloat("opacity", opacity);
+    m_state.bindTexture(0, GL_TEXTURE_2D, m_fillTexture);
+    m_compositeShader->setInt("scratchTexture", 0);
+    m_compositeShader->setInt("blendMode", static_cast<int>(blend));
+    m_compositeShader->setInt("readDestination", readDestination ? 1 : 0);
+    m_compositeShader->setInt("destination", 1);
+    m_compositeShader->setInt("useMask", applySelection(true) ? 1 : 0);
+    m_compositeShader->setInt("mask", 2);
+    
+    m_state.bindVertexArray(m_dabVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    return true;
+}
+
+bool Canvas::isFixedFunctionBlend(BlendMode mode) {
+    // Multiply needs the destination alpha in a way blend factors cannot express
+    return mode != BlendMode::Multiply;
+}
+
+void Canvas::setFixedFunctionBlend(BlendMode mode) {
+    // Source color is premultiplied
+    m_state.blendEquation(GL_FUNC_ADD);
+    switch (mode) {
+        case BlendMode::Erase:
+            // Destination out
+            m_state.blendFunc(GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+            break;
+        case BlendMode::Screen:
+            m_state.blendFuncSeparate(GL_ONE, GL_ONE_MINUS_SRC_COLOR, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+            break;
+        case BlendMode::Add:
+            m_state.blendFuncSeparate(GL_ONE, GL_ONE, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+            break;
+        case BlendMode::Multiply:
+            // Exact only over opaque pixels; callers use the shader path instead
+            m_state.blendFuncSeparate(GL_DST_COLOR, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+            break;
+        case BlendMode::Normal:
+        default:
+            m_state.blendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+            break;
+    }
+}
+
+bool Canvas::copyDestination(float minX, float minY, float maxX, float maxY) {
+    int x0 = std::max(0, static_cast<int>(std::floor(minX)));
+    int y0 = std::max(0, static_cast<int>(std::floor(minY)));
+    int x1 = std::min(m_width, static_cast<int>(std::ceil(maxX)));
+    int y1 = std::min(m_height, static_cast<int>(std::ceil(maxY)));
+    if (x0 >= x1 || y0 >= y1) {
+        return false;
+    }
+    
+    if (!m_destinationTexture) {
+        // Same size as the canvas so gl_FragCoord addresses it directly
+        glGenTextures(1, &m_destinationTexture);
+        m_state.bindTexture(1, GL_TEXTURE_2D, m_destinationTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_width, m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    } else {
+        m_state.bindTexture(1, GL_TEXTURE_2D, m_destinationTexture);
+    }
+    
+    // Canvas rows are flipped in the framebuffer (y down in canvas pixels)
+    int fbY = m_height - y1;
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, x0, fbY, x0, fbY, x1 - x0, y1 - y0);
+    
+    // The shader writes the blended result directly
+    m_state.setBlend(false);
+    return true;
+}
 
+bool Canvas::copyDestination(const std::vector<Box>& regions) {
+    bool copied = false;
+    for (const auto& region : regions) {
+        copied = copyDestination(region.minX, region.minY, region.maxX, region.maxY) || copied;
+    }
+    return copied;
+}
+
+void Canvas::pickUpPaint(const BrushDab& dab) {
+    if (!m_pickupTextures[0]) {
+        // Cleared, so a stale pickup is never NaN
+        const std::vector<float> zeros(Symmetry::kMaxTransforms * 4, 0.0f);
+        glGenTextures(2, m_pickupTextures);
+        glGenFramebuffers(2, m_pickupFramebuffers);
+        for (int i = 0; i < 2; i++) {
+            m_state.bindTexture(3, GL_TEXTURE_2D, m_pickupTextures[i]);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, Symmetry::kMaxTransforms, 1, 0, GL_RGBA, GL_FLOAT,
+                         zeros.data());
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            m_state.bindFramebuffer(GL_FRAMEBUFFER, m_pickupFramebuffers[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_pickupTextures[i], 0);
+        }
+    }
+    
+    // Read the last pickup, write the other texture
+    const int next = 1 - m_pickupCurrent;
+    m_state.bindFramebuffer(GL_FRAMEBUFFER, m_pickupFramebuffers[next]);
+    m_state.viewport(0, 0, static_cast<GLsizei>(m_symmetryTransforms.size()), 1);
+    m_state.setBlend(false);
+    m_state.setStencilTest(false);
+    
+    m_pickupShader->use(m_state);
+    m_pickupShader->setVec2("canvasSize", static_cast<float>(m_width), static_cast<float>(m_height));
+    m_pickupShader->setVec2("position", dab.x, dab.y);
+    m_pickupShader->setFloat("size", dab.size);
+    m_pickupShader->setFloat("rotation", dab.rotation);
+    m_pickupShader->setFloat("smudgeLength", dab.smudgeLength);
+    m_pickupShader->setFloat("tipLayer", static_cast<float>(m_brushTips.layerForDab(dab.tip, dab.hardness)));
+    m_pickupShader->setFloat("tipLod", std::log2(BrushTipSet::kTipSize / 8.0f));
+    m_pickupShader->setInt("brushTips", 0);
+    m_pickupShader->setInt("previous", 3);
+    m_pickupShader->setInt("canvas", 4);
+    
+    // The canvas goes on a unit the dab shader does not sample, so it can
+    // stay bound while the dab draws into it
+    m_state.bindTexture(0, GL_TEXTURE_2D_ARRAY, m_tipTexture);
+    m_state.bindTexture(3, GL_TEXTURE_2D, m_pickupTextures[m_pickupCurrent]);
+    m_state.bindTexture(4, GL_TEXTURE_2D, m_canvasTexture);
+    m_state.bindVertexArray(m_screenVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    
+    // The dab reads the new pickup
+    m_pickupCurrent = next;
+    m_state.bindTexture(3, GL_TEXTURE_2D, m_pickupTextures[next]);
+}
+
+void Canvas::markDirty(float minX, float minY, float maxX, float maxY) {
+    int x0 = std::max(0, static_cast<int>(std::floor(minX)));
+    int y0 = std::max(0, static_cast<int>(std::floor(minY)));
+    int x1 = std::min(m_width, static_cast<int>(std::ceil(maxX)));
+    int y1 = std::min(m_height, static_cast<int>(std::ceil(maxY)));
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+    if (m_readbackCache) {
+        m_readbackCache->markDirty(x0, y0, x1, y1);
+    }
+    if (m_residency) {
+        // Tracked per tile; rows are flipped in the texture
+        m_residency->markDirty(x0, m_height - y1, x1, m_height - y0);
+        return;
+    }
+    
+    // Symmetry copies and separate strokes stay separate regions, rather than
+    // one box spanning the canvas between them
+    for (size_t i = 0; i < m_dirtyRegions.size(); i += 4) {
+        int* region = &m_dirtyRegions[i];
+        if (x0 <= region[2] && x1 >= region[0] && y0 <= region[3] && y1 >= region[1]) {
+            region[0] = std::min(region[0], x0);
+            region[1] = std::min(region[1], y0);
+            region[2] = std::max(region[2], x1);
+            region[3] = std::max(region[3], y1);
+            return;
+        }
+    }
+    const int region[4] = { x0, y0, x1, y1 };
+    m_dirtyRegions.insert(m_dirtyRegions.end(), region, region + 4);
+    if (m_dirtyRegions.size() > kMaxDirtyRegions * 4) {
+        for (size_t i = 4; i < m_dirtyRegions.size(); i += 4) {
+            m_dirtyRegions[0] = std::min(m_dirtyRegions[0], m_dirtyRegions[i]);
+            m_dirtyRegions[1] = std::min(m_dirtyRegions[1], m_dirtyRegions[i + 1]);
+            m_dirtyRegions[2] = std::max(m_dirtyRegions[2], m_dirtyRegions[i + 2]);
+            m_dirtyRegions[3] = std::max(m_dirtyRegions[3], m_dirtyRegions[i + 3]);
+        }
+        m_dirtyRegions.resize(4);
+    }
+}
+
+void Canvas::markDirty(const std::vector<Box>& regions) {
+    for (const auto& region : regions) {
+        markDirty(region.minX, region.minY, region.maxX, region.maxY);
+    }
+}
+
+void Canvas::markAllDirty() {
+    if (m_readbackCache) {
+        m_readbackCache->markAllDirty();
+    }
+    if (m_residency) {
+        m_residency->markDirty(0, 0, m_width, m_height);
+        return;
+    }
+    m_dirtyRegions = { 0, 0, m_width, m_height };
+}
+
+void Canvas::updateMips() {
+    if (m_residency) {
+        // Tile by tile: the union of the dirty tiles may cover tiles that are
+        // not resident, which read as zero
+        m_residency->takeDirtyTiles(m_dirtyTiles);
+        for (size_t i = 0; i + 3 < m_dirtyTiles.size(); i += 4) {
+            updateMipRegion(m_dirtyTiles[i], m_dirtyTiles[i + 1], m_dirtyTiles[i + 2], m_dirtyTiles[i + 3]);
+        }
+        return;
+    }
+    
+    // Dirty regions in framebuffer texels (rows are flipped)
+    for (size_t i = 0; i + 3 < m_dirtyRegions.size(); i += 4) {
+        const int* region = &m_dirtyRegions[i];
+        updateMipRegion(region[0], m_height - region[3], region[2], m_height - region[1]);
+    }
+    m_dirtyRegions.clear();
+}
+
+void Canvas::updateMipRegion(int x0, int y0, int x1, int y1) {
+    if (m_mipLevels <= 1) {
+        return;
+    }
+    
+    m_state.bindFramebuffer(GL_FRAMEBUFFER, m_mipFramebuffer);
+    m_state.setBlend(false);
+    m_state.setStencilTest(false);
+    m_mipShader->use(m_state);
+    m_mipShader->setInt("source", 0);
+    m_state.bindTexture(0, GL_TEXTURE_2D, m_canvasTexture);
+    m_state.bindVertexArray(m_screenVAO);
+    
+    for (int level = 1; level < m_mipLevels; level++) {
+        // Texels of this level that read any dirty texel of the level above
+        x0 >>= 1;
+        y0 >>= 1;
+        x1 = std::min(std::max(1, m_width >> level), (x1 + 1) >> 1);
+        y1 = std::min(std::max(1, m_height >> level), (y1 + 1) >> 1);
+        if (x0 >= x1 || y0 >= y1) {
+            // Only a trailing odd row or column changed, which no smaller level reads
+            break;
+        }
+        
+        // Only the source level may be sampled while this level is attached
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_canvasTexture, level);
+        m_state.viewport(x0, y0, x1 - x0, y1 - y0);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+    }
+    
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, m_mipLevels - 1);
+}
+
+void Canvas::setViewSize(int width, int height) {
+    m_viewWidth = width;
+    m_viewHeight = height;
+}
+
+void Canvas::setView(float zoom, float originX, float originY) {
+    m_zoom = zoom;
+    m_viewOriginX = originX;
+    m_viewOriginY = originY;
+}
+
+void Canvas::screenToCanvas(float& x, float& y) const {
+    x = m_viewOriginX + x / m_zoom;
+    y = m_viewOriginY + y / m_zoom;
+}
+
+void Canvas::render() {
+    // One canvas pixel per screen pixel at level 0, half as many per level
+    float lod = std::min(std::max(0.0f, -std::log2(m_zoom)), static_cast<float>(m_mipLevels - 1));
+    
+    if (m_residency) {
+        // Stream tiles towards the visible region, in texels (rows bottom up)
+        float viewRight = m_viewOriginX + m_viewWidth / m_zoom;
+        float viewBottom = m_viewOriginY + m_viewHeight / m_zoom;
+        m_residency->update(m_viewOriginX, m_height - viewBottom, viewRight, m_height - m_viewOriginY, lod);
+    }
+    updateMips();
+    if (m_readbackCache) {
+        m_readbackCache->update();
+        if (m_frameExport || m_timelapse) {
+            m_readbackCache->takeRefreshed(m_refreshedTiles);
+        }
+        if (m_frameExport && !m_refreshedTiles.empty()) {
+            m_frameExport->publish(*m_readbackCache, m_refreshedTiles);
+        }
+        if (m_timelapse) {
+            m_timelapse->update(m_readbackCache->getPixels(), m_refreshedTiles);
+        }
+    }
+    
+    // Render canvas texture to screen
+    m_state.bindFramebuffer(GL_FRAMEBUFFER, 0);
+    m_state.viewport(0, 0, m_viewWidth, m_viewHeight);
+    m_state.clearColor(0.2f, 0.2f, 0.2f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    
+    // The screen shader composites over the checkerboard itself
+    m_state.setBlend(false);
+    m_state.setStencilTest(false);
+    
+    m_screenShader->use(m_state);
+    m_state.bindTexture(0, GL_TEXTURE_2D, m_canvasTexture);
+    m_screenShader->setInt("screenTexture", 0);
+    m_screenShader->setVec2("canvasSize", static_cast<float>(m_width), static_cast<float>(m_height));
+    m_screenShader->setVec2("viewSize", static_cast<float>(m_viewWidth), static_cast<float>(m_viewHeight));
+    m_screenShader->setVec2("viewOrigin", m_viewOriginX, m_viewOriginY);
+    m_screenShader->setFloat("zoom", m_zoom);
+    m_screenShader->setFloat("lod", lod);
+    m_screenShader->setInt("residencyActive", m_residency ? 1 : 0);
+    // Samplers of different types may not share a unit, even unused
+    m_screenShader->setInt("residencySlot", 4);
+    m_screenShader->setInt("compressedTiles", 5);
+    if (m_residency) {
+        m_state.bindTexture(3, GL_TEXTURE_2D, m_residency->getLodTexture());
+        m_screenShader->setInt("residencyLod", 3);
+        m_state.bindTexture(4, GL_TEXTURE_2D, m_residency->getSlotTexture());
+        m_state.bindTexture(5, GL_TEXTURE_2D_ARRAY, m_residency->getCompressedTexture());
+        m_screenShader->setFloat("tiledLevels", static_cast<float>(m_residency->getTiledLevels()));
+        m_screenShader->setFloat("tileSize", static_cast<float>(TileResidency::kTileSize));
+    }
+    
+    // Show the in-progress stroke over the canvas without touching it
+    bool showStroke = m_strokeBufferActive && m_strokeHasContent;
+    m_screenShader->setInt("strokeActive", showStroke ? 1 : 0);
+    if (showStroke) {
+        m_state.bindTexture(1, GL_TEXTURE_2D, m_scratchTexture);
+        m_screenShader->setInt("strokeTexture", 1);
+        m_screenShader->setVec4("strokeRect", static_cast<float>(m_scratchX), static_cast<float>(m_scratchY),
+                                static_cast<float>(m_scratchWidth), static_cast<float>(m_scratchHeight));
+        m_screenShader->setFloat("strokeOpacity", m_strokeOpacity);
+        m_screenShader->setInt("strokeMode", static_cast<int>(m_strokeBlend));
+    }
+    
+    // The mask also shows which part of the canvas is selected
+    int selectionMode = m_maskPainting ? 2 : (m_selection != Selection::None ? 1 : 0);
+    m_screenShader->setInt("selectionMode", selectionMode);
+    if (selectionMode != 0) {
+        m_state.bindTexture(2, GL_TEXTURE_2D, m_maskTexture);
+        m_screenShader->setInt("selectionMask", 2);
+    }
+    
+    m_state.bindVertexArray(m_screenVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    
+    drawProxy();
+}
+
+void Canvas::setProxyDabs(const std::vector<BrushDab>& dabs) {
+    if (dabs.empty() && m_proxyCount == 0) {
+        return;
+    }
+    
+    m_proxyInstances.clear();
+    for (const auto& dab : dabs) {
+        // Smudged paint is only known once the dabs before it are drawn
+        if (dab.blend == BlendMode::Erase || dab.isSmudging()) {
+            continue;
+        }
+        const float instance[8] = {
+            dab.x, dab.y, dab.size, dab.hardness, dab.r, dab.g, dab.b, dab.opacity * dab.flow
+        };
+        m_proxyInstances.insert(m_proxyInstances.end(), instance, instance + 8);
+    }
+    m_proxyCount = static_cast<GLsizei>(m_proxyInstances.size() / 8);
+    if (m_proxyCount == 0) {
+        return;
+    }
+    
+    // Orphan the previous frame's data
+    m_state.bindBuffer(GL_ARRAY_BUFFER, m_proxyVBO);
+    glBufferData(GL_ARRAY_BUFFER, m_proxyInstances.size() * sizeof(float), m_proxyInstances.data(),
+                 GL_STREAM_DRAW);
+}
+
+void Canvas::drawProxy() {
+    if (m_proxyCount == 0 || m_maskPainting) {
+        return;
+    }
+    
+    // Low resolution target covering the view, rebuilt when the view size changes
+    int width = (m_viewWidth + kProxyScale - 1) / kProxyScale;
+    int height = (m_viewHeight + kProxyScale - 1) / kProxyScale;
+    if (!m_proxyTexture || width != m_proxyWidth || height != m_proxyHeight) {
+        m_state.deleteFramebuffer(m_proxyFramebuffer);
+        m_state.deleteTexture(m_proxyTexture);
+        
+        glGenTextures(1, &m_proxyTexture);
+        m_state.bindTexture(0, GL_TEXTURE_2D, m_proxyTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        
+        glGenFramebuffers(1, &m_proxyFramebuffer);
+        m_state.bindFramebuffer(GL_FRAMEBUFFER, m_proxyFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_proxyTexture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Proxy framebuffer is not complete!" << std::endl;
+            m_state.deleteFramebuffer(m_proxyFramebuffer);
+            m_state.deleteTexture(m_proxyTexture);
+            return;
+        }
+        m_proxyWidth = width;
+        m_proxyHeight = height;
+    }
+    
+    // Discs over transparent black, premultiplied
+    m_state.bindFramebuffer(GL_FRAMEBUFFER, m_proxyFramebuffer);
+    m_state.viewport(0, 0, width, height);
+    m_state.clearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    m_state.setBlend(true);
+    setFixedFunctionBlend(BlendMode::Normal);
+    
+    float projection[16];
+    float scale = static_cast<float>(kProxyScale) / m_zoom;
+    makeProjection(projection, m_viewOriginX, m_viewOriginY, width * scale, height * scale);
+    GLsizei copies = static_cast<GLsizei>(m_symmetryTransforms.size());
+    m_proxyShader->use(m_state);
+    m_proxyShader->setMat4("projection", projection);
+    m_proxyShader->setInt("copies", copies);
+    
+    m_state.bindVertexArray(m_proxyVAO);
+    glVertexAttribDivisor(2, static_cast<GLuint>(copies));
+    glVertexAttribDivisor(3, static_cast<GLuint>(copies));
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, m_proxyCount * copies);
+    
+    // Upscale over the screen
+    m_state.bindFramebuffer(GL_FRAMEBUFFER, 0);
+    m_state.viewport(0, 0, m_viewWidth, m_viewHeight);
+    m_proxyCompositeShader->use(m_state);
+    m_state.bindTexture(0, GL_TEXTURE_2D, m_proxyTexture);
+    m_proxyCompositeShader->setInt("proxyTexture", 0);
+    m_proxyCompositeShader->setVec2("scale", static_cast<float>(m_viewWidth) / (width * kProxyScale),
+                                    static_cast<float>(m_viewHeight) / (height * kProxyScale));
+    m_state.bindVertexArray(m_screenVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
+void Canvas::resize(int width, int height) {
+    m_width = width;
+    m_height = height;
+    
+    // An in-progress stroke buffer refers to the old canvas
+    m_strokeBufferActive = false;
+    m_strokeHasContent = false;
+    releaseScratch();
+    m_state.deleteTexture(m_destinationTexture);
+    
+    // The selection is in old canvas pixels
+    m_selection = Selection::None;
+    m_maskPainting = false;
+    releaseSelectionTargets();
+    
+    // Recreate framebuffer with new size
+    m_state.deleteFramebuffer(m_framebuffer);
+    m_state.deleteTexture(m_canvasTexture);
+    
+    createFramebuffer();
+    if (m_readbackCache) {
+        m_readbackCache->initialize(m_framebuffer, m_width, m_height, m_residency.get());
+    }
+    if (m_timelapse) {
+        m_timelapse->resize(m_width, m_height);
+    }
+    if (m_frameExport) {
+        // Readers see the old segment close and open the new size
+        std::string name = m_frameExport->getName();
+        if (!m_frameExport->open(name, m_width, m_height)) {
+            m_frameExport.reset();
+            updateReadbackCache();
+        }
+    }
+    updateSymmetry();
+    clear();
+}
+
+bool Canvas::applySelection(bool canvasTarget) {
+    if (!canvasTarget || m_selection == Selection::None) {
+        m_state.setStencilTest(false);
+        return false;
+    }
+    
+    if (m_selection == Selection::Hard) {
+        // Selected pixels have stencil 1; nothing outside is written
+        m_state.setStencilTest(true);
+        m_state.stencilFunc(GL_EQUAL, 1, 1);
+        m_state.stencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        return false;
+    }
+    
+    // Soft masks scale coverage in the shader, read at the fragment's own texel
+    m_state.setStencilTest(false);
+    m_state.bindTexture(2, GL_TEXTURE_2D, m_maskTexture);
+    return true;
+}
+
+bool Canvas::ensureSelectionTargets() {
+    if (m_maskFramebuffer) {
+        return true;
+    }
+    
+    // The window's stencil does not apply to the off-screen canvas, so the
+    // canvas framebuffer gets its own
+    glGenRenderbuffers(1, &m_stencilRenderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_stencilRenderbuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_STENCIL_INDEX8, m_width, m_height);
+    
+    GLenum attachment = GL_STENCIL_ATTACHMENT;
+    m_state.bindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, m_stencilRenderbuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        // Stencil-only attachments are optional; packed depth-stencil is not
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, 0);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, m_width, m_height);
+        attachment = GL_DEPTH_STENCIL_ATTACHMENT;
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, m_stencilRenderbuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Canvas framebuffer with stencil is not complete" << std::endl;
+            releaseSelectionTargets();
+            return false;
+        }
+    }
+    
+    // Mask with the same size and row order as the canvas, sharing its stencil
+    glGenTextures(1, &m_maskTexture);
+    m_state.bindTexture(2, GL_TEXTURE_2D, m_maskTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, m_width, m_height, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    
+    glGenFramebuffers(1, &m_maskFramebuffer);
+    m_state.bindFramebuffer(GL_FRAMEBUFFER, m_maskFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_maskTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, m_stencilRenderbuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Selection mask framebuffer is not complete" << std::endl;
+        releaseSelectionTargets();
+        return false;
+    }
+    
+    return true;
+}
+
+void Canvas::releaseSelectionTargets() {
+    if (m_stencilRenderbuffer) {
+        // Deleting a renderbuffer only detaches it from the bound framebuffer
+        m_state.bindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, 0);
+        glDeleteRenderbuffers(1, &m_stencilRenderbuffer);
+        m_stencilRenderbuffer = 0;
+    }
+    m_state.deleteFramebuffer(m_maskFramebuffer);
+    m_state.deleteTexture(m_maskTexture);
+}
+
+void Canvas::selectRectangle(float x0, float y0, float x1, float y1) {
+    std::vector<float> points = {x0, y0, x1, y0, x1, y1, x0, y1};
+    selectLasso(points);
+}
 
+void Canvas::selectLasso(const std::vector<float>& points) {
+    if (points.size() < 6 || !ensureSelectionTargets()) {
+        return;
+    }
+    
+    // Polygon as a fan, followed by a quad covering the canvas
+    std::vector<float> vertices(points.begin(), points.end() - (points.size() & 1));
+    int polygonCount = static_cast<int>(vertices.size() / 2);
+    const float w = static_cast<float>(m_width);
+    const float h = static_cast<float>(m_height);
+    vertices.insert(vertices.end(), {0.0f, 0.0f, w, 0.0f, w, h, 0.0f, h});
+    
+    m_state.bindVertexArray(m_selectionVAO);
+    m_state.bindBuffer(GL_ARRAY_BUFFER, m_selectionVBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STREAM_DRAW);
+    
+    float projection[16];
+    makeProjection(projection, 0.0f, 0.0f, m_width, m_height);
+    m_state.bindFramebuffer(GL_FRAMEBUFFER, m_maskFramebuffer);
+    m_state.viewport(0, 0, m_width, m_height);
+    m_state.setBlend(false);
+    m_state.clearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    
+    m_selectionShader->use(m_state);
+    m_selectionShader->setMat4("projection", projection);
+    
+    // Even-odd fill: every triangle of the fan flips the stencil bit it covers
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    m_state.setStencilTest(true);
+    m_state.stencilFunc(GL_ALWAYS, 0, 1);
+    m_state.stencilOp(GL_KEEP, GL_KEEP, GL_INVERT);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, polygonCount);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    
+    // Copy the stencil into the mask for display and mask painting
+    m_state.stencilFunc(GL_EQUAL, 1, 1);
+    m_state.stencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+    glDrawArrays(GL_TRIANGLE_FAN, polygonCount, 4);
+    
+    m_selection = m_maskPainting ? Selection::Soft : Selection::Hard;
+}
+
+void Canvas::clearSelection() {
+    m_selection = Selection::None;
+    m_maskPainting = false;
+}
+
+void Canvas::setMaskPainting(bool enabled) {
+    if (!enabled) {
+        m_maskPainting = false;
+        return;
+    }
+    if (m_maskPainting || !ensureSelectionTargets()) {
+        return;
+    }
+    
+    if (m_selection == Selection::None) {
+        // Start from everything selected
+        m_state.bindFramebuffer(GL_FRAMEBUFFER, m_maskFramebuffer);
+        m_state.clearColor(1.0f, 1.0f, 1.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+    
+    // A hard selection's mask already holds its shape; from here on the
+    // painted mask is what clips
+    m_selection = Selection::Soft;
+    m_maskPainting = true;
+}
+
+} // namespace Acute
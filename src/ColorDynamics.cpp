@@ -0,0 +1,199 @@
+#include "ColorDynamics.h"
+#include "BrushPipeline.h"
+#include <algorithm>
+#include <cstdint>
+
+namespace Acute {
+
+namespace {
+
+// Fractional part of a non-negative value. Truncating through int is the
+// form compilers vectorize under default floating point settings (a compare
+// and select is kept as a branch, since the compare could trap).
+inline float fraction(float value) {
+    return value - static_cast<float>(static_cast<int>(value));
+}
+
+// One channel of HSV to RGB, with k = (n + 6h) mod 6:
+// v - v * s * clamp(min(k, 4 - k), 0, 1). Red is n = 5, green 3, blue 1.
+inline float hsvChannel(float n, float h6, float s, float v) {
+    float k = fraction((n + h6) * (1.0f / 6.0f)) * 6.0f;
+    float ramp = std::max(0.0f, std::min(1.0f, std::min(k, 4.0f - k)));
+    return v - v * s * ramp;
+}
+
+inline float clampUnit(float value) {
+    return std::max(0.0f, std::min(1.0f, value));
+}
+
+// Integer hash with good avalanche (lowbias32), for jitter values that can
+// be computed in parallel. DabGenerator's shader has the same function.
+inline uint32_t hash32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+template <InputSource Source>
+void readSource(const InputPoint* inputs, size_t count, float* values) {
+    for (size_t i = 0; i < count; i++) {
+        values[i] = readInputSource<Source>(inputs[i]);
+    }
+}
+
+template <CurveType Curve>
+void applyCurve(const InputMapping& mapping, size_t count, float* values) {
+    for (size_t i = 0; i < count; i++) {
+        values[i] = mapping.applyCurve<Curve>(values[i]);
+    }
+}
+
+} // namespace
+
+HsvColor rgbToHsv(float r, float g, float b) {
+    float maxC = std::max(r, std::max(g, b));
+    float minC = std::min(r, std::min(g, b));
+    float delta = maxC - minC;
+    
+    HsvColor hsv;
+    hsv.v = maxC;
+    hsv.s = maxC > 0.0f ? delta / maxC : 0.0f;
+    if (delta <= 0.0f) {
+        hsv.h = 0.0f;
+    } else if (maxC == r) {
+        hsv.h = (g - b) / delta / 6.0f;
+        if (hsv.h < 0.0f) {
+            hsv.h += 1.0f;
+        }
+    } else if (maxC == g) {
+        hsv.h = ((b - r) / delta + 2.0f) / 6.0f;
+    } else {
+        hsv.h = ((r - g) / delta + 4.0f) / 6.0f;
+    }
+    return hsv;
+}
+
+void hsvToRgb(const float* __restrict h, const float* __restrict s, const float* __restrict v,
+              float* __restrict r, float* __restrict g, float* __restrict b, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        // Wrap to [0, 1): the first truncation leaves (-1, 1)
+        float hue = fraction(fraction(h[i]) + 1.0f);
+        float h6 = hue * 6.0f;
+        float sat = clampUnit(s[i]);
+        float val = clampUnit(v[i]);
+        
+        r[i] = hsvChannel(5.0f, h6, sat, val);
+        g[i] = hsvChannel(3.0f, h6, sat, val);
+        b[i] = hsvChannel(1.0f, h6, sat, val);
+    }
+}
+
+ColorDynamics::ColorDynamics()
+    : m_base{ 0.0f, 0.0f, 0.0f }
+{
+}
+
+void ColorDynamics::setBrush(float r, float g, float b, const std::vector<InputMapping>& mappings) {
+    m_base = rgbToHsv(r, g, b);
+    m_mappings.clear();
+    for (const auto& mapping : mappings) {
+        if (isColorProperty(mapping.target)) {
+            m_mappings.push_back(mapping);
+        }
+    }
+}
+
+void ColorDynamics::evaluate(size_t index, const InputPoint* inputs, size_t count, uint32_t seed,
+                             uint32_t firstDab, float* values) const {
+    const InputMapping& mapping = m_mappings[index];
+    switch (mapping.source) {
+        case InputSource::Pressure:
+            readSource<InputSource::Pressure>(inputs, count, values);
+            break;
+        case InputSource::TiltX:
+            readSource<InputSource::TiltX>(inputs, count, values);
+            break;
+        case InputSource::TiltY:
+            readSource<InputSource::TiltY>(inputs, count, values);
+            break;
+        case InputSource::TiltMagnitude:
+            readSource<InputSource::TiltMagnitude>(inputs, count, values);
+            break;
+        case InputSource::Speed:
+            readSource<InputSource::Speed>(inputs, count, values);
+            break;
+        case InputSource::Rotation:
+            readSource<InputSource::Rotation>(inputs, count, values);
+            break;
+        case InputSource::Random: {
+            // Keyed by the stroke's seed, the mapping and the dab's index in
+            // the stroke, so any dab's value can be computed on its own
+            uint32_t base = seed + static_cast<uint32_t>(index) * 0x632be5abu;
+            for (size_t i = 0; i < count; i++) {
+                uint32_t bits = hash32(base + (firstDab + static_cast<uint32_t>(i)) * 0x9e3779b9u);
+                values[i] = static_cast<float>(bits >> 8) * (1.0f / 16777216.0f);
+            }
+            break;
+        }
+        case InputSource::Constant:
+        default:
+            std::fill(values, values + count, 1.0f);
+            break;
+    }
+    
+    switch (mapping.curve) {
+        case CurveType::Quadratic:
+            applyCurve<CurveType::Quadratic>(mapping, count, values);
+            break;
+        case CurveType::Cubic:
+            applyCurve<CurveType::Cubic>(mapping, count, values);
+            break;
+        default:
+            applyCurve<CurveType::Linear>(mapping, count, values);
+            break;
+    }
+}
+
+void ColorDynamics::apply(const InputPoint* inputs, BrushDab* dabs, size_t count, uint32_t seed,
+                          uint32_t firstDab) const {
+    float h[kBatchSize], s[kBatchSize], v[kBatchSize], values[kBatchSize];
+    float r[kBatchSize], g[kBatchSize], b[kBatchSize];
+    
+    for (size_t start = 0; start < count; start += kBatchSize) {
+        size_t n = std::min(kBatchSize, count - start);
+        std::fill(h, h + n, m_base.h);
+        std::fill(s, s + n, m_base.s);
+        std::fill(v, v + n, m_base.v);
+        
+        for (size_t m = 0; m < m_mappings.size(); m++) {
+            evaluate(m, inputs + start, n, seed, firstDab + static_cast<uint32_t>(start), values);
+            const InputMapping& mapping = m_mappings[m];
+            if (mapping.target == BrushProperty::ColorH) {
+                for (size_t i = 0; i < n; i++) {
+                    h[i] += values[i];
+                }
+            } else if (mapping.target == BrushProperty::ColorS) {
+                for (size_t i = 0; i < n; i++) {
+                    s[i] *= values[i];
+                }
+            } else {
+                for (size_t i = 0; i < n; i++) {
+                    v[i] *= values[i];
+                }
+            }
+        }
+        
+        hsvToRgb(h, s, v, r, g, b, n);
+        BrushDab* batch = dabs + start;
+        for (size_t i = 0; i < n; i++) {
+            batch[i].r = r[i];
+            batch[i].g = g[i];
+            batch[i].b = b[i];
+        }
+    }
+}
+
+} // namespace Acute
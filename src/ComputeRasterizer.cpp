@@ -0,0 +1,497 @@
+#include "ComputeRasterizer.h"
+#include "Shader.h"
+#include "GLStateCache.h"
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+namespace Acute {
+
+namespace {
+
+// Shared between the passes (std430, 80 bytes): texel bounds, the texel to
+// tip coordinate mapping as two rows plus the tip layer and level, color and
+// blend mode
+const char* const kInstanceSource = R"(
+        struct Dab {
+            vec4 shape;     // x, y, size, rotation
+            vec4 color;     // rgb, opacity
+            vec4 params;    // tip layer, blend mode, lod
+        };
+        
+        struct Instance {
+            vec4 bounds;    // Texel rect x0, y0, x1, y1 (empty if off the region)
+            vec4 u;         // u = dot(u.xy, p) + u.z; u.w is the tip layer
+            vec4 v;         // v = dot(v.xy, p) + v.z; v.w is the tip level
+            vec4 color;
+            ivec4 mode;
+        };
+        
+        uniform ivec4 region;       // Texel rect covered by the tile grid
+        uniform int tilesX;
+        uniform int instanceCount;
+        
+        // Tiles an instance is counted in; the same test in both passes
+        bool tileRange(vec4 bounds, out ivec2 first, out ivec2 last) {
+            if (any(greaterThanEqual(bounds.xy, bounds.zw))) {
+                return false;
+            }
+            first = (ivec2(floor(bounds.xy)) - region.xy) / 16;
+            last = (ivec2(ceil(bounds.zw)) - 1 - region.xy) / 16;
+            return true;
+        }
+)";
+
+// Written by the scan pass, read by the raster pass: the indirect dispatch
+// size (xyz) and the number of non-empty tiles (w), then their indices
+const char* const kActiveTileSource = R"(
+        layout (std430, binding = 7) buffer ActiveTiles {
+            uvec4 groups;
+            uint activeTiles[];
+        };
+)";
+
+} // namespace
+
+ComputeRasterizer::ComputeRasterizer(GLStateCache& state)
+    : m_state(state)
+    , m_copies(1)
+    , m_dabBuffer(0)
+    , m_instanceBuffer(0)
+    , m_tileCountBuffer(0)
+    , m_tileOffsetBuffer(0)
+    , m_tileListBuffer(0)
+    , m_activeTileBuffer(0)
+    , m_dabCapacity(0)
+    , m_instanceCapacity(0)
+    , m_tileCapacity(0)
+    , m_tileOffsetCapacity(0)
+    , m_tileListCapacity(0)
+    , m_activeTileCapacity(0)
+{
+}
+
+ComputeRasterizer::~ComputeRasterizer() {
+    m_state.deleteBuffer(m_dabBuffer);
+    m_state.deleteBuffer(m_instanceBuffer);
+    m_state.deleteBuffer(m_tileCountBuffer);
+    m_state.deleteBuffer(m_tileOffsetBuffer);
+    m_state.deleteBuffer(m_tileListBuffer);
+    m_state.deleteBuffer(m_activeTileBuffer);
+}
+
+bool ComputeRasterizer::isSupported() {
+    return GLEW_VERSION_4_3 || GLEW_ARB_compute_shader;
+}
+
+bool ComputeRasterizer::initialize() {
+    // One invocation per dab copy: transform, bounds, inverse mapping, and a
+    // count in every tile the bounds touch
+    m_binShader = std::make_unique<Shader>();
+    std::string binSource = std::string(R"(
+        #version 430 core
+        layout (local_size_x = 64) in;
+    )") + kInstanceSource + R"(
+        layout (std430, binding = 0) readonly buffer Dabs { Dab dabs[]; };
+        layout (std430, binding = 1) writeonly buffer Instances { Instance instances[]; };
+        layout (std430, binding = 2) buffer TileCounts { uint tileCounts[]; };
+        
+        uniform mat3x2 symmetry[32];
+        uniform int copies;
+        uniform vec2 targetOrigin;      // Canvas pixel at the target's top-left
+        uniform float targetHeight;
+        
+        void main() {
+            int index = int(gl_GlobalInvocationID.x);
+            if (index >= instanceCount) {
+                return;
+            }
+            Dab dab = dabs[index / copies];
+            mat3x2 transform = symmetry[index % copies];
+            
+            // Texel x is canvas x; texel rows run bottom up
+            vec2 center = transform * vec3(dab.shape.xy, 1.0);
+            vec2 texel = vec2(center.x - targetOrigin.x, targetHeight - (center.y - targetOrigin.y));
+            float extent = dab.shape.z * 0.7072 + 1.0;
+            vec4 bounds = vec4(max(texel - extent, vec2(region.xy)), min(texel + extent, vec2(region.zw)));
+            
+            // Texel to canvas, back through the rigid copy, unrotate into the
+            // quad: all affine, folded into one 2x3 mapping
+            mat2 flip = mat2(1.0, 0.0, 0.0, -1.0);
+            vec2 offset = vec2(targetOrigin.x, targetOrigin.y + targetHeight);
+            mat2 uncopy = transpose(mat2(transform[0], transform[1]));
+            float c = cos(radians(dab.shape.w));
+            float s = sin(radians(dab.shape.w));
+            mat2 unrotate = transpose(mat2(c, -s, s, c));
+            mat2 linear = unrotate * uncopy * flip / dab.shape.z;
+            vec2 origin = unrotate * (uncopy * (offset - transform[2]) - dab.shape.xy) / dab.shape.z + 0.5;
+            
+            instances[index] = Instance(bounds,
+                                        vec4(linear[0][0], linear[1][0], origin.x, dab.params.x),
+                                        vec4(linear[0][1], linear[1][1], origin.y, dab.params.z),
+                                        dab.color, ivec4(int(dab.params.y), 0, 0, 0));
+                                        
+            ivec2 first, last;
+            if (!tileRange(bounds, first, last)) {
+                return;
+            }
+            for (int y = first.y; y <= last.y; y++) {
+                for (int x = first.x; x <= last.x; x++) {
+                    atomicAdd(tileCounts[y * tilesX + x], 1u);
+                }
+            }
+        }
+    )";
+    if (!m_binShader->loadComputeFromSource(binSource)) {
+        std::cerr << "Failed to load dab binning shader" << std::endl;
+        return false;
+    }
+    
+    // Exclusive prefix sum of the tile counts in one workgroup, 256 tiles at
+    // a time. Entry tileCount is the total, so a tile's list ends where the
+    // next one starts. A second sum over the non-empty tiles lists them and
+    // sizes the raster dispatch: most tiles of a thin stroke's bounds are
+    // empty and get no workgroup.
+    m_scanShader = std::make_unique<Shader>();
+    std::string scanSource = std::string(R"(
+        #version 430 core
+        layout (local_size_x = 256) in;
+        
+        layout (std430, binding = 2) readonly buffer TileCounts { uint tileCounts[]; };
+        layout (std430, binding = 5) writeonly buffer TileOffsets { uint tileOffsets[]; };
+    )") + kActiveTileSource + R"(
+        uniform int tileCount;
+        uniform int tilesX;
+        
+        shared uint sums[256];
+        shared uint occupiedSums[256];
+        
+        void main() {
+            uint lane = gl_LocalInvocationIndex;
+            uint total = 0u;
+            uint activeTotal = 0u;
+            for (int base = 0; base < tileCount; base += 256) {
+                int index = base + int(lane);
+                uint count = index < tileCount ? tileCounts[index] : 0u;
+                uint occupied = count > 0u ? 1u : 0u;
+                sums[lane] = count;
+                occupiedSums[lane] = occupied;
+                barrier();
+                for (uint offset = 1u; offset < 256u; offset <<= 1) {
+                    uint add = lane >= offset ? sums[lane - offset] : 0u;
+                    uint addOccupied = lane >= offset ? occupiedSums[lane - offset] : 0u;
+                    barrier();
+                    sums[lane] += add;
+                    occupiedSums[lane] += addOccupied;
+                    barrier();
+                }
+                if (index < tileCount) {
+                    tileOffsets[index] = total + sums[lane] - count;
+                }
+                if (occupied != 0u) {
+                    activeTiles[activeTotal + occupiedSums[lane] - 1u] = uint(index);
+                }
+                total += sums[255];
+                activeTotal += occupiedSums[255];
+                barrier();
+            }
+            
+            // Rows of tilesX workgroups, which stays within the dispatch
+            // limits however large the grid
+            if (lane == 0u) {
+                tileOffsets[tileCount] = total;
+                groups = uvec4(uint(tilesX), (activeTotal + uint(tilesX) - 1u) / uint(tilesX), 1u, activeTotal);
+            }
+        }
+    )";
+    if (!m_scanShader->loadComputeFromSource(scanSource)) {
+        std::cerr << "Failed to load dab tile scan shader" << std::endl;
+        return false;
+    }
+    
+    // One invocation per dab copy again: write its index into the list of
+    // every tile it was counted in. Taking the counts back down to zero
+    // hands out the slots, in no particular order.
+    m_scatterShader = std::make_unique<Shader>();
+    std::string scatterSource = std::string(R"(
+        #version 430 core
+        layout (local_size_x = 64) in;
+    )") + kInstanceSource + R"(
+        layout (std430, binding = 1) readonly buffer Instances { Instance instances[]; };
+        layout (std430, binding = 2) buffer TileCounts { uint tileCounts[]; };
+        layout (std430, binding = 5) readonly buffer TileOffsets { uint tileOffsets[]; };
+        layout (std430, binding = 6) writeonly buffer TileLists { uint tileLists[]; };
+        
+        uniform int listCapacity;
+        
+        void main() {
+            int index = int(gl_GlobalInvocationID.x);
+            if (index >= instanceCount) {
+                return;
+            }
+            ivec2 first, last;
+            if (!tileRange(instances[index].bounds, first, last)) {
+                return;
+            }
+            for (int y = first.y; y <= last.y; y++) {
+                for (int x = first.x; x <= last.x; x++) {
+                    int tile = y * tilesX + x;
+                    uint slot = tileOffsets[tile] + atomicAdd(tileCounts[tile], 0xffffffffu) - 1u;
+                    if (slot < uint(listCapacity)) {
+                        tileLists[slot] = uint(index);
+                    }
+                }
+            }
+        }
+    )";
+    if (!m_scatterShader->loadComputeFromSource(scatterSource)) {
+        std::cerr << "Failed to load dab tile scatter shader" << std::endl;
+        return false;
+    }
+    
+    // One workgroup per tile, over its own list only. The list is sorted
+    // back into batch order (bitonic, in shared memory unless it is long),
+    // then its copies are staged in shared memory 256 at a time and every
+    // invocation blends them into its own pixel.
+    m_rasterShader = std::make_unique<Shader>();
+    std::string rasterSource = std::string(R"(
+        #version 430 core
+        layout (local_size_x = 16, local_size_y = 16) in;
+    )") + kInstanceSource + kBlendFunctionSource + R"(
+        layout (std430, binding = 1) readonly buffer Instances { Instance instances[]; };
+        layout (std430, binding = 5) readonly buffer TileOffsets { uint tileOffsets[]; };
+        layout (std430, binding = 6) coherent buffer TileLists { uint tileLists[]; };
+    )" + kActiveTileSource + R"(
+        layout (rgba8, binding = 0) uniform image2D target;
+        
+        uniform int listCapacity;
+        uniform sampler2DArray brushTips;
+        uniform int useMask;
+        uniform sampler2D mask;
+        
+        shared Instance chunk[256];
+        shared uint order[2048];
+        
+        void main() {
+            uint slot = gl_WorkGroupID.y * uint(tilesX) + gl_WorkGroupID.x;
+            if (slot >= groups.w) {
+                return;
+            }
+            int tileIndex = int(activeTiles[slot]);
+            ivec2 tile = ivec2(tileIndex % tilesX, tileIndex / tilesX);
+            uint start = tileOffsets[tileIndex];
+            uint end = min(tileOffsets[tileIndex + 1], uint(listCapacity));
+            if (start >= end) {
+                return;
+            }
+            uint count = end - start;
+            uint lane = gl_LocalInvocationIndex;
+            
+            // Longer lists are sorted in place in the list buffer
+            bool local = count <= 2048u;
+            if (local) {
+                for (uint k = lane; k < count; k += 256u) {
+                    order[k] = tileLists[start + k];
+                }
+                barrier();
+            }
+            
+            // Bitonic sort with every pair ascending (the first pass of each
+            // merge compares mirrored positions), so entries past the end
+            // act as infinite and are never touched
+            uint width = 1u;
+            while (width < count) {
+                width <<= 1;
+            }
+            for (uint size = 2u; size <= width; size <<= 1) {
+                for (uint stride = size >> 1; stride > 0u; stride >>= 1) {
+                    for (uint pair = lane; pair < width / 2u; pair += 256u) {
+                        uint a = pair / stride * stride * 2u + pair % stride;
+                        uint b = stride == size >> 1 ? a ^ (size - 1u) : a + stride;
+                        if (b >= count) {
+                            continue;
+                        }
+                        if (local) {
+                            uint x = order[a];
+                            uint y = order[b];
+                            if (x > y) {
+                                order[a] = y;
+                                order[b] = x;
+                            }
+                        } else {
+                            uint x = tileLists[start + a];
+                            uint y = tileLists[start + b];
+                            if (x > y) {
+                                tileLists[start + a] = y;
+                                tileLists[start + b] = x;
+                            }
+                        }
+                    }
+                    memoryBarrierBuffer();
+                    barrier();
+                }
+            }
+            
+            ivec2 texel = region.xy + tile * 16 + ivec2(gl_LocalInvocationID.xy);
+            bool inside = all(lessThan(texel, region.zw));
+            vec4 color = inside ? imageLoad(target, texel) : vec4(0.0);
+            float coverage = inside && useMask != 0 ? texelFetch(mask, texel, 0).r : 1.0;
+            vec2 p = vec2(texel) + 0.5;
+            
+            for (uint base = 0u; base < count; base += 256u) {
+                uint k = base + lane;
+                if (k < count) {
+                    chunk[lane] = instances[local ? order[k] : tileLists[start + k]];
+                }
+                barrier();
+                
+                uint n = min(count - base, 256u);
+                if (inside) {
+                    for (uint k = 0u; k < n; k++) {
+                        vec4 u = chunk[k].u;
+                        vec4 v = chunk[k].v;
+                        vec2 uv = vec2(dot(u.xy, p) + u.z, dot(v.xy, p) + v.z);
+                        if (all(greaterThanEqual(uv, vec2(0.0))) && all(lessThanEqual(uv, vec2(1.0)))) {
+                            float alpha = textureLod(brushTips, vec3(uv, u.w), v.w).r * chunk[k].color.a * coverage;
+                            color = blendPremultiplied(vec4(chunk[k].color.rgb * alpha, alpha), color, chunk[k].mode.x);
+                        }
+                    }
+                }
+                barrier();
+            }
+            
+            if (inside) {
+                imageStore(target, texel, color);
+            }
+        }
+    )";
+    if (!m_rasterShader->loadComputeFromSource(rasterSource)) {
+        std::cerr << "Failed to load dab raster shader" << std::endl;
+        return false;
+    }
+    
+    glGenBuffers(1, &m_dabBuffer);
+    glGenBuffers(1, &m_instanceBuffer);
+    glGenBuffers(1, &m_tileCountBuffer);
+    glGenBuffers(1, &m_tileOffsetBuffer);
+    glGenBuffers(1, &m_tileListBuffer);
+    glGenBuffers(1, &m_activeTileBuffer);
+    return true;
+}
+
+void ComputeRasterizer::setSymmetry(const std::vector<float>& matrices, int count) {
+    m_copies = count;
+    m_binShader->use(m_state);
+    m_binShader->setMat3x2Array("symmetry", matrices.data(), count);
+}
+
+void ComputeRasterizer::reserve(GLuint buffer, size_t& capacity, size_t bytes) {
+    m_state.bindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    if (bytes > capacity) {
+        capacity = std::max(bytes, capacity * 2);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, capacity, nullptr, GL_DYNAMIC_DRAW);
+    }
+}
+
+void ComputeRasterizer::draw(const std::vector<Dab>& dabs, const Target& target, GLuint tipTexture) {
+    if (dabs.empty() || target.x0 >= target.x1 || target.y0 >= target.y1) {
+        return;
+    }
+    size_t maxTiles = 0;
+    for (const Dab& dab : dabs) {
+        maxTiles += tilesPerCopy(dab.size * 0.7072f + 1.0f);
+    }
+    reserveDabs(dabs.size());
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, dabs.size() * sizeof(Dab), dabs.data());
+    drawReserved(dabs.size(), maxTiles, target, tipTexture);
+}
+
+size_t ComputeRasterizer::tilesPerCopy(float extent) {
+    // The bounds span at most 2 * extent + 2 texels, starting anywhere in a tile
+    size_t span = static_cast<size_t>(std::max(extent, 0.0f) * 2.0f + 2.0f) / kTileSize + 2;
+    return span * span;
+}
+
+GLuint ComputeRasterizer::reserveDabs(size_t count) {
+    reserve(m_dabBuffer, m_dabCapacity, count * sizeof(Dab));
+    return m_dabBuffer;
+}
+
+void ComputeRasterizer::drawReserved(size_t count, size_t maxTiles, const Target& target, GLuint tipTexture) {
+    if (count == 0 || target.x0 >= target.x1 || target.y0 >= target.y1) {
+        return;
+    }
+    const int instanceCount = static_cast<int>(count) * m_copies;
+    const int tilesX = (target.x1 - target.x0 + kTileSize - 1) / kTileSize;
+    const int tilesY = (target.y1 - target.y0 + kTileSize - 1) / kTileSize;
+    const int tileCount = tilesX * tilesY;
+    
+    // No copy is binned into more tiles than the grid has
+    size_t listLength = std::min(maxTiles, count * static_cast<size_t>(tileCount)) * m_copies;
+    
+    reserve(m_instanceBuffer, m_instanceCapacity, static_cast<size_t>(instanceCount) * 80);
+    reserve(m_tileOffsetBuffer, m_tileOffsetCapacity, (static_cast<size_t>(tileCount) + 1) * sizeof(GLuint));
+    reserve(m_tileListBuffer, m_tileListCapacity, std::max<size_t>(listLength, 1) * sizeof(GLuint));
+    reserve(m_activeTileBuffer, m_activeTileCapacity, (static_cast<size_t>(tileCount) + 4) * sizeof(GLuint));
+    
+    // Counts start at zero
+    reserve(m_tileCountBuffer, m_tileCapacity, static_cast<size_t>(tileCount) * sizeof(GLuint));
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_dabBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_instanceBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_tileCountBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_tileOffsetBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, m_tileListBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, m_activeTileBuffer);
+    
+    m_binShader->use(m_state);
+    glUniform4i(glGetUniformLocation(m_binShader->getProgram(), "region"),
+                target.x0, target.y0, target.x1, target.y1);
+    m_binShader->setInt("tilesX", tilesX);
+    m_binShader->setInt("instanceCount", instanceCount);
+    m_binShader->setInt("copies", m_copies);
+    m_binShader->setVec2("targetOrigin", target.originX, target.originY);
+    m_binShader->setFloat("targetHeight", static_cast<float>(target.height));
+    glDispatchCompute(static_cast<GLuint>((instanceCount + 63) / 64), 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    
+    m_scanShader->use(m_state);
+    m_scanShader->setInt("tileCount", tileCount);
+    m_scanShader->setInt("tilesX", tilesX);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+    
+    // The list buffer holds the bound; a bad bound drops entries rather
+    // than writing past the end
+    const int listCapacity = static_cast<int>(m_tileListCapacity / sizeof(GLuint));
+    m_scatterShader->use(m_state);
+    glUniform4i(glGetUniformLocation(m_scatterShader->getProgram(), "region"),
+                target.x0, target.y0, target.x1, target.y1);
+    m_scatterShader->setInt("tilesX", tilesX);
+    m_scatterShader->setInt("instanceCount", instanceCount);
+    m_scatterShader->setInt("listCapacity", listCapacity);
+    glDispatchCompute(static_cast<GLuint>((instanceCount + 63) / 64), 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    
+    m_rasterShader->use(m_state);
+    glUniform4i(glGetUniformLocation(m_rasterShader->getProgram(), "region"),
+                target.x0, target.y0, target.x1, target.y1);
+    m_rasterShader->setInt("tilesX", tilesX);
+    m_rasterShader->setInt("listCapacity", listCapacity);
+    m_state.bindTexture(0, GL_TEXTURE_2D_ARRAY, tipTexture);
+    m_rasterShader->setInt("brushTips", 0);
+    m_rasterShader->setInt("useMask", target.mask ? 1 : 0);
+    if (target.mask) {
+        m_state.bindTexture(2, GL_TEXTURE_2D, target.mask);
+        m_rasterShader->setInt("mask", 2);
+    }
+    glBindImageTexture(0, target.texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA8);
+    m_state.bindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_activeTileBuffer);
+    glDispatchComputeIndirect(0);
+    
+    // The target is sampled, blitted and drawn into next
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT |
+                    GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+}
+
+} // namespace Acute
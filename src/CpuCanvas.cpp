@@ -0,0 +1,272 @@
+#include "CpuCanvas.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Acute {
+
+namespace {
+
+constexpr float kDegToRad = 3.14159265358979f / 180.0f;
+
+// Pickup samples per side of a dab, as in the GPU canvas's pickup shader
+constexpr int kPickupSamples = 8;
+
+// Mip level a trilinear fetch would mostly use for a dab of this size
+int tipLevelForSize(float size) {
+    float texelsPerPixel = BrushTipSet::kTipSize / std::max(size, 1.0f);
+    int level = 0;
+    while (texelsPerPixel >= 2.0f && level < BrushTipSet::getLevelCount() - 1) {
+        texelsPerPixel *= 0.5f;
+        level++;
+    }
+    return level;
+}
+
+// Premultiplied blend of src (rgb already scaled by alpha) into p, matching
+// the GPU canvas blend state for each mode
+inline void blendPixel(float* p, float r, float g, float b, float alpha, BlendMode mode) {
+    const float inv = 1.0f - alpha;
+    switch (mode) {
+        case BlendMode::Erase:
+            p[0] *= inv;
+            p[1] *= inv;
+            p[2] *= inv;
+            p[3] *= inv;
+            return;
+        case BlendMode::Multiply: {
+            const float invDst = 1.0f - p[3];
+            p[0] = r * p[0] + r * invDst + p[0] * inv;
+            p[1] = g * p[1] + g * invDst + p[1] * inv;
+            p[2] = b * p[2] + b * invDst + p[2] * inv;
+            break;
+        }
+        case BlendMode::Screen:
+            p[0] = r + p[0] * (1.0f - r);
+            p[1] = g + p[1] * (1.0f - g);
+            p[2] = b + p[2] * (1.0f - b);
+            break;
+        case BlendMode::Add:
+            p[0] = std::min(1.0f, r + p[0]);
+            p[1] = std::min(1.0f, g + p[1]);
+            p[2] = std::min(1.0f, b + p[2]);
+            break;
+        case BlendMode::Normal:
+        default:
+            p[0] = r + p[0] * inv;
+            p[1] = g + p[1] * inv;
+            p[2] = b + p[2] * inv;
+            break;
+    }
+    p[3] = alpha + p[3] * inv;
+}
+
+} // namespace
+
+CpuCanvas::CpuCanvas(int width, int height)
+    : m_width(width)
+    , m_height(height)
+    , m_pixels(static_cast<size_t>(width) * height * 4, 1.0f)
+{
+}
+
+CpuCanvas::~CpuCanvas() = default;
+
+void CpuCanvas::clear(float r, float g, float b, float a) {
+    // Stored premultiplied
+    for (size_t i = 0; i < m_pixels.size(); i += 4) {
+        m_pixels[i] = r * a;
+        m_pixels[i + 1] = g * a;
+        m_pixels[i + 2] = b * a;
+        m_pixels[i + 3] = a;
+    }
+}
+
+void CpuCanvas::clearRect(int x0, int y0, int x1, int y1, float r, float g, float b, float a) {
+    x0 = std::max(0, x0);
+    y0 = std::max(0, y0);
+    x1 = std::min(m_width, x1);
+    y1 = std::min(m_height, y1);
+    for (int y = y0; y < y1; y++) {
+        float* p = &m_pixels[(static_cast<size_t>(y) * m_width + x0) * 4];
+        for (int x = x0; x < x1; x++, p += 4) {
+            p[0] = r * a;
+            p[1] = g * a;
+            p[2] = b * a;
+            p[3] = a;
+        }
+    }
+}
+
+void CpuCanvas::resize(int width, int height) {
+    m_width = width;
+    m_height = height;
+    m_pixels.assign(static_cast<size_t>(width) * height * 4, 1.0f);
+}
+
+int CpuCanvas::addBrushTip(const uint8_t* pixels, int width, int height) {
+    return m_brushTips.addImageTip(pixels, width, height);
+}
+
+int CpuCanvas::loadBrushTip(const std::string& path) {
+    return m_brushTips.loadImageTip(path);
+}
+
+bool CpuCanvas::getDabBounds(const BrushDab& dab, int& x0, int& y0, int& x1, int& y1) const {
+    // Half-diagonal of the rotated quad
+    float extent = dab.size * 0.7072f + 1.0f;
+    x0 = std::max(0, static_cast<int>(std::floor(dab.x - extent)));
+    y0 = std::max(0, static_cast<int>(std::floor(dab.y - extent)));
+    x1 = std::min(m_width, static_cast<int>(std::ceil(dab.x + extent)));
+    y1 = std::min(m_height, static_cast<int>(std::ceil(dab.y + extent)));
+    return x0 < x1 && y0 < y1;
+}
+
+void CpuCanvas::drawDab(const BrushDab& dab, int copy) {
+    drawDabClipped(dab, 0, 0, m_width, m_height, copy);
+}
+
+void CpuCanvas::drawDabs(const std::vector<BrushDab>& dabs, int copies) {
+    copies = std::max(1, copies);
+    for (size_t i = 0; i < dabs.size(); i++) {
+        drawDab(dabs[i], static_cast<int>(i % copies));
+    }
+}
+
+void CpuCanvas::drawDabClipped(const BrushDab& dab, int x0, int y0, int x1, int y1, int copy) {
+    int bx0, by0, bx1, by1;
+    if (!getDabBounds(dab, bx0, by0, bx1, by1)) {
+        return;
+    }
+    
+    // The pickup samples the whole footprint, whatever the clip region
+    const bool smudging = dab.isSmudging() && dab.size > 0.0f;
+    if (smudging) {
+        pickUpPaint(dab, copy);
+    }
+    x0 = std::max(x0, bx0);
+    y0 = std::max(y0, by0);
+    x1 = std::min(x1, bx1);
+    y1 = std::min(y1, by1);
+    if (x0 >= x1 || y0 >= y1 || dab.size <= 0.0f) {
+        return;
+    }
+    
+    const int layer = m_brushTips.layerForDab(dab.tip, dab.hardness);
+    const int level = tipLevelForSize(dab.size);
+    const float opacity = dab.opacity * dab.flow;
+    
+    // Inverse of the dab shader's rotate-then-scale, mapping pixels to tip UVs
+    const float c = std::cos(dab.rotation * kDegToRad);
+    const float s = std::sin(dab.rotation * kDegToRad);
+    const float invSize = 1.0f / dab.size;
+    
+    // Premultiplied smudge paint: the brush color mixed with the pickup
+    float paint[4] = { dab.r, dab.g, dab.b, 1.0f };
+    if (smudging) {
+        const float* pickup = &m_pickup[static_cast<size_t>(copy) * 4];
+        for (int i = 0; i < 4; i++) {
+            paint[i] += (pickup[i] - paint[i]) * dab.smudge;
+        }
+    }
+    
+    for (int y = y0; y < y1; y++) {
+        float* row = &m_pixels[(static_cast<size_t>(y) * m_width) * 4];
+        float py = y + 0.5f - dab.y;
+        for (int x = x0; x < x1; x++) {
+            float px = x + 0.5f - dab.x;
+            float u = (c * px - s * py) * invSize + 0.5f;
+            float v = (s * px + c * py) * invSize + 0.5f;
+            if (u < 0.0f || u > 1.0f || v < 0.0f || v > 1.0f) {
+                continue;
+            }
+            float alpha = m_brushTips.sample(layer, u, v, level) * opacity;
+            if (alpha <= 0.0f) {
+                continue;
+            }
+            
+            if (smudging) {
+                // Lerp towards the paint, which may be partly transparent
+                float* p = row + x * 4;
+                for (int i = 0; i < 4; i++) {
+                    p[i] += (paint[i] - p[i]) * alpha;
+                }
+                continue;
+            }
+            blendPixel(row + x * 4, dab.r * alpha, dab.g * alpha, dab.b * alpha, alpha, dab.blend);
+        }
+    }
+}
+
+void CpuCanvas::pickUpPaint(const BrushDab& dab, int copy) {
+    if (m_pickup.size() < static_cast<size_t>(copy + 1) * 4) {
+        m_pickup.resize(static_cast<size_t>(copy + 1) * 4, 0.0f);
+    }
+    float* pickup = &m_pickup[static_cast<size_t>(copy) * 4];
+    
+    // Tip-weighted average of the canvas over a grid across the dab
+    const int layer = m_brushTips.layerForDab(dab.tip, dab.hardness);
+    const int level = tipLevelForSize(static_cast<float>(kPickupSamples));
+    const float c = std::cos(dab.rotation * kDegToRad);
+    const float s = std::sin(dab.rotation * kDegToRad);
+    float sum[4] = {};
+    float weight = 0.0f;
+    for (int j = 0; j < kPickupSamples; j++) {
+        for (int i = 0; i < kPickupSamples; i++) {
+            float u = (i + 0.5f) / kPickupSamples;
+            float v = (j + 0.5f) / kPickupSamples;
+            float w = m_brushTips.sample(layer, u, v, level);
+            if (w <= 0.0f) {
+                continue;
+            }
+            // The dab shader's rotate-then-scale
+            float lx = (u - 0.5f) * dab.size;
+            float ly = (v - 0.5f) * dab.size;
+            float color[4];
+            sampleBilinear(dab.x + c * lx + s * ly, dab.y - s * lx + c * ly, color);
+            for (int k = 0; k < 4; k++) {
+                sum[k] += w * color[k];
+            }
+            weight += w;
+        }
+    }
+    if (weight <= 0.0f) {
+        return;
+    }
+    for (int k = 0; k < 4; k++) {
+        float picked = sum[k] / weight;
+        pickup[k] = picked + (pickup[k] - picked) * dab.smudgeLength;
+    }
+}
+
+void CpuCanvas::sampleBilinear(float x, float y, float* color) const {
+    x = std::min(std::max(x - 0.5f, 0.0f), static_cast<float>(m_width - 1));
+    y = std::min(std::max(y - 0.5f, 0.0f), static_cast<float>(m_height - 1));
+    const int ix = static_cast<int>(x), iy = static_cast<int>(y);
+    const int nx = std::min(ix + 1, m_width - 1), ny = std::min(iy + 1, m_height - 1);
+    const float fx = x - ix, fy = y - iy;
+    const float* p00 = &m_pixels[(static_cast<size_t>(iy) * m_width + ix) * 4];
+    const float* p10 = &m_pixels[(static_cast<size_t>(iy) * m_width + nx) * 4];
+    const float* p01 = &m_pixels[(static_cast<size_t>(ny) * m_width + ix) * 4];
+    const float* p11 = &m_pixels[(static_cast<size_t>(ny) * m_width + nx) * 4];
+    for (int k = 0; k < 4; k++) {
+        float top = p00[k] + (p10[k] - p00[k]) * fx;
+        float bottom = p01[k] + (p11[k] - p01[k]) * fx;
+        color[k] = top + (bottom - top) * fy;
+    }
+}
+
+void CpuCanvas::readPixels(std::vector<uint8_t>& rgba) const {
+    // Images are stored with straight alpha
+    rgba.resize(m_pixels.size());
+    for (size_t i = 0; i < m_pixels.size(); i += 4) {
+        float alpha = std::max(0.0f, std::min(1.0f, m_pixels[i + 3]));
+        float scale = alpha > 0.0f ? 1.0f / alpha : 0.0f;
+        for (int c = 0; c < 3; c++) {
+            float value = std::max(0.0f, std::min(1.0f, m_pixels[i + c] * scale));
+            rgba[i + c] = static_cast<uint8_t>(value * 255.0f + 0.5f);
+        }
+        rgba[i + 3] = static_cast<uint8_t>(alpha * 255.0f + 0.5f);
+    }
+}
+
+} // namespace Acute
@@ -0,0 +1,382 @@
+#include "DabGenerator.h"
+#include "BrushMapping.h"
+#include "BrushTip.h"
+#include "ColorDynamics.h"
+#include "Shader.h"
+#include "GLStateCache.h"
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+namespace Acute {
+
+namespace {
+
+// A DabSegment as six vec4s
+const char* const kSegmentSource = R"(
+        struct Segment {
+            vec4 move;          // x0, y0, x1, y1
+            vec4 pressureTilt;  // pressure0, pressure1, tiltX0, tiltX1
+            vec4 tiltRotation;  // tiltY0, tiltY1, rotation0, rotation1
+            vec4 velocity;      // velocityX0, velocityY0, velocityX1, velocityY1
+            vec4 spacing;       // length, distance, spacing, spacing factor
+            vec4 info;          // count, blend, size, radius
+        };
+        
+        layout (std430, binding = 3) readonly buffer Segments { Segment segments[]; };
+        uniform int segmentCount;
+)";
+
+static_assert(sizeof(DabSegment) == 6 * 4 * sizeof(float), "DabSegment layout");
+
+// GLSL constant for an enum value the generation shader tests
+template <typename Enum>
+std::string enumConstant(const char* name, Enum value) {
+    return std::string("const int ") + name + " = " + std::to_string(static_cast<int>(value)) + ";\n";
+}
+
+} // namespace
+
+DabGenerator::DabGenerator(GLStateCache& state)
+    : m_state(state)
+    , m_segmentBuffer(0)
+    , m_firstDabBuffer(0)
+    , m_segmentCapacity(0)
+    , m_firstDabCapacity(0)
+    , m_strokeDabs(0)
+    , m_curveTexture(0)
+{
+}
+
+DabGenerator::~DabGenerator() {
+    m_state.deleteBuffer(m_segmentBuffer);
+    m_state.deleteBuffer(m_firstDabBuffer);
+    m_state.deleteTexture(m_curveTexture);
+}
+
+bool DabGenerator::initialize() {
+    // Exclusive prefix sum of the dab counts in one workgroup, 256 segments
+    // at a time
+    m_scanShader = std::make_unique<Shader>();
+    std::string scanSource = std::string(R"(
+        #version 430 core
+        layout (local_size_x = 256) in;
+    )") + kSegmentSource + R"(
+        layout (std430, binding = 4) writeonly buffer FirstDabs { uint firstDabs[]; };
+        
+        shared uint sums[256];
+        
+        void main() {
+            uint lane = gl_LocalInvocationIndex;
+            uint total = 0u;
+            for (int base = 0; base < segmentCount; base += 256) {
+                int index = base + int(lane);
+                uint count = index < segmentCount ? uint(segments[index].info.x) : 0u;
+                sums[lane] = count;
+                barrier();
+                for (uint offset = 1u; offset < 256u; offset <<= 1) {
+                    uint add = lane >= offset ? sums[lane - offset] : 0u;
+                    barrier();
+                    sums[lane] += add;
+                    barrier();
+                }
+                if (index < segmentCount) {
+                    firstDabs[index] = total + sums[lane] - count;
+                }
+                total += sums[255];
+                barrier();
+            }
+        }
+    )";
+    if (!m_scanShader->loadComputeFromSource(scanSource)) {
+        std::cerr << "Failed to load dab segment scan shader" << std::endl;
+        return false;
+    }
+    
+    // One invocation per dab: the same interpolation, mappings, clamps, flow
+    // compensation and color dynamics as BrushEngine
+    m_generateShader = std::make_unique<Shader>();
+    std::string generateSource = std::string(R"(
+        #version 430 core
+        layout (local_size_x = 64) in;
+    )") + kSegmentSource
+        + "const float kTipSize = " + std::to_string(BrushTipSet::kTipSize) + ".0;\n"
+        + "const float kRoundTipSteps = " + std::to_string(BrushTipSet::kRoundTipCount - 1) + ".0;\n"
+        + "const int kMaxMappings = " + std::to_string(DabSegmentBrush::kMaxMappings) + ";\n"
+        + enumConstant("kSourcePressure", InputSource::Pressure)
+        + enumConstant("kSourceTiltX", InputSource::TiltX)
+        + enumConstant("kSourceTiltY", InputSource::TiltY)
+        + enumConstant("kSourceTiltMagnitude", InputSource::TiltMagnitude)
+        + enumConstant("kSourceSpeed", InputSource::Speed)
+        + enumConstant("kSourceRotation", InputSource::Rotation)
+        + enumConstant("kSourceRandom", InputSource::Random)
+        + enumConstant("kTargetSize", BrushProperty::Size)
+        + enumConstant("kTargetOpacity", BrushProperty::Opacity)
+        + enumConstant("kTargetHardness", BrushProperty::Hardness)
+        + enumConstant("kTargetFlow", BrushProperty::Flow)
+        + enumConstant("kTargetRotation", BrushProperty::Rotation)
+        + enumConstant("kTargetColorH", BrushProperty::ColorH)
+        + enumConstant("kTargetColorS", BrushProperty::ColorS)
+        + enumConstant("kTargetColorV", BrushProperty::ColorV) + R"(
+        struct Dab {
+            vec4 shape;     // x, y, size, rotation
+            vec4 color;     // rgb, opacity
+            vec4 params;    // tip layer, blend mode, lod
+        };
+        
+        layout (std430, binding = 0) writeonly buffer Dabs { Dab dabs[]; };
+        layout (std430, binding = 4) readonly buffer FirstDabs { uint firstDabs[]; };
+        
+        uniform int dabCount;
+        uniform vec4 base;              // Size, opacity, hardness, flow
+        uniform float baseRotation;
+        uniform vec3 color;
+        uniform vec3 baseHsv;           // Of color, for color dynamics
+        uniform int colorDynamics;
+        uniform int colorSeed;
+        uniform int firstStrokeDab;     // Stroke index of dab 0
+        uniform int imageLayer;
+        uniform float accumulationScale;
+        uniform int mappingCount;
+        uniform int sources[kMaxMappings];
+        uniform int targets[kMaxMappings];
+        uniform sampler2D curves;
+        uniform int strokeBuffer;
+        uniform float strokeOpacity;
+        
+        float curve(int mapping, float x) {
+            x = clamp(x, 0.0, 1.0) * float(textureSize(curves, 0).x - 1);
+            int i = min(int(x), textureSize(curves, 0).x - 2);
+            float a = texelFetch(curves, ivec2(i, mapping), 0).r;
+            float b = texelFetch(curves, ivec2(i + 1, mapping), 0).r;
+            return mix(a, b, x - float(i));
+        }
+        
+        // lowbias32, as ColorDynamics hashes its jitter
+        uint hash32(uint x) {
+            x ^= x >> 16;
+            x *= 0x7feb352du;
+            x ^= x >> 15;
+            x *= 0x846ca68bu;
+            x ^= x >> 16;
+            return x;
+        }
+        
+        // One channel of HSV to RGB, as hsvToRgb
+        float hsvChannel(float n, float h6, float s, float v) {
+            float k = fract((n + h6) / 6.0) * 6.0;
+            return v - v * s * clamp(min(k, 4.0 - k), 0.0, 1.0);
+        }
+        
+        void main() {
+            uint index = gl_GlobalInvocationID.x;
+            if (index >= uint(dabCount)) {
+                return;
+            }
+            
+            // The last segment starting at or before this dab
+            int low = 0;
+            int high = segmentCount - 1;
+            while (low < high) {
+                int mid = (low + high + 1) / 2;
+                if (firstDabs[mid] <= index) {
+                    low = mid;
+                } else {
+                    high = mid - 1;
+                }
+            }
+            Segment segment = segments[low];
+            
+            // Dab k of the move sits `spacing` short of the distance left
+            // before it; t runs back from the end of the move
+            float k = float(index - firstDabs[low]);
+            float moveLength = segment.spacing.x;
+            float spacing = segment.spacing.z;
+            float left = segment.spacing.y - k * spacing;
+            float t = moveLength > 0.0 ? clamp((left - spacing) / moveLength, 0.0, 1.0) : 0.0;
+            float f = 1.0 - t;
+            vec2 position = segment.move.xy + (segment.move.zw - segment.move.xy) * f;
+            float pressure = segment.pressureTilt.x + (segment.pressureTilt.y - segment.pressureTilt.x) * f;
+            float tiltX = segment.pressureTilt.z + (segment.pressureTilt.w - segment.pressureTilt.z) * f;
+            float tiltY = segment.tiltRotation.x + (segment.tiltRotation.y - segment.tiltRotation.x) * f;
+            vec2 velocity = segment.velocity.xy + (segment.velocity.zw - segment.velocity.xy) * f;
+            
+            // Barrel rotation turns the short way round
+            float turn = segment.tiltRotation.w - segment.tiltRotation.z;
+            turn -= 360.0 * round(turn / 360.0);
+            float barrel = segment.tiltRotation.z + turn * f;
+            barrel += barrel < 0.0 ? 360.0 : (barrel >= 360.0 ? -360.0 : 0.0);
+            
+            float size = base.x;
+            float opacity = base.y;
+            float hardness = base.z;
+            float flow = base.w;
+            float rotation = baseRotation;
+            vec3 hsv = baseHsv;
+            uint colorMapping = 0u;
+            for (int m = 0; m < mappingCount; m++) {
+                float value = 1.0;
+                int source = sources[m];
+                if (source == kSourcePressure) {
+                    value = pressure;
+                } else if (source == kSourceTiltX) {
+                    value = (tiltX + 1.0) * 0.5;
+                } else if (source == kSourceTiltY) {
+                    value = (tiltY + 1.0) * 0.5;
+                } else if (source == kSourceTiltMagnitude) {
+                    value = min(1.0, length(vec2(tiltX, tiltY)));
+                } else if (source == kSourceSpeed) {
+                    value = min(1.0, length(velocity) / 1000.0);
+                } else if (source == kSourceRotation) {
+                    value = barrel / 360.0;
+                } else if (source == kSourceRandom) {
+                    uint dab = uint(firstStrokeDab) + index;
+                    uint bits = hash32(uint(colorSeed) + colorMapping * 0x632be5abu + dab * 0x9e3779b9u);
+                    value = float(bits >> 8) * (1.0 / 16777216.0);
+                }
+                value = curve(m, value);
+                
+                int target = targets[m];
+                if (target == kTargetSize) {
+                    size *= value;
+                } else if (target == kTargetOpacity) {
+                    opacity *= value;
+                } else if (target == kTargetHardness) {
+                    hardness = clamp(value, 0.0, 1.0);
+                } else if (target == kTargetFlow) {
+                    flow *= value;
+                } else if (target == kTargetRotation) {
+                    rotation += value;
+                } else if (target == kTargetColorH) {
+                    hsv.x += value;
+                    colorMapping++;
+                } else if (target == kTargetColorS) {
+                    hsv.y *= value;
+                    colorMapping++;
+                } else if (target == kTargetColorV) {
+                    hsv.z *= value;
+                    colorMapping++;
+                }
+            }
+            vec3 rgb = color;
+            if (colorDynamics != 0) {
+                float h6 = fract(hsv.x) * 6.0;
+                float s = clamp(hsv.y, 0.0, 1.0);
+                float v = clamp(hsv.z, 0.0, 1.0);
+                rgb = vec3(hsvChannel(5.0, h6, s, v), hsvChannel(3.0, h6, s, v), hsvChannel(1.0, h6, s, v));
+            }
+            size = max(0.1, size);
+            opacity = clamp(opacity, 0.0, 1.0);
+            flow = clamp(flow, 0.0, 1.0);
+            
+            // Raise the flow to cover for adaptively widened spacing
+            float factor = segment.spacing.w;
+            if (factor > 1.0 && opacity > 0.0) {
+                float alpha = min(1.0, opacity * flow / accumulationScale);
+                flow = min(1.0, (1.0 - pow(1.0 - alpha, factor)) * accumulationScale / opacity);
+            }
+            
+            float alpha = opacity * flow;
+            float blend = segment.info.y;
+            if (strokeBuffer != 0) {
+                alpha = min(1.0, alpha / strokeOpacity);
+                blend = 0.0;
+            }
+            float layer = imageLayer >= 0 ? float(imageLayer) : float(int(clamp(hardness, 0.0, 1.0) * kRoundTipSteps + 0.5));
+            float lod = log2(kTipSize / max(size, 1.0));
+            dabs[index] = Dab(vec4(position, size, rotation), vec4(rgb, alpha), vec4(layer, blend, lod, 0.0));
+        }
+    )";
+    if (!m_generateShader->loadComputeFromSource(generateSource)) {
+        std::cerr << "Failed to load dab generation shader" << std::endl;
+        return false;
+    }
+    
+    glGenBuffers(1, &m_segmentBuffer);
+    glGenBuffers(1, &m_firstDabBuffer);
+    
+    glGenTextures(1, &m_curveTexture);
+    m_state.bindTexture(1, GL_TEXTURE_2D, m_curveTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return true;
+}
+
+void DabGenerator::setBrush(const DabSegmentBrush& brush, int imageLayer) {
+    const int mappings = std::min(static_cast<int>(brush.sources.size()), DabSegmentBrush::kMaxMappings);
+    
+    // A row of zeros keeps the texture complete without mappings
+    std::vector<float> curves = brush.curves;
+    curves.resize(static_cast<size_t>(std::max(1, mappings)) * DabSegmentBrush::kCurveSamples, 0.0f);
+    m_state.bindTexture(1, GL_TEXTURE_2D, m_curveTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, DabSegmentBrush::kCurveSamples, std::max(1, mappings), 0,
+                 GL_RED, GL_FLOAT, curves.data());
+                 
+    m_generateShader->use(m_state);
+    m_generateShader->setVec4("base", brush.size, brush.opacity, brush.hardness, brush.flow);
+    m_generateShader->setFloat("baseRotation", brush.rotation);
+    m_generateShader->setVec3("color", brush.r, brush.g, brush.b);
+    HsvColor hsv = rgbToHsv(brush.r, brush.g, brush.b);
+    m_generateShader->setVec3("baseHsv", hsv.h, hsv.s, hsv.v);
+    bool colorDynamics = false;
+    for (int i = 0; i < mappings; i++) {
+        colorDynamics = colorDynamics || isColorProperty(static_cast<BrushProperty>(brush.targets[i]));
+    }
+    m_generateShader->setInt("colorDynamics", colorDynamics ? 1 : 0);
+    m_generateShader->setInt("colorSeed", static_cast<int>(brush.colorSeed));
+    m_strokeDabs = 0;
+    m_generateShader->setInt("imageLayer", imageLayer);
+    m_generateShader->setFloat("accumulationScale", brush.accumulationScale);
+    m_generateShader->setInt("mappingCount", mappings);
+    if (mappings > 0) {
+        m_generateShader->setIntArray("sources", brush.sources.data(), mappings);
+        m_generateShader->setIntArray("targets", brush.targets.data(), mappings);
+    }
+    m_generateShader->setInt("curves", 1);
+}
+
+void DabGenerator::reserve(GLuint buffer, size_t& capacity, size_t bytes) {
+    m_state.bindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    if (bytes > capacity) {
+        capacity = std::max(bytes, capacity * 2);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, capacity, nullptr, GL_DYNAMIC_DRAW);
+    }
+}
+
+void DabGenerator::generate(const DabSegment* segments, size_t count, size_t dabCount, GLuint dabBuffer,
+                            bool strokeBuffer, float strokeOpacity) {
+    if (count == 0 || dabCount == 0) {
+        return;
+    }
+    
+    // The only upload: one record per input sample
+    reserve(m_segmentBuffer, m_segmentCapacity, count * sizeof(DabSegment));
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(DabSegment), segments);
+    reserve(m_firstDabBuffer, m_firstDabCapacity, count * sizeof(GLuint));
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, dabBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_segmentBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_firstDabBuffer);
+    
+    m_scanShader->use(m_state);
+    m_scanShader->setInt("segmentCount", static_cast<int>(count));
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    
+    m_generateShader->use(m_state);
+    m_generateShader->setInt("segmentCount", static_cast<int>(count));
+    m_generateShader->setInt("dabCount", static_cast<int>(dabCount));
+    m_generateShader->setInt("strokeBuffer", strokeBuffer ? 1 : 0);
+    m_generateShader->setFloat("strokeOpacity", strokeOpacity);
+    m_generateShader->setInt("firstStrokeDab", static_cast<int>(m_strokeDabs));
+    m_strokeDabs += dabCount;
+    m_state.bindTexture(1, GL_TEXTURE_2D, m_curveTexture);
+    glDispatchCompute(static_cast<GLuint>((dabCount + 63) / 64), 1, 1);
+    
+    // The rasterizer's binning pass reads the dabs next
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+} // namespace Acute
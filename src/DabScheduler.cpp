@@ -0,0 +1,384 @@
+#include "DabScheduler.h"
+#include "AdaptiveSpacing.h"
+#include "Canvas.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace Acute {
+
+namespace {
+
+// Starting guesses until measurements arrive; deliberately pessimistic so the
+// first frames of a heavy stroke do not overrun
+constexpr double kInitialCpuPerDab = 4e-6;
+constexpr double kInitialGpuPerDab = 2e-6;
+constexpr double kInitialGpuPerPixel = 2e-9;
+
+// Weight of a new CPU sample, and how fast old GPU batches are forgotten
+constexpr double kCpuSmoothing = 0.2;
+constexpr double kGpuDecay = 0.9;
+
+// Pixels shaded for a ribbon segment: Canvas::drawRibbon covers it with a
+// quad reaching 1.5 pixels past its larger radius on every side
+double ribbonPixels(const RibbonSegment& segment) {
+    float extent = std::max(segment.r0, segment.r1) + 1.5f;
+    float dx = segment.x1 - segment.x0;
+    float dy = segment.y1 - segment.y0;
+    return (std::sqrt(dx * dx + dy * dy) + 2.0 * extent) * 2.0 * extent;
+}
+
+} // namespace
+
+DabScheduler::DabScheduler()
+    : m_pendingDabs(0)
+    , m_carriedDabs(0)
+    , m_nextQuery(0)
+    , m_cpuPerDab(kInitialCpuPerDab)
+    , m_gpuPerDab(kInitialGpuPerDab)
+    , m_gpuPerPixel(kInitialGpuPerPixel)
+    , m_sumDD(0.0)
+    , m_sumDP(0.0)
+    , m_sumPP(0.0)
+    , m_sumDT(0.0)
+    , m_sumPT(0.0)
+    , m_stats()
+{
+    for (auto& query : m_queries) {
+        query = TimerQuery{0, false, 0.0, 0.0};
+    }
+}
+
+DabScheduler::~DabScheduler() {
+    for (auto& query : m_queries) {
+        if (query.query) {
+            glDeleteQueries(1, &query.query);
+        }
+    }
+}
+
+bool DabScheduler::initialize() {
+    for (auto& query : m_queries) {
+        glGenQueries(1, &query.query);
+        if (!query.query) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void DabScheduler::beginStroke(bool useStrokeBuffer, float opacity, BlendMode blend,
+                               std::shared_ptr<const DabSegmentBrush> segmentBrush) {
+    PendingStroke stroke;
+    stroke.useStrokeBuffer = useStrokeBuffer;
+    stroke.opacity = opacity;
+    stroke.blend = blend;
+    stroke.begun = false;
+    stroke.ended = false;
+    stroke.next = 0;
+    stroke.nextRibbon = 0;
+    stroke.segmentBrush = std::move(segmentBrush);
+    stroke.nextSegment = 0;
+    m_strokes.push_back(std::move(stroke));
+}
+
+void DabScheduler::submit(const std::vector<BrushDab>& dabs) {
+    if (m_strokes.empty() || m_strokes.back().ended) {
+        return;
+    }
+    std::vector<BrushDab>& queued = m_strokes.back().dabs;
+    queued.insert(queued.end(), dabs.begin(), dabs.end());
+    m_pendingDabs += dabs.size();
+}
+
+void DabScheduler::submitRibbon(const std::vector<RibbonSegment>& segments) {
+    if (m_strokes.empty() || m_strokes.back().ended) {
+        return;
+    }
+    std::vector<RibbonSegment>& queued = m_strokes.back().segments;
+    queued.insert(queued.end(), segments.begin(), segments.end());
+    m_pendingDabs += segments.size();
+}
+
+void DabScheduler::submitSegments(const std::vector<DabSegment>& segments) {
+    if (m_strokes.empty() || m_strokes.back().ended || !m_strokes.back().segmentBrush) {
+        return;
+    }
+    std::vector<DabSegment>& queued = m_strokes.back().dabSegments;
+    queued.insert(queued.end(), segments.begin(), segments.end());
+    for (const auto& segment : segments) {
+        m_pendingDabs += static_cast<size_t>(segment.count);
+    }
+}
+
+void DabScheduler::endStroke() {
+    if (!m_strokes.empty()) {
+        m_strokes.back().ended = true;
+    }
+}
+
+bool DabScheduler::isIdle() const {
+    // An open stroke whose input has all been drawn is not waiting on anything
+    return m_strokes.empty()
+        || (m_strokes.size() == 1 && m_strokes.front().begun && !m_strokes.front().ended
+            && m_pendingDabs == 0);
+}
+
+void DabScheduler::drain(Canvas& canvas, float budget) {
+    collectQueries();
+    if (!isIdle()) {
+        drawQueued(canvas, std::max(0.0f, budget));
+    }
+    updateProxy(canvas);
+    
+    if (m_pendingDabs > 0) {
+        m_stats.framesBehind++;
+        m_stats.longestBacklog = std::max(m_stats.longestBacklog, m_pendingDabs);
+    }
+    m_carriedDabs = m_pendingDabs;
+}
+
+void DabScheduler::finish(Canvas& canvas) {
+    if (!isIdle()) {
+        drawQueued(canvas, -1.0);
+    }
+    updateProxy(canvas);
+    m_carriedDabs = 0;
+}
+
+void DabScheduler::drawQueued(Canvas& canvas, double budget) {
+    auto start = std::chrono::steady_clock::now();
+    
+    // Time the whole batch on the GPU when a query slot is free
+    TimerQuery* timer = nullptr;
+    if (m_queries[m_nextQuery].query && !m_queries[m_nextQuery].pending) {
+        timer = &m_queries[m_nextQuery];
+        m_nextQuery = (m_nextQuery + 1) % kQuerySlots;
+        glBeginQuery(GL_TIME_ELAPSED, timer->query);
+    }
+    
+    const int copies = canvas.getSymmetryCopies();
+    double spent = 0.0;
+    double pixels = 0.0;
+    size_t drawn = 0;
+    while (!m_strokes.empty()) {
+        PendingStroke& stroke = m_strokes.front();
+        if (!stroke.begun) {
+            canvas.beginStroke(stroke.useStrokeBuffer, stroke.opacity, stroke.blend);
+            if (stroke.segmentBrush) {
+                canvas.setSegmentBrush(*stroke.segmentBrush);
+            }
+            stroke.begun = true;
+        }
+        
+        // Ribbons: the longest run of segments that fits, drawn in one pass
+        size_t endRibbon = stroke.nextRibbon;
+        while (endRibbon < stroke.segments.size()) {
+            double segmentPixels = ribbonPixels(stroke.segments[endRibbon]);
+            double cost = predictCost(segmentPixels, copies);
+            if (budget >= 0.0 && drawn + (endRibbon - stroke.nextRibbon) > 0 && spent + cost > budget) {
+                break;
+            }
+            spent += cost;
+            pixels += segmentPixels * copies;
+            endRibbon++;
+        }
+        if (endRibbon > stroke.nextRibbon) {
+            canvas.drawRibbon(stroke.segments.data() + stroke.nextRibbon, endRibbon - stroke.nextRibbon);
+            drawn += endRibbon - stroke.nextRibbon;
+            stroke.nextRibbon = endRibbon;
+        }
+        if (stroke.nextRibbon < stroke.segments.size()) {
+            break;
+        }
+        
+        // The longest run that fits, but at least one dab per frame
+        size_t end = stroke.next;
+        while (end < stroke.dabs.size()) {
+            const BrushDab& dab = stroke.dabs[end];
+            double cost = predictCost(static_cast<double>(dab.size) * dab.size, copies);
+            if (budget >= 0.0 && drawn + (end - stroke.next) > 0 && spent + cost > budget) {
+                break;
+            }
+            spent += cost;
+            pixels += static_cast<double>(dab.size) * dab.size * copies;
+            end++;
+        }
+        if (end > stroke.next) {
+            canvas.drawDabs(stroke.dabs.data() + stroke.next, end - stroke.next);
+            drawn += end - stroke.next;
+            stroke.next = end;
+        }
+        if (stroke.next < stroke.dabs.size()) {
+            break;
+        }
+        
+        // Generated strokes: whole segments, priced by their dabs
+        size_t endSegment = stroke.nextSegment;
+        size_t segmentDabs = 0;
+        while (endSegment < stroke.dabSegments.size()) {
+            const DabSegment& segment = stroke.dabSegments[endSegment];
+            double cost = predictCost(static_cast<double>(segment.size) * segment.size, copies) * segment.count;
+            if (budget >= 0.0 && drawn + segmentDabs > 0 && spent + cost > budget) {
+                break;
+            }
+            spent += cost;
+            pixels += static_cast<double>(segment.size) * segment.size * copies * segment.count;
+            segmentDabs += static_cast<size_t>(segment.count);
+            endSegment++;
+        }
+        if (endSegment > stroke.nextSegment) {
+            canvas.drawDabSegments(stroke.dabSegments.data() + stroke.nextSegment, endSegment - stroke.nextSegment);
+            drawn += segmentDabs;
+            stroke.nextSegment = endSegment;
+        }
+        if (stroke.nextSegment < stroke.dabSegments.size()) {
+            break;
+        }
+        
+        // Everything submitted so far is drawn
+        stroke.segments.clear();
+        stroke.nextRibbon = 0;
+        stroke.dabs.clear();
+        stroke.next = 0;
+        stroke.dabSegments.clear();
+        stroke.nextSegment = 0;
+        if (!stroke.ended) {
+            break;
+        }
+        canvas.endStroke();
+        m_strokes.pop_front();
+    }
+    
+    if (timer) {
+        glEndQuery(GL_TIME_ELAPSED);
+        timer->pending = true;
+        timer->dabs = static_cast<double>(drawn) * copies;
+        timer->pixels = pixels;
+    }
+    
+    // Queued dabs are drawn first in, first out
+    m_stats.dabsDrawn += drawn;
+    m_stats.dabsDeferred += std::min(drawn, m_carriedDabs);
+    m_carriedDabs -= std::min(drawn, m_carriedDabs);
+    m_pendingDabs -= drawn;
+    
+    if (drawn > 0) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        m_cpuPerDab += kCpuSmoothing * (seconds / drawn - m_cpuPerDab);
+    }
+}
+
+void DabScheduler::collectQueries() {
+    for (auto& query : m_queries) {
+        if (!query.pending) {
+            continue;
+        }
+        GLint available = 0;
+        glGetQueryObjectiv(query.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            continue;
+        }
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(query.query, GL_QUERY_RESULT, &nanoseconds);
+        query.pending = false;
+        if (query.dabs > 0.0) {
+            addGpuSample(query.dabs, query.pixels, static_cast<double>(nanoseconds) * 1e-9);
+        }
+    }
+}
+
+void DabScheduler::addGpuSample(double dabs, double pixels, double seconds) {
+    m_sumDD = m_sumDD * kGpuDecay + dabs * dabs;
+    m_sumDP = m_sumDP * kGpuDecay + dabs * pixels;
+    m_sumPP = m_sumPP * kGpuDecay + pixels * pixels;
+    m_sumDT = m_sumDT * kGpuDecay + dabs * seconds;
+    m_sumPT = m_sumPT * kGpuDecay + pixels * seconds;
+    
+    // Batches of similar dabs cannot tell the two terms apart; then only the
+    // per pixel cost is refitted, keeping the per dab cost
+    double det = m_sumDD * m_sumPP - m_sumDP * m_sumDP;
+    if (det > 1e-3 * m_sumDD * m_sumPP) {
+        double perDab = (m_sumDT * m_sumPP - m_sumPT * m_sumDP) / det;
+        double perPixel = (m_sumPT * m_sumDD - m_sumDT * m_sumDP) / det;
+        if (perDab >= 0.0 && perPixel >= 0.0) {
+            m_gpuPerDab = perDab;
+            m_gpuPerPixel = perPixel;
+            return;
+        }
+    }
+    if (m_sumPP > 0.0) {
+        m_gpuPerPixel = std::max(0.0, (m_sumPT - m_gpuPerDab * m_sumDP) / m_sumPP);
+    }
+}
+
+double DabScheduler::predictCost(double pixels, int copies) const {
+    // CPU submission and GPU fill do overlap, but adding them stays on the
+    // safe side. The GPU terms count every symmetry copy.
+    return m_cpuPerDab + m_gpuPerDab * copies + m_gpuPerPixel * pixels * copies;
+}
+
+void DabScheduler::updateProxy(Canvas& canvas) {
+    // Every stride-th waiting dab, with its opacity built up to cover the
+    // ones skipped
+    size_t stride = std::max<size_t>(1, (m_pendingDabs + kMaxProxyDabs - 1) / kMaxProxyDabs);
+    m_proxyDabs.clear();
+    for (const auto& stroke : m_strokes) {
+        for (size_t i = stroke.next; i < stroke.dabs.size(); i += stride) {
+            BrushDab dab = stroke.dabs[i];
+            if (stroke.blend == BlendMode::Erase) {
+                dab.blend = BlendMode::Erase;
+            }
+            dab.opacity = compensateAlpha(dab.opacity * dab.flow, static_cast<float>(stride));
+            dab.flow = 1.0f;
+            m_proxyDabs.push_back(dab);
+        }
+        
+        // Ribbon segments show as a disc at their end. Pieces are shorter
+        // than the ribbon is wide, so the discs overlap about width / length
+        // times (stride times fewer when thinned out).
+        for (size_t i = stroke.nextRibbon; i < stroke.segments.size(); i += stride) {
+            const RibbonSegment& segment = stroke.segments[i];
+            float dx = segment.x1 - segment.x0;
+            float dy = segment.y1 - segment.y0;
+            float width = std::max(1.0f, segment.r0 + segment.r1);
+            float overlap = std::min(1.0f, std::sqrt(dx * dx + dy * dy) * stride / width);
+            BrushDab dab;
+            dab.x = segment.x1;
+            dab.y = segment.y1;
+            dab.size = segment.r1 * 2.0f;
+            dab.hardness = segment.hardness;
+            dab.r = segment.r;
+            dab.g = segment.g;
+            dab.b = segment.b;
+            dab.blend = stroke.blend == BlendMode::Erase ? BlendMode::Erase : segment.blend;
+            dab.opacity = compensateAlpha(segment.opacity, overlap);
+            dab.flow = 1.0f;
+            m_proxyDabs.push_back(dab);
+        }
+        
+        // A generated stroke's waiting segments show as one dab at the end
+        // of each move, standing for all of the move's dabs
+        const DabSegmentBrush* brush = stroke.segmentBrush.get();
+        for (size_t i = stroke.nextSegment; i < stroke.dabSegments.size(); i++) {
+            const DabSegment& segment = stroke.dabSegments[i];
+            BrushDab dab;
+            dab.x = segment.x1;
+            dab.y = segment.y1;
+            dab.size = segment.size;
+            dab.hardness = brush->hardness;
+            dab.tip = brush->tip;
+            dab.r = brush->r;
+            dab.g = brush->g;
+            dab.b = brush->b;
+            dab.blend = stroke.blend == BlendMode::Erase ? BlendMode::Erase
+                                                         : static_cast<BlendMode>(static_cast<int>(segment.blend));
+            dab.opacity = compensateAlpha(brush->opacity * brush->flow, segment.count);
+            dab.flow = 1.0f;
+            m_proxyDabs.push_back(dab);
+        }
+    }
+    canvas.setProxyDabs(m_proxyDabs);
+}
+
+} // namespace Acute
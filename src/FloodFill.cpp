@@ -0,0 +1,390 @@
+#include "FloodFill.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ACUTE_FILL_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace Acute {
+
+namespace {
+
+#ifdef ACUTE_FILL_SSE2
+// The seed color in every pixel lane
+__m128i splatColor(const uint8_t color[4]) {
+    int word;
+    std::memcpy(&word, color, sizeof(word));
+    return _mm_set1_epi32(word);
+}
+#endif
+
+#ifdef ACUTE_FILL_SSE2
+// 255 per pixel of 16 whose every channel is within the limit of the color
+__m128i passes(const uint8_t* pixels, __m128i color, __m128i limit) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lanes[4];
+    for (int i = 0; i < 4; i++) {
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels + i * 16));
+        __m128i difference = _mm_or_si128(_mm_subs_epu8(p, color), _mm_subs_epu8(color, p));
+        lanes[i] = _mm_cmpeq_epi32(_mm_subs_epu8(difference, limit), zero);
+    }
+    // Saturating packs keep all ones and zeros
+    return _mm_packs_epi16(_mm_packs_epi32(lanes[0], lanes[1]), _mm_packs_epi32(lanes[2], lanes[3]));
+}
+#endif
+
+int lowestSetBit(uint32_t bits) {
+#if defined(__GNUC__)
+    return __builtin_ctz(bits);
+#else
+    int bit = 0;
+    while (!(bits & 1u)) {
+        bits >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+int highestSetBit(uint32_t bits) {
+#if defined(__GNUC__)
+    return 31 - __builtin_clz(bits);
+#else
+    int bit = 31;
+    while (!(bits & 0x80000000u)) {
+        bits <<= 1;
+        bit--;
+    }
+    return bit;
+#endif
+}
+
+// Fillable: within the tolerance of the seed color and not filled yet
+struct ColorTest {
+    const uint8_t* pixels;
+    const uint8_t* mask;
+    int width;
+    uint8_t seed[4];
+    int tolerance;
+    
+    bool pixel(int x, int y) const {
+        size_t i = static_cast<size_t>(y) * width + x;
+        if (mask[i]) {
+            return false;
+        }
+        const uint8_t* p = pixels + i * 4;
+        for (int c = 0; c < 4; c++) {
+            if (std::abs(p[c] - seed[c]) > tolerance) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+#ifdef ACUTE_FILL_SSE2
+    static constexpr int kLanes = 16;
+    
+    // Bit i set if pixel x + i is fillable
+    uint32_t lanes(int x, int y) const {
+        size_t i = static_cast<size_t>(y) * width + x;
+        const uint8_t* p = pixels + i * 4;
+        __m128i filled = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + i));
+        __m128i limit = _mm_set1_epi8(static_cast<char>(tolerance));
+        __m128i fillable = _mm_andnot_si128(filled, passes(p, splatColor(seed), limit));
+        return static_cast<uint32_t>(_mm_movemask_epi8(fillable));
+    }
+#endif
+};
+
+// Fillable: not blocked and not filled yet (gap closing)
+struct MapTest {
+    const uint8_t* blocked;
+    const uint8_t* mask;
+    int width;
+    
+    bool pixel(int x, int y) const {
+        size_t i = static_cast<size_t>(y) * width + x;
+        return !blocked[i] && !mask[i];
+    }
+
+#ifdef ACUTE_FILL_SSE2
+    static constexpr int kLanes = 16;
+    
+    uint32_t lanes(int x, int y) const {
+        size_t i = static_cast<size_t>(y) * width + x;
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(blocked + i));
+        __m128i m = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mask + i));
+        __m128i fillable = _mm_cmpeq_epi8(_mm_or_si128(b, m), _mm_setzero_si128());
+        return static_cast<uint32_t>(_mm_movemask_epi8(fillable));
+    }
+#endif
+};
+
+// First pixel in [x, end) that is not fillable, or end
+template <typename Test>
+int runRight(const Test& test, int x, int y, int end) {
+#ifdef ACUTE_FILL_SSE2
+    const uint32_t all = (1u << Test::kLanes) - 1u;
+    for (; x + Test::kLanes <= end; x += Test::kLanes) {
+        uint32_t bits = test.lanes(x, y);
+        if (bits != all) {
+            return x + lowestSetBit(~bits & all);
+        }
+    }
+#endif
+    while (x < end && test.pixel(x, y)) {
+        x++;
+    }
+    return x;
+}
+
+// Start of the fillable run ending just before x, not before begin
+template <typename Test>
+int runLeft(const Test& test, int x, int y, int begin) {
+#ifdef ACUTE_FILL_SSE2
+    const uint32_t all = (1u << Test::kLanes) - 1u;
+    for (; x - Test::kLanes >= begin; x -= Test::kLanes) {
+        uint32_t bits = test.lanes(x - Test::kLanes, y);
+        if (bits != all) {
+            return x - Test::kLanes + highestSetBit(~bits & all) + 1;
+        }
+    }
+#endif
+    while (x > begin && test.pixel(x - 1, y)) {
+        x--;
+    }
+    return x;
+}
+
+// First fillable pixel in [x, end), or end
+template <typename Test>
+int skipRight(const Test& test, int x, int y, int end) {
+#ifdef ACUTE_FILL_SSE2
+    for (; x + Test::kLanes <= end; x += Test::kLanes) {
+        uint32_t bits = test.lanes(x, y);
+        if (bits != 0) {
+            return x + lowestSetBit(bits);
+        }
+    }
+#endif
+    while (x < end && !test.pixel(x, y)) {
+        x++;
+    }
+    return x;
+}
+
+// dst = a | b over count bytes. dst may be a, and b may lie further on in
+// the same buffer: each block is read before it is written.
+void orBytes(uint8_t* dst, const uint8_t* a, const uint8_t* b, int count) {
+    int i = 0;
+#ifdef ACUTE_FILL_SSE2
+    for (; i + 16 <= count; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_or_si128(va, vb));
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = a[i] | b[i];
+    }
+}
+
+// dst &= ~clear over count bytes
+void clearBytes(uint8_t* dst, const uint8_t* clear, int count) {
+    int i = 0;
+#ifdef ACUTE_FILL_SSE2
+    for (; i + 16 <= count; i += 16) {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(clear + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_andnot_si128(c, d));
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] &= static_cast<uint8_t>(~clear[i]);
+    }
+}
+
+// 255 where a pixel is outside the tolerance of the seed
+void classifyBarriers(const uint8_t* pixels, size_t count, const uint8_t seed[4], int tolerance,
+                      uint8_t* barrier) {
+    size_t i = 0;
+#ifdef ACUTE_FILL_SSE2
+    const __m128i color = splatColor(seed);
+    const __m128i limit = _mm_set1_epi8(static_cast<char>(tolerance));
+    for (; i + 16 <= count; i += 16) {
+        __m128i pass = passes(pixels + i * 4, color, limit);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(barrier + i), _mm_cmpeq_epi8(pass, _mm_setzero_si128()));
+    }
+#endif
+    for (; i < count; i++) {
+        const uint8_t* p = pixels + i * 4;
+        bool pass = true;
+        for (int c = 0; c < 4; c++) {
+            pass = pass && std::abs(p[c] - seed[c]) <= tolerance;
+        }
+        barrier[i] = pass ? 0 : 255;
+    }
+}
+
+} // namespace
+
+FloodFill::FloodFill()
+    : m_width(0)
+    , m_height(0)
+    , m_minX(0)
+    , m_minY(0)
+    , m_maxX(0)
+    , m_maxY(0)
+{
+}
+
+bool FloodFill::fill(const uint8_t* pixels, int width, int height, int x, int y, const FillOptions& options) {
+    if (x < 0 || y < 0 || x >= width || y >= height) {
+        return false;
+    }
+    
+    // Clear what the last fill set
+    if (width != m_width || height != m_height) {
+        m_width = width;
+        m_height = height;
+        m_mask.assign(static_cast<size_t>(width) * height, 0);
+    } else {
+        for (int row = m_minY; row < m_maxY; row++) {
+            std::memset(m_mask.data() + static_cast<size_t>(row) * width + m_minX, 0, m_maxX - m_minX);
+        }
+    }
+    m_minX = m_maxX = x;
+    m_minY = m_maxY = y;
+    
+    ColorTest colorTest = { pixels, m_mask.data(), width, {}, std::min(255, std::max(0, options.tolerance)) };
+    std::memcpy(colorTest.seed, pixels + (static_cast<size_t>(y) * width + x) * 4, 4);
+    
+    // Distances are counted in bytes
+    int gap = std::min(254, options.gap);
+    if (gap <= 0) {
+        fillSpans(colorTest, x, y);
+        return true;
+    }
+    
+    size_t count = static_cast<size_t>(width) * height;
+    m_barrier.resize(count);
+    m_blocked.resize(count);
+    classifyBarriers(pixels, count, colorTest.seed, colorTest.tolerance, m_barrier.data());
+    std::memcpy(m_blocked.data(), m_barrier.data(), count);
+    grow(m_blocked.data(), 0, 0, width, height, gap);
+    
+    // Seeded inside a gap's reach (a narrow area): fill it without closing
+    if (m_blocked[static_cast<size_t>(y) * width + x]) {
+        fillSpans(colorTest, x, y);
+        return true;
+    }
+    
+    MapTest mapTest = { m_blocked.data(), m_mask.data(), width };
+    fillSpans(mapTest, x, y);
+    
+    // Grow back up to the barriers
+    m_minX = std::max(0, m_minX - gap);
+    m_minY = std::max(0, m_minY - gap);
+    m_maxX = std::min(width, m_maxX + gap);
+    m_maxY = std::min(height, m_maxY + gap);
+    grow(m_mask.data(), m_minX, m_minY, m_maxX, m_maxY, gap);
+    for (int row = m_minY; row < m_maxY; row++) {
+        size_t offset = static_cast<size_t>(row) * width + m_minX;
+        clearBytes(m_mask.data() + offset, m_barrier.data() + offset, m_maxX - m_minX);
+    }
+    return true;
+}
+
+template <typename Test>
+void FloodFill::fillSpans(const Test& test, int x, int y) {
+    // The first span searches both neighbouring rows in full
+    m_stack.clear();
+    m_stack.push_back({ x, x + 1, y, 1, x, x });
+    while (!m_stack.empty()) {
+        Seed seed = m_stack.back();
+        m_stack.pop_back();
+        
+        // Runs may have been filled from another span since they were pushed
+        if (!test.pixel(seed.x, seed.y)) {
+            continue;
+        }
+        int left = runLeft(test, seed.x, seed.y, 0);
+        int right = runRight(test, seed.end, seed.y, m_width);
+        std::memset(m_mask.data() + static_cast<size_t>(seed.y) * m_width + left, 255, right - left);
+        m_minX = std::min(m_minX, left);
+        m_maxX = std::max(m_maxX, right);
+        m_minY = std::min(m_minY, seed.y);
+        m_maxY = std::max(m_maxY, seed.y + 1);
+        
+        // Onwards in full; back towards the parent only past its ends
+        int next = seed.y + seed.direction, back = seed.y - seed.direction;
+        pushRuns(test, next, left, right, seed.direction, left, right);
+        pushRuns(test, back, left, std::min(right, seed.parentLeft), -seed.direction, left, right);
+        pushRuns(test, back, std::max(left, seed.parentRight), right, -seed.direction, left, right);
+    }
+}
+
+template <typename Test>
+void FloodFill::pushRuns(const Test& test, int y, int left, int right, int direction, int parentLeft,
+                         int parentRight) {
+    if (y < 0 || y >= m_height) {
+        return;
+    }
+    int x = skipRight(test, left, y, right);
+    while (x < right) {
+        int end = runRight(test, x + 1, y, right);
+        m_stack.push_back({ x, end, y, direction, parentLeft, parentRight });
+        x = skipRight(test, end, y, right);
+    }
+}
+
+void FloodFill::grow(uint8_t* map, int x0, int y0, int x1, int y1, int radius) {
+    const int width = x1 - x0;
+    if (width <= 0 || y1 <= y0 || radius <= 0) {
+        return;
+    }
+    
+    // Rows: a window of 2 * radius + 1 as the OR of windows doubling in
+    // width, over a copy of the row padded with radius zeros either side
+    const int window = 2 * radius + 1;
+    const int padded = width + 2 * radius;
+    m_row.assign(padded, 0);
+    for (int y = y0; y < y1; y++) {
+        uint8_t* row = map + static_cast<size_t>(y) * m_width + x0;
+        uint8_t* run = m_row.data();
+        std::memcpy(run + radius, row, width);
+        std::fill(run, run + radius, static_cast<uint8_t>(0));
+        std::fill(run + radius + width, run + padded, static_cast<uint8_t>(0));
+        int span = 1;
+        for (; span * 2 <= window; span *= 2) {
+            orBytes(run, run, run + span, padded - span);
+        }
+        orBytes(row, run, run + window - span, width);
+    }
+    
+    // Columns: each row is the OR of the rows within the radius. The rows
+    // below are still as they were; those above are kept in a ring before
+    // they are overwritten. Everything stays in cache.
+    m_above.resize(static_cast<size_t>(radius) * width);
+    for (int y = y0; y < y1; y++) {
+        uint8_t* row = map + static_cast<size_t>(y) * m_width + x0;
+        uint8_t* grown = m_row.data();
+        std::memcpy(grown, row, width);
+        for (int k = 1; k <= radius; k++) {
+            if (y + k < y1) {
+                orBytes(grown, grown, row + static_cast<size_t>(k) * m_width, width);
+            }
+            if (y - k >= y0) {
+                orBytes(grown, grown, m_above.data() + static_cast<size_t>((y - k - y0) % radius) * width, width);
+            }
+        }
+        // Row y - radius is not needed any more
+        std::memcpy(m_above.data() + static_cast<size_t>((y - y0) % radius) * width, row, width);
+        std::memcpy(row, grown, width);
+    }
+}
+
+} // namespace Acute
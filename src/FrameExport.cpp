@@ -0,0 +1,245 @@
+#include "FrameExport.h"
+#include "ReadbackCache.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <new>
+
+#ifdef PLATFORM_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace Acute {
+
+FrameExport::FrameExport()
+    : m_header(nullptr)
+    , m_base(nullptr)
+    , m_size(0)
+#ifdef PLATFORM_WINDOWS
+    , m_mapping(nullptr)
+#endif
+    , m_width(0)
+    , m_height(0)
+    , m_sequence(0)
+    , m_bytesCopied(0)
+{
+}
+
+FrameExport::~FrameExport() {
+    close();
+}
+
+bool FrameExport::open(const std::string& name, int width, int height) {
+    close();
+
+#ifdef PLATFORM_WINDOWS
+    m_name = name;
+#else
+    // POSIX names are a single component with a leading slash
+    m_name = name.empty() || name[0] != '/' ? "/" + name : name;
+#endif
+    m_width = width;
+    m_height = height;
+    m_sequence = 0;
+    
+    // Slot pixels start on page boundaries so readers can map or upload them
+    // directly
+    const size_t page = 4096;
+    const size_t stride = static_cast<size_t>(width) * 4;
+    const size_t slotBytes = (stride * height + page - 1) / page * page;
+    const size_t pixelOffset = (sizeof(FrameExportHeader) + page - 1) / page * page;
+    m_size = pixelOffset + slotBytes * kFrameExportSlots;
+    if (!createMapping()) {
+        return false;
+    }
+    
+    // A new segment is zero filled: every slot starts transparent, with no frame
+    m_header = new (m_base) FrameExportHeader();
+    m_header->version = kFrameExportVersion;
+    m_header->slotCount = kFrameExportSlots;
+    m_header->width = width;
+    m_header->height = height;
+    m_header->stride = stride;
+    m_header->pixelOffset = pixelOffset;
+    m_header->slotBytes = slotBytes;
+    m_header->magic.store(kFrameExportMagic, std::memory_order_release);
+    
+    for (auto& pending : m_pending) {
+        pending.clear();
+    }
+    return true;
+}
+
+void FrameExport::close() {
+    if (!m_header) {
+        return;
+    }
+    // Readers still mapping the old segment keep it until they let go
+    m_header->closed.store(1, std::memory_order_release);
+    releaseMapping();
+    m_header = nullptr;
+}
+
+bool FrameExport::createMapping() {
+#ifdef PLATFORM_WINDOWS
+    m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                                   static_cast<DWORD>(static_cast<uint64_t>(m_size) >> 32),
+                                   static_cast<DWORD>(m_size), m_name.c_str());
+    if (!m_mapping) {
+        std::cerr << "Failed to create frame export mapping: " << m_name << std::endl;
+        return false;
+    }
+    m_base = static_cast<uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, m_size));
+    if (!m_base) {
+        std::cerr << "Failed to map frame export: " << m_name << std::endl;
+        CloseHandle(m_mapping);
+        m_mapping = nullptr;
+        return false;
+    }
+    // An existing mapping of the name may hold an old frame
+    std::memset(m_base, 0, m_size);
+    return true;
+#else
+    // A fresh object, so readers of an old one never see it change size
+    shm_unlink(m_name.c_str());
+    int fd = shm_open(m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        std::cerr << "Failed to create shared memory: " << m_name << std::endl;
+        return false;
+    }
+    if (ftruncate(fd, static_cast<off_t>(m_size)) != 0) {
+        std::cerr << "Failed to size shared memory: " << m_name << std::endl;
+        ::close(fd);
+        shm_unlink(m_name.c_str());
+        return false;
+    }
+    void* address = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED) {
+        std::cerr << "Failed to map shared memory: " << m_name << std::endl;
+        shm_unlink(m_name.c_str());
+        return false;
+    }
+    m_base = static_cast<uint8_t*>(address);
+    return true;
+#endif
+}
+
+void FrameExport::releaseMapping() {
+#ifdef PLATFORM_WINDOWS
+    UnmapViewOfFile(m_base);
+    CloseHandle(m_mapping);
+    m_mapping = nullptr;
+#else
+    munmap(m_base, m_size);
+    shm_unlink(m_name.c_str());
+#endif
+    m_base = nullptr;
+}
+
+void FrameExport::publish(const ReadbackCache& cache, const std::vector<int>& tiles) {
+    if (!m_header || tiles.empty() || cache.getWidth() != m_width || cache.getHeight() != m_height) {
+        return;
+    }
+    const size_t tileCount = static_cast<size_t>(cache.getTilesX()) * cache.getTilesY();
+    for (auto& pending : m_pending) {
+        if (pending.size() != tileCount) {
+            // Until a slot has been written in full, it is missing every tile
+            pending.assign(tileCount, 1);
+        }
+        for (int index : tiles) {
+            pending[index] = 1;
+        }
+    }
+    buildRects(cache, tiles);
+    
+    uint64_t sequence = m_sequence + 1;
+    int slotIndex = static_cast<int>(sequence % kFrameExportSlots);
+    FrameExportSlot& slot = m_header->slots[slotIndex];
+    slot.sequence.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    
+    // Bring the slot up to date: copy the tiles changed since it last held a
+    // frame, a run of tiles on a row at a time
+    std::vector<uint8_t>& pending = m_pending[slotIndex];
+    uint8_t* pixels = m_base + m_header->pixelOffset + m_header->slotBytes * slotIndex;
+    const uint8_t* source = cache.getPixels();
+    const size_t stride = m_header->stride;
+    const int tilesX = cache.getTilesX();
+    for (int ty = 0; ty < cache.getTilesY(); ty++) {
+        uint8_t* row = pending.data() + static_cast<size_t>(ty) * tilesX;
+        for (int tx = 0; tx < tilesX;) {
+            if (!row[tx]) {
+                tx++;
+                continue;
+            }
+            int end = tx;
+            while (end < tilesX && row[end]) {
+                row[end++] = 0;
+            }
+            int x0, y0, x1, y1, lastX0, lastY0, lastY1;
+            cache.getTileRect(ty * tilesX + tx, x0, y0, x1, y1);
+            cache.getTileRect(ty * tilesX + end - 1, lastX0, lastY0, x1, lastY1);
+            for (int y = y0; y < y1; y++) {
+                const size_t offset = static_cast<size_t>(y) * stride + static_cast<size_t>(x0) * 4;
+                std::memcpy(pixels + offset, source + offset, static_cast<size_t>(x1 - x0) * 4);
+            }
+            m_bytesCopied += static_cast<uint64_t>(x1 - x0) * 4 * (y1 - y0);
+            tx = end;
+        }
+    }
+    
+    slot.rectCount = static_cast<uint32_t>(m_rects.size());
+    std::copy(m_rects.begin(), m_rects.end(), slot.rects);
+    slot.sequence.store(sequence, std::memory_order_release);
+    m_header->latest.store(sequence, std::memory_order_release);
+    m_sequence = sequence;
+}
+
+void FrameExport::buildRects(const ReadbackCache& cache, const std::vector<int>& tiles) {
+    // Tiles come in row major order, so runs on a row are consecutive
+    m_rects.clear();
+    const int tilesX = cache.getTilesX();
+    for (size_t i = 0; i < tiles.size();) {
+        size_t end = i + 1;
+        while (end < tiles.size() && tiles[end] == tiles[end - 1] + 1 && tiles[end] % tilesX != 0) {
+            end++;
+        }
+        int x0, y0, x1, y1, lastX0, lastY0, lastY1;
+        cache.getTileRect(tiles[i], x0, y0, x1, y1);
+        cache.getTileRect(tiles[end - 1], lastX0, lastY0, x1, lastY1);
+        FrameExportRect rect = { x0, y0, x1, y1 };
+        i = end;
+        
+        // Extend a region with the same columns ending on the row above
+        bool merged = false;
+        for (auto& above : m_rects) {
+            if (above.x0 == rect.x0 && above.x1 == rect.x1 && above.y1 == rect.y0) {
+                above.y1 = rect.y1;
+                merged = true;
+                break;
+            }
+        }
+        if (!merged) {
+            m_rects.push_back(rect);
+        }
+    }
+    
+    // Too many: report their bounds instead
+    if (m_rects.size() > static_cast<size_t>(kFrameExportMaxRects)) {
+        FrameExportRect bounds = m_rects[0];
+        for (const auto& rect : m_rects) {
+            bounds.x0 = std::min(bounds.x0, rect.x0);
+            bounds.y0 = std::min(bounds.y0, rect.y0);
+            bounds.x1 = std::max(bounds.x1, rect.x1);
+            bounds.y1 = std::max(bounds.y1, rect.y1);
+        }
+        m_rects.assign(1, bounds);
+    }
+}
+
+} // namespace Acute
@@ -0,0 +1,352 @@
+#include "GLStateCache.h"
+#include <algorithm>
+#include <iostream>
+
+namespace Acute {
+
+namespace {
+
+const char* const kCounterNames[] = {
+    "framebuffer", "viewport", "program", "vertex array", "array buffer",
+    "active texture", "texture", "blend enable", "blend func", "blend equation",
+    "clear color", "stencil test", "stencil func", "stencil op"
+};
+
+GLuint getBinding(GLenum query) {
+    GLint value = 0;
+    glGetIntegerv(query, &value);
+    return static_cast<GLuint>(value);
+}
+
+} // namespace
+
+uint64_t GLStateCache::Stats::totalIssued() const {
+    uint64_t total = 0;
+    for (int i = 0; i < CounterCount; i++) {
+        total += issued[i];
+    }
+    return total;
+}
+
+uint64_t GLStateCache::Stats::totalElided() const {
+    uint64_t total = 0;
+    for (int i = 0; i < CounterCount; i++) {
+        total += elided[i];
+    }
+    return total;
+}
+
+GLStateCache::GLStateCache() {
+    invalidate();
+    resetStats();
+}
+
+void GLStateCache::invalidate() {
+    m_drawFramebuffer = kUnknownName;
+    m_readFramebuffer = kUnknownName;
+    std::fill(m_viewport, m_viewport + 4, 0);
+    m_viewportKnown = false;
+    m_program = kUnknownName;
+    m_vertexArray = kUnknownName;
+    m_arrayBuffer = kUnknownName;
+    m_activeUnit = -1;
+    for (auto& unit : m_textures) {
+        std::fill(unit, unit + TextureSlotCount, kUnknownName);
+    }
+    m_blendEnabled = -1;
+    std::fill(m_blendFunc, m_blendFunc + 4, kUnknownEnum);
+    m_blendEquation = kUnknownEnum;
+    std::fill(m_clearColor, m_clearColor + 4, 0.0f);
+    m_clearColorKnown = false;
+    m_stencilEnabled = -1;
+    m_stencilFunc = kUnknownEnum;
+    m_stencilRef = 0;
+    m_stencilMask = 0;
+    std::fill(m_stencilOp, m_stencilOp + 3, kUnknownEnum);
+}
+
+const char* GLStateCache::getCounterName(Counter counter) {
+    return kCounterNames[counter];
+}
+
+void GLStateCache::resetStats() {
+    std::fill(m_stats.issued, m_stats.issued + CounterCount, 0);
+    std::fill(m_stats.elided, m_stats.elided + CounterCount, 0);
+}
+
+bool GLStateCache::track(Counter counter, bool changed) {
+    if (changed) {
+        m_stats.issued[counter]++;
+    } else {
+        m_stats.elided[counter]++;
+    }
+    return changed;
+}
+
+int GLStateCache::textureSlot(GLenum target) {
+    if (target == GL_TEXTURE_2D) {
+        return Texture2D;
+    } else if (target == GL_TEXTURE_2D_ARRAY) {
+        return Texture2DArray;
+    }
+    return -1;
+}
+
+void GLStateCache::bindFramebuffer(GLenum target, GLuint framebuffer) {
+    bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+    bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+    bool changed = (draw && m_drawFramebuffer != framebuffer) || (read && m_readFramebuffer != framebuffer);
+    if (track(Framebuffer, changed)) {
+        glBindFramebuffer(target, framebuffer);
+        if (draw) m_drawFramebuffer = framebuffer;
+        if (read) m_readFramebuffer = framebuffer;
+    }
+}
+
+void GLStateCache::viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+    bool changed = !m_viewportKnown || m_viewport[0] != x || m_viewport[1] != y
+        || m_viewport[2] != width || m_viewport[3] != height;
+    if (track(Viewport, changed)) {
+        glViewport(x, y, width, height);
+        m_viewport[0] = x;
+        m_viewport[1] = y;
+        m_viewport[2] = width;
+        m_viewport[3] = height;
+        m_viewportKnown = true;
+    }
+}
+
+void GLStateCache::useProgram(GLuint program) {
+    if (track(Program, m_program != program)) {
+        glUseProgram(program);
+        m_program = program;
+    }
+}
+
+void GLStateCache::bindVertexArray(GLuint vertexArray) {
+    if (track(VertexArray, m_vertexArray != vertexArray)) {
+        glBindVertexArray(vertexArray);
+        m_vertexArray = vertexArray;
+    }
+}
+
+void GLStateCache::bindBuffer(GLenum target, GLuint buffer) {
+    // Element buffers are vertex array state; only the array buffer is global
+    if (target != GL_ARRAY_BUFFER) {
+        glBindBuffer(target, buffer);
+        return;
+    }
+    if (track(ArrayBuffer, m_arrayBuffer != buffer)) {
+        glBindBuffer(target, buffer);
+        m_arrayBuffer = buffer;
+    }
+}
+
+void GLStateCache::activeTexture(int unit) {
+    if (track(ActiveTexture, m_activeUnit != unit)) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        m_activeUnit = unit;
+    }
+}
+
+void GLStateCache::bindTexture(int unit, GLenum target, GLuint texture) {
+    int slot = textureSlot(target);
+    if (slot < 0 || unit < 0 || unit >= kTextureUnits) {
+        activeTexture(unit);
+        glBindTexture(target, texture);
+        return;
+    }
+    
+    // Callers expect glTex* calls to reach this unit afterwards, so the
+    // active unit is switched even when the bind itself is elided
+    activeTexture(unit);
+    if (track(Texture, m_textures[unit][slot] != texture)) {
+        glBindTexture(target, texture);
+        m_textures[unit][slot] = texture;
+    }
+}
+
+void GLStateCache::setBlend(bool enabled) {
+    if (track(BlendEnable, m_blendEnabled != (enabled ? 1 : 0))) {
+        if (enabled) {
+            glEnable(GL_BLEND);
+        } else {
+            glDisable(GL_BLEND);
+        }
+        m_blendEnabled = enabled ? 1 : 0;
+    }
+}
+
+void GLStateCache::blendFunc(GLenum source, GLenum destination) {
+    blendFuncSeparate(source, destination, source, destination);
+}
+
+void GLStateCache::blendFuncSeparate(GLenum sourceColor, GLenum destinationColor,
+                                     GLenum sourceAlpha, GLenum destinationAlpha) {
+    bool changed = m_blendFunc[0] != sourceColor || m_blendFunc[1] != destinationColor
+        || m_blendFunc[2] != sourceAlpha || m_blendFunc[3] != destinationAlpha;
+    if (track(BlendFunc, changed)) {
+        glBlendFuncSeparate(sourceColor, destinationColor, sourceAlpha, destinationAlpha);
+        m_blendFunc[0] = sourceColor;
+        m_blendFunc[1] = destinationColor;
+        m_blendFunc[2] = sourceAlpha;
+        m_blendFunc[3] = destinationAlpha;
+    }
+}
+
+void GLStateCache::blendEquation(GLenum mode) {
+    if (track(BlendEquation, m_blendEquation != mode)) {
+        glBlendEquation(mode);
+        m_blendEquation = mode;
+    }
+}
+
+void GLStateCache::clearColor(float r, float g, float b, float a) {
+    bool changed = !m_clearColorKnown || m_clearColor[0] != r || m_clearColor[1] != g
+        || m_clearColor[2] != b || m_clearColor[3] != a;
+    if (track(ClearColor, changed)) {
+        glClearColor(r, g, b, a);
+        m_clearColor[0] = r;
+        m_clearColor[1] = g;
+        m_clearColor[2] = b;
+        m_clearColor[3] = a;
+        m_clearColorKnown = true;
+    }
+}
+
+void GLStateCache::setStencilTest(bool enabled) {
+    if (track(StencilTest, m_stencilEnabled != (enabled ? 1 : 0))) {
+        if (enabled) {
+            glEnable(GL_STENCIL_TEST);
+        } else {
+            glDisable(GL_STENCIL_TEST);
+        }
+        m_stencilEnabled = enabled ? 1 : 0;
+    }
+}
+
+void GLStateCache::stencilFunc(GLenum func, GLint ref, GLuint mask) {
+    bool changed = m_stencilFunc != func || m_stencilRef != ref || m_stencilMask != mask;
+    if (track(StencilFunc, changed)) {
+        glStencilFunc(func, ref, mask);
+        m_stencilFunc = func;
+        m_stencilRef = ref;
+        m_stencilMask = mask;
+    }
+}
+
+void GLStateCache::stencilOp(GLenum stencilFail, GLenum depthFail, GLenum pass) {
+    bool changed = m_stencilOp[0] != stencilFail || m_stencilOp[1] != depthFail || m_stencilOp[2] != pass;
+    if (track(StencilOp, changed)) {
+        glStencilOp(stencilFail, depthFail, pass);
+        m_stencilOp[0] = stencilFail;
+        m_stencilOp[1] = depthFail;
+        m_stencilOp[2] = pass;
+    }
+}
+
+void GLStateCache::deleteTexture(GLuint& texture) {
+    if (!texture) {
+        return;
+    }
+    for (auto& unit : m_textures) {
+        for (GLuint& bound : unit) {
+            if (bound == texture) {
+                bound = 0;
+            }
+        }
+    }
+    glDeleteTextures(1, &texture);
+    texture = 0;
+}
+
+void GLStateCache::deleteFramebuffer(GLuint& framebuffer) {
+    if (!framebuffer) {
+        return;
+    }
+    if (m_drawFramebuffer == framebuffer) m_drawFramebuffer = 0;
+    if (m_readFramebuffer == framebuffer) m_readFramebuffer = 0;
+    glDeleteFramebuffers(1, &framebuffer);
+    framebuffer = 0;
+}
+
+void GLStateCache::deleteVertexArray(GLuint& vertexArray) {
+    if (!vertexArray) {
+        return;
+    }
+    if (m_vertexArray == vertexArray) m_vertexArray = 0;
+    glDeleteVertexArrays(1, &vertexArray);
+    vertexArray = 0;
+}
+
+void GLStateCache::deleteBuffer(GLuint& buffer) {
+    if (!buffer) {
+        return;
+    }
+    if (m_arrayBuffer == buffer) m_arrayBuffer = 0;
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
+
+bool GLStateCache::validate() const {
+    bool valid = true;
+    auto check = [&valid](Counter counter, bool known, bool matches) {
+        if (known && !matches) {
+            std::cerr << "GL state cache out of sync: " << kCounterNames[counter] << std::endl;
+            valid = false;
+        }
+    };
+    
+    check(Framebuffer, m_drawFramebuffer != kUnknownName,
+          getBinding(GL_DRAW_FRAMEBUFFER_BINDING) == m_drawFramebuffer);
+    check(Framebuffer, m_readFramebuffer != kUnknownName,
+          getBinding(GL_READ_FRAMEBUFFER_BINDING) == m_readFramebuffer);
+          
+    GLint viewport[4] = {};
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    check(Viewport, m_viewportKnown, std::equal(viewport, viewport + 4, m_viewport));
+    
+    check(Program, m_program != kUnknownName, getBinding(GL_CURRENT_PROGRAM) == m_program);
+    check(VertexArray, m_vertexArray != kUnknownName, getBinding(GL_VERTEX_ARRAY_BINDING) == m_vertexArray);
+    check(ArrayBuffer, m_arrayBuffer != kUnknownName, getBinding(GL_ARRAY_BUFFER_BINDING) == m_arrayBuffer);
+    
+    GLuint activeUnit = getBinding(GL_ACTIVE_TEXTURE) - GL_TEXTURE0;
+    check(ActiveTexture, m_activeUnit >= 0, activeUnit == static_cast<GLuint>(m_activeUnit));
+    
+    // Walk the units, then put the active unit back
+    for (int unit = 0; unit < kTextureUnits; unit++) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        check(Texture, m_textures[unit][Texture2D] != kUnknownName,
+              getBinding(GL_TEXTURE_BINDING_2D) == m_textures[unit][Texture2D]);
+        check(Texture, m_textures[unit][Texture2DArray] != kUnknownName,
+              getBinding(GL_TEXTURE_BINDING_2D_ARRAY) == m_textures[unit][Texture2DArray]);
+    }
+    glActiveTexture(GL_TEXTURE0 + activeUnit);
+    
+    check(BlendEnable, m_blendEnabled >= 0, (glIsEnabled(GL_BLEND) == GL_TRUE) == (m_blendEnabled == 1));
+    const GLenum blendQueries[4] = { GL_BLEND_SRC_RGB, GL_BLEND_DST_RGB, GL_BLEND_SRC_ALPHA, GL_BLEND_DST_ALPHA };
+    for (int i = 0; i < 4; i++) {
+        check(BlendFunc, m_blendFunc[i] != kUnknownEnum, getBinding(blendQueries[i]) == m_blendFunc[i]);
+    }
+    check(BlendEquation, m_blendEquation != kUnknownEnum,
+          getBinding(GL_BLEND_EQUATION_RGB) == m_blendEquation
+          && getBinding(GL_BLEND_EQUATION_ALPHA) == m_blendEquation);
+          
+    float clearColor[4] = {};
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+    check(ClearColor, m_clearColorKnown, std::equal(clearColor, clearColor + 4, m_clearColor));
+    
+    check(StencilTest, m_stencilEnabled >= 0, (glIsEnabled(GL_STENCIL_TEST) == GL_TRUE) == (m_stencilEnabled == 1));
+    check(StencilFunc, m_stencilFunc != kUnknownEnum,
+          getBinding(GL_STENCIL_FUNC) == m_stencilFunc
+          && static_cast<GLint>(getBinding(GL_STENCIL_REF)) == m_stencilRef
+          && getBinding(GL_STENCIL_VALUE_MASK) == m_stencilMask);
+    check(StencilOp, m_stencilOp[0] != kUnknownEnum,
+          getBinding(GL_STENCIL_FAIL) == m_stencilOp[0]
+          && getBinding(GL_STENCIL_PASS_DEPTH_FAIL) == m_stencilOp[1]
+          && getBinding(GL_STENCIL_PASS_DEPTH_PASS) == m_stencilOp[2]);
+          
+    return valid;
+}
+
+} // namespace Acute
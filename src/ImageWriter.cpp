@@ -0,0 +1,135 @@
+#include "ImageWriter.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+namespace Acute {
+
+namespace {
+
+uint32_t crcTable[256];
+bool crcTableReady = false;
+
+void buildCrcTable() {
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        crcTable[n] = c;
+    }
+    crcTableReady = true;
+}
+
+uint32_t updateCrc(uint32_t crc, const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+void appendBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+void writeChunk(FILE* file, const char* type, const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> header;
+    appendBigEndian(header, static_cast<uint32_t>(data.size()));
+    header.insert(header.end(), type, type + 4);
+    
+    uint32_t crc = updateCrc(0xFFFFFFFFu, header.data() + 4, 4);
+    crc = updateCrc(crc, data.data(), data.size()) ^ 0xFFFFFFFFu;
+    
+    std::vector<uint8_t> footer;
+    appendBigEndian(footer, crc);
+    
+    fwrite(header.data(), 1, header.size(), file);
+    if (!data.empty()) {
+        fwrite(data.data(), 1, data.size(), file);
+    }
+    fwrite(footer.data(), 1, footer.size(), file);
+}
+
+} // namespace
+
+bool writePng(const std::string& path, const uint8_t* rgba, int width, int height) {
+    if (!crcTableReady) {
+        buildCrcTable();
+    }
+    
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        std::cerr << "Failed to write image: " << path << std::endl;
+        return false;
+    }
+    
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    fwrite(signature, 1, sizeof(signature), file);
+    
+    std::vector<uint8_t> header;
+    appendBigEndian(header, static_cast<uint32_t>(width));
+    appendBigEndian(header, static_cast<uint32_t>(height));
+    header.push_back(8);    // Bit depth
+    header.push_back(6);    // Color type RGBA
+    header.push_back(0);    // Compression
+    header.push_back(0);    // Filter
+    header.push_back(0);    // Interlace
+    writeChunk(file, "IHDR", header);
+    
+    // Filtered scanlines: a filter byte (0 = none) followed by the row
+    const size_t rowBytes = static_cast<size_t>(width) * 4;
+    std::vector<uint8_t> raw;
+    raw.reserve((rowBytes + 1) * height);
+    for (int y = 0; y < height; y++) {
+        raw.push_back(0);
+        const uint8_t* row = rgba + rowBytes * y;
+        raw.insert(raw.end(), row, row + rowBytes);
+    }
+    
+    // zlib stream of stored deflate blocks (at most 65535 bytes each)
+    std::vector<uint8_t> compressed;
+    compressed.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+    compressed.push_back(0x78);
+    compressed.push_back(0x01);
+    size_t offset = 0;
+    do {
+        size_t length = std::min<size_t>(raw.size() - offset, 65535);
+        bool last = (offset + length == raw.size());
+        compressed.push_back(last ? 1 : 0);
+        compressed.push_back(static_cast<uint8_t>(length));
+        compressed.push_back(static_cast<uint8_t>(length >> 8));
+        compressed.push_back(static_cast<uint8_t>(~length));
+        compressed.push_back(static_cast<uint8_t>(~length >> 8));
+        compressed.insert(compressed.end(), raw.begin() + offset, raw.begin() + offset + length);
+        offset += length;
+    } while (offset < raw.size());
+    
+    // Adler-32; 5552 bytes is the longest run before b can overflow
+    uint32_t a = 1, b = 0;
+    for (size_t begin = 0; begin < raw.size(); begin += 5552) {
+        size_t end = std::min(raw.size(), begin + 5552);
+        for (size_t i = begin; i < end; i++) {
+            a += raw[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    appendBigEndian(compressed, (b << 16) | a);
+    writeChunk(file, "IDAT", compressed);
+    
+    writeChunk(file, "IEND", std::vector<uint8_t>());
+    
+    bool ok = (ferror(file) == 0);
+    fclose(file);
+    if (!ok) {
+        std::cerr << "Failed to write image: " << path << std::endl;
+    }
+    return ok;
+}
+
+} // namespace Acute
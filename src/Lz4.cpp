@@ -0,0 +1,183 @@
+#include "Lz4.h"
+#include <algorithm>
+#include <cstring>
+
+namespace Acute {
+
+namespace {
+
+// Format limits: matches are at least 4 bytes and reach back at most 64 KiB;
+// the last match starts 12 bytes before the end and the last 5 bytes are
+// always literals
+constexpr size_t kMinMatch = 4;
+constexpr size_t kMaxOffset = 65535;
+constexpr size_t kMatchStartLimit = 12;
+constexpr size_t kLastLiterals = 5;
+
+constexpr int kHashBits = 13;
+
+uint32_t read32(const uint8_t* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+uint32_t hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - kHashBits);
+}
+
+// Lengths of 15 and more spill into following bytes, 255 at a time
+uint8_t* writeLength(uint8_t* op, size_t length) {
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = static_cast<uint8_t>(length);
+    return op;
+}
+
+bool readLength(const uint8_t*& ip, const uint8_t* end, size_t& length) {
+    uint8_t byte;
+    do {
+        if (ip >= end) {
+            return false;
+        }
+        byte = *ip++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+// Token, literals and (unless last) the match; nullptr if dst is too small
+uint8_t* writeSequence(uint8_t* op, uint8_t* opEnd, const uint8_t* literals, size_t literalLength,
+                       size_t offset, size_t matchLength, bool last) {
+    size_t worst = 1 + literalLength / 255 + 1 + literalLength + (last ? 0 : 2 + matchLength / 255 + 1);
+    if (worst > static_cast<size_t>(opEnd - op)) {
+        return nullptr;
+    }
+    
+    uint8_t* token = op++;
+    *token = static_cast<uint8_t>(literalLength >= 15 ? 15 << 4 : literalLength << 4);
+    if (literalLength >= 15) {
+        op = writeLength(op, literalLength - 15);
+    }
+    std::memcpy(op, literals, literalLength);
+    op += literalLength;
+    if (last) {
+        return op;
+    }
+    
+    *op++ = static_cast<uint8_t>(offset);
+    *op++ = static_cast<uint8_t>(offset >> 8);
+    size_t code = matchLength - kMinMatch;
+    *token |= static_cast<uint8_t>(code >= 15 ? 15 : code);
+    if (code >= 15) {
+        op = writeLength(op, code - 15);
+    }
+    return op;
+}
+
+} // namespace
+
+size_t lz4CompressBound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+size_t lz4Compress(const uint8_t* src, size_t size, uint8_t* dst, size_t capacity) {
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* const end = src + size;
+    uint8_t* op = dst;
+    uint8_t* const opEnd = dst + capacity;
+    
+    if (size > kMatchStartLimit) {
+        // Positions are offsets from src; a stale or colliding entry is caught
+        // by comparing the bytes
+        uint32_t table[1 << kHashBits] = {};
+        const uint8_t* const matchStartEnd = end - kMatchStartLimit;
+        const uint8_t* const matchEnd = end - kLastLiterals;
+        
+        while (ip < matchStartEnd) {
+            uint32_t sequence = read32(ip);
+            uint32_t& slot = table[hash(sequence)];
+            const uint8_t* ref = src + slot;
+            slot = static_cast<uint32_t>(ip - src);
+            
+            if (ref >= ip || static_cast<size_t>(ip - ref) > kMaxOffset || read32(ref) != sequence) {
+                // Step faster through data that keeps not matching
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+            
+            size_t length = kMinMatch;
+            while (ip + length < matchEnd && ref[length] == ip[length]) {
+                length++;
+            }
+            op = writeSequence(op, opEnd, anchor, static_cast<size_t>(ip - anchor),
+                               static_cast<size_t>(ip - ref), length, false);
+            if (!op) {
+                return 0;
+            }
+            ip += length;
+            anchor = ip;
+        }
+    }
+    
+    op = writeSequence(op, opEnd, anchor, static_cast<size_t>(end - anchor), 0, 0, true);
+    return op ? static_cast<size_t>(op - dst) : 0;
+}
+
+bool lz4Decompress(const uint8_t* src, size_t size, uint8_t* dst, size_t outputSize) {
+    const uint8_t* ip = src;
+    const uint8_t* const end = src + size;
+    uint8_t* op = dst;
+    uint8_t* const opEnd = dst + outputSize;
+    
+    while (ip < end) {
+        uint8_t token = *ip++;
+        
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !readLength(ip, end, literalLength)) {
+            return false;
+        }
+        if (literalLength > static_cast<size_t>(end - ip) || literalLength > static_cast<size_t>(opEnd - op)) {
+            return false;
+        }
+        std::memcpy(op, ip, literalLength);
+        op += literalLength;
+        ip += literalLength;
+        if (ip == end) {
+            break;
+        }
+        
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > static_cast<size_t>(op - dst)) {
+            return false;
+        }
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !readLength(ip, end, matchLength)) {
+            return false;
+        }
+        matchLength += kMinMatch;
+        if (matchLength > static_cast<size_t>(opEnd - op)) {
+            return false;
+        }
+        
+        // Overlapping matches repeat the last `offset` bytes. The copied span
+        // doubles each pass since it stays a whole number of periods.
+        const uint8_t* match = op - offset;
+        while (matchLength > 0) {
+            size_t chunk = std::min(matchLength, static_cast<size_t>(op - match));
+            std::memcpy(op, match, chunk);
+            op += chunk;
+            matchLength -= chunk;
+        }
+    }
+    return op == opEnd;
+}
+
+} // namespace Acute
@@ -0,0 +1,277 @@
+#include "RTree.h"
+#include <algorithm>
+
+namespace Acute {
+
+Box Box::merged(const Box& other) const {
+    return { std::min(minX, other.minX), std::min(minY, other.minY),
+             std::max(maxX, other.maxX), std::max(maxY, other.maxY) };
+}
+
+RTree::RTree()
+    : m_root(0)
+    , m_size(0)
+{
+    clear();
+}
+
+void RTree::clear() {
+    m_nodes.clear();
+    m_freeNodes.clear();
+    m_size = 0;
+    m_root = allocateNode(true);
+}
+
+uint32_t RTree::allocateNode(bool leaf) {
+    uint32_t index;
+    if (!m_freeNodes.empty()) {
+        index = m_freeNodes.back();
+        m_freeNodes.pop_back();
+    } else {
+        index = static_cast<uint32_t>(m_nodes.size());
+        m_nodes.emplace_back();
+    }
+    m_nodes[index].leaf = leaf;
+    m_nodes[index].count = 0;
+    return index;
+}
+
+Box RTree::nodeBounds(uint32_t node) const {
+    const Node& n = m_nodes[node];
+    Box bounds = n.boxes[0];
+    for (int i = 1; i < n.count; i++) {
+        bounds = bounds.merged(n.boxes[i]);
+    }
+    return bounds;
+}
+
+Box RTree::getBounds() const {
+    return nodeBounds(m_root);
+}
+
+void RTree::insert(const Box& box, uint32_t value) {
+    int64_t sibling = insertInto(m_root, box, value);
+    if (sibling >= 0) {
+        // The root split: grow the tree by one level
+        uint32_t oldRoot = m_root;
+        uint32_t newRoot = allocateNode(false);
+        Node& root = m_nodes[newRoot];
+        root.count = 2;
+        root.boxes[0] = nodeBounds(oldRoot);
+        root.items[0] = oldRoot;
+        root.boxes[1] = nodeBounds(static_cast<uint32_t>(sibling));
+        root.items[1] = static_cast<uint32_t>(sibling);
+        m_root = newRoot;
+    }
+    m_size++;
+}
+
+int64_t RTree::insertInto(uint32_t node, const Box& box, uint32_t value) {
+    if (m_nodes[node].leaf) {
+        Node& n = m_nodes[node];
+        n.boxes[n.count] = box;
+        n.items[n.count] = value;
+        n.count++;
+    } else {
+        // Child needing the least enlargement, then the smallest
+        const Node& n = m_nodes[node];
+        int best = 0;
+        float bestGrowth = 0.0f, bestArea = 0.0f;
+        for (int i = 0; i < n.count; i++) {
+            float area = n.boxes[i].area();
+            float growth = n.boxes[i].merged(box).area() - area;
+            if (i == 0 || growth < bestGrowth || (growth == bestGrowth && area < bestArea)) {
+                best = i;
+                bestGrowth = growth;
+                bestArea = area;
+            }
+        }
+        
+        uint32_t child = n.items[best];
+        int64_t sibling = insertInto(child, box, value);
+        
+        // Re-fetch: the recursion may have grown the node array
+        Node& parent = m_nodes[node];
+        parent.boxes[best] = parent.boxes[best].merged(box);
+        if (sibling >= 0) {
+            parent.boxes[best] = nodeBounds(child);
+            parent.boxes[parent.count] = nodeBounds(static_cast<uint32_t>(sibling));
+            parent.items[parent.count] = static_cast<uint32_t>(sibling);
+            parent.count++;
+        }
+    }
+    
+    if (m_nodes[node].count > kMaxEntries) {
+        return split(node);
+    }
+    return -1;
+}
+
+uint32_t RTree::split(uint32_t node) {
+    uint32_t siblingIndex = allocateNode(m_nodes[node].leaf);
+    Node& n = m_nodes[node];
+    Node& sibling = m_nodes[siblingIndex];
+    
+    const int total = n.count;
+    Box boxes[kMaxEntries + 1];
+    uint32_t items[kMaxEntries + 1];
+    std::copy(n.boxes, n.boxes + total, boxes);
+    std::copy(n.items, n.items + total, items);
+    
+    // Seeds: the pair that would waste the most area together
+    int seedA = 0, seedB = 1;
+    float worst = -1.0f;
+    for (int i = 0; i < total; i++) {
+        for (int j = i + 1; j < total; j++) {
+            float waste = boxes[i].merged(boxes[j]).area() - boxes[i].area() - boxes[j].area();
+            if (waste > worst) {
+                worst = waste;
+                seedA = i;
+                seedB = j;
+            }
+        }
+    }
+    
+    bool assigned[kMaxEntries + 1] = {};
+    n.count = 0;
+    sibling.count = 0;
+    auto assign = [&](Node& group, Box& bounds, int entry) {
+        bounds = group.count == 0 ? boxes[entry] : bounds.merged(boxes[entry]);
+        group.boxes[group.count] = boxes[entry];
+        group.items[group.count] = items[entry];
+        group.count++;
+        assigned[entry] = true;
+    };
+    
+    Box boundsA{}, boundsB{};
+    assign(n, boundsA, seedA);
+    assign(sibling, boundsB, seedB);
+    
+    int remaining = total - 2;
+    while (remaining > 0) {
+        // A group that needs every remaining entry to reach the minimum takes them
+        if (n.count + remaining <= kMinEntries || sibling.count + remaining <= kMinEntries) {
+            Node& group = n.count + remaining <= kMinEntries ? n : sibling;
+            Box& bounds = &group == &n ? boundsA : boundsB;
+            for (int i = 0; i < total; i++) {
+                if (!assigned[i]) {
+                    assign(group, bounds, i);
+                }
+            }
+            break;
+        }
+        
+        // Next: the entry with the strongest preference for one group
+        int next = -1;
+        float nextPreference = -1.0f, growthA = 0.0f, growthB = 0.0f;
+        for (int i = 0; i < total; i++) {
+            if (assigned[i]) {
+                continue;
+            }
+            float a = boundsA.merged(boxes[i]).area() - boundsA.area();
+            float b = boundsB.merged(boxes[i]).area() - boundsB.area();
+            float preference = a > b ? a - b : b - a;
+            if (preference > nextPreference) {
+                next = i;
+                nextPreference = preference;
+                growthA = a;
+                growthB = b;
+            }
+        }
+        
+        bool toA = growthA < growthB
+            || (growthA == growthB && (boundsA.area() < boundsB.area()
+                || (boundsA.area() == boundsB.area() && n.count <= sibling.count)));
+        if (toA) {
+            assign(n, boundsA, next);
+        } else {
+            assign(sibling, boundsB, next);
+        }
+        remaining--;
+    }
+    return siblingIndex;
+}
+
+bool RTree::remove(const Box& box, uint32_t value) {
+    if (!removeFrom(m_root, box, value)) {
+        return false;
+    }
+    m_size--;
+    
+    // Drop roots with a single child
+    while (!m_nodes[m_root].leaf && m_nodes[m_root].count == 1) {
+        uint32_t child = m_nodes[m_root].items[0];
+        m_freeNodes.push_back(m_root);
+        m_root = child;
+    }
+    if (!m_nodes[m_root].leaf && m_nodes[m_root].count == 0) {
+        m_nodes[m_root].leaf = true;
+    }
+    return true;
+}
+
+bool RTree::removeFrom(uint32_t node, const Box& box, uint32_t value) {
+    Node& n = m_nodes[node];
+    if (n.leaf) {
+        for (int i = 0; i < n.count; i++) {
+            if (n.items[i] == value) {
+                n.count--;
+                n.boxes[i] = n.boxes[n.count];
+                n.items[i] = n.items[n.count];
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    for (int i = 0; i < n.count; i++) {
+        if (!n.boxes[i].intersects(box)) {
+            continue;
+        }
+        uint32_t child = n.items[i];
+        if (!removeFrom(child, box, value)) {
+            continue;
+        }
+        if (m_nodes[child].count == 0) {
+            m_freeNodes.push_back(child);
+            n.count--;
+            n.boxes[i] = n.boxes[n.count];
+            n.items[i] = n.items[n.count];
+        } else {
+            n.boxes[i] = nodeBounds(child);
+        }
+        return true;
+    }
+    return false;
+}
+
+void RTree::query(const Box& box, std::vector<uint32_t>& values) const {
+    if (m_size == 0) {
+        return;
+    }
+    
+    // Height stays below 13 for 2^32 entries (nodes split at 17, halves hold
+    // at least 6), and each level pushes at most kMaxEntries children
+    uint32_t stack[256];
+    int top = 0;
+    stack[top++] = m_root;
+    while (top > 0) {
+        const Node& n = m_nodes[stack[--top]];
+        for (int i = 0; i < n.count; i++) {
+            if (!n.boxes[i].intersects(box)) {
+                continue;
+            }
+            if (n.leaf) {
+                values.push_back(n.items[i]);
+            } else {
+                stack[top++] = n.items[i];
+            }
+        }
+    }
+}
+
+void RTree::queryPoint(float x, float y, std::vector<uint32_t>& values) const {
+    query({ x, y, x, y }, values);
+}
+
+} // namespace Acute
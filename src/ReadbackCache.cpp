@@ -0,0 +1,285 @@
+#include "ReadbackCache.h"
+#include "GLStateCache.h"
+#include "TileResidency.h"
+#include <algorithm>
+#include <cstring>
+
+namespace Acute {
+
+ReadbackCache::ReadbackCache(GLStateCache& state)
+    : m_state(state)
+    , m_framebuffer(0)
+    , m_residency(nullptr)
+    , m_width(0)
+    , m_height(0)
+    , m_tilesX(0)
+    , m_tilesY(0)
+    , m_frameBudget(4u << 20)
+    , m_maxDeferral(UINT64_MAX)
+    , m_frame(1)
+    , m_nextStale(0)
+    , m_refreshedCount(0)
+    , m_readbacks{}
+    , m_storedX(-1)
+    , m_storedY(-1)
+    , m_stats{}
+{
+    for (auto& readback : m_readbacks) {
+        readback.tile = -1;
+    }
+}
+
+ReadbackCache::~ReadbackCache() {
+    for (auto& readback : m_readbacks) {
+        if (readback.tile >= 0) {
+            glDeleteSync(readback.fence);
+        }
+        m_state.deleteBuffer(readback.buffer);
+    }
+}
+
+void ReadbackCache::initialize(GLuint framebuffer, int width, int height, const TileResidency* residency) {
+    m_framebuffer = framebuffer;
+    m_residency = residency;
+    m_width = width;
+    m_height = height;
+    m_tilesX = (width + kTileSize - 1) / kTileSize;
+    m_tilesY = (height + kTileSize - 1) / kTileSize;
+    m_pixels.assign(static_cast<size_t>(width) * height * 4, 0);
+    m_tiles.assign(static_cast<size_t>(m_tilesX) * m_tilesY, Tile{ TileState::Stale, 1, 0, 0, m_frame });
+    m_nextStale = 0;
+    m_refreshed.assign(m_tiles.size(), 0);
+    m_refreshedCount = 0;
+    m_stats = Stats{};
+    m_stats.staleTiles = m_tiles.size();
+    
+    const size_t tileBytes = static_cast<size_t>(kTileSize) * kTileSize * 4;
+    for (auto& readback : m_readbacks) {
+        if (readback.tile >= 0) {
+            glDeleteSync(readback.fence);
+            readback.tile = -1;
+        }
+        if (!readback.buffer) {
+            glGenBuffers(1, &readback.buffer);
+            m_state.bindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, tileBytes, nullptr, GL_STREAM_READ);
+        }
+    }
+    m_state.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    
+    if (m_residency) {
+        m_stored.resize(static_cast<size_t>(TileResidency::kTileSize) * TileResidency::kTileSize * 4);
+    }
+}
+
+void ReadbackCache::markDirty(int x0, int y0, int x1, int y1) {
+    int tx0 = std::max(0, x0 / kTileSize), ty0 = std::max(0, y0 / kTileSize);
+    int tx1 = std::min(m_tilesX, (x1 + kTileSize - 1) / kTileSize);
+    int ty1 = std::min(m_tilesY, (y1 + kTileSize - 1) / kTileSize);
+    for (int ty = ty0; ty < ty1; ty++) {
+        for (int tx = tx0; tx < tx1; tx++) {
+            Tile& tile = m_tiles[ty * m_tilesX + tx];
+            if (tile.state == TileState::Fresh) {
+                m_stats.staleTiles++;
+                tile.staleSince = m_frame;
+            }
+            // A copy in flight is from before the change; it still lands, as
+            // it is newer than the mirror, but leaves the tile stale
+            tile.state = TileState::Stale;
+            tile.generation++;
+            tile.lastDirty = m_frame;
+        }
+    }
+}
+
+void ReadbackCache::markAllDirty() {
+    markDirty(0, 0, m_width, m_height);
+}
+
+void ReadbackCache::update() {
+    finishReadbacks(false);
+    
+    // Tiles drawn on this frame will likely be drawn on again next frame
+    size_t budget = m_frameBudget;
+    const size_t tileBytes = static_cast<size_t>(kTileSize) * kTileSize * 4;
+    m_storedX = m_storedY = -1;
+    for (size_t visited = 0; visited < m_tiles.size() && m_stats.staleTiles > 0 && budget >= tileBytes; visited++) {
+        size_t index = m_nextStale;
+        m_nextStale = (m_nextStale + 1) % m_tiles.size();
+        const Tile& tile = m_tiles[index];
+        if (tile.state != TileState::Stale
+            || (tile.lastDirty >= m_frame && m_frame - tile.staleSince < m_maxDeferral)) {
+            continue;
+        }
+        if (!beginReadback(static_cast<int>(index))) {
+            // Out of slots; resume here next frame
+            m_nextStale = index;
+            break;
+        }
+        budget -= tileBytes;
+    }
+    m_frame++;
+}
+
+void ReadbackCache::finish() {
+    m_storedX = m_storedY = -1;
+    while (m_stats.staleTiles > 0) {
+        for (size_t index = 0; index < m_tiles.size(); index++) {
+            if (m_tiles[index].state == TileState::Stale && !beginReadback(static_cast<int>(index))) {
+                break;
+            }
+        }
+        if (m_stats.staleTiles > 0) {
+            finishReadbacks(true);
+        }
+    }
+}
+
+bool ReadbackCache::takeRefreshed(std::vector<int>& tiles) {
+    tiles.clear();
+    if (m_refreshedCount == 0) {
+        return false;
+    }
+    for (size_t index = 0; index < m_refreshed.size(); index++) {
+        if (m_refreshed[index]) {
+            m_refreshed[index] = 0;
+            tiles.push_back(static_cast<int>(index));
+        }
+    }
+    m_refreshedCount = 0;
+    return true;
+}
+
+void ReadbackCache::getTileRect(int index, int& x0, int& y0, int& x1, int& y1) const {
+    x0 = (index % m_tilesX) * kTileSize;
+    y0 = (index / m_tilesX) * kTileSize;
+    x1 = std::min(m_width, x0 + kTileSize);
+    y1 = std::min(m_height, y0 + kTileSize);
+}
+
+bool ReadbackCache::beginReadback(int index) {
+    Tile& tile = m_tiles[index];
+    if (readStored(index)) {
+        tile.state = TileState::Fresh;
+        tile.landed = tile.generation;
+        m_stats.staleTiles--;
+        m_stats.tilesFromStore++;
+        markRefreshed(index);
+        return true;
+    }
+    
+    int slot = -1;
+    for (int i = 0; i < kReadbackSlots && slot < 0; i++) {
+        slot = m_readbacks[i].tile < 0 ? i : -1;
+    }
+    if (slot < 0) {
+        return false;
+    }
+    
+    // Framebuffer rows are bottom up
+    int x0, y0, x1, y1;
+    getTileRect(index, x0, y0, x1, y1);
+    Readback& readback = m_readbacks[slot];
+    m_state.bindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+    m_state.bindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    glReadPixels(x0, m_height - y1, x1 - x0, y1 - y0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    m_state.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.tile = index;
+    readback.generation = tile.generation;
+    tile.state = TileState::Pending;
+    return true;
+}
+
+void ReadbackCache::finishReadbacks(bool wait) {
+    if (wait) {
+        // Any pending copy will do; the first one found was not necessarily
+        // issued first, but all of them are on their way
+        for (auto& readback : m_readbacks) {
+            if (readback.tile >= 0) {
+                while (glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000)
+                       == GL_TIMEOUT_EXPIRED) {
+                }
+                break;
+            }
+        }
+    }
+    
+    for (auto& readback : m_readbacks) {
+        if (readback.tile < 0 || glClientWaitSync(readback.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            continue;
+        }
+        glDeleteSync(readback.fence);
+        int index = readback.tile;
+        readback.tile = -1;
+        // Copies can land out of order; never replace a newer one
+        Tile& tile = m_tiles[index];
+        if (readback.generation <= tile.landed) {
+            continue;
+        }
+        
+        int x0, y0, x1, y1;
+        getTileRect(index, x0, y0, x1, y1);
+        const size_t rowBytes = static_cast<size_t>(x1 - x0) * 4;
+        m_state.bindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        auto* pixels = static_cast<const uint8_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, rowBytes * (y1 - y0),
+                                                                    GL_MAP_READ_BIT));
+        if (pixels) {
+            // The buffer's first row is the tile's bottom row
+            for (int y = y0; y < y1; y++) {
+                std::memcpy(m_pixels.data() + (static_cast<size_t>(y) * m_width + x0) * 4,
+                            pixels + static_cast<size_t>(y1 - 1 - y) * rowBytes, rowBytes);
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            m_stats.tilesReadBack++;
+            m_stats.bytesReadBack += rowBytes * (y1 - y0);
+            tile.landed = readback.generation;
+            markRefreshed(index);
+            if (tile.state == TileState::Pending && tile.generation == readback.generation) {
+                tile.state = TileState::Fresh;
+                m_stats.staleTiles--;
+            }
+        } else if (tile.generation == readback.generation) {
+            // Try again
+            tile.state = TileState::Stale;
+        }
+        m_state.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+}
+
+bool ReadbackCache::readStored(int index) {
+    if (!m_residency) {
+        return false;
+    }
+    int x0, y0, x1, y1;
+    getTileRect(index, x0, y0, x1, y1);
+    
+    // Residency tiles are in texels, rows bottom up; canvases under
+    // residency are whole residency tiles, so one holds this tile
+    const int size = TileResidency::kTileSize;
+    int texelY0 = m_height - y1;
+    int storedX = x0 / size * size, storedY = texelY0 / size * size;
+    if (storedX != m_storedX || storedY != m_storedY) {
+        if (!m_residency->readStored(storedX, storedY, m_stored.data())) {
+            return false;
+        }
+        m_storedX = storedX;
+        m_storedY = storedY;
+    }
+    const size_t rowBytes = static_cast<size_t>(x1 - x0) * 4;
+    for (int y = y0; y < y1; y++) {
+        int texelRow = m_height - 1 - y - storedY;
+        std::memcpy(m_pixels.data() + (static_cast<size_t>(y) * m_width + x0) * 4,
+                    m_stored.data() + (static_cast<size_t>(texelRow) * size + (x0 - storedX)) * 4, rowBytes);
+    }
+    return true;
+}
+
+void ReadbackCache::markRefreshed(int index) {
+    if (!m_refreshed[index]) {
+        m_refreshed[index] = 1;
+        m_refreshedCount++;
+    }
+}
+
+} // namespace Acute
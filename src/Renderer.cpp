@@ -11,8 +11,12 @@ Renderer::Renderer()
 Renderer::~Renderer() = default;
 
 bool Renderer::initialize() {
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    // The context was set up without the cache
+    m_state.invalidate();
+    
+    // Premultiplied alpha over
+    m_state.setBlend(true);
+    m_state.blendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
     return true;
 }
 
@@ -24,7 +28,7 @@ void Renderer::setClearColor(float r, float g, float b, float a) {
 }
 
 void Renderer::clear() {
-    glClearColor(m_clearColor[0], m_clearColor[1], m_clearColor[2], m_clearColor[3]);
+    m_state.clearColor(m_clearColor[0], m_clearColor[1], m_clearColor[2], m_clearColor[3]);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
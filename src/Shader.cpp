@@ -1,10 +1,29 @@
 #include "Shader.h"
+#include "GLStateCache.h"
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
 namespace Acute {
 
+const char* const kBlendFunctionSource = R"(
+        vec4 blendPremultiplied(vec4 src, vec4 dst, int mode) {
+            vec4 over = vec4(0.0, 0.0, 0.0, src.a + dst.a * (1.0 - src.a));
+            if (mode == 1) {
+                return dst * (1.0 - src.a);
+            } else if (mode == 2) {
+                over.rgb = src.rgb * dst.rgb + src.rgb * (1.0 - dst.a) + dst.rgb * (1.0 - src.a);
+            } else if (mode == 3) {
+                over.rgb = src.rgb + dst.rgb * (1.0 - src.rgb);
+            } else if (mode == 4) {
+                over.rgb = min(src.rgb + dst.rgb, vec3(1.0));
+            } else {
+                over.rgb = src.rgb + dst.rgb * (1.0 - src.a);
+            }
+            return over;
+        }
+)";
+
 Shader::Shader()
     : m_program(0)
 {
@@ -28,7 +47,7 @@ bool Shader::loadFromSource(const std::string& vertexSource, const std::string&
         return false;
     }
     
-    bool success = linkProgram(vertexShader, fragmentShader);
+    bool success = linkProgram({vertexShader, fragmentShader});
     
     glDeleteShader(vertexShader);
     glDeleteShader(fragmentShader);
@@ -36,6 +55,17 @@ bool Shader::loadFromSource(const std::string& vertexSource, const std::string&
     return success;
 }
 
+bool Shader::loadComputeFromSource(const std::string& computeSource) {
+    GLuint computeShader = compileShader(GL_COMPUTE_SHADER, computeSource);
+    if (computeShader == 0) {
+        return false;
+    }
+    
+    bool success = linkProgram({computeShader});
+    glDeleteShader(computeShader);
+    return success;
+}
+
 bool Shader::loadFromFile(const std::string& vertexPath, const std::string& fragmentPath) {
     // Read vertex shader
     std::ifstream vertexFile(vertexPath);
@@ -60,8 +90,8 @@ bool Shader::loadFromFile(const std::string& vertexPath, const std::string& frag
     return loadFromSource(vertexSource, fragmentSource);
 }
 
-void Shader::use() const {
-    glUseProgram(m_program);
+void Shader::use(GLStateCache& state) const {
+    state.useProgram(m_program);
 }
 
 void Shader::setInt(const std::string& name, int value) const {
@@ -88,6 +118,14 @@ void Shader::setMat4(const std::string& name, const float* value) const {
     glUniformMatrix4fv(glGetUniformLocation(m_program, name.c_str()), 1, GL_FALSE, value);
 }
 
+void Shader::setMat3x2Array(const std::string& name, const float* values, int count) const {
+    glUniformMatrix3x2fv(glGetUniformLocation(m_program, name.c_str()), count, GL_FALSE, values);
+}
+
+void Shader::setIntArray(const std::string& name, const int* values, int count) const {
+    glUniform1iv(glGetUniformLocation(m_program, name.c_str()), count, values);
+}
+
 GLuint Shader::compileShader(GLenum type, const std::string& source) {
     GLuint shader = glCreateShader(type);
     const char* src = source.c_str();
@@ -108,10 +146,11 @@ GLuint Shader::compileShader(GLenum type, const std::string& source) {
     return shader;
 }
 
-bool Shader::linkProgram(GLuint vertexShader, GLuint fragmentShader) {
+bool Shader::linkProgram(std::initializer_list<GLuint> shaders) {
     m_program = glCreateProgram();
-    glAttachShader(m_program, vertexShader);
-    glAttachShader(m_program, fragmentShader);
+    for (GLuint shader : shaders) {
+        glAttachShader(m_program, shader);
+    }
     glLinkProgram(m_program);
     
     // Check for linking errors
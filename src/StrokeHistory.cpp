@@ -0,0 +1,172 @@
+#include "StrokeHistory.h"
+#include "CpuCanvas.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Acute {
+
+namespace {
+
+// Squared distance from a point to the segment a-b
+float distanceSquaredToSegment(float px, float py, float ax, float ay, float bx, float by) {
+    float dx = bx - ax, dy = by - ay;
+    float lengthSquared = dx * dx + dy * dy;
+    float t = 0.0f;
+    if (lengthSquared > 0.0f) {
+        t = std::max(0.0f, std::min(1.0f, ((px - ax) * dx + (py - ay) * dy) / lengthSquared));
+    }
+    float cx = ax + t * dx - px, cy = ay + t * dy - py;
+    return cx * cx + cy * cy;
+}
+
+} // namespace
+
+StrokeHistory::StrokeHistory() = default;
+
+Box StrokeHistory::computeBounds(const std::vector<InputPoint>& points, const BrushSettings& settings) {
+    if (points.empty()) {
+        return { 0.0f, 0.0f, 0.0f, 0.0f };
+    }
+    Box bounds = { points[0].x, points[0].y, points[0].x, points[0].y };
+    for (const auto& point : points) {
+        bounds.minX = std::min(bounds.minX, point.x);
+        bounds.minY = std::min(bounds.minY, point.y);
+        bounds.maxX = std::max(bounds.maxX, point.x);
+        bounds.maxY = std::max(bounds.maxY, point.y);
+    }
+    float radius = BrushEngine::getMaxDabRadius(settings);
+    return { bounds.minX - radius, bounds.minY - radius, bounds.maxX + radius, bounds.maxY + radius };
+}
+
+uint32_t StrokeHistory::addStroke(std::vector<InputPoint> points, BrushSettingsPtr settings, uint32_t seed) {
+    StrokeRecord stroke;
+    stroke.bounds = computeBounds(points, *settings);
+    stroke.points = std::move(points);
+    stroke.settings = std::move(settings);
+    stroke.seed = seed;
+    stroke.removed = false;
+    
+    uint32_t id = static_cast<uint32_t>(m_strokes.size());
+    m_index.insert(stroke.bounds, id);
+    m_strokes.push_back(std::move(stroke));
+    return id;
+}
+
+Box StrokeHistory::setStrokeSettings(uint32_t id, BrushSettingsPtr settings) {
+    StrokeRecord& stroke = m_strokes[id];
+    Box dirty = stroke.bounds;
+    if (stroke.removed || !settings) {
+        return dirty;
+    }
+    
+    m_index.remove(stroke.bounds, id);
+    stroke.settings = std::move(settings);
+    stroke.bounds = computeBounds(stroke.points, *stroke.settings);
+    m_index.insert(stroke.bounds, id);
+    return dirty.merged(stroke.bounds);
+}
+
+Box StrokeHistory::removeStroke(uint32_t id) {
+    StrokeRecord& stroke = m_strokes[id];
+    if (!stroke.removed) {
+        m_index.remove(stroke.bounds, id);
+        stroke.removed = true;
+    }
+    return stroke.bounds;
+}
+
+void StrokeHistory::clear() {
+    m_strokes.clear();
+    m_index.clear();
+}
+
+void StrokeHistory::queryRegion(const Box& region, std::vector<uint32_t>& ids) const {
+    ids.clear();
+    m_index.query(region, ids);
+    std::sort(ids.begin(), ids.end());
+}
+
+void StrokeHistory::hitTest(float x, float y, float radius, std::vector<uint32_t>& ids) const {
+    ids.clear();
+    m_candidates.clear();
+    m_index.query({ x - radius, y - radius, x + radius, y + radius }, m_candidates);
+    
+    // Bounds only say the brush could reach; check the path itself
+    for (uint32_t id : m_candidates) {
+        const StrokeRecord& stroke = m_strokes[id];
+        float reach = radius + BrushEngine::getMaxDabRadius(*stroke.settings);
+        float reachSquared = reach * reach;
+        const auto& points = stroke.points;
+        bool hit = points.size() == 1
+            && distanceSquaredToSegment(x, y, points[0].x, points[0].y, points[0].x, points[0].y) <= reachSquared;
+        for (size_t i = 1; i < points.size() && !hit; i++) {
+            hit = distanceSquaredToSegment(x, y, points[i - 1].x, points[i - 1].y,
+                                           points[i].x, points[i].y) <= reachSquared;
+        }
+        if (hit) {
+            ids.push_back(id);
+        }
+    }
+    std::sort(ids.begin(), ids.end());
+}
+
+void StrokeHistory::replay(BrushEngine& engine, const StrokeRecord& stroke, float originX, float originY,
+                           float scale, std::vector<BrushDab>& dabs) const {
+    if (scale == 1.0f) {
+        engine.setBrushSettings(stroke.settings);
+    } else {
+        // Spacing is relative to size, so scaling the size keeps the dab pattern
+        BrushSettings scaled = *stroke.settings;
+        scaled.baseSize *= scale;
+        engine.setBrushSettings(scaled);
+    }
+    engine.setRandomSeed(stroke.seed);
+    
+    dabs.clear();
+    engine.beginStroke();
+    for (InputPoint point : stroke.points) {
+        point.x = (point.x - originX) * scale;
+        point.y = (point.y - originY) * scale;
+        auto pointDabs = engine.processInput(point);
+        dabs.insert(dabs.end(), pointDabs.begin(), pointDabs.end());
+    }
+    engine.endStroke();
+}
+
+void StrokeHistory::redrawRegion(BrushEngine& engine, CpuCanvas& canvas, const Box& region) const {
+    int x0 = static_cast<int>(std::floor(region.minX));
+    int y0 = static_cast<int>(std::floor(region.minY));
+    int x1 = static_cast<int>(std::ceil(region.maxX));
+    int y1 = static_cast<int>(std::ceil(region.maxY));
+    canvas.clearRect(x0, y0, x1, y1);
+    
+    std::vector<uint32_t> ids;
+    queryRegion(region, ids);
+    std::vector<BrushDab> dabs;
+    for (uint32_t id : ids) {
+        replay(engine, m_strokes[id], 0.0f, 0.0f, 1.0f, dabs);
+        for (const auto& dab : dabs) {
+            canvas.drawDabClipped(dab, x0, y0, x1, y1);
+        }
+    }
+}
+
+void StrokeHistory::rasterize(BrushEngine& engine, CpuCanvas& canvas, const Box& region, float scale) const {
+    std::vector<BrushDab> dabs;
+    collectDabs(engine, region, scale, dabs);
+    canvas.drawDabs(dabs);
+}
+
+void StrokeHistory::collectDabs(BrushEngine& engine, const Box& region, float scale,
+                                std::vector<BrushDab>& dabs) const {
+    dabs.clear();
+    std::vector<uint32_t> ids;
+    queryRegion(region, ids);
+    std::vector<BrushDab> strokeDabs;
+    for (uint32_t id : ids) {
+        replay(engine, m_strokes[id], region.minX, region.minY, scale, strokeDabs);
+        dabs.insert(dabs.end(), strokeDabs.begin(), strokeDabs.end());
+    }
+}
+
+} // namespace Acute
@@ -0,0 +1,123 @@
+#include "Symmetry.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace Acute {
+
+namespace {
+
+constexpr float kDegToRad = 3.14159265358979f / 180.0f;
+
+// Rotation (dab convention, see the dab shader) about a center, optionally
+// preceded by a reflection across the vertical axis
+SymmetryTransform makeTransform(float rotation, bool mirrored, float centerX, float centerY) {
+    const float c = std::cos(rotation * kDegToRad);
+    const float s = std::sin(rotation * kDegToRad);
+    
+    SymmetryTransform transform;
+    transform.m[0] = mirrored ? -c : c;
+    transform.m[1] = mirrored ? s : -s;
+    transform.m[2] = s;
+    transform.m[3] = c;
+    transform.m[4] = centerX - (transform.m[0] * centerX + transform.m[2] * centerY);
+    transform.m[5] = centerY - (transform.m[1] * centerX + transform.m[3] * centerY);
+    transform.rotation = rotation;
+    transform.mirrored = mirrored;
+    return transform;
+}
+
+SymmetryTransform makeTranslation(float x, float y) {
+    SymmetryTransform transform = makeTransform(0.0f, false, 0.0f, 0.0f);
+    transform.m[4] = x;
+    transform.m[5] = y;
+    return transform;
+}
+
+} // namespace
+
+std::vector<SymmetryTransform> Symmetry::buildTransforms(int canvasWidth, int canvasHeight) const {
+    const float cx = centerX >= 0.0f ? centerX : canvasWidth * 0.5f;
+    const float cy = centerY >= 0.0f ? centerY : canvasHeight * 0.5f;
+    
+    std::vector<SymmetryTransform> transforms;
+    transforms.push_back(makeTransform(0.0f, false, cx, cy));
+    
+    switch (mode) {
+        case SymmetryMode::None:
+            break;
+        case SymmetryMode::MirrorX:
+            transforms.push_back(makeTransform(0.0f, true, cx, cy));
+            break;
+        case SymmetryMode::MirrorY:
+            // A vertical flip is a horizontal one turned half way round
+            transforms.push_back(makeTransform(180.0f, true, cx, cy));
+            break;
+        case SymmetryMode::Radial: {
+            int count = std::max(2, std::min(kMaxTransforms, segments));
+            for (int i = 1; i < count; i++) {
+                transforms.push_back(makeTransform(360.0f * i / count, false, cx, cy));
+            }
+            break;
+        }
+        case SymmetryMode::Tiled:
+            for (int ty = -1; ty <= 1; ty++) {
+                for (int tx = -1; tx <= 1; tx++) {
+                    if (tx != 0 || ty != 0) {
+                        transforms.push_back(makeTranslation(static_cast<float>(tx * canvasWidth),
+                                                             static_cast<float>(ty * canvasHeight)));
+                    }
+                }
+            }
+            break;
+    }
+    return transforms;
+}
+
+BrushDab transformDab(const BrushDab& dab, const SymmetryTransform& transform) {
+    BrushDab copy = dab;
+    transform.apply(copy.x, copy.y);
+    copy.rotation = transform.mirrored ? transform.rotation - dab.rotation : transform.rotation + dab.rotation;
+    return copy;
+}
+
+bool parseSymmetry(const std::string& text, Symmetry& symmetry) {
+    std::string name = text;
+    int segments = symmetry.segments;
+    size_t colon = text.find(':');
+    if (colon != std::string::npos) {
+        name = text.substr(0, colon);
+        segments = std::atoi(text.c_str() + colon + 1);
+        if (name != "radial" || segments < 2 || segments > Symmetry::kMaxTransforms) {
+            return false;
+        }
+    }
+    
+    if (name == "none") {
+        symmetry.mode = SymmetryMode::None;
+    } else if (name == "mirror-x") {
+        symmetry.mode = SymmetryMode::MirrorX;
+    } else if (name == "mirror-y") {
+        symmetry.mode = SymmetryMode::MirrorY;
+    } else if (name == "radial") {
+        symmetry.mode = SymmetryMode::Radial;
+        symmetry.segments = segments;
+    } else if (name == "tiled") {
+        symmetry.mode = SymmetryMode::Tiled;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::string toString(const Symmetry& symmetry) {
+    switch (symmetry.mode) {
+        case SymmetryMode::MirrorX: return "mirror-x";
+        case SymmetryMode::MirrorY: return "mirror-y";
+        case SymmetryMode::Radial:  return "radial:" + std::to_string(symmetry.segments);
+        case SymmetryMode::Tiled:   return "tiled";
+        default:                    return "none";
+    }
+}
+
+} // namespace Acute
@@ -0,0 +1,761 @@
+#include "TileResidency.h"
+#include "Bc7.h"
+#include "GLStateCache.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+namespace Acute {
+
+TileResidency::TileResidency(GLStateCache& state)
+    : m_state(state)
+    , m_texture(0)
+    , m_framebuffer(0)
+    , m_tilesX(0)
+    , m_tilesY(0)
+    , m_tiledLevels(0)
+    , m_maxResident(0)
+    , m_frameBudget(4u << 20)
+    , m_coldFrames(300)
+    , m_frame(0)
+    , m_store(static_cast<size_t>(kTileSize) * kTileSize * 4)
+    , m_solidColor{ 0, 0, 0, 0 }
+    , m_uploadBuffers{}
+    , m_nextUpload(0)
+    , m_readbacks{}
+    , m_viewKnown(false)
+    , m_lastCenterX(0.0f)
+    , m_lastCenterY(0.0f)
+    , m_velocityX(0.0f)
+    , m_velocityY(0.0f)
+    , m_lodTexture(0)
+    , m_lodChanged(false)
+    , m_compressedTexture(0)
+    , m_compressedLayers(0)
+    , m_maxCompressedLayers(0)
+    , m_slotTexture(0)
+    , m_slotsChanged(false)
+    , m_encodesPending(0)
+    , m_encoderStopping(false)
+    , m_stats{}
+{
+    for (auto& readback : m_readbacks) {
+        readback.tile = -1;
+    }
+}
+
+TileResidency::~TileResidency() {
+    if (m_encoder.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_encodeMutex);
+            m_encoderStopping = true;
+        }
+        m_encodeWake.notify_all();
+        m_encoder.join();
+    }
+    for (auto& readback : m_readbacks) {
+        if (readback.tile >= 0) {
+            glDeleteSync(readback.fence);
+        }
+        m_state.deleteBuffer(readback.buffer);
+    }
+    for (auto& buffer : m_uploadBuffers) {
+        m_state.deleteBuffer(buffer);
+    }
+    m_state.deleteTexture(m_lodTexture);
+    m_state.deleteTexture(m_slotTexture);
+    m_state.deleteTexture(m_compressedTexture);
+}
+
+bool TileResidency::isSupported(int width, int height) {
+    if (!GLEW_ARB_sparse_texture || !GLEW_VERSION_4_2) {
+        return false;
+    }
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_SPARSE_TEXTURE_SIZE_ARB, &maxSize);
+    return width % kTileSize == 0 && height % kTileSize == 0 && width <= maxSize && height <= maxSize;
+}
+
+bool TileResidency::initialize(GLuint texture, GLuint framebuffer, int width, int height, int levels,
+                               size_t budgetBytes) {
+    m_texture = texture;
+    m_framebuffer = framebuffer;
+    m_tilesX = width / kTileSize;
+    m_tilesY = height / kTileSize;
+    
+    // A tile must cover whole pages in every level it splits
+    GLint pageX = 0, pageY = 0;
+    glGetInternalformativ(GL_TEXTURE_2D, GL_RGBA8, GL_VIRTUAL_PAGE_SIZE_X_ARB, 1, &pageX);
+    glGetInternalformativ(GL_TEXTURE_2D, GL_RGBA8, GL_VIRTUAL_PAGE_SIZE_Y_ARB, 1, &pageY);
+    if (pageX <= 0 || pageY <= 0 || kTileSize % pageX != 0 || kTileSize % pageY != 0) {
+        std::cerr << "Sparse page size " << pageX << "x" << pageY << " does not divide the tile size" << std::endl;
+        return false;
+    }
+    
+    m_state.bindTexture(0, GL_TEXTURE_2D, m_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SPARSE_ARB, GL_TRUE);
+    glTexParameteri(GL_TEXTURE_2D, GL_VIRTUAL_PAGE_SIZE_INDEX_ARB, 0);
+    glTexStorage2D(GL_TEXTURE_2D, levels, GL_RGBA8, width, height);
+    GLint sparseLevels = 0;
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_NUM_SPARSE_LEVELS_ARB, &sparseLevels);
+    
+    m_tiledLevels = 0;
+    while (m_tiledLevels < std::min(levels, static_cast<int>(sparseLevels))
+           && (kTileSize >> m_tiledLevels) >= pageX && (kTileSize >> m_tiledLevels) >= pageY) {
+        m_tiledLevels++;
+    }
+    if (m_tiledLevels == 0) {
+        std::cerr << "Canvas texture has no sparse levels" << std::endl;
+        return false;
+    }
+    
+    // Coarse levels stay committed; a level in the mip tail commits the whole tail
+    for (int level = m_tiledLevels; level < std::min(levels, static_cast<int>(sparseLevels) + 1); level++) {
+        glTexPageCommitmentARB(GL_TEXTURE_2D, level, 0, 0, 0, std::max(1, width >> level),
+                               std::max(1, height >> level), 1, GL_TRUE);
+    }
+    
+    // Budget in tiles with their share of the tiled levels
+    size_t bytesPerTile = 0;
+    for (int level = 0; level < m_tiledLevels; level++) {
+        bytesPerTile += tileBytes() >> (2 * level);
+    }
+    m_maxResident = std::max<size_t>(1, budgetBytes / bytesPerTile);
+    
+    m_tiles.assign(static_cast<size_t>(m_tilesX) * m_tilesY, Tile{ false, false, false, -1, -1, 0, 0, 0, {} });
+    m_stats = Stats{};
+    m_viewKnown = false;
+    
+    for (auto& buffer : m_uploadBuffers) {
+        glGenBuffers(1, &buffer);
+        m_state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, tileBytes(), nullptr, GL_STREAM_DRAW);
+    }
+    m_state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    for (auto& readback : m_readbacks) {
+        glGenBuffers(1, &readback.buffer);
+        m_state.bindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, tileBytes(), nullptr, GL_STREAM_READ);
+        readback.tile = -1;
+        readback.compress = false;
+    }
+    m_state.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    
+    // Nothing is resident yet: every tile shows from the first committed level
+    m_lodValues.assign(m_tiles.size(), static_cast<uint8_t>(m_tiledLevels));
+    glGenTextures(1, &m_lodTexture);
+    m_state.bindTexture(0, GL_TEXTURE_2D, m_lodTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, m_tilesX, m_tilesY, 0, GL_RED, GL_UNSIGNED_BYTE, m_lodValues.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    m_lodChanged = false;
+    
+    m_slotValues.assign(m_tiles.size(), 0);
+    glGenTextures(1, &m_slotTexture);
+    m_state.bindTexture(0, GL_TEXTURE_2D, m_slotTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, m_tilesX, m_tilesY, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT,
+                 m_slotValues.data());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    m_slotsChanged = false;
+    
+    // BC7 is core with sparse textures (4.2); growing the array copies it
+    // over with glCopyImageSubData
+    bool compression = (GLEW_VERSION_4_3 || GLEW_ARB_copy_image) && (kTileSize >> (m_tiledLevels - 1)) >= 4;
+    if (compression) {
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &m_maxCompressedLayers);
+        m_maxCompressedLayers = std::min(m_maxCompressedLayers, 65535);
+        m_encoder = std::thread(&TileResidency::encoderLoop, this);
+    }
+    
+    // The caller goes on setting up the canvas texture
+    m_state.bindTexture(0, GL_TEXTURE_2D, m_texture);
+    
+    std::cout << "Tile residency: " << m_tilesX << "x" << m_tilesY << " tiles of " << kTileSize
+              << " px, up to " << m_maxResident << " resident (" << (budgetBytes >> 20) << " MiB)"
+              << (compression ? ", cold tiles in BC7" : "") << std::endl;
+    return true;
+}
+
+void TileResidency::clear(const uint8_t color[4]) {
+    std::memcpy(m_solidColor, color, sizeof(m_solidColor));
+    for (size_t i = 0; i < m_tiles.size(); i++) {
+        Tile& tile = m_tiles[i];
+        if (tile.readback >= 0) {
+            cancelReadback(static_cast<int>(i));
+        }
+        if (tile.encoding) {
+            cancelEncode(static_cast<int>(i));
+        }
+        if (tile.slot >= 0) {
+            releaseSlot(static_cast<int>(i));
+        }
+        // The caller clears every committed level, so mips are already right
+        tile.dirty = false;
+        if (!tile.resident) {
+            tile.data.reset();
+        }
+    }
+    m_stats.storedBytes = m_store.getStats().storedBytes;
+}
+
+void TileResidency::require(int x0, int y0, int x1, int y1) {
+    int tx0 = std::max(0, x0 / kTileSize), ty0 = std::max(0, y0 / kTileSize);
+    int tx1 = std::min(m_tilesX, (x1 + kTileSize - 1) / kTileSize);
+    int ty1 = std::min(m_tilesY, (y1 + kTileSize - 1) / kTileSize);
+    for (int ty = ty0; ty < ty1; ty++) {
+        for (int tx = tx0; tx < tx1; tx++) {
+            int index = ty * m_tilesX + tx;
+            Tile& tile = m_tiles[index];
+            tile.lastUsed = m_frame;
+            tile.lastDrawn = m_frame;
+            if (tile.resident) {
+                m_stats.hits++;
+                if (tile.readback >= 0) {
+                    cancelReadback(index);
+                }
+                if (tile.encoding) {
+                    cancelEncode(index);
+                }
+            } else {
+                // Compressed tiles too: they are drawn on in RGBA8
+                m_stats.misses++;
+                upload(index);
+            }
+        }
+    }
+}
+
+bool TileResidency::readStored(int x, int y, uint8_t* texels) const {
+    const Tile& tile = m_tiles[(y / kTileSize) * m_tilesX + x / kTileSize];
+    if (tile.resident) {
+        return false;
+    }
+    if (!tile.data || !m_store.load(*tile.data, texels)) {
+        for (size_t offset = 0; offset < tileBytes(); offset += 4) {
+            std::memcpy(texels + offset, m_solidColor, 4);
+        }
+    }
+    return true;
+}
+
+void TileResidency::markDirty(int x0, int y0, int x1, int y1) {
+    int tx0 = std::max(0, x0 / kTileSize), ty0 = std::max(0, y0 / kTileSize);
+    int tx1 = std::min(m_tilesX, (x1 + kTileSize - 1) / kTileSize);
+    int ty1 = std::min(m_tilesY, (y1 + kTileSize - 1) / kTileSize);
+    for (int ty = ty0; ty < ty1; ty++) {
+        for (int tx = tx0; tx < tx1; tx++) {
+            // Nothing was drawn on tiles that are not resident
+            Tile& tile = m_tiles[ty * m_tilesX + tx];
+            tile.dirty = tile.dirty || tile.resident;
+        }
+    }
+}
+
+void TileResidency::takeDirtyTiles(std::vector<int>& rects) {
+    rects.clear();
+    for (size_t i = 0; i < m_tiles.size(); i++) {
+        if (m_tiles[i].dirty) {
+            int x = static_cast<int>(i % m_tilesX) * kTileSize;
+            int y = static_cast<int>(i / m_tilesX) * kTileSize;
+            rects.insert(rects.end(), { x, y, x + kTileSize, y + kTileSize });
+            m_tiles[i].dirty = false;
+        }
+    }
+}
+
+void TileResidency::update(float x0, float y0, float x1, float y1, float lod) {
+    m_frame++;
+    
+    // Pan velocity in texels per frame, smoothed over a few frames
+    float centerX = (x0 + x1) * 0.5f, centerY = (y0 + y1) * 0.5f;
+    if (m_viewKnown) {
+        m_velocityX = 0.7f * m_velocityX + 0.3f * (centerX - m_lastCenterX);
+        m_velocityY = 0.7f * m_velocityY + 0.3f * (centerY - m_lastCenterY);
+    }
+    m_lastCenterX = centerX;
+    m_lastCenterY = centerY;
+    m_viewKnown = true;
+    
+    // Coarser views only sample the committed levels; tiles are then needed
+    // just for drawing
+    m_wanted.clear();
+    if (lod < m_tiledLevels) {
+        // Candidates nearest to where they are needed first: the visible tiles
+        // around the view center, then a one tile ring and the area the pan
+        // is heading for around the predicted center
+        std::vector<std::pair<float, int>> candidates;
+        auto collect = [&](float minX, float minY, float maxX, float maxY, float cx, float cy, float bias) {
+            int tx0 = std::max(0, static_cast<int>(std::floor(minX / kTileSize)));
+            int ty0 = std::max(0, static_cast<int>(std::floor(minY / kTileSize)));
+            int tx1 = std::min(m_tilesX, static_cast<int>(std::ceil(maxX / kTileSize)));
+            int ty1 = std::min(m_tilesY, static_cast<int>(std::ceil(maxY / kTileSize)));
+            for (int ty = ty0; ty < ty1; ty++) {
+                for (int tx = tx0; tx < tx1; tx++) {
+                    float dx = (tx + 0.5f) * kTileSize - cx, dy = (ty + 0.5f) * kTileSize - cy;
+                    candidates.emplace_back(bias + std::sqrt(dx * dx + dy * dy), ty * m_tilesX + tx);
+                }
+            }
+        };
+        collect(x0, y0, x1, y1, centerX, centerY, 0.0f);
+        size_t visible = candidates.size();
+        
+        float aheadX = m_velocityX * kLookaheadFrames, aheadY = m_velocityY * kLookaheadFrames;
+        float prefetchBias = static_cast<float>(m_tilesX + m_tilesY) * kTileSize;
+        collect(std::min(x0, x0 + aheadX) - kTileSize, std::min(y0, y0 + aheadY) - kTileSize,
+                std::max(x1, x1 + aheadX) + kTileSize, std::max(y1, y1 + aheadY) + kTileSize,
+                centerX + aheadX, centerY + aheadY, prefetchBias);
+        std::sort(candidates.begin(), candidates.begin() + visible);
+        std::sort(candidates.begin() + visible, candidates.end());
+        
+        for (size_t i = 0; i < candidates.size() && m_wanted.size() < m_maxResident; i++) {
+            int index = candidates[i].second;
+            Tile& tile = m_tiles[index];
+            if (tile.lastUsed == m_frame) {
+                continue;    // Already taken (visible tiles repeat in the prefetch area)
+            }
+            tile.lastUsed = m_frame;
+            m_wanted.push_back(index);
+            if (i < visible) {
+                if (tile.resident || tile.slot >= 0) {
+                    m_stats.hits++;
+                } else {
+                    m_stats.misses++;
+                }
+            }
+        }
+    }
+    
+    // Stream in nearest first until the frame's budget is spent
+    size_t uploadBudget = m_frameBudget;
+    for (int index : m_wanted) {
+        Tile& tile = m_tiles[index];
+        if (tile.resident) {
+            if (tile.readback >= 0 && !m_readbacks[tile.readback].compress) {
+                cancelReadback(index);
+            }
+        } else if (tile.slot >= 0) {
+            // Shown from the compressed array until drawn on
+        } else if (uploadBudget >= tileBytes()) {
+            upload(index);
+            uploadBudget -= tileBytes();
+        }
+    }
+    
+    size_t readbackBudget = m_frameBudget;
+    finishReadbacks(readbackBudget);
+    takeEncoded();
+    compressColdTiles();
+    
+    // Over budget: start evicting the least recently used tiles that are not
+    // needed this frame and have no pending mip update. Load is counted in
+    // quarter tiles, the size of a compressed one.
+    size_t pending = 0;
+    for (const auto& readback : m_readbacks) {
+        pending += readback.tile >= 0 && !readback.compress ? 1 : 0;
+    }
+    size_t load = m_stats.residentTiles * 4 + m_stats.compressedLayers;
+    size_t limit = (m_maxResident + pending) * 4;
+    if (load > limit) {
+        std::vector<std::pair<uint64_t, int>> victims;
+        for (size_t i = 0; i < m_tiles.size(); i++) {
+            const Tile& tile = m_tiles[i];
+            bool evictable = (tile.resident && tile.readback < 0 && !tile.dirty) || tile.slot >= 0;
+            if (evictable && tile.lastUsed != m_frame) {
+                victims.emplace_back(tile.lastUsed, static_cast<int>(i));
+            }
+        }
+        std::sort(victims.begin(), victims.end());
+        for (size_t i = 0; i < victims.size() && load > limit; i++) {
+            int index = victims[i].second;
+            if (m_tiles[index].slot >= 0) {
+                // Its LZ4 copy is already stored
+                load -= releaseSlot(index) ? 1 : 0;
+                m_stats.evictions++;
+            } else if (beginReadback(index, false)) {
+                load -= 4;
+            }
+        }
+    }
+    
+    if (m_lodChanged) {
+        m_state.bindTexture(0, GL_TEXTURE_2D, m_lodTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_tilesX, m_tilesY, GL_RED, GL_UNSIGNED_BYTE, m_lodValues.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        m_lodChanged = false;
+    }
+    if (m_slotsChanged) {
+        m_state.bindTexture(0, GL_TEXTURE_2D, m_slotTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_tilesX, m_tilesY, GL_RED_INTEGER, GL_UNSIGNED_SHORT,
+                        m_slotValues.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        m_slotsChanged = false;
+    }
+    m_stats.deduplicated = m_store.getStats().hits;
+    m_stats.storedBytes = m_store.getStats().storedBytes;
+}
+
+void TileResidency::commit(int index, bool commit) {
+    int tx = index % m_tilesX, ty = index / m_tilesX;
+    m_state.bindTexture(0, GL_TEXTURE_2D, m_texture);
+    for (int level = 0; level < m_tiledLevels; level++) {
+        int size = kTileSize >> level;
+        glTexPageCommitmentARB(GL_TEXTURE_2D, level, tx * size, ty * size, 0, size, size, 1,
+                               commit ? GL_TRUE : GL_FALSE);
+    }
+}
+
+void TileResidency::upload(int index) {
+    commit(index, true);
+    Tile& tile = m_tiles[index];
+    if (tile.slot >= 0) {
+        releaseSlot(index);
+    }
+    
+    // Cycle through the buffers and orphan the old contents, so mapping
+    // never waits for an upload still in flight
+    GLuint buffer = m_uploadBuffers[m_nextUpload];
+    m_nextUpload = (m_nextUpload + 1) % kUploadSlots;
+    m_state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, tileBytes(), nullptr, GL_STREAM_DRAW);
+    auto* pixels = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, tileBytes(),
+                                                          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+    if (pixels) {
+        bool decoded = tile.data && m_store.load(*tile.data, pixels);
+        if (!decoded) {
+            if (tile.data) {
+                std::cerr << "Corrupt stored tile " << index << ", filling with the clear color" << std::endl;
+            }
+            for (size_t offset = 0; offset < tileBytes(); offset += 4) {
+                std::memcpy(pixels + offset, m_solidColor, 4);
+            }
+        }
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        
+        // Returns at once; the copy runs from the buffer on the GPU's time
+        int x = (index % m_tilesX) * kTileSize, y = (index / m_tilesX) * kTileSize;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, kTileSize, kTileSize, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        m_stats.bytesUploaded += tileBytes();
+    }
+    m_state.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    
+    // The texture holds the tile now; its finer levels are rebuilt from level 0
+    tile.data.reset();
+    tile.dirty = true;
+    tile.lastDrawn = m_frame;
+    setResident(index, true);
+}
+
+bool TileResidency::beginReadback(int index, bool compress) {
+    int slot = -1;
+    for (int i = 0; i < kReadbackSlots && slot < 0; i++) {
+        slot = m_readbacks[i].tile < 0 ? i : -1;
+    }
+    if (slot < 0) {
+        return false;
+    }
+    
+    // Copy into the buffer on the GPU; the pages stay committed until the copy
+    // has landed, and the tile stays usable until then
+    Readback& readback = m_readbacks[slot];
+    int x = (index % m_tilesX) * kTileSize, y = (index / m_tilesX) * kTileSize;
+    m_state.bindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+    m_state.bindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    glReadPixels(x, y, kTileSize, kTileSize, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    m_state.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.tile = index;
+    readback.compress = compress;
+    m_tiles[index].readback = slot;
+    if (compress) {
+        m_tiles[index].encoding = true;
+        m_encodesPending++;
+    }
+    return true;
+}
+
+void TileResidency::finishReadbacks(size_t& budget) {
+    for (auto& readback : m_readbacks) {
+        if (readback.tile < 0 || budget < tileBytes()) {
+            continue;
+        }
+        if (glClientWaitSync(readback.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            continue;
+        }
+        glDeleteSync(readback.fence);
+        
+        int index = readback.tile;
+        Tile& tile = m_tiles[index];
+        readback.tile = -1;
+        tile.readback = -1;
+        
+        m_state.bindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        auto* pixels = static_cast<const uint8_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, tileBytes(),
+                                                                    GL_MAP_READ_BIT));
+        std::shared_ptr<TileStore::Entry> stored = pixels ? m_store.store(pixels) : nullptr;
+        EncodeJob job = { index, tile.generation, {}, {} };
+        if (stored && readback.compress && stored->layer < 0) {
+            job.pixels.assign(pixels, pixels + tileBytes());
+        }
+        if (pixels) {
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        m_state.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        if (!stored) {
+            // Keep the tile rather than lose it
+            if (readback.compress) {
+                tile.encoding = false;
+                m_encodesPending--;
+            }
+            continue;
+        }
+        
+        // Replaces the copy of a tile evicted while its encode is queued
+        tile.data = std::move(stored);
+        m_stats.bytesReadBack += tileBytes();
+        budget -= tileBytes();
+        
+        if (readback.compress && tile.data->layer >= 0) {
+            // An identical tile is in the compressed array already
+            tile.encoding = false;
+            m_encodesPending--;
+            showCompressed(index, tile.data->layer);
+        } else if (readback.compress) {
+            // Stays resident until the encode is done
+            {
+                std::lock_guard<std::mutex> lock(m_encodeMutex);
+                m_encodeJobs.push_back(std::move(job));
+            }
+            m_encodeWake.notify_one();
+        } else {
+            commit(index, false);
+            setResident(index, false);
+            m_stats.evictions++;
+        }
+    }
+}
+
+void TileResidency::cancelReadback(int index) {
+    Readback& readback = m_readbacks[m_tiles[index].readback];
+    glDeleteSync(readback.fence);
+    readback.tile = -1;
+    m_tiles[index].readback = -1;
+    if (readback.compress) {
+        m_tiles[index].encoding = false;
+        m_encodesPending--;
+    }
+}
+
+void TileResidency::setResident(int index, bool resident) {
+    Tile& tile = m_tiles[index];
+    if (tile.resident == resident) {
+        return;
+    }
+    tile.resident = resident;
+    if (resident) {
+        m_stats.residentTiles++;
+    } else {
+        m_stats.residentTiles--;
+    }
+    m_lodValues[index] = resident ? 0 : static_cast<uint8_t>(m_tiledLevels);
+    m_lodChanged = true;
+}
+
+void TileResidency::compressColdTiles() {
+    if (!m_encoder.joinable() || m_coldFrames == 0) {
+        return;
+    }
+    for (size_t i = 0; i < m_tiles.size() && m_encodesPending < kMaxEncodes; i++) {
+        const Tile& tile = m_tiles[i];
+        bool cold = m_frame - tile.lastDrawn >= m_coldFrames;
+        if (cold && tile.resident && tile.readback < 0 && !tile.dirty && !tile.encoding) {
+            if (!beginReadback(static_cast<int>(i), true)) {
+                return;
+            }
+        }
+    }
+}
+
+void TileResidency::takeEncoded() {
+    std::vector<EncodeJob> done;
+    {
+        std::lock_guard<std::mutex> lock(m_encodeMutex);
+        done.swap(m_encoded);
+    }
+    for (auto& job : done) {
+        m_encodesPending--;
+        Tile& tile = m_tiles[job.tile];
+        if (!tile.encoding || tile.generation != job.generation) {
+            continue;    // Drawn on since
+        }
+        tile.encoding = false;
+        if (!tile.resident || tile.dirty || !tile.data) {
+            continue;    // Evicted since
+        }
+        
+        // An identical tile may have finished first
+        int slot = tile.data->layer;
+        if (slot < 0) {
+            slot = allocateSlot();
+            if (slot < 0) {
+                continue;
+            }
+            m_state.bindTexture(0, GL_TEXTURE_2D_ARRAY, m_compressedTexture);
+            const uint8_t* blocks = job.blocks.data();
+            for (int level = 0; level < m_tiledLevels; level++) {
+                int size = kTileSize >> level;
+                size_t bytes = bc7EncodedSize(size, size);
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, slot, size, size, 1,
+                                          GL_COMPRESSED_RGBA_BPTC_UNORM, static_cast<GLsizei>(bytes), blocks);
+                blocks += bytes;
+            }
+            tile.data->layer = slot;
+            m_stats.bytesUploaded += job.blocks.size();
+        }
+        
+        if (tile.readback >= 0) {
+            cancelReadback(job.tile);
+        }
+        showCompressed(job.tile, slot);
+    }
+}
+
+void TileResidency::showCompressed(int index, int slot) {
+    // The LZ4 copy was kept when the readback landed
+    Tile& tile = m_tiles[index];
+    commit(index, false);
+    setResident(index, false);
+    tile.slot = slot;
+    m_slotValues[index] = static_cast<uint16_t>(slot + 1);
+    m_slotsChanged = true;
+    if (m_layerUsers[slot]++ == 0) {
+        m_stats.compressedLayers++;
+    }
+    m_stats.compressedTiles++;
+    m_stats.compressions++;
+}
+
+int TileResidency::allocateSlot() {
+    if (m_freeSlots.empty()) {
+        if (m_compressedLayers >= m_maxCompressedLayers) {
+            return -1;
+        }
+        
+        // Double the array; layers keep their index
+        int layers = std::min(m_maxCompressedLayers, std::max(16, m_compressedLayers * 2));
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        m_state.bindTexture(0, GL_TEXTURE_2D_ARRAY, texture);
+        glTexStorage3D(GL_TEXTURE_2D_ARRAY, m_tiledLevels, GL_COMPRESSED_RGBA_BPTC_UNORM, kTileSize, kTileSize, layers);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        if (m_compressedTexture) {
+            for (int level = 0; level < m_tiledLevels; level++) {
+                int size = kTileSize >> level;
+                glCopyImageSubData(m_compressedTexture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+                                   texture, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, size, size, m_compressedLayers);
+            }
+            m_state.deleteTexture(m_compressedTexture);
+        }
+        m_compressedTexture = texture;
+        for (int layer = layers - 1; layer >= m_compressedLayers; layer--) {
+            m_freeSlots.push_back(layer);
+        }
+        m_layerUsers.resize(layers, 0);
+        m_compressedLayers = layers;
+    }
+    int slot = m_freeSlots.back();
+    m_freeSlots.pop_back();
+    return slot;
+}
+
+bool TileResidency::releaseSlot(int index) {
+    Tile& tile = m_tiles[index];
+    int slot = tile.slot;
+    tile.slot = -1;
+    m_slotValues[index] = 0;
+    m_slotsChanged = true;
+    m_stats.compressedTiles--;
+    if (--m_layerUsers[slot] > 0) {
+        return false;
+    }
+    
+    // Compressed tiles keep their stored copy, which names the layer
+    m_freeSlots.push_back(slot);
+    tile.data->layer = -1;
+    m_stats.compressedLayers--;
+    return true;
+}
+
+void TileResidency::cancelEncode(int index) {
+    // The worker finishes it anyway; takeEncoded drops the result
+    Tile& tile = m_tiles[index];
+    tile.encoding = false;
+    tile.generation++;
+    tile.data.reset();
+}
+
+void TileResidency::encoderLoop() {
+    for (;;) {
+        EncodeJob job;
+        {
+            std::unique_lock<std::mutex> lock(m_encodeMutex);
+            m_encodeWake.wait(lock, [this] { return m_encoderStopping || !m_encodeJobs.empty(); });
+            if (m_encoderStopping) {
+                return;
+            }
+            job = std::move(m_encodeJobs.front());
+            m_encodeJobs.pop_front();
+        }
+        
+        size_t total = 0;
+        for (int level = 0; level < m_tiledLevels; level++) {
+            total += bc7EncodedSize(kTileSize >> level, kTileSize >> level);
+        }
+        job.blocks.resize(total);
+        
+        // Finer levels by 2x2 box filter from the one above, as the mips are built
+        std::vector<uint8_t> pixels = std::move(job.pixels);
+        std::vector<uint8_t> half;
+        uint8_t* blocks = job.blocks.data();
+        for (int level = 0; level < m_tiledLevels; level++) {
+            int size = kTileSize >> level;
+            if (level > 0) {
+                half.resize(static_cast<size_t>(size) * size * 4);
+                int source = size * 2;
+                for (int y = 0; y < size; y++) {
+                    for (int x = 0; x < size; x++) {
+                        const uint8_t* a = &pixels[(static_cast<size_t>(y * 2) * source + x * 2) * 4];
+                        const uint8_t* b = a + static_cast<size_t>(source) * 4;
+                        for (int c = 0; c < 4; c++) {
+                            half[(static_cast<size_t>(y) * size + x) * 4 + c] =
+                                static_cast<uint8_t>((a[c] + a[c + 4] + b[c] + b[c + 4] + 2) >> 2);
+                        }
+                    }
+                }
+                pixels.swap(half);
+            }
+            bc7EncodeImage(pixels.data(), size, size, blocks);
+            blocks += bc7EncodedSize(size, size);
+        }
+        
+        std::lock_guard<std::mutex> lock(m_encodeMutex);
+        m_encoded.push_back(std::move(job));
+    }
+}
+
+} // namespace Acute
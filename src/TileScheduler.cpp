@@ -0,0 +1,183 @@
+#include "TileScheduler.h"
+#include "CpuCanvas.h"
+#include <algorithm>
+
+namespace Acute {
+
+TileScheduler::TileScheduler(int threadCount)
+    : m_task(nullptr)
+    , m_generation(0)
+    , m_remaining(0)
+    , m_stopping(false)
+    , m_tasksRun(0)
+    , m_tasksStolen(0)
+{
+    if (threadCount <= 0) {
+        threadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+    
+    for (int i = 0; i < threadCount; i++) {
+        m_queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    
+    // Worker 0 is whoever calls parallelFor
+    for (int i = 1; i < threadCount; i++) {
+        m_threads.emplace_back(&TileScheduler::workerLoop, this, i);
+    }
+}
+
+TileScheduler::~TileScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void TileScheduler::composite(CpuCanvas& canvas, const std::vector<BrushDab>& dabs, int copies) {
+    for (const auto& dab : dabs) {
+        if (dab.isSmudging()) {
+            canvas.drawDabs(dabs, copies);
+            return;
+        }
+    }
+    
+    const int tilesX = (canvas.getWidth() + kTileSize - 1) / kTileSize;
+    const int tilesY = (canvas.getHeight() + kTileSize - 1) / kTileSize;
+    const size_t tileCount = static_cast<size_t>(tilesX) * tilesY;
+    
+    if (m_bins.size() != tileCount) {
+        m_bins.assign(tileCount, std::vector<uint32_t>());
+    }
+    for (uint32_t tile : m_activeTiles) {
+        m_bins[tile].clear();
+    }
+    m_activeTiles.clear();
+    
+    // Bin by bounding box; appending in dab order keeps per-tile order exact
+    for (size_t i = 0; i < dabs.size(); i++) {
+        int x0, y0, x1, y1;
+        if (!canvas.getDabBounds(dabs[i], x0, y0, x1, y1)) {
+            continue;
+        }
+        for (int ty = y0 / kTileSize; ty <= (y1 - 1) / kTileSize; ty++) {
+            for (int tx = x0 / kTileSize; tx <= (x1 - 1) / kTileSize; tx++) {
+                uint32_t tile = static_cast<uint32_t>(ty * tilesX + tx);
+                if (m_bins[tile].empty()) {
+                    m_activeTiles.push_back(tile);
+                }
+                m_bins[tile].push_back(static_cast<uint32_t>(i));
+            }
+        }
+    }
+    
+    parallelFor(m_activeTiles.size(), [&](size_t index) {
+        uint32_t tile = m_activeTiles[index];
+        int x0 = static_cast<int>(tile % tilesX) * kTileSize;
+        int y0 = static_cast<int>(tile / tilesX) * kTileSize;
+        int x1 = std::min(x0 + kTileSize, canvas.getWidth());
+        int y1 = std::min(y0 + kTileSize, canvas.getHeight());
+        for (uint32_t dab : m_bins[tile]) {
+            canvas.drawDabClipped(dabs[dab], x0, y0, x1, y1);
+        }
+    });
+}
+
+void TileScheduler::parallelFor(size_t count, const std::function<void(size_t)>& task) {
+    if (count == 0) {
+        return;
+    }
+    
+    // Single worker or a single task: nothing to share
+    if (m_queues.size() == 1 || count == 1) {
+        for (size_t i = 0; i < count; i++) {
+            task(i);
+        }
+        m_tasksRun += count;
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_remaining = count;
+        
+        // Deal contiguous ranges so neighbouring tiles start on the same worker
+        const size_t workers = m_queues.size();
+        for (size_t w = 0; w < workers; w++) {
+            size_t begin = count * w / workers;
+            size_t end = count * (w + 1) / workers;
+            std::lock_guard<std::mutex> queueLock(m_queues[w]->mutex);
+            for (size_t i = begin; i < end; i++) {
+                m_queues[w]->tasks.push_back(i);
+            }
+        }
+        m_generation++;
+    }
+    m_wake.notify_all();
+    
+    drainTasks(0);
+    
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_remaining.load() == 0; });
+    m_task = nullptr;
+}
+
+void TileScheduler::workerLoop(int index) {
+    uint64_t seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stopping || m_generation != seenGeneration; });
+            if (m_stopping) {
+                return;
+            }
+            seenGeneration = m_generation;
+        }
+        drainTasks(index);
+    }
+}
+
+void TileScheduler::drainTasks(int index) {
+    size_t task;
+    while (takeTask(index, task)) {
+        (*m_task)(task);
+        m_tasksRun++;
+        if (--m_remaining == 0) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_done.notify_all();
+        }
+    }
+}
+
+bool TileScheduler::takeTask(int index, size_t& task) {
+    // Own queue first, newest task (LIFO keeps caches warm)
+    {
+        WorkerQueue& own = *m_queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    
+    // Steal the oldest task from the other workers, starting with the next one
+    const size_t workers = m_queues.size();
+    for (size_t offset = 1; offset < workers; offset++) {
+        WorkerQueue& victim = *m_queues[(index + offset) % workers];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            m_tasksStolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace Acute
@@ -0,0 +1,81 @@
+#include "TileStore.h"
+#include "Lz4.h"
+#include <cstring>
+
+namespace Acute {
+
+namespace {
+
+// 64-bit multiply-xorshift hash over whole words. Matches are checked
+// against the stored texels, so it need not be collision resistant.
+uint64_t hashTexels(const uint8_t* texels, size_t size) {
+    const uint64_t prime = 0x9E3779B97F4A7C15ull;
+    uint64_t hash = size * prime;
+    size_t offset = 0;
+    for (; offset + 8 <= size; offset += 8) {
+        uint64_t word;
+        std::memcpy(&word, texels + offset, sizeof(word));
+        hash = (hash ^ (word * prime)) * prime;
+        hash ^= hash >> 29;
+    }
+    for (; offset < size; offset++) {
+        hash = (hash ^ texels[offset]) * prime;
+    }
+    return hash ^ (hash >> 32);
+}
+
+} // namespace
+
+TileStore::TileStore(size_t tileBytes)
+    : m_tileBytes(tileBytes)
+    , m_compressScratch(lz4CompressBound(tileBytes))
+    , m_loadScratch(tileBytes)
+    , m_stats{}
+{
+}
+
+std::shared_ptr<TileStore::Entry> TileStore::store(const uint8_t* texels) {
+    uint64_t hash = hashTexels(texels, m_tileBytes);
+    
+    // Same hash: compare the texels themselves
+    auto range = m_entries.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (load(*it->second.entry, m_loadScratch.data())
+            && std::memcmp(m_loadScratch.data(), texels, m_tileBytes) == 0) {
+            m_stats.hits++;
+            return it->second.reference.lock();
+        }
+    }
+    
+    size_t size = lz4Compress(texels, m_tileBytes, m_compressScratch.data(), m_compressScratch.size());
+    if (size == 0) {
+        return nullptr;
+    }
+    m_stats.misses++;
+    m_stats.entries++;
+    m_stats.storedBytes += size;
+    
+    auto* entry = new Entry{ hash, std::vector<uint8_t>(m_compressScratch.begin(), m_compressScratch.begin() + size), -1 };
+    std::shared_ptr<Entry> reference(entry, [this](Entry* released) { release(released); });
+    m_entries.emplace(hash, Live{ entry, reference });
+    return reference;
+}
+
+bool TileStore::load(const Entry& entry, uint8_t* texels) const {
+    return lz4Decompress(entry.data.data(), entry.data.size(), texels, m_tileBytes);
+}
+
+void TileStore::release(Entry* entry) {
+    auto range = m_entries.equal_range(entry->hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.entry == entry) {
+            m_entries.erase(it);
+            break;
+        }
+    }
+    m_stats.entries--;
+    m_stats.storedBytes -= entry->data.size();
+    delete entry;
+}
+
+} // namespace Acute
@@ -0,0 +1,567 @@
+#include "Timelapse.h"
+#include "Lz4.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace Acute {
+
+namespace {
+
+const char kTimelapseMagic[4] = { 'A', 'C', 'T', 'L' };
+constexpr uint32_t kTimelapseVersion = 1;
+
+constexpr uint32_t kRecordDelta = 1;
+constexpr uint32_t kRecordKeyframe = 2;
+
+// Main thread copying per frame while a snapshot is collected
+constexpr size_t kCopyBudget = 1u << 20;
+
+// Largest canvas side a record may claim, the largest texture GPUs allow
+constexpr int32_t kMaxCanvasSize = 32768;
+
+struct FileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t tileSize;
+    uint32_t reserved;
+};
+
+// Followed by tileCount tiles, payloadBytes in all
+struct RecordHeader {
+    uint32_t type;
+    uint32_t tileCount;
+    uint64_t time;
+    int32_t width;
+    int32_t height;
+    uint64_t payloadBytes;
+};
+
+// Followed by size bytes of LZ4 compressed byte planes; a keyframe tile of
+// size 0 is transparent
+struct TileHeader {
+    uint32_t index;
+    uint32_t size;
+};
+
+static_assert(sizeof(FileHeader) == 16, "FileHeader layout");
+static_assert(sizeof(RecordHeader) == 32, "RecordHeader layout");
+static_assert(sizeof(TileHeader) == 8, "TileHeader layout");
+
+constexpr size_t kTilePixels = static_cast<size_t>(TimelapseRecorder::kTileSize) * TimelapseRecorder::kTileSize;
+constexpr size_t kTileBytes = kTilePixels * 4;
+
+// RGBA pixels to four planes of one channel each, and back
+void toPlanes(const uint8_t* rgba, uint8_t* planes) {
+    for (size_t i = 0; i < kTilePixels; i++) {
+        planes[i] = rgba[i * 4];
+        planes[kTilePixels + i] = rgba[i * 4 + 1];
+        planes[kTilePixels * 2 + i] = rgba[i * 4 + 2];
+        planes[kTilePixels * 3 + i] = rgba[i * 4 + 3];
+    }
+}
+
+void fromPlanes(const uint8_t* planes, uint8_t* rgba) {
+    for (size_t i = 0; i < kTilePixels; i++) {
+        rgba[i * 4] = planes[i];
+        rgba[i * 4 + 1] = planes[kTilePixels + i];
+        rgba[i * 4 + 2] = planes[kTilePixels * 2 + i];
+        rgba[i * 4 + 3] = planes[kTilePixels * 3 + i];
+    }
+}
+
+bool isZero(const uint8_t* data, size_t size) {
+    uint64_t any = 0;
+    for (size_t offset = 0; offset < size; offset += 8) {
+        uint64_t word;
+        std::memcpy(&word, data + offset, sizeof(word));
+        any |= word;
+    }
+    return any == 0;
+}
+
+} // namespace
+
+TimelapseRecorder::TimelapseRecorder()
+    : m_file(nullptr)
+    , m_width(0)
+    , m_height(0)
+    , m_tilesX(0)
+    , m_tilesY(0)
+    , m_startTime(0)
+    , m_lastSnapshot(0)
+    , m_reset(true)
+    , m_pendingCount(0)
+    , m_collecting(false)
+    , m_cursor(0)
+    , m_collected{}
+    , m_queued{}
+    , m_hasQueued(false)
+    , m_working(false)
+    , m_stopping(false)
+    , m_stats{}
+    , m_lastKeyframe(0)
+    , m_wroteKeyframe(false)
+{
+}
+
+TimelapseRecorder::~TimelapseRecorder() {
+    close();
+}
+
+bool TimelapseRecorder::open(const std::string& path, int width, int height, const TimelapseOptions& options) {
+    close();
+    m_file = fopen(path.c_str(), "wb");
+    if (!m_file) {
+        std::cerr << "Failed to create time-lapse: " << path << std::endl;
+        return false;
+    }
+    FileHeader header;
+    std::memcpy(header.magic, kTimelapseMagic, sizeof(kTimelapseMagic));
+    header.version = kTimelapseVersion;
+    header.tileSize = kTileSize;
+    header.reserved = 0;
+    if (fwrite(&header, sizeof(header), 1, m_file) != 1) {
+        std::cerr << "Failed to write time-lapse: " << path << std::endl;
+        fclose(m_file);
+        m_file = nullptr;
+        return false;
+    }
+    
+    m_path = path;
+    m_options = options;
+    m_startTime = now();
+    m_stats = Stats{};
+    m_stored.clear();
+    m_wroteKeyframe = false;
+    m_stopping = false;
+    resize(width, height);
+    m_worker = std::thread(&TimelapseRecorder::workerLoop, this);
+    return true;
+}
+
+void TimelapseRecorder::close() {
+    if (!m_file) {
+        return;
+    }
+    // The worker writes what is queued before it stops
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_wake.notify_one();
+    m_worker.join();
+    fclose(m_file);
+    m_file = nullptr;
+    m_collecting = false;
+}
+
+void TimelapseRecorder::update(const uint8_t* pixels, const std::vector<int>& refreshed) {
+    if (!m_file) {
+        return;
+    }
+    markPending(refreshed);
+    if (!m_collecting) {
+        if (m_pendingCount == 0 || now() - m_lastSnapshot < static_cast<uint64_t>(m_options.interval * 1000.0f)
+            || !beginSnapshot(false)) {
+            return;
+        }
+    }
+    if (copyTiles(pixels, kCopyBudget)) {
+        queueSnapshot();
+    }
+}
+
+void TimelapseRecorder::finish(const uint8_t* pixels, const std::vector<int>& refreshed) {
+    if (!m_file) {
+        return;
+    }
+    markPending(refreshed);
+    if (m_collecting || (m_pendingCount > 0 && beginSnapshot(true))) {
+        copyTiles(pixels, SIZE_MAX);
+        queueSnapshot();
+    }
+    close();
+}
+
+void TimelapseRecorder::resize(int width, int height) {
+    m_width = width;
+    m_height = height;
+    m_tilesX = (width + kTileSize - 1) / kTileSize;
+    m_tilesY = (height + kTileSize - 1) / kTileSize;
+    m_pending.assign(static_cast<size_t>(m_tilesX) * m_tilesY, 0);
+    m_pendingCount = 0;
+    m_collecting = false;
+    m_reset = true;
+    
+    // The first snapshot waits an interval, for the readback cache to catch
+    // up, so its keyframe has the whole canvas
+    m_lastSnapshot = now();
+}
+
+TimelapseRecorder::Stats TimelapseRecorder::getStats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+uint64_t TimelapseRecorder::now() const {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+void TimelapseRecorder::markPending(const std::vector<int>& refreshed) {
+    for (int index : refreshed) {
+        if (!m_pending[index]) {
+            m_pending[index] = 1;
+            m_pendingCount++;
+        }
+    }
+}
+
+bool TimelapseRecorder::beginSnapshot(bool wait) {
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (wait) {
+            m_idle.wait(lock, [this] { return !m_hasQueued && !m_working; });
+        } else if (m_hasQueued || m_working) {
+            return false;
+        }
+    }
+    uint64_t time = now();
+    m_collected.time = time - m_startTime;
+    m_collected.width = m_width;
+    m_collected.height = m_height;
+    m_collected.reset = m_reset;
+    m_collected.tiles.clear();
+    m_lastSnapshot = time;
+    m_reset = false;
+    m_collecting = true;
+    m_cursor = 0;
+    return true;
+}
+
+bool TimelapseRecorder::copyTiles(const uint8_t* pixels, size_t budget) {
+    const size_t rowStride = static_cast<size_t>(m_width) * 4;
+    size_t copied = 0;
+    for (; m_cursor < m_pending.size() && copied < budget; m_cursor++) {
+        if (!m_pending[m_cursor]) {
+            continue;
+        }
+        m_pending[m_cursor] = 0;
+        m_pendingCount--;
+        
+        size_t slot = m_collected.tiles.size();
+        m_collected.tiles.push_back(static_cast<int>(m_cursor));
+        if (m_collected.texels.size() < (slot + 1) * kTileBytes) {
+            m_collected.texels.resize((slot + 1) * kTileBytes);
+        }
+        uint8_t* tile = m_collected.texels.data() + slot * kTileBytes;
+        int x0 = static_cast<int>(m_cursor % m_tilesX) * kTileSize;
+        int y0 = static_cast<int>(m_cursor / m_tilesX) * kTileSize;
+        int x1 = std::min(m_width, x0 + kTileSize), y1 = std::min(m_height, y0 + kTileSize);
+        if (x1 - x0 < kTileSize || y1 - y0 < kTileSize) {
+            std::memset(tile, 0, kTileBytes);
+        }
+        for (int y = y0; y < y1; y++) {
+            std::memcpy(tile + static_cast<size_t>(y - y0) * kTileSize * 4,
+                        pixels + y * rowStride + static_cast<size_t>(x0) * 4, static_cast<size_t>(x1 - x0) * 4);
+        }
+        copied += kTileBytes;
+    }
+    return m_cursor == m_pending.size();
+}
+
+void TimelapseRecorder::queueSnapshot() {
+    m_collecting = false;
+    if (m_collected.tiles.empty() && !m_collected.reset) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::swap(m_queued, m_collected);
+        m_hasQueued = true;
+    }
+    m_wake.notify_one();
+}
+
+void TimelapseRecorder::workerLoop() {
+    Snapshot snapshot;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this] { return m_stopping || m_hasQueued; });
+            if (!m_hasQueued) {
+                return;
+            }
+            std::swap(snapshot, m_queued);
+            m_hasQueued = false;
+            m_working = true;
+        }
+        
+        bool written = writeSnapshot(snapshot);
+        
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_working = false;
+        }
+        m_idle.notify_one();
+        if (!written) {
+            std::cerr << "Failed to write time-lapse: " << m_path << std::endl;
+        }
+    }
+}
+
+bool TimelapseRecorder::writeSnapshot(const Snapshot& snapshot) {
+    const size_t tileCount = static_cast<size_t>((snapshot.width + kTileSize - 1) / kTileSize)
+                             * ((snapshot.height + kTileSize - 1) / kTileSize);
+    if (snapshot.reset || m_stored.size() != tileCount) {
+        m_stored.assign(tileCount, std::vector<uint8_t>());
+    }
+    bool keyframe = !m_wroteKeyframe || snapshot.reset
+                    || snapshot.time - m_lastKeyframe >= static_cast<uint64_t>(m_options.keyframeInterval * 1000.0f);
+    
+    // Each tile against its last contents, kept as compressed planes
+    std::vector<uint8_t> planes(kTileBytes), previous(kTileBytes);
+    std::vector<uint8_t> compressed(lz4CompressBound(kTileBytes));
+    std::vector<uint8_t> payload;
+    uint32_t written = 0;
+    for (size_t i = 0; i < snapshot.tiles.size(); i++) {
+        int index = snapshot.tiles[i];
+        toPlanes(snapshot.texels.data() + i * kTileBytes, planes.data());
+        std::vector<uint8_t>& stored = m_stored[index];
+        if (stored.empty()) {
+            std::fill(previous.begin(), previous.end(), 0);
+        } else if (!lz4Decompress(stored.data(), stored.size(), previous.data(), kTileBytes)) {
+            return false;
+        }
+        
+        if (!keyframe) {
+            for (size_t b = 0; b < kTileBytes; b++) {
+                previous[b] ^= planes[b];
+            }
+            if (isZero(previous.data(), kTileBytes)) {
+                continue;
+            }
+            size_t size = lz4Compress(previous.data(), kTileBytes, compressed.data(), compressed.size());
+            TileHeader tile = { static_cast<uint32_t>(index), static_cast<uint32_t>(size) };
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&tile);
+            payload.insert(payload.end(), bytes, bytes + sizeof(tile));
+            payload.insert(payload.end(), compressed.begin(), compressed.begin() + size);
+            written++;
+        }
+        
+        if (isZero(planes.data(), kTileBytes)) {
+            stored.clear();
+        } else {
+            size_t size = lz4Compress(planes.data(), kTileBytes, compressed.data(), compressed.size());
+            stored.assign(compressed.begin(), compressed.begin() + size);
+        }
+    }
+    
+    // A keyframe is every tile's stored contents as they are
+    if (keyframe) {
+        for (size_t index = 0; index < tileCount; index++) {
+            const std::vector<uint8_t>& stored = m_stored[index];
+            TileHeader tile = { static_cast<uint32_t>(index), static_cast<uint32_t>(stored.size()) };
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&tile);
+            payload.insert(payload.end(), bytes, bytes + sizeof(tile));
+            payload.insert(payload.end(), stored.begin(), stored.end());
+        }
+        written = static_cast<uint32_t>(tileCount);
+    } else if (written == 0) {
+        return true;
+    }
+    
+    RecordHeader header;
+    header.type = keyframe ? kRecordKeyframe : kRecordDelta;
+    header.tileCount = written;
+    header.time = snapshot.time;
+    header.width = snapshot.width;
+    header.height = snapshot.height;
+    header.payloadBytes = payload.size();
+    // Flushed record by record, so a crash loses at most the one being written
+    bool ok = fwrite(&header, sizeof(header), 1, m_file) == 1
+              && fwrite(payload.data(), 1, payload.size(), m_file) == payload.size() && fflush(m_file) == 0;
+    if (keyframe) {
+        m_lastKeyframe = snapshot.time;
+        m_wroteKeyframe = true;
+    }
+    
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats.snapshots++;
+    m_stats.keyframes += keyframe ? 1 : 0;
+    m_stats.tilesWritten += written;
+    m_stats.bytesWritten += sizeof(header) + payload.size();
+    return ok;
+}
+
+TimelapseReader::TimelapseReader()
+    : m_file(nullptr)
+    , m_time(0)
+    , m_keyframe(false)
+    , m_width(0)
+    , m_height(0)
+    , m_tilesX(0)
+    , m_tilesY(0)
+    , m_planes(kTileBytes)
+    , m_tile(kTileBytes)
+{
+}
+
+TimelapseReader::~TimelapseReader() {
+    if (m_file) {
+        fclose(m_file);
+    }
+}
+
+bool TimelapseReader::open(const std::string& path) {
+    if (m_file) {
+        fclose(m_file);
+    }
+    m_file = fopen(path.c_str(), "rb");
+    if (!m_file) {
+        std::cerr << "Failed to open time-lapse: " << path << std::endl;
+        return false;
+    }
+    FileHeader header;
+    if (fread(&header, sizeof(header), 1, m_file) != 1 || std::memcmp(header.magic, kTimelapseMagic, 4) != 0
+        || header.version != kTimelapseVersion || header.tileSize != static_cast<uint32_t>(kTileSize)) {
+        std::cerr << "Not a time-lapse: " << path << std::endl;
+        fclose(m_file);
+        m_file = nullptr;
+        return false;
+    }
+    m_width = m_height = 0;
+    m_tilesX = m_tilesY = 0;
+    m_pixels.clear();
+    return true;
+}
+
+bool TimelapseReader::next() {
+    RecordHeader header;
+    if (!m_file || fread(&header, sizeof(header), 1, m_file) != 1) {
+        return false;
+    }
+    bool keyframe = header.type == kRecordKeyframe;
+    bool sameSize = header.width == m_width && header.height == m_height;
+    if ((!keyframe && (header.type != kRecordDelta || m_pixels.empty() || !sameSize)) || header.width <= 0
+        || header.height <= 0 || header.width > kMaxCanvasSize || header.height > kMaxCanvasSize) {
+        std::cerr << "Damaged time-lapse record" << std::endl;
+        return false;
+    }
+    
+    // Each tile at most once, each at most its compressed bound, before
+    // anything is allocated for the record
+    const uint64_t tileLimit = static_cast<uint64_t>((header.width + kTileSize - 1) / kTileSize)
+                               * ((header.height + kTileSize - 1) / kTileSize);
+    if (header.tileCount > tileLimit
+        || header.payloadBytes > header.tileCount * (sizeof(TileHeader) + lz4CompressBound(kTileBytes))) {
+        std::cerr << "Damaged time-lapse record" << std::endl;
+        return false;
+    }
+    m_compressed.resize(header.payloadBytes);
+    if (fread(m_compressed.data(), 1, m_compressed.size(), m_file) != m_compressed.size()) {
+        std::cerr << "Time-lapse ends in a truncated record" << std::endl;
+        return false;
+    }
+    
+    if (!sameSize) {
+        m_width = header.width;
+        m_height = header.height;
+        m_tilesX = (m_width + kTileSize - 1) / kTileSize;
+        m_tilesY = (m_height + kTileSize - 1) / kTileSize;
+        m_pixels.assign(static_cast<size_t>(m_width) * m_height * 4, 0);
+    }
+    m_time = header.time;
+    m_keyframe = keyframe;
+    m_changed.clear();
+    
+    size_t offset = 0;
+    for (uint32_t i = 0; i < header.tileCount; i++) {
+        TileHeader tile;
+        if (m_compressed.size() - offset < sizeof(tile)) {
+            std::cerr << "Damaged time-lapse record" << std::endl;
+            return false;
+        }
+        std::memcpy(&tile, m_compressed.data() + offset, sizeof(tile));
+        offset += sizeof(tile);
+        if (tile.index >= static_cast<uint32_t>(m_tilesX * m_tilesY) || m_compressed.size() - offset < tile.size) {
+            std::cerr << "Damaged time-lapse record" << std::endl;
+            return false;
+        }
+        if (tile.size == 0 && keyframe) {
+            std::fill(m_planes.begin(), m_planes.end(), 0);
+        } else if (!lz4Decompress(m_compressed.data() + offset, tile.size, m_planes.data(), kTileBytes)) {
+            std::cerr << "Damaged time-lapse tile" << std::endl;
+            return false;
+        }
+        offset += tile.size;
+        fromPlanes(m_planes.data(), m_tile.data());
+        
+        // Keyframe tiles replace the pixels, delta tiles are XORed in
+        int x0, y0, x1, y1;
+        getTileRect(static_cast<int>(tile.index), x0, y0, x1, y1);
+        const size_t rowBytes = static_cast<size_t>(x1 - x0) * 4;
+        for (int y = y0; y < y1; y++) {
+            uint8_t* row = m_pixels.data() + (static_cast<size_t>(y) * m_width + x0) * 4;
+            const uint8_t* source = m_tile.data() + static_cast<size_t>(y - y0) * kTileSize * 4;
+            if (keyframe) {
+                std::memcpy(row, source, rowBytes);
+            } else {
+                for (size_t b = 0; b < rowBytes; b++) {
+                    row[b] ^= source[b];
+                }
+            }
+        }
+        m_changed.push_back(static_cast<int>(tile.index));
+    }
+    return true;
+}
+
+bool TimelapseReader::peekTime(uint64_t& time) {
+    RecordHeader header;
+    long start = m_file ? ftell(m_file) : -1;
+    if (start < 0 || fread(&header, sizeof(header), 1, m_file) != 1) {
+        return false;
+    }
+    fseek(m_file, start, SEEK_SET);
+    time = header.time;
+    return true;
+}
+
+bool TimelapseReader::seek(uint64_t time) {
+    if (!m_file) {
+        return false;
+    }
+    // Record headers only, skipping the payloads
+    fseek(m_file, sizeof(FileHeader), SEEK_SET);
+    long keyframe = -1;
+    for (;;) {
+        long start = ftell(m_file);
+        RecordHeader header;
+        if (fread(&header, sizeof(header), 1, m_file) != 1 || header.time > time) {
+            break;
+        }
+        if (header.type == kRecordKeyframe) {
+            keyframe = start;
+        }
+        if (fseek(m_file, static_cast<long>(header.payloadBytes), SEEK_CUR) != 0) {
+            break;
+        }
+    }
+    if (keyframe < 0) {
+        return false;
+    }
+    fseek(m_file, keyframe, SEEK_SET);
+    return next();
+}
+
+void TimelapseReader::getTileRect(int index, int& x0, int& y0, int& x1, int& y1) const {
+    x0 = (index % m_tilesX) * kTileSize;
+    y0 = (index / m_tilesX) * kTileSize;
+    x1 = std::min(m_width, x0 + kTileSize);
+    y1 = std::min(m_height, y0 + kTileSize);
+}
+
+} // namespace Acute
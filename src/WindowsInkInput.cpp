@@ -274,6 +274,10 @@ bool WindowsInkInput::processMessage(void* hwnd, unsigned int msg, void* wParam,
             m_currentInput.tiltY = normalizeTilt(penInfo.tiltY);
         }
         
+        // Inverted pen (eraser end) or eraser button held
+        bool eraser = (penInfo.penFlags & (PEN_FLAG_INVERTED | PEN_FLAG_ERASER)) != 0;
+        m_currentInput.device = eraser ? DeviceType::StylusEraser : DeviceType::StylusPen;
+        
         // Extract rotation (barrel rotation, if available)
         // Note: Windows pointer API doesn't directly provide rotation
         // This would require Windows Ink API for full support
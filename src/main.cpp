@@ -1,24 +1,105 @@
 #include "Application.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 int main(int argc, char* argv[]) {
-    (void)argc;
-    (void)argv;
+    // --canvas WxH opens a document of that size instead of following the window;
+    // --vram-budget MB keeps only the document's tiles near the view in video memory;
+    // --compute-raster draws dabs with compute shaders instead of blended quads;
+    // --fill-tolerance N (0-255) and --fill-gap PX set up the fill tool;
+    // --export-frames NAME publishes the canvas to a shared memory ring;
+    // --timelapse FILE records the session (--timelapse-interval SEC apart);
+    // --play-timelapse FILE plays one back (--playback-rate snapshots/s)
+    int canvasWidth = 0, canvasHeight = 0;
+    size_t residencyBudget = 0;
+    bool computeRaster = false;
+    Acute::FillOptions fillOptions;
+    fillOptions.tolerance = 32;
+    const char* exportName = nullptr;
+    const char* timelapsePath = nullptr;
+    const char* playbackPath = nullptr;
+    Acute::TimelapseOptions timelapseOptions;
+    float playbackRate = 10.0f;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--canvas") == 0 && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%dx%d", &canvasWidth, &canvasHeight) != 2
+                || canvasWidth <= 0 || canvasHeight <= 0) {
+                std::cerr << "Invalid canvas size: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--vram-budget") == 0 && i + 1 < argc) {
+            int megabytes = std::atoi(argv[++i]);
+            if (megabytes <= 0) {
+                std::cerr << "Invalid video memory budget: " << argv[i] << std::endl;
+                return 1;
+            }
+            residencyBudget = static_cast<size_t>(megabytes) << 20;
+        } else if (std::strcmp(argv[i], "--compute-raster") == 0) {
+            computeRaster = true;
+        } else if (std::strcmp(argv[i], "--fill-tolerance") == 0 && i + 1 < argc) {
+            fillOptions.tolerance = std::atoi(argv[++i]);
+            if (fillOptions.tolerance < 0 || fillOptions.tolerance > 255) {
+                std::cerr << "Invalid fill tolerance: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--fill-gap") == 0 && i + 1 < argc) {
+            fillOptions.gap = std::atoi(argv[++i]);
+            if (fillOptions.gap < 0) {
+                std::cerr << "Invalid fill gap: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--export-frames") == 0 && i + 1 < argc) {
+            exportName = argv[++i];
+        } else if (std::strcmp(argv[i], "--timelapse") == 0 && i + 1 < argc) {
+            timelapsePath = argv[++i];
+        } else if (std::strcmp(argv[i], "--timelapse-interval") == 0 && i + 1 < argc) {
+            timelapseOptions.interval = static_cast<float>(std::atof(argv[++i]));
+            if (timelapseOptions.interval <= 0.0f) {
+                std::cerr << "Invalid time-lapse interval: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (std::strcmp(argv[i], "--play-timelapse") == 0 && i + 1 < argc) {
+            playbackPath = argv[++i];
+        } else if (std::strcmp(argv[i], "--playback-rate") == 0 && i + 1 < argc) {
+            playbackRate = static_cast<float>(std::atof(argv[++i]));
+            if (playbackRate <= 0.0f) {
+                std::cerr << "Invalid playback rate: " << argv[i] << std::endl;
+                return 1;
+            }
+        }
+    }
     
     std::cout << "Acute Drawing Software" << std::endl;
     std::cout << "======================" << std::endl;
     std::cout << "Controls:" << std::endl;
     std::cout << "  - Left Mouse Button: Draw" << std::endl;
     std::cout << "  - Ctrl+C: Clear canvas" << std::endl;
+    std::cout << "  - Mouse Wheel: Zoom, Middle Mouse Button: Pan, Home: Fit canvas" << std::endl;
+    std::cout << "  - Shift+Drag: Rectangle selection, Alt+Drag: Lasso, Q: Paint mask, Ctrl+D: Deselect" << std::endl;
+    std::cout << "  - M: Cycle symmetry mode, G: Fill tool" << std::endl;
     std::cout << "  - ESC: Exit" << std::endl;
     std::cout << std::endl;
     
     Acute::Application app;
     
-    if (!app.initialize("Acute - Drawing Software", 1280, 720)) {
+    if (!app.initialize("Acute - Drawing Software", 1280, 720, canvasWidth, canvasHeight, residencyBudget,
+                        computeRaster)) {
         std::cerr << "Failed to initialize application" << std::endl;
         return 1;
     }
+    app.setFillOptions(fillOptions);
+    if (exportName && !app.setFrameExport(exportName)) {
+        std::cerr << "Failed to start frame export" << std::endl;
+        app.shutdown();
+        return 1;
+    }
+    if ((timelapsePath && !app.startTimelapse(timelapsePath, timelapseOptions))
+        || (playbackPath && !app.playTimelapse(playbackPath, playbackRate))) {
+        app.shutdown();
+        return 1;
+    }
     
     app.run();
     app.shutdown();
@@ -0,0 +1,778 @@
+// acute-render: headless batch renderer.
+// Runs brush presets and recorded strokes through the BrushEngine and composites
+// them on the CPU, without creating a window or an OpenGL context.
+
+#include "BrushEngine.h"
+#include "BrushPresetFile.h"
+#include "BrushPresetLibrary.h"
+#include "BrushPresets.h"
+#include "CpuCanvas.h"
+#include "ImageWriter.h"
+#include "StrokeHistory.h"
+#include "Symmetry.h"
+#include "TileScheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace Acute;
+
+namespace {
+
+typedef std::vector<InputPoint> Stroke;
+
+struct NamedPreset {
+    const char* name;
+    BrushSettings (*create)();
+};
+
+const NamedPreset kBuiltinPresets[] = {
+    { "pencil", BrushPresets::createPencil },
+    { "airbrush", BrushPresets::createAirbrush },
+    { "pen", BrushPresets::createPen },
+    { "marker", BrushPresets::createMarker },
+    { "splatter", BrushPresets::createSplatter },
+    { "calligraphy", BrushPresets::createCalligraphy },
+    { "watercolor", BrushPresets::createWatercolor },
+    { "smudge", BrushPresets::createSmudge },
+    { "blender", BrushPresets::createBlender },
+    { "wetmix", BrushPresets::createWetMix }
+};
+
+struct RenderJob {
+    std::string preset;
+    std::string strokes;   // Stroke file, or "-" for the built-in sample stroke
+    std::string output;
+    int width;
+    int height;
+};
+
+void printUsage() {
+    std::cout << "Usage: acute-render [options]" << std::endl;
+    std::cout << "  --preset <name|file>   Library, built-in preset name, or preset file" << std::endl;
+    std::cout << "  --library <file>       Preset library (.acbl binary or text)" << std::endl;
+    std::cout << "  --convert <in> <out>   Convert a preset library (.acbl = binary)" << std::endl;
+    std::cout << "  --export-presets <out> Write the built-in presets as a library" << std::endl;
+    std::cout << "  --strokes <file|->     Stroke file (- = built-in sample stroke)" << std::endl;
+    std::cout << "  --output <file.png>    Output image" << std::endl;
+    std::cout << "  --size <W>x<H>         Canvas size (default 512x256)" << std::endl;
+    std::cout << "  --symmetry <mode>      none, mirror-x, mirror-y, radial[:N] or tiled" << std::endl;
+    std::cout << "  --scale <S>            Re-rasterize the strokes at S times the size" << std::endl;
+    std::cout << "  --jobs <file|->        Render many jobs, one per line:" << std::endl;
+    std::cout << "                         <preset> <strokes|-> <output> [WxH]" << std::endl;
+    std::cout << "  --thumbnails <dir>     Render every built-in preset into <dir>" << std::endl;
+    std::cout << "  --threads <N>          Compositing threads (default: all cores)" << std::endl;
+    std::cout << "  --list-presets         Print the built-in preset names" << std::endl;
+    std::cout << "  --bench-pipelines      Verify and time the specialized mapping pipelines" << std::endl;
+    std::cout << "  --bench-color          Time color dynamics against a solid color" << std::endl;
+    std::cout << "  --bench-spacing        Compare dab counts and results with adaptive spacing" << std::endl;
+    std::cout << "  --bench-history        Time stroke history queries over 100k strokes" << std::endl;
+    std::cout << std::endl;
+    std::cout << "Stroke files hold one point per line:" << std::endl;
+    std::cout << "  x y [pressure tiltX tiltY rotation timestampMs]" << std::endl;
+    std::cout << "Blank lines separate strokes, # starts a comment." << std::endl;
+    std::cout << "Points without a timestamp are taken 8 ms apart." << std::endl;
+}
+
+bool parseSize(const std::string& text, int& width, int& height) {
+    return sscanf(text.c_str(), "%dx%d", &width, &height) == 2 && width > 0 && height > 0;
+}
+
+// Library presets are shared as-is; built-ins and preset files are built per job
+BrushSettingsPtr resolvePreset(const std::string& preset, const BrushPresetLibrary& library) {
+    int index = library.findPreset(preset);
+    if (index >= 0) {
+        return library.getPreset(static_cast<size_t>(index));
+    }
+    for (const auto& builtin : kBuiltinPresets) {
+        if (preset == builtin.name) {
+            return std::make_shared<const BrushSettings>(builtin.create());
+        }
+    }
+    BrushSettings settings;
+    std::string name;
+    if (!loadBrushPreset(preset, settings, name)) {
+        return nullptr;
+    }
+    return std::make_shared<const BrushSettings>(settings);
+}
+
+bool saveLibrary(const BrushPresetLibrary& library, const std::string& output) {
+    bool binary = output.size() >= 5 && output.compare(output.size() - 5, 5, ".acbl") == 0;
+    if (!(binary ? library.saveBinary(output) : library.saveText(output))) {
+        return false;
+    }
+    std::cout << "Wrote " << library.getPresetCount() << " presets to " << output << std::endl;
+    return true;
+}
+
+bool convertLibrary(const std::string& input, const std::string& output) {
+    BrushPresetLibrary library;
+    return library.open(input) && saveLibrary(library, output);
+}
+
+bool exportBuiltinPresets(const std::string& output) {
+    BrushPresetLibrary library;
+    for (const auto& builtin : kBuiltinPresets) {
+        library.addPreset(builtin.name, builtin.create());
+    }
+    return saveLibrary(library, output);
+}
+
+// Velocity from timestamps, as InputManager does for live input
+void computeVelocities(Stroke& stroke) {
+    for (size_t i = 1; i < stroke.size(); i++) {
+        uint64_t deltaTime = stroke[i].timestamp - stroke[i - 1].timestamp;
+        if (stroke[i].timestamp > stroke[i - 1].timestamp) {
+            float dt = deltaTime / 1000.0f;
+            stroke[i].velocityX = (stroke[i].x - stroke[i - 1].x) / dt;
+            stroke[i].velocityY = (stroke[i].y - stroke[i - 1].y) / dt;
+        }
+    }
+}
+
+bool loadStrokes(const std::string& path, std::vector<Stroke>& strokes) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Failed to open stroke file: " << path << std::endl;
+        return false;
+    }
+    
+    strokes.clear();
+    Stroke current;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        std::string content = line.substr(0, line.find('#'));
+        if (content.find_first_not_of(" \t\r") == std::string::npos) {
+            // Blank line ends the stroke; comment-only lines do not
+            if (content.size() == line.size() && !current.empty()) {
+                strokes.push_back(current);
+                current.clear();
+            }
+            continue;
+        }
+        
+        InputPoint point;
+        std::istringstream stream(content);
+        if (!(stream >> point.x >> point.y)) {
+            std::cerr << path << ":" << lineNumber << ": expected 'x y'" << std::endl;
+            return false;
+        }
+        // Optional columns, in order; a failed read would store 0, so each
+        // goes through a temporary
+        float value;
+        float* columns[] = { &point.pressure, &point.tiltX, &point.tiltY, &point.rotation };
+        for (float* column : columns) {
+            if (!(stream >> value)) {
+                break;
+            }
+            *column = value;
+        }
+        uint64_t timestamp;
+        if (stream && stream >> timestamp) {
+            point.timestamp = timestamp;
+        } else {
+            // Without timestamps, points are a steady 8 ms apart (125 Hz)
+            point.timestamp = current.empty() ? 0 : current.back().timestamp + 8;
+        }
+        current.push_back(point);
+    }
+    if (!current.empty()) {
+        strokes.push_back(current);
+    }
+    
+    for (auto& stroke : strokes) {
+        computeVelocities(stroke);
+    }
+    return true;
+}
+
+// S-curve across the canvas with a pressure swell, used for preset previews
+void makeSampleStroke(int width, int height, std::vector<Stroke>& strokes) {
+    const int pointCount = 64;
+    const float pi = 3.14159265f;
+    Stroke stroke;
+    for (int i = 0; i < pointCount; i++) {
+        float t = i / static_cast<float>(pointCount - 1);
+        InputPoint point;
+        point.x = width * (0.1f + 0.8f * t);
+        point.y = height * (0.5f - 0.25f * std::sin(t * 2.0f * pi));
+        point.pressure = 0.2f + 0.8f * std::sin(t * pi);
+        point.tiltX = 0.6f * (t - 0.5f);
+        point.timestamp = static_cast<uint64_t>(i * 8);
+        stroke.push_back(point);
+    }
+    computeVelocities(stroke);
+    strokes.assign(1, stroke);
+}
+
+// Engine, canvas and scheduler are kept across jobs; only the canvas storage
+// is reallocated, and only when the size changes.
+class BatchRenderer {
+public:
+    BatchRenderer(int threadCount, const BrushPresetLibrary& library)
+        : m_canvas(1, 1)
+        , m_scheduler(threadCount)
+        , m_library(library)
+        , m_scale(1.0f)
+    {
+    }
+    
+    void setSymmetry(const Symmetry& symmetry) { m_symmetry = symmetry; }
+    void setScale(float scale) { m_scale = scale; }
+    
+    bool render(const RenderJob& job) {
+        BrushSettingsPtr settings = resolvePreset(job.preset, m_library);
+        if (!settings) {
+            return false;
+        }
+        
+        if (job.strokes == "-") {
+            makeSampleStroke(job.width, job.height, m_strokes);
+            m_loadedStrokes.clear();
+        } else if (job.strokes != m_loadedStrokes) {
+            if (!loadStrokes(job.strokes, m_strokes)) {
+                m_loadedStrokes.clear();
+                return false;
+            }
+            m_loadedStrokes = job.strokes;
+        }
+        
+        // Strokes are kept as input and re-rasterized at the output scale;
+        // seeding each by its index keeps renders reproducible
+        m_history.clear();
+        for (size_t i = 0; i < m_strokes.size(); i++) {
+            m_history.addStroke(m_strokes[i], settings, static_cast<uint32_t>(i + 1));
+        }
+        
+        const int width = std::max(1, static_cast<int>(job.width * m_scale + 0.5f));
+        const int height = std::max(1, static_cast<int>(job.height * m_scale + 0.5f));
+        if (m_canvas.getWidth() != width || m_canvas.getHeight() != height) {
+            m_canvas.resize(width, height);
+        }
+        m_canvas.clear();
+        m_transforms = m_symmetry.buildTransforms(width, height);
+        
+        // Ribbon and stroke buffer are GPU paths; the CPU canvas always stamps dabs
+        const Box region = { 0.0f, 0.0f, static_cast<float>(job.width), static_cast<float>(job.height) };
+        m_history.collectDabs(m_engine, region, m_scale, m_dabs);
+        
+        // Every copy of a dab follows it, in the GPU canvas's instance order
+        if (m_transforms.size() > 1) {
+            m_copies.clear();
+            m_copies.reserve(m_dabs.size() * m_transforms.size());
+            for (const auto& dab : m_dabs) {
+                for (const auto& transform : m_transforms) {
+                    m_copies.push_back(transformDab(dab, transform));
+                }
+            }
+            m_dabs.swap(m_copies);
+        }
+        m_scheduler.composite(m_canvas, m_dabs, static_cast<int>(m_transforms.size()));
+        
+        m_canvas.readPixels(m_pixels);
+        return writePng(job.output, m_pixels.data(), width, height);
+    }
+    
+private:
+    BrushEngine m_engine;
+    CpuCanvas m_canvas;
+    TileScheduler m_scheduler;
+    const BrushPresetLibrary& m_library;
+    
+    std::vector<Stroke> m_strokes;
+    std::string m_loadedStrokes;
+    std::vector<BrushDab> m_dabs;
+    std::vector<BrushDab> m_copies;
+    std::vector<uint8_t> m_pixels;
+    
+    StrokeHistory m_history;
+    float m_scale;
+    
+    Symmetry m_symmetry;
+    std::vector<SymmetryTransform> m_transforms;
+};
+
+// Run a stroke through the engine, collecting every dab
+double generateDabs(BrushEngine& engine, const Stroke& stroke, int repeats, std::vector<BrushDab>& out) {
+    out.clear();
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; r++) {
+        engine.beginStroke();
+        for (const auto& point : stroke) {
+            auto dabs = engine.processInput(point);
+            out.insert(out.end(), dabs.begin(), dabs.end());
+        }
+        engine.endStroke();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The CPU side of GPU dab generation for a stroke: the segments' dab counts
+// go to dabCount
+double generateSegments(BrushEngine& engine, const Stroke& stroke, int repeats, size_t& dabCount) {
+    dabCount = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; r++) {
+        engine.beginStroke();
+        for (const auto& point : stroke) {
+            for (const auto& segment : engine.processSegmentInput(point)) {
+                dabCount += static_cast<size_t>(segment.count);
+            }
+        }
+        engine.endStroke();
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Bit-for-bit equality of two dab lists, field by field (BrushDab may have
+// padding)
+bool sameDabs(const std::vector<BrushDab>& a, const std::vector<BrushDab>& b) {
+    auto same = [](float x, float y) { return memcmp(&x, &y, sizeof(float)) == 0; };
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        const BrushDab& x = a[i];
+        const BrushDab& y = b[i];
+        if (!same(x.x, y.x) || !same(x.y, y.y) || !same(x.size, y.size) || !same(x.opacity, y.opacity)
+            || !same(x.rotation, y.rotation) || !same(x.hardness, y.hardness) || !same(x.flow, y.flow)
+            || !same(x.scatter, y.scatter) || !same(x.spacing, y.spacing) || x.tip != y.tip || x.blend != y.blend
+            || !same(x.smudge, y.smudge) || !same(x.smudgeLength, y.smudgeLength) || !same(x.r, y.r)
+            || !same(x.g, y.g) || !same(x.b, y.b)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Check the specialized mapping pipelines against the generic path (must match
+// bit for bit) and report dab throughput for both
+bool benchPipelines() {
+    std::vector<Stroke> strokes;
+    makeSampleStroke(4096, 1024, strokes);
+    const int repeats = 200;
+    bool allMatch = true;
+    
+    std::cout << "preset        pipeline     generic dabs/s  specialized dabs/s  match" << std::endl;
+    for (const auto& builtin : kBuiltinPresets) {
+        BrushEngine engine;
+        engine.setBrushSettings(builtin.create());
+        if (!engine.isPipelineSpecialized()) {
+            printf("%-13s generic\n", builtin.name);
+            continue;
+        }
+        
+        // Alternate the two paths and keep the best time of each; enough
+        // rounds that scheduling noise does not decide the comparison
+        std::vector<BrushDab> generic, specialized;
+        double genericTime = 1e30, specializedTime = 1e30;
+        for (int round = 0; round < 9; round++) {
+            engine.setSpecializedPipelines(false);
+            genericTime = std::min(genericTime, generateDabs(engine, strokes[0], repeats, generic));
+            engine.setSpecializedPipelines(true);
+            specializedTime = std::min(specializedTime, generateDabs(engine, strokes[0], repeats, specialized));
+        }
+        
+        bool match = sameDabs(generic, specialized);
+        allMatch = allMatch && match;
+        printf("%-13s specialized  %14.0f  %18.0f  %s\n", builtin.name,
+               generic.size() / genericTime, specialized.size() / specializedTime, match ? "yes" : "NO");
+    }
+    return allMatch;
+}
+
+// Dab throughput of every preset with a solid color, with pressure and tilt
+// driven color and with random color jitter. The color variants must also
+// match between the generic and specialized paths, and the batch HSV
+// conversion must round-trip RGB.
+bool benchColor() {
+    float worstError = 0.0f;
+    for (int r = 0; r <= 32; r++) {
+        for (int g = 0; g <= 32; g++) {
+            for (int b = 0; b <= 32; b++) {
+                float rgb[3] = { r / 32.0f, g / 32.0f, b / 32.0f };
+                HsvColor hsv = rgbToHsv(rgb[0], rgb[1], rgb[2]);
+                float out[3];
+                hsvToRgb(&hsv.h, &hsv.s, &hsv.v, &out[0], &out[1], &out[2], 1);
+                for (int c = 0; c < 3; c++) {
+                    worstError = std::max(worstError, std::abs(out[c] - rgb[c]));
+                }
+            }
+        }
+    }
+    bool roundTrip = worstError < 1e-5f;
+    printf("HSV round trip: max error %g %s\n", worstError, roundTrip ? "ok" : "FAILED");
+    
+    std::vector<Stroke> strokes;
+    makeSampleStroke(4096, 1024, strokes);
+    const int repeats = 200;
+    bool allMatch = true;
+    
+    auto addColorMapping = [](BrushSettings& settings, InputSource source, BrushProperty target,
+                              float minOutput, float maxOutput) {
+        InputMapping mapping;
+        mapping.source = source;
+        mapping.target = target;
+        mapping.minOutput = minOutput;
+        mapping.maxOutput = maxOutput;
+        settings.mappings.push_back(mapping);
+    };
+    
+    // Color mappings are evaluated per dab on the CPU path; strokes generated
+    // on the GPU only hand over segments, whatever their color dynamics
+    std::cout << "preset        solid dabs/s  mapped dabs/s  jitter dabs/s  match"
+              << "    gpu solid   gpu mapped   gpu jitter" << std::endl;
+    for (const auto& builtin : kBuiltinPresets) {
+        BrushSettings solid = builtin.create();
+        solid.colorR = 0.8f;
+        solid.colorG = 0.3f;
+        solid.colorB = 0.2f;
+        
+        BrushSettings mapped = solid;
+        addColorMapping(mapped, InputSource::Pressure, BrushProperty::ColorV, 0.5f, 1.0f);
+        addColorMapping(mapped, InputSource::TiltX, BrushProperty::ColorH, -0.1f, 0.1f);
+        
+        BrushSettings jitter = solid;
+        addColorMapping(jitter, InputSource::Random, BrushProperty::ColorH, -0.05f, 0.05f);
+        addColorMapping(jitter, InputSource::Random, BrushProperty::ColorS, 0.7f, 1.0f);
+        addColorMapping(jitter, InputSource::Random, BrushProperty::ColorV, 0.8f, 1.0f);
+        
+        const BrushSettings* variants[3] = { &solid, &mapped, &jitter };
+        double rates[3], segmentRates[3] = { 0.0, 0.0, 0.0 };
+        bool match = true;
+        for (int v = 0; v < 3; v++) {
+            BrushEngine engine;
+            engine.setBrushSettings(*variants[v]);
+            std::vector<BrushDab> dabs, generic;
+            double time = 1e30;
+            for (int round = 0; round < 3; round++) {
+                engine.setRandomSeed(1);
+                time = std::min(time, generateDabs(engine, strokes[0], repeats, dabs));
+            }
+            rates[v] = dabs.size() / time;
+            
+            engine.setSpecializedPipelines(false);
+            engine.setRandomSeed(1);
+            generateDabs(engine, strokes[0], repeats, generic);
+            match = match && sameDabs(generic, dabs);
+            
+            if (BrushEngine::canGenerateOnGpu(*variants[v]) && engine.getStrokeMode() == StrokeMode::Dabs) {
+                size_t segmentDabs = 0;
+                double segmentTime = 1e30;
+                for (int round = 0; round < 3; round++) {
+                    segmentTime = std::min(segmentTime, generateSegments(engine, strokes[0], repeats, segmentDabs));
+                }
+                segmentRates[v] = segmentDabs / segmentTime;
+            }
+        }
+        allMatch = allMatch && match;
+        printf("%-13s %12.0f  %13.0f  %13.0f  %-5s", builtin.name, rates[0], rates[1], rates[2],
+               match ? "yes" : "NO");
+        for (int v = 0; v < 3; v++) {
+            if (segmentRates[v] > 0.0) {
+                printf(" %12.0f", segmentRates[v]);
+            } else {
+                printf(" %12s", "-");
+            }
+        }
+        printf("\n");
+    }
+    return roundTrip && allMatch;
+}
+
+// Every preset drawn with a fast stroke, with and without adaptive spacing:
+// dab counts and the largest difference in the result (premultiplied, in
+// 8-bit steps, on a transparent canvas)
+bool benchSpacing() {
+    const int width = 2048, height = 512;
+    std::vector<Stroke> strokes;
+    makeSampleStroke(width, height, strokes);
+    bool allInvisible = true;
+    
+    std::cout << "preset        dabs    adaptive  saved   max diff  mean diff" << std::endl;
+    for (const auto& builtin : kBuiltinPresets) {
+        BrushEngine engine;
+        engine.setBrushSettings(builtin.create());
+        
+        std::vector<BrushDab> dabs[2];
+        std::vector<float> pixels[2];
+        for (int adaptive = 0; adaptive < 2; adaptive++) {
+            engine.setAdaptiveSpacing(adaptive == 1);
+            engine.setRandomSeed(1);
+            generateDabs(engine, strokes[0], 1, dabs[adaptive]);
+            
+            CpuCanvas canvas(width, height);
+            canvas.clear(0.0f, 0.0f, 0.0f, 0.0f);
+            canvas.drawDabs(dabs[adaptive]);
+            pixels[adaptive].assign(canvas.getPixels(), canvas.getPixels() + width * height * 4);
+        }
+        
+        float maxDiff = 0.0f;
+        double sumDiff = 0.0;
+        size_t covered = 0;
+        for (size_t i = 0; i < pixels[0].size(); i++) {
+            float diff = std::abs(pixels[1][i] - pixels[0][i]) * 255.0f;
+            maxDiff = std::max(maxDiff, diff);
+            if (pixels[0][i] > 0.0f || pixels[1][i] > 0.0f) {
+                sumDiff += diff;
+                covered++;
+            }
+        }
+        allInvisible = allInvisible && maxDiff <= 1.0f;
+        printf("%-13s %6zu  %8zu  %4.0f%%  %8.2f  %9.3f\n", builtin.name, dabs[0].size(), dabs[1].size(),
+               100.0 * (1.0 - static_cast<double>(dabs[1].size()) / dabs[0].size()), maxDiff,
+               covered ? sumDiff / covered : 0.0);
+    }
+    return allInvisible;
+}
+
+// Random strokes over a large document; region queries and hit tests are
+// timed and checked against a linear scan
+bool benchHistory() {
+    const int strokeCount = 100000;
+    const float documentSize = 16384.0f;
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    
+    std::vector<BrushSettingsPtr> brushes;
+    for (const auto& builtin : kBuiltinPresets) {
+        brushes.push_back(std::make_shared<BrushSettings>(builtin.create()));
+    }
+    
+    StrokeHistory history;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < strokeCount; i++) {
+        // Short wandering strokes, 8 to 40 points
+        Stroke stroke(8 + static_cast<int>(unit(random) * 32));
+        float x = unit(random) * documentSize, y = unit(random) * documentSize;
+        for (auto& point : stroke) {
+            x += (unit(random) - 0.5f) * 40.0f;
+            y += (unit(random) - 0.5f) * 40.0f;
+            point.x = x;
+            point.y = y;
+        }
+        history.addStroke(std::move(stroke), brushes[i % brushes.size()], static_cast<uint32_t>(i));
+    }
+    double buildTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    // Window-sized regions and cursor hit tests
+    const int queries = 2000;
+    std::vector<Box> regions(queries);
+    for (auto& region : regions) {
+        float x = unit(random) * documentSize, y = unit(random) * documentSize;
+        region = { x, y, x + 1280.0f, y + 720.0f };
+    }
+    std::vector<uint32_t> ids;
+    size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (const auto& region : regions) {
+        history.queryRegion(region, ids);
+        found += ids.size();
+    }
+    double regionTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / queries;
+    
+    start = std::chrono::steady_clock::now();
+    size_t hits = 0;
+    for (const auto& region : regions) {
+        history.hitTest(region.minX, region.minY, 4.0f, ids);
+        hits += ids.size();
+    }
+    double hitTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / queries;
+    
+    // Linear scan over the first hundred regions
+    bool match = true;
+    for (int q = 0; q < 100 && match; q++) {
+        std::vector<uint32_t> expected;
+        for (uint32_t id = 0; id < history.getStrokeCount(); id++) {
+            if (history.getStroke(id).bounds.intersects(regions[q])) {
+                expected.push_back(id);
+            }
+        }
+        history.queryRegion(regions[q], ids);
+        match = ids == expected;
+    }
+    
+    printf("%d strokes indexed in %.1f ms\n", strokeCount, buildTime * 1e3);
+    printf("region query: %.1f us, %.1f strokes on average\n", regionTime * 1e6,
+           static_cast<double>(found) / queries);
+    printf("hit test:     %.1f us, %.2f strokes on average\n", hitTime * 1e6,
+           static_cast<double>(hits) / queries);
+    printf("matches linear scan: %s\n", match ? "yes" : "NO");
+    return match && regionTime < 1e-3 && hitTime < 1e-3;
+}
+
+bool loadJobs(const std::string& path, int defaultWidth, int defaultHeight,
+              std::vector<RenderJob>& jobs) {
+    std::ifstream file;
+    if (path != "-") {
+        file.open(path);
+        if (!file.is_open()) {
+            std::cerr << "Failed to open job file: " << path << std::endl;
+            return false;
+        }
+    }
+    std::istream& in = (path == "-") ? std::cin : file;
+    
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        std::istringstream stream(line.substr(0, line.find('#')));
+        RenderJob job;
+        if (!(stream >> job.preset)) {
+            continue;
+        }
+        std::string size;
+        job.width = defaultWidth;
+        job.height = defaultHeight;
+        if (!(stream >> job.strokes >> job.output)
+            || (stream >> size && !parseSize(size, job.width, job.height))) {
+            std::cerr << path << ":" << lineNumber << ": expected '<preset> <strokes> <output> [WxH]'"
+                      << std::endl;
+            return false;
+        }
+        jobs.push_back(job);
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    std::string preset;
+    std::string strokes = "-";
+    std::string output;
+    std::string jobFile;
+    std::string thumbnailDir;
+    std::string libraryPath;
+    bool listPresets = false;
+    int width = 512;
+    int height = 256;
+    int threads = 0;
+    Symmetry symmetry;
+    float scale = 1.0f;
+    
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+        if (arg == "--help" || arg == "-h") {
+            printUsage();
+            return 0;
+        } else if (arg == "--list-presets") {
+            listPresets = true;
+        } else if (arg == "--bench-pipelines") {
+            return benchPipelines() ? 0 : 1;
+        } else if (arg == "--bench-color") {
+            return benchColor() ? 0 : 1;
+        } else if (arg == "--bench-spacing") {
+            return benchSpacing() ? 0 : 1;
+        } else if (arg == "--bench-history") {
+            return benchHistory() ? 0 : 1;
+        } else if (arg == "--convert" && i + 2 < argc) {
+            return convertLibrary(argv[i + 1], argv[i + 2]) ? 0 : 1;
+        } else if (arg == "--export-presets" && hasValue) {
+            return exportBuiltinPresets(argv[++i]) ? 0 : 1;
+        } else if (arg == "--library" && hasValue) {
+            libraryPath = argv[++i];
+        } else if (arg == "--preset" && hasValue) {
+            preset = argv[++i];
+        } else if (arg == "--strokes" && hasValue) {
+            strokes = argv[++i];
+        } else if (arg == "--output" && hasValue) {
+            output = argv[++i];
+        } else if (arg == "--jobs" && hasValue) {
+            jobFile = argv[++i];
+        } else if (arg == "--thumbnails" && hasValue) {
+            thumbnailDir = argv[++i];
+        } else if (arg == "--threads" && hasValue) {
+            threads = atoi(argv[++i]);
+        } else if (arg == "--scale" && hasValue) {
+            scale = static_cast<float>(atof(argv[++i]));
+            if (scale <= 0.0f || scale > 16.0f) {
+                std::cerr << "Invalid scale: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--symmetry" && hasValue) {
+            if (!parseSymmetry(argv[++i], symmetry)) {
+                std::cerr << "Invalid symmetry: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--size" && hasValue) {
+            if (!parseSize(argv[++i], width, height)) {
+                std::cerr << "Invalid size: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else {
+            std::cerr << "Unknown or incomplete option: " << arg << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+    
+    BrushPresetLibrary library;
+    if (!libraryPath.empty() && !library.open(libraryPath)) {
+        return 1;
+    }
+    if (listPresets) {
+        for (size_t i = 0; i < library.getPresetCount(); i++) {
+            std::cout << library.getPresetName(i) << std::endl;
+        }
+        for (const auto& builtin : kBuiltinPresets) {
+            std::cout << builtin.name << std::endl;
+        }
+        return 0;
+    }
+    
+    std::vector<RenderJob> jobs;
+    if (!jobFile.empty()) {
+        if (!loadJobs(jobFile, width, height, jobs)) {
+            return 1;
+        }
+    }
+    if (!thumbnailDir.empty()) {
+        for (const auto& builtin : kBuiltinPresets) {
+            jobs.push_back({ builtin.name, "-", thumbnailDir + "/" + builtin.name + ".png",
+                             width, height });
+        }
+    }
+    if (!preset.empty()) {
+        if (output.empty()) {
+            std::cerr << "--preset needs --output" << std::endl;
+            return 1;
+        }
+        jobs.push_back({ preset, strokes, output, width, height });
+    }
+    if (jobs.empty()) {
+        printUsage();
+        return 1;
+    }
+    
+    BatchRenderer renderer(threads, library);
+    renderer.setSymmetry(symmetry);
+    renderer.setScale(scale);
+    int failed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& job : jobs) {
+        if (!renderer.render(job)) {
+            std::cerr << "Job failed: " << job.preset << " -> " << job.output << std::endl;
+            failed++;
+        }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    
+    std::cout << "Rendered " << (jobs.size() - failed) << "/" << jobs.size() << " jobs in "
+              << elapsed << "s" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
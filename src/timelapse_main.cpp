@@ -0,0 +1,172 @@
+// acute-timelapse: inspects time-lapse recordings (AcuteDrawing --timelapse)
+// and transcodes them to numbered PNG frames, without a window or OpenGL.
+
+#include "ImageWriter.h"
+#include "Timelapse.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace Acute;
+
+namespace {
+
+void printUsage() {
+    std::cout << "Usage: acute-timelapse FILE [options]" << std::endl;
+    std::cout << "  (no options)       Print the records, their size and the recording's length" << std::endl;
+    std::cout << "  --frames DIR       Write DIR/frame_00000.png, ... one per snapshot" << std::endl;
+    std::cout << "  --every SEC        With --frames: one frame per SEC of recorded time instead" << std::endl;
+    std::cout << "  --from SEC         Start at the keyframe before SEC" << std::endl;
+    std::cout << "  --downscale N      Shrink frames N times (box filter)" << std::endl;
+}
+
+// Premultiplied canvas to a straight alpha image, shrunk by a box filter
+void convertFrame(const TimelapseReader& reader, int downscale, std::vector<uint8_t>& rgba, int& width,
+                  int& height) {
+    width = std::max(1, reader.getWidth() / downscale);
+    height = std::max(1, reader.getHeight() / downscale);
+    rgba.resize(static_cast<size_t>(width) * height * 4);
+    const uint8_t* pixels = reader.getPixels();
+    const size_t stride = static_cast<size_t>(reader.getWidth()) * 4;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint32_t sum[4] = { 0, 0, 0, 0 };
+            int count = 0;
+            for (int sy = y * downscale; sy < std::min(reader.getHeight(), (y + 1) * downscale); sy++) {
+                const uint8_t* p = pixels + sy * stride + static_cast<size_t>(x) * downscale * 4;
+                for (int sx = x * downscale; sx < std::min(reader.getWidth(), (x + 1) * downscale); sx++, p += 4) {
+                    sum[0] += p[0];
+                    sum[1] += p[1];
+                    sum[2] += p[2];
+                    sum[3] += p[3];
+                    count++;
+                }
+            }
+            uint8_t* out = &rgba[(static_cast<size_t>(y) * width + x) * 4];
+            uint32_t alpha = (sum[3] + count / 2) / count;
+            for (int c = 0; c < 3; c++) {
+                out[c] = sum[3] ? static_cast<uint8_t>(std::min<uint32_t>(255, (sum[c] * 255 + sum[3] / 2) / sum[3]))
+                                : 0;
+            }
+            out[3] = static_cast<uint8_t>(alpha);
+        }
+    }
+}
+
+bool writeFrame(const std::string& directory, int number, const TimelapseReader& reader, int downscale,
+                std::vector<uint8_t>& rgba) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "frame_%05d.png", number);
+    int width, height;
+    convertFrame(reader, downscale, rgba, width, height);
+    std::string path = directory + "/" + name;
+    if (!writePng(path, rgba.data(), width, height)) {
+        std::cerr << "Failed to write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || argv[1][0] == '-') {
+        printUsage();
+        return 1;
+    }
+    std::string path = argv[1];
+    std::string framesDirectory;
+    double every = 0.0, from = 0.0;
+    int downscale = 1;
+    for (int i = 2; i < argc; i++) {
+        if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            framesDirectory = argv[++i];
+        } else if (std::strcmp(argv[i], "--every") == 0 && i + 1 < argc) {
+            every = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+            from = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--downscale") == 0 && i + 1 < argc) {
+            downscale = std::max(1, std::atoi(argv[++i]));
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+    
+    TimelapseReader reader;
+    if (!reader.open(path)) {
+        return 1;
+    }
+    if (from > 0.0 && !reader.seek(static_cast<uint64_t>(from * 1000.0))) {
+        std::cerr << "No keyframe before " << from << " s" << std::endl;
+        return 1;
+    }
+    
+    // Info: walk the records
+    if (framesDirectory.empty()) {
+        size_t records = 0, keyframes = 0, tiles = 0;
+        int width = 0, height = 0;
+        uint64_t duration = 0;
+        while (reader.next()) {
+            records++;
+            keyframes += reader.isKeyframe() ? 1 : 0;
+            tiles += reader.getChangedTiles().size();
+            width = reader.getWidth();
+            height = reader.getHeight();
+            duration = reader.getTime();
+        }
+        FILE* file = std::fopen(path.c_str(), "rb");
+        long bytes = 0;
+        if (file) {
+            std::fseek(file, 0, SEEK_END);
+            bytes = std::ftell(file);
+            std::fclose(file);
+        }
+        double hours = duration / 3600000.0;
+        std::cout << path << ": " << width << "x" << height << ", " << records << " snapshots (" << keyframes
+                  << " keyframes), " << tiles << " tiles, " << duration / 1000.0 << " s, " << (bytes >> 10)
+                  << " KiB";
+        if (hours > 0.0) {
+            std::cout << " (" << bytes / hours / (1 << 20) << " MiB per hour)";
+        }
+        std::cout << std::endl;
+        return 0;
+    }
+    
+    // Frames: one per snapshot, or the canvas as it was at each step of
+    // recorded time
+    std::vector<uint8_t> rgba;
+    int frame = 0;
+    if (every <= 0.0) {
+        while (reader.next()) {
+            if (!writeFrame(framesDirectory, frame++, reader, downscale, rgba)) {
+                return 1;
+            }
+        }
+    } else {
+        const uint64_t step = std::max<uint64_t>(1, static_cast<uint64_t>(every * 1000.0));
+        if (from <= 0.0 && !reader.next()) {
+            std::cerr << "Empty time-lapse" << std::endl;
+            return 1;
+        }
+        uint64_t time = reader.getTime(), nextTime;
+        for (;;) {
+            while (reader.peekTime(nextTime) && nextTime <= time) {
+                reader.next();
+            }
+            if (!writeFrame(framesDirectory, frame++, reader, downscale, rgba)) {
+                return 1;
+            }
+            if (!reader.peekTime(nextTime)) {
+                break;
+            }
+            time += step;
+        }
+    }
+    std::cout << "Wrote " << frame << " frames to " << framesDirectory << std::endl;
+    return 0;
+}